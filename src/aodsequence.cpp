@@ -0,0 +1,212 @@
+#include <stdexcept>
+
+#include "aodsequence.h"
+#include "dds.h"
+
+#define WRITES_PER_TARGET 8     // 48 bit frequency tuning word + 16 bit OSK multiplier
+#define SAMPLES_PER_WRITE 4     // see DDS::write8()
+#define DDS_CHANNELS 3          // control, data, data2
+
+
+AODSequence::AODSequence()
+{
+}
+
+QVector<AODTarget> AODSequence::getTargets() const
+{
+    return targets;
+}
+
+void AODSequence::setTargets(const QVector<AODTarget> &value)
+{
+    if (value == targets) {
+        return;  // keep compiled chunks
+    }
+    targets = value;
+    chunks.clear();
+}
+
+int AODSequence::size() const
+{
+    return targets.size();
+}
+
+bool AODSequence::isEmpty() const
+{
+    return targets.isEmpty();
+}
+
+/**
+ * @brief Duration of one pass through all the targets (s).
+ */
+
+double AODSequence::getPeriod() const
+{
+    double period = 0;
+    for (const AODTarget &t : targets) {
+        period += t.dwell;
+    }
+    return period;
+}
+
+/**
+ * @brief Shortest dwell time (s) that leaves enough time to load the next target.
+ */
+
+double AODSequence::getMinDwell() const
+{
+    return 1.1 * samplesPerChunk() / AOD_SEQUENCE_SAMP_CLOCK_RATE + AOD_UDCLK_HIGH_TIME;
+}
+
+/**
+ * @brief Number of DDS samples per channel needed to load one target.
+ */
+
+int AODSequence::samplesPerChunk() const
+{
+    return WRITES_PER_TARGET * SAMPLES_PER_WRITE;
+}
+
+/**
+ * @brief Load the first target immediately, with the output turned off until the next UDCLK.
+ *
+ * The DDS must be in DDS::WRITE_MODE_TO_NI_TASK.
+ */
+
+void AODSequence::writeFirstTarget(DDS *dds) const
+{
+    if (targets.isEmpty()) {
+        return;
+    }
+    const QPair<double, double> f = toFrequencies(targets.first().point);
+    dds->setFrequency1(f.first, f.second);
+    dds->setOSKI(0, 0); // turn off
+    dds->udclkPulse();
+    const quint16 osk = toOSK(targets.first().amplitude);
+    dds->setOSKI(osk, osk); // turn on (at next UDCLK)
+}
+
+/**
+ * @brief Fill the DDS buffer with the targets to be loaded after each UDCLK edge.
+ * @param dds
+ * @param nCycles Passes through the sequence
+ *
+ * The first target is loaded by writeFirstTarget(). After the edge of the k-th target, the
+ * (k + 1)-th is loaded; after the last target of the last cycle the output is turned off. Register
+ * writes of each target are computed only once and cached until the targets or the DDS system
+ * clock change. Leaves the DDS in DDS::WRITE_MODE_TO_BUFFER.
+ */
+
+void AODSequence::compile(DDS *dds, int nCycles)
+{
+    if (chunks.isEmpty() || dds->getSystemClock() != chunksSystemClock) {
+        compileChunks(dds);
+    }
+    dds->setWriteMode(DDS::WRITE_MODE_TO_BUFFER);
+
+    const int K = targets.size();
+    const int N = nCycles * K;
+    const QVector<uInt32> &off = chunks.last();
+
+    dds->clearBuffer();
+    dds->reserveBuffer((N + 1) * off.size());
+    for (int j = 0; j < N - 1; ++j) {
+        dds->appendToBuffer(chunks.at((j + 1) % K));
+    }
+    // the last UDCLK edge retriggers the sample clock too, hence twice
+    dds->appendToBuffer(off);
+    dds->appendToBuffer(off);
+}
+
+/**
+ * @brief Times of the UDCLK pulse train, as counter output samples.
+ * @param nCycles
+ * @param startDelay Seconds from the start trigger to the first target
+ * @param highTime
+ * @param lowTime Output before the corresponding high time
+ *
+ * One pulse per target, plus a final one turning the output off.
+ */
+
+void AODSequence::udclkTimes(int nCycles, double startDelay,
+                             QVector<double> &highTime, QVector<double> &lowTime) const
+{
+    const int K = targets.size();
+    const int N = nCycles * K;
+    highTime.fill(AOD_UDCLK_HIGH_TIME, N + 1);
+    lowTime.resize(N + 1);
+    lowTime[0] = startDelay;
+    for (int j = 1; j <= N; ++j) {
+        lowTime[j] = targets.at((j - 1) % K).dwell - AOD_UDCLK_HIGH_TIME;
+    }
+}
+
+/**
+ * @brief Onset of each target (s).
+ */
+
+QVector<double> AODSequence::onsets(int nCycles, double startDelay) const
+{
+    QVector<double> ret;
+    ret.reserve(nCycles * targets.size());
+    double t = startDelay;
+    for (int c = 0; c < nCycles; ++c) {
+        for (const AODTarget &target : targets) {
+            ret << t;
+            t += target.dwell;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief DDS frequencies (MHz) that deflect the beam to the given point of the camera image.
+ */
+
+QPair<double, double> AODSequence::toFrequencies(const QPointF &point)
+{
+    return qMakePair(MHZ_CENTRAL - (point.y() - 256) * MHZ_PER_PIXEL,
+                     MHZ_CENTRAL - (point.x() - 256) * MHZ_PER_PIXEL);
+}
+
+quint16 AODSequence::toOSK(double amplitude)
+{
+    return static_cast<quint16>(qRound(qBound(0., amplitude, 1.) * MAX_POWER));
+}
+
+void AODSequence::writeTarget(DDS *dds, const QPointF &point, double amplitude) const
+{
+    const QPair<double, double> f = toFrequencies(point);
+    dds->setFrequency1(f.first, f.second);
+    const quint16 osk = toOSK(amplitude);
+    dds->setOSKI(osk, osk);
+}
+
+void AODSequence::compileChunks(DDS *dds)
+{
+    if (targets.isEmpty()) {
+        throw std::runtime_error("No AOD targets");
+    }
+
+    chunks.clear();
+    chunks.reserve(targets.size() + 1);
+    dds->setWriteMode(DDS::WRITE_MODE_TO_BUFFER);
+    for (const AODTarget &t : targets) {
+        dds->clearBuffer();
+        writeTarget(dds, t.point, t.amplitude);
+        chunks << dds->getBuffer();
+    }
+    dds->clearBuffer();
+    writeTarget(dds, targets.first().point, 0);
+    chunks << dds->getBuffer();
+    dds->clearBuffer();
+
+    // all chunks are clocked out by the same number of sample clock ticks
+    for (const QVector<uInt32> &c : chunks) {
+        if (c.size() != samplesPerChunk() * DDS_CHANNELS) {
+            chunks.clear();
+            throw std::runtime_error("Unexpected DDS chunk size");
+        }
+    }
+    chunksSystemClock = dds->getSystemClock();
+}
@@ -0,0 +1,75 @@
+#ifndef AODSEQUENCE_H
+#define AODSEQUENCE_H
+
+#include <QPair>
+#include <QPointF>
+#include <QVector>
+
+#include <qtlab/hw/ni/nitask.h>
+
+#define MHZ_PER_PIXEL 0.151
+#define MHZ_CENTRAL 95.0
+#define MAX_POWER 3546
+
+#define AOD_SEQUENCE_SAMP_CLOCK_RATE 1e6  // Hz, DDS writes while playing a sequence
+#define AOD_UDCLK_HIGH_TIME 1e-6          // s
+
+class DDS;
+
+struct AODTarget
+{
+    QPointF point;          //!< pixels
+    double dwell = 1e-3;    //!< s
+    double amplitude = 1;   //!< fraction of MAX_POWER
+};
+
+inline bool operator==(const AODTarget &a, const AODTarget &b)
+{
+    return a.point == b.point && a.dwell == b.dwell && a.amplitude == b.amplitude;
+}
+
+/**
+ * @brief Sequence of AOD targets played from precomputed DDS register writes.
+ *
+ * Each target is one chunk of DDS samples (frequency tuning words of both axes and amplitude),
+ * all chunks having the same length. The chunks of a whole stimulation are written to the DDS
+ * buffer once, then clocked out by a retriggerable sample clock started by every UDCLK edge, so
+ * that the registers for the next target are loaded while the current one is being held. Each
+ * UDCLK edge makes the loaded target effective, hopping happens without software in the loop.
+ */
+
+class AODSequence
+{
+public:
+    AODSequence();
+
+    QVector<AODTarget> getTargets() const;
+    void setTargets(const QVector<AODTarget> &value);
+    int size() const;
+    bool isEmpty() const;
+
+    double getPeriod() const;
+    double getMinDwell() const;
+    int samplesPerChunk() const;
+
+    void writeFirstTarget(DDS *dds) const;
+    void compile(DDS *dds, int nCycles);
+    void udclkTimes(int nCycles, double startDelay,
+                    QVector<double> &highTime, QVector<double> &lowTime) const;
+    QVector<double> onsets(int nCycles, double startDelay) const;
+
+    static QPair<double, double> toFrequencies(const QPointF &point);
+    static quint16 toOSK(double amplitude);
+
+private:
+    void writeTarget(DDS *dds, const QPointF &point, double amplitude) const;
+    void compileChunks(DDS *dds);
+
+    QVector<AODTarget> targets;
+
+    // DDS samples (GroupByScanNumber) for each target, then one turning the output off
+    QVector<QVector<uInt32>> chunks;
+    double chunksSystemClock = 0;
+};
+
+#endif // AODSEQUENCE_H
@@ -1,23 +1,84 @@
+#include <stdexcept>
+
 #include <QImage>
 #include <QElapsedTimer>
+#include <QtMath>
 
 #include <Spinnaker.h>
-#include <SpinVideo.h>
 
 #include <qtlab/core/logmanager.h>
 
 #include "behavworker.h"
 #include "chameleoncamera.h"
+#include "synctable.h"
+#include "videoencoder.h"
 
 using namespace Spinnaker;
 
 static Logger *logger = logManager().getLogger("BehavDispWorker");
 
+#define PREVIEW_POOL_SIZE 3
+#define PREVIEW_MAX_FACTOR 16  // so that box sums fit in 16 bit accumulators
+
+/**
+ * @brief Box filter downscaling of a grayscale image by an integer factor.
+ * @param src
+ * @param stride Bytes per source row
+ * @param factor
+ * @param dst Output image (Format_Grayscale8), its size determines the source area used
+ * @param acc Row accumulator, resized as needed
+ *
+ * Rows are summed into a 16 bit accumulator with plain contiguous loops, so that the compiler
+ * vectorizes them; the horizontal pass then averages factor consecutive sums.
+ */
+
+static void boxDownscale(const uchar *src, int stride, int factor, QImage &dst,
+                         QVector<quint16> &acc)
+{
+    const int outW = dst.width();
+    const int outH = dst.height();
+    const int srcW = outW * factor;
+
+    if (factor == 1) {
+        for (int y = 0; y < outH; ++y) {
+            memcpy(dst.scanLine(y), src + y * stride, outW);
+        }
+        return;
+    }
+
+    acc.resize(srcW);
+    quint16 *a = acc.data();
+    const quint32 area = factor * factor;
+
+    for (int y = 0; y < outH; ++y) {
+        const uchar *row = src + y * factor * stride;
+        for (int x = 0; x < srcW; ++x) {
+            a[x] = row[x];
+        }
+        for (int r = 1; r < factor; ++r) {
+            row += stride;
+            for (int x = 0; x < srcW; ++x) {
+                a[x] += row[x];
+            }
+        }
+
+        uchar *out = dst.scanLine(y);
+        for (int x = 0; x < outW; ++x) {
+            quint32 sum = 0;
+            for (int k = 0; k < factor; ++k) {
+                sum += a[x * factor + k];
+            }
+            out[x] = static_cast<uchar>((sum + area / 2) / area);  // rounded mean
+        }
+    }
+}
+
 
 BehavWorker::BehavWorker(ChameleonCamera *camera,
                          QObject *parent) : QObject(parent)
 {
     this->camera = camera;
+    encoder = new VideoEncoder(this);
 
     connect(camera, &ChameleonCamera::acquisitionStarted, this, &BehavWorker::start);
     connect(camera, &ChameleonCamera::acquisitionStopped, this, [ = ](){
@@ -28,21 +89,43 @@ BehavWorker::BehavWorker(ChameleonCamera *camera,
 void BehavWorker::start()
 {
     stop = false;
-    QImage qimg(camera->imageSize(), QImage::Format_Indexed8);
-    for (int i = 0; i < 256; ++i)  // populate index
-        qimg.setColor(i, qRgb(i, i, i));
+    const QSize imageSize = camera->imageSize();
+    allocatePreviewPool(imageSize);
 
-    Video::SpinVideo video;
-    video.SetMaximumFileSize(0);
+    const bool eventWindows = saveToFileEnabled && recordingMode == RECORDING_EVENT_WINDOWS;
 
     if (saveToFileEnabled) {
-        Video::H264Option option;
-        option.frameRate = 25;
-        option.bitrate = 1000000;
-        option.width = static_cast<unsigned int>(qimg.width());
-        option.height = static_cast<unsigned int>(qimg.height());
+        try {
+            encoder->open(outputFile, imageSize.width(), imageSize.height());
+            if (eventWindows) {
+                eventWindowRecorder.start(encoder, encoder->getFrameRate());
+            }
+        }
+        catch (Spinnaker::Exception e) {
+            logger->critical(e.what());
+            emit captureCompleted(false);
+            return;
+        }
 
-        video.Open(outputFile.toStdString().c_str(), option);
+        frameLog.setExpectedPeriod(1. / encoder->getFrameRate());
+        try {
+            frameLog.open(outputFile + "_behav_frames.bin");
+        } catch (std::runtime_error e) {
+            logger->warning(e.what());
+        }
+    }
+
+    motionEnergy.reset();
+    // the time series is only needed to be saved
+    motionEnergy.setRecordingEnabled(saveToFileEnabled);
+    motionBatch.clear();
+    pupilTracker.reset();
+    if (saveToFileEnabled && pupilTrackingEnabled) {
+        try {
+            pupilTracker.open(outputFile + "_pupil.dat");
+        } catch (std::runtime_error e) {
+            logger->critical(e.what());
+        }
     }
 
     QElapsedTimer timer;
@@ -63,35 +146,339 @@ void BehavWorker::start()
             continue;
 
         if (saveToFileEnabled) {
-            video.Append(img);
+            double hostTime = syncTable ? syncTable->hostTime() : 0;
+            quint64 timestamp = img->GetTimeStamp();
+            frameLog.append(img->GetFrameID(), timestamp, hostTime);
+            if (syncTable) {
+                // by hardware frame ID, so that lost frames do not skew the drift fit
+                syncTable->addClockPoint(SyncTable::STREAM_BEHAVIOR,
+                                         frameLog.getLastFrameIndex(), timestamp * 1e-9);
+            }
         }
 
         i++;
 
+        const uchar *data = static_cast<const uchar *>(img->GetData());
+        const int width = static_cast<int>(img->GetWidth());
+        const int height = static_cast<int>(img->GetHeight());
+
+        if (motionEnergyEnabled) {
+            motionEnergy.process(data, width, height, static_cast<int>(img->GetStride()));
+            // only the first ROI is plotted
+            const QVector<double> &values = motionEnergy.getLastValues();
+            if (!values.isEmpty()) {
+                motionBatch.append(values.first());
+            }
+        }
+
+        if (pupilTrackingEnabled) {
+            pupilTracker.submit(data, width, height, static_cast<int>(img->GetStride()));
+        }
+
         if (timer.elapsed() >= 40) {  // no more than 25 fps
-            memcpy(qimg.bits(), img->GetData(), img->GetBufferSize());
-            emit newImage(QPixmap::fromImage(qimg));
+            updatePreview(data, width, height, static_cast<int>(img->GetStride()));
+            if (!motionBatch.isEmpty()) {
+                emit newMotionEnergy(motionBatch);
+                motionBatch.clear();
+            }
+            if (pupilTrackingEnabled) {
+                QVector<double> areas = pupilTracker.takeCompleted();
+                if (!areas.isEmpty()) {
+                    emit newPupilArea(areas);
+                }
+            }
             timer.restart();
         }
-        img->Release();
+
+        if (eventWindows) {
+            eventWindowRecorder.process(frameLog.getLastFrameIndex(), img);
+        } else if (saveToFileEnabled) {
+            encoder->push(img, frameLog.getLastFrameIndex());  // released by the encoder
+        } else {
+            img->Release();
+        }
     }
 
-    emit captureCompleted(i == frameCount);
+    pupilTracker.waitForDone();
 
-    if (saveToFileEnabled) {
-        QString msg = QString("Saved %1/%2 frames").arg(i).arg(frameCount);
-        if (i != frameCount) {
-            logger->warning(msg);
-        } else {
-            logger->info(msg);
+    if (!saveToFileEnabled) {
+        emit captureCompleted(i == frameCount);
+        return;
+    }
+
+    encoder->finish();
+    frameLog.setVideoFrames(encoder->getEncodedFrameIndices());
+    frameLog.close();
+
+    if (eventWindows) {
+        eventWindowRecorder.stop();
+        try {
+            eventWindowRecorder.saveSegments(outputFile + "_windows.dat");
+        } catch (std::runtime_error e) {
+            logger->critical(e.what());
         }
+    }
+
+    if (motionEnergyEnabled) {
         try {
-            video.Close();
+            motionEnergy.saveToFile(outputFile + "_motion.dat");
+        } catch (std::runtime_error e) {
+            logger->critical(e.what());
         }
-        catch (Spinnaker::Exception e) {
-            logger->warning(e.what());
+    }
+
+    if (pupilTrackingEnabled) {
+        if (pupilTracker.getSkippedFrames() != 0) {
+            logger->warning(QString("%1: pupil tracking skipped %2 frames")
+                            .arg(name).arg(pupilTracker.getSkippedFrames()));
+        }
+    }
+    pupilTracker.close();
+
+    size_t encoded = encoder->getEncodedFrames();
+    size_t expected = frameCount;
+    if (eventWindows) {
+        expected = 0;
+        for (const EventWindowRecorder::Segment &s : eventWindowRecorder.getSegments()) {
+            expected += s.second - s.first + 1;
+        }
+        logger->info(QString("%1: %2 event windows")
+                     .arg(name).arg(eventWindowRecorder.getSegments().size()));
+    }
+    QString msg = QString("%1: saved %2/%3 frames (grabbed %4, dropped %5), encoder queue depth: "
+                          "max %6/%7, mean %8")
+                  .arg(name).arg(encoded).arg(expected).arg(i)
+                  .arg(encoder->getDroppedFrames())
+                  .arg(encoder->getMaxQueueDepth())
+                  .arg(encoder->getQueueCapacity())
+                  .arg(encoder->getMeanQueueDepth(), 0, 'f', 1);
+    if (encoded != expected) {
+        logger->warning(msg);
+    } else {
+        logger->info(msg);
+    }
+
+    msg = QString("%1 frames: %2").arg(name).arg(frameLog.summary());
+    if (frameLog.getMissingFrames() != 0 || frameLog.getFrameIDResets() != 0) {
+        logger->warning(msg);
+    } else {
+        logger->info(msg);
+    }
+
+    double throughput = encoder->getEncodeThroughput();
+    msg = QString("%1: %2 encoder throughput: %3 fps (%4 MB/s), acquisition rate %5 fps")
+          .arg(name)
+          .arg(VideoEncoder::codecName(encoder->getCodec()))
+          .arg(throughput, 0, 'f', 1)
+          .arg(throughput * imageSize.width() * imageSize.height() * 1e-6, 0, 'f', 1)
+          .arg(encoder->getFrameRate());
+    if (throughput < encoder->getFrameRate()) {
+        logger->warning(msg);
+    } else {
+        logger->info(msg);
+    }
+
+    emit captureCompleted(encoded == expected && i == frameCount);
+}
+
+VideoEncoder *BehavWorker::getEncoder() const
+{
+    return encoder;
+}
+
+/**
+ * @brief Event windows used when the recording mode is RECORDING_EVENT_WINDOWS.
+ */
+
+EventWindowRecorder *BehavWorker::getEventWindowRecorder()
+{
+    return &eventWindowRecorder;
+}
+
+/**
+ * @brief Frame IDs and timestamps of the last saved run.
+ */
+
+const FrameLog *BehavWorker::getFrameLog() const
+{
+    return &frameLog;
+}
+
+/**
+ * @brief (Re)allocate the preview images for the given camera image size and the current preview
+ * size.
+ *
+ * The downscaling factor is the largest integer factor that keeps the preview at least as large as
+ * it is displayed (aspect ratio preserved, in either orientation), so that the widget never has to
+ * upscale.
+ */
+
+void BehavWorker::allocatePreviewPool(const QSize &imageSize)
+{
+    QSize target = getPreviewSize();
+    int factor = 1;
+    if (target.width() > 0 && target.height() > 0) {
+        const double w = imageSize.width(), h = imageSize.height();
+        double f = qMax(w / target.width(), h / target.height());
+        double fRotated = qMax(w / target.height(), h / target.width());
+        factor = qFloor(qMin(f, fRotated));
+    }
+    factor = qBound(1, factor, PREVIEW_MAX_FACTOR);
+
+    QSize size(imageSize.width() / factor, imageSize.height() / factor);
+    if (size == pooledPreviewSize && factor == previewFactor
+        && previewPool.size() == PREVIEW_POOL_SIZE) {
+        return;
+    }
+
+    previewPool.clear();
+    for (int i = 0; i < PREVIEW_POOL_SIZE; ++i) {
+        previewPool.append(QImage(size, QImage::Format_Grayscale8));
+    }
+    pooledPreviewSize = size;
+    previewFactor = factor;
+}
+
+/**
+ * @brief A pool image that is not referenced by the GUI anymore, nullptr if all are in use.
+ *
+ * Images are implicitly shared: an image is in use as long as a copy of it is queued or being
+ * displayed, and writing to it would trigger a deep copy.
+ */
+
+QImage *BehavWorker::nextPreviewImage()
+{
+    for (QImage &img : previewPool) {
+        if (img.isDetached()) {
+            return &img;
         }
     }
+    return nullptr;
+}
+
+void BehavWorker::updatePreview(const uchar *data, int width, int height, int stride)
+{
+    allocatePreviewPool(QSize(width, height));
+    QImage *img = nextPreviewImage();
+    if (!img) {
+        return;  // GUI is lagging behind, skip this preview
+    }
+    boxDownscale(data, stride, previewFactor, *img, previewAcc);
+    emit newImage(*img);
+}
+
+bool BehavWorker::isMotionEnergyEnabled() const
+{
+    return motionEnergyEnabled;
+}
+
+/**
+ * @brief Compute motion energy of each frame over the ROIs of getMotionEnergy().
+ *
+ * The time series is plotted live through newMotionEnergy() (first ROI only) and saved as
+ * <run>_motion.dat.
+ */
+
+void BehavWorker::setMotionEnergyEnabled(bool value)
+{
+    motionEnergyEnabled = value;
+}
+
+MotionEnergy *BehavWorker::getMotionEnergy()
+{
+    return &motionEnergy;
+}
+
+bool BehavWorker::isPupilTrackingEnabled() const
+{
+    return pupilTrackingEnabled;
+}
+
+/**
+ * @brief Estimate pupil size on each frame (see PupilTracker).
+ *
+ * The pupil area is plotted live through newPupilArea() and saved as <run>_pupil.dat.
+ */
+
+void BehavWorker::setPupilTrackingEnabled(bool value)
+{
+    pupilTrackingEnabled = value;
+}
+
+PupilTracker *BehavWorker::getPupilTracker()
+{
+    return &pupilTracker;
+}
+
+BehavWorker::RECORDING_MODE BehavWorker::getRecordingMode() const
+{
+    return recordingMode;
+}
+
+/**
+ * @brief Save every frame, or only the frames around events (see EventWindowRecorder).
+ *
+ * In event window mode the frames left out are not encoded at all; frame log, motion energy and
+ * pupil size still cover the whole run.
+ */
+
+void BehavWorker::setRecordingMode(const RECORDING_MODE &value)
+{
+    recordingMode = value;
+}
+
+/**
+ * @brief Save a window around the given time. Thread safe.
+ * @param commonTime s, see SyncTable
+ */
+
+void BehavWorker::addEvent(double commonTime)
+{
+    eventWindowRecorder.addEvent(commonTime);
+}
+
+/**
+ * @brief Save a window around the current frame. Thread safe.
+ */
+
+void BehavWorker::markEvent()
+{
+    eventWindowRecorder.markEvent();
+}
+
+QSize BehavWorker::getPreviewSize() const
+{
+    QMutexLocker locker(&previewMutex);
+    return previewSize;
+}
+
+/**
+ * @brief Size of the widget displaying the preview. Thread safe.
+ */
+
+void BehavWorker::setPreviewSize(const QSize &value)
+{
+    QMutexLocker locker(&previewMutex);
+    previewSize = value;
+}
+
+QString BehavWorker::getName() const
+{
+    return name;
+}
+
+/**
+ * @brief Name of the camera, used in log messages.
+ */
+
+void BehavWorker::setName(const QString &value)
+{
+    name = value;
+}
+
+void BehavWorker::setSyncTable(SyncTable *value)
+{
+    syncTable = value;
 }
 
 void BehavWorker::setFrameCount(int value)
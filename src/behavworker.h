@@ -1,15 +1,29 @@
 #ifndef BEHAVWORKER_H
 #define BEHAVWORKER_H
 
-#include <QPixmap>
+#include <QImage>
+#include <QMutex>
+#include <QVector>
+
+#include "eventwindowrecorder.h"
+#include "framelog.h"
+#include "motionenergy.h"
+#include "pupiltracker.h"
 
 class ChameleonCamera;
+class SyncTable;
+class VideoEncoder;
 
 
 class BehavWorker : public QObject
 {
     Q_OBJECT
 public:
+    enum RECORDING_MODE {
+        RECORDING_CONTINUOUS,
+        RECORDING_EVENT_WINDOWS,
+    };
+
     explicit BehavWorker(ChameleonCamera *camera, QObject *parent = nullptr);
 
     void setSaveToFileEnabled(bool value);
@@ -18,16 +32,67 @@ public:
 
     void setFrameCount(int value);
 
+    void setSyncTable(SyncTable *value);
+
+    QString getName() const;
+    void setName(const QString &value);
+
+    VideoEncoder *getEncoder() const;
+    EventWindowRecorder *getEventWindowRecorder();
+    const FrameLog *getFrameLog() const;
+
+    QSize getPreviewSize() const;
+    void setPreviewSize(const QSize &value);
+
+    bool isMotionEnergyEnabled() const;
+    void setMotionEnergyEnabled(bool value);
+    MotionEnergy *getMotionEnergy();
+
+    bool isPupilTrackingEnabled() const;
+    void setPupilTrackingEnabled(bool value);
+    PupilTracker *getPupilTracker();
+
+    RECORDING_MODE getRecordingMode() const;
+    void setRecordingMode(const RECORDING_MODE &value);
+
+public slots:
+    void addEvent(double commonTime);
+    void markEvent();
+
 signals:
-    void newImage(const QPixmap &pm);
+    void newImage(const QImage &img);
+    void newMotionEnergy(const QVector<double> &values);
+    void newPupilArea(const QVector<double> &values);
     void captureCompleted(bool ok);
 
 private:
     void start();
+    void allocatePreviewPool(const QSize &imageSize);
+    QImage *nextPreviewImage();
+    void updatePreview(const uchar *data, int width, int height, int stride);
+
     ChameleonCamera *camera;
+    SyncTable *syncTable = nullptr;
+    VideoEncoder *encoder;
+    EventWindowRecorder eventWindowRecorder;
+    RECORDING_MODE recordingMode = RECORDING_CONTINUOUS;
+    FrameLog frameLog;
+    MotionEnergy motionEnergy;
+    bool motionEnergyEnabled = false;
+    QVector<double> motionBatch;
+    PupilTracker pupilTracker;
+    bool pupilTrackingEnabled = false;
     QString outputFile;
+    QString name = "Behavior";
     bool stop, saveToFileEnabled = false;
     size_t frameCount;
+
+    mutable QMutex previewMutex;
+    QSize previewSize = QSize(640, 512);
+    QSize pooledPreviewSize;
+    int previewFactor = 1;
+    QVector<QImage> previewPool;
+    QVector<quint16> previewAcc;
 };
 
 #endif // BEHAVWORKER_H
@@ -80,9 +80,13 @@ CamDisplay::CamDisplay(QWidget *parent) : CameraDisplay(parent)
     menu->addAction(clearMarkersAction);
 }
 
+/**
+ * @brief Add a marker, clearing the existing ones if there are already getMaxPoints().
+ */
+
 void CamDisplay::addPoint(const QPointF &p)
 {
-    if (points.size() == 1) {
+    if (points.size() >= maxPoints) {
         clearMarkers();
     }
     QwtPlotMarker *marker = new QwtPlotMarker();
@@ -95,6 +99,10 @@ void CamDisplay::addPoint(const QPointF &p)
     marker->setLineStyle((QwtPlotMarker::LineStyle)(QwtPlotMarker::NoLine));
     marker->setValue(p);
     marker->setLabelAlignment((Qt::Alignment) (Qt::AlignLeft | Qt::AlignTop));
+    if (maxPoints > 1) {
+        // sequence order
+        marker->setLabel(QwtText(QString::number(points.size() + 1)));
+    }
     marker->attach(plot);
     plot->replot();
 
@@ -107,6 +115,31 @@ QVector<QPointF> CamDisplay::getPoints() const
     return points;
 }
 
+void CamDisplay::setPoints(const QVector<QPointF> &value)
+{
+    clearMarkers();
+    for (const QPointF &p : value) {
+        addPoint(p);
+    }
+}
+
+int CamDisplay::getMaxPoints() const
+{
+    return maxPoints;
+}
+
+/**
+ * @brief Maximum number of markers (1 by default, for single point AOD stimulation).
+ */
+
+void CamDisplay::setMaxPoints(int value)
+{
+    maxPoints = qMax(1, value);
+    if (points.size() > maxPoints) {
+        clearMarkers();
+    }
+}
+
 void CamDisplay::clearMarkers()
 {
     points.clear();
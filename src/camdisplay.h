@@ -11,10 +11,15 @@ public:
 
     void addPoint(const QPointF &p);
     QVector<QPointF> getPoints() const;
+    void setPoints(const QVector<QPointF> &value);
+
+    int getMaxPoints() const;
+    void setMaxPoints(int value);
 
 private:
     QVector<QPointF> points;
     QVector<QwtPlotMarker *> markers;
+    int maxPoints = 1;
 
     void clearMarkers();
 };
@@ -36,6 +36,18 @@ void ChameleonCamera::open(uint index)
     pCam->Init();
 }
 
+void ChameleonCamera::open(const QString &serialNumber)
+{
+    CameraList camList = sys->GetCameras();
+    pCam = camList.GetBySerial(serialNumber.toStdString());
+    camList.Clear();
+    if (!pCam.IsValid()) {
+        throw std::runtime_error(QString("No camera with serial number %1")
+                                 .arg(serialNumber).toStdString());
+    }
+    pCam->Init();
+}
+
 void ChameleonCamera::logDeviceInfo()
 {
     FeatureList_t features;
@@ -102,6 +114,45 @@ bool ChameleonCamera::isValid()
     return pCam.IsValid();
 }
 
+/**
+ * @brief Set the number of stream buffers, i.e. the number of frames that can be held by the
+ * application (e.g. waiting to be encoded) before the camera starts dropping frames.
+ * @param count Clamped to the maximum allowed by the device
+ *
+ * Has effect at the next startAcquisition().
+ */
+
+void ChameleonCamera::setStreamBufferCount(int count)
+{
+    if (!pCam.IsValid()) {
+        return;
+    }
+    INodeMap &sNodeMap = pCam->GetTLStreamNodeMap();
+
+    // deliver frames in order, never overwrite a frame that has not been retrieved
+    CEnumerationPtr handlingMode = sNodeMap.GetNode("StreamBufferHandlingMode");
+    if (IsAvailable(handlingMode) && IsWritable(handlingMode)) {
+        handlingMode->SetIntValue(handlingMode->GetEntryByName("OldestFirst")->GetValue());
+    }
+
+    CEnumerationPtr countMode = sNodeMap.GetNode("StreamBufferCountMode");
+    if (IsAvailable(countMode) && IsWritable(countMode)) {
+        countMode->SetIntValue(countMode->GetEntryByName("Manual")->GetValue());
+    }
+
+    CIntegerPtr bufferCount = sNodeMap.GetNode("StreamBufferCountManual");
+    if (!IsAvailable(bufferCount) || !IsWritable(bufferCount)) {
+        logger->warning("Cannot set stream buffer count");
+        return;
+    }
+    int64_t value = qBound(bufferCount->GetMin(), int64_t(count), bufferCount->GetMax());
+    bufferCount->SetValue(value);
+    if (value < count) {
+        logger->warning(QString("Stream buffer count limited to %1 (requested %2)")
+                        .arg(value).arg(count));
+    }
+}
+
 void ChameleonCamera::setupAcquisitionMode()
 {
     if (!pCam.IsValid()) {
@@ -15,6 +15,7 @@ public:
     virtual ~ChameleonCamera();
 
     void open(uint index);
+    void open(const QString &serialNumber);
     void logDeviceInfo();
     Spinnaker::ImagePtr getNextImage(uint64_t timeout);
     QSize imageSize();
@@ -24,6 +25,8 @@ public:
 
     bool isValid();
 
+    void setStreamBufferCount(int count);
+
 public slots:
     void startAcquisition();
     void stopAcquisition();
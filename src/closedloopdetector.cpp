@@ -0,0 +1,240 @@
+#include <cmath>
+
+#include <QtMath>
+
+#include "closedloopdetector.h"
+
+#define MAX_BAND_FRACTION 0.45  // of the sample rate
+
+
+ClosedLoopDetector::ClosedLoopDetector()
+{
+}
+
+/**
+ * @brief Compute the band-pass coefficients and the window length, and reset the state.
+ * @param sampleRate Hz
+ * @param maxBlockSize Longest block passed to process(), for preallocation
+ */
+
+void ClosedLoopDetector::init(double sampleRate, int maxBlockSize)
+{
+    this->sampleRate = sampleRate;
+
+    // RBJ band-pass (0 dB peak gain) centered on the geometric mean of the band edges
+    const double high = qMin(bandHigh, MAX_BAND_FRACTION * sampleRate);
+    const double low = qBound(1e-3, bandLow, 0.99 * high);
+    const double w0 = 2 * M_PI * std::sqrt(low * high) / sampleRate;
+    const double Q = std::sqrt(low * high) / (high - low);
+    const double alpha = std::sin(w0) / (2 * Q);
+    const double a0 = 1 + alpha;
+    b0 = alpha / a0;
+    b2 = -alpha / a0;
+    a1 = -2 * std::cos(w0) / a0;
+    a2 = (1 - alpha) / a0;
+
+    const int windowSamples = detector == DETECTOR_THRESHOLD
+                              ? 1 : qMax(1, qRound(window * sampleRate));
+    ring.resize(windowSamples);
+    refractorySamples = qRound64(refractoryPeriod * sampleRate);
+    detections.reserve(maxDetections(maxBlockSize));
+
+    reset();
+}
+
+void ClosedLoopDetector::reset()
+{
+    z1 = z2 = 0;
+    ring.fill(0);
+    ringSum = 0;
+    ringPos = 0;
+    ringFill = 0;
+    previous = 0;
+    hasPrevious = false;
+    armed = true;
+    nextAllowed = 0;
+    detections.clear();
+}
+
+/**
+ * @brief Upper bound of the number of events detected in nSamples samples.
+ *
+ * Consecutive events are at least a refractory period apart, and at least two samples apart as
+ * the statistic must go back across the threshold in between.
+ */
+
+qint64 ClosedLoopDetector::maxDetections(qint64 nSamples) const
+{
+    return nSamples / qMax<qint64>(2, refractorySamples) + 1;
+}
+
+/**
+ * @brief Run the detector on a block of samples.
+ * @param in Samples (V)
+ * @param n
+ * @param firstIndex Stream index of the first sample of the block
+ * @return Number of events detected in this block, see getDetections()
+ */
+
+int ClosedLoopDetector::process(const double *in, size_t n, qint64 firstIndex)
+{
+    detections.clear();
+    const bool negative = threshold < 0;
+    for (size_t i = 0; i < n; ++i) {
+        const double v = update(in[i]);
+        if (ringFill < ring.size()) {
+            continue;
+        }
+        const bool above = negative ? v <= threshold : v >= threshold;
+        if (!above) {
+            armed = true;
+            continue;
+        }
+        const qint64 index = firstIndex + static_cast<qint64>(i);
+        if (armed && index >= nextAllowed) {
+            detections.append({index, v});
+            armed = false;
+            nextAllowed = index + refractorySamples;
+        }
+    }
+    return detections.size();
+}
+
+/**
+ * @brief Events detected by the last call to process().
+ */
+
+const QVector<ClosedLoopDetector::Detection> &ClosedLoopDetector::getDetections() const
+{
+    return detections;
+}
+
+double ClosedLoopDetector::update(double x)
+{
+    switch (detector) {
+    case DETECTOR_BAND_POWER: {
+        // transposed direct form II, b1 = 0 for a band-pass
+        const double y = b0 * x + z1;
+        z1 = -a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        push(y * y);
+        return ringSum / ring.size();
+    }
+    case DETECTOR_LINE_LENGTH: {
+        const double d = hasPrevious ? std::abs(x - previous) : 0;
+        previous = x;
+        if (!hasPrevious) {
+            hasPrevious = true;
+            return 0;  // no difference yet, the window is not filled
+        }
+        push(d);
+        return ringSum;
+    }
+    case DETECTOR_THRESHOLD:
+    default:
+        push(x);
+        return x;
+    }
+}
+
+void ClosedLoopDetector::push(double v)
+{
+    ringSum += v - ring[ringPos];
+    ring[ringPos] = v;
+    if (++ringPos == ring.size()) {
+        ringPos = 0;
+        // recompute once per window, so that rounding errors do not accumulate
+        ringSum = 0;
+        for (double r : ring) {
+            ringSum += r;
+        }
+    }
+    ringFill = qMin(ringFill + 1, ring.size());
+}
+
+ClosedLoopDetector::DETECTOR ClosedLoopDetector::getDetector() const
+{
+    return detector;
+}
+
+void ClosedLoopDetector::setDetector(const DETECTOR &value)
+{
+    detector = value;
+}
+
+double ClosedLoopDetector::getThreshold() const
+{
+    return threshold;
+}
+
+/**
+ * @brief Detection threshold, in the units of the statistic (V or V^2).
+ * @param value A negative threshold detects negative-going crossings (threshold detector only).
+ */
+
+void ClosedLoopDetector::setThreshold(double value)
+{
+    threshold = value;
+}
+
+double ClosedLoopDetector::getWindow() const
+{
+    return window;
+}
+
+/**
+ * @brief Window of the band power and line length statistics (s).
+ */
+
+void ClosedLoopDetector::setWindow(double s)
+{
+    window = s;
+}
+
+double ClosedLoopDetector::getBandLow() const
+{
+    return bandLow;
+}
+
+void ClosedLoopDetector::setBandLow(double Hz)
+{
+    bandLow = Hz;
+}
+
+double ClosedLoopDetector::getBandHigh() const
+{
+    return bandHigh;
+}
+
+void ClosedLoopDetector::setBandHigh(double Hz)
+{
+    bandHigh = Hz;
+}
+
+double ClosedLoopDetector::getRefractoryPeriod() const
+{
+    return refractoryPeriod;
+}
+
+/**
+ * @brief Minimum time between two detected events (s).
+ */
+
+void ClosedLoopDetector::setRefractoryPeriod(double s)
+{
+    refractoryPeriod = s;
+}
+
+QString ClosedLoopDetector::detectorName(ClosedLoopDetector::DETECTOR detector)
+{
+    switch (detector) {
+    case DETECTOR_THRESHOLD:
+        return "threshold";
+    case DETECTOR_BAND_POWER:
+        return "band_power";
+    case DETECTOR_LINE_LENGTH:
+        return "line_length";
+    default:
+        return QString();
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef CLOSEDLOOPDETECTOR_H
+#define CLOSEDLOOPDETECTOR_H
+
+#include <QString>
+#include <QVector>
+
+/**
+ * @brief Streaming event detector on the electrode signal, driving closed-loop stimulation.
+ *
+ * A detection statistic is updated sample by sample:
+ * - DETECTOR_THRESHOLD: the signal itself (V);
+ * - DETECTOR_BAND_POWER: mean power over the window (V^2) of the signal band-passed between
+ *   getBandLow() and getBandHigh() (second order);
+ * - DETECTOR_LINE_LENGTH: sum of the absolute differences between consecutive samples over the
+ *   window (V).
+ *
+ * An event is detected when the statistic crosses the threshold (from below, or from above for a
+ * negative threshold): it must go back across the threshold before another event can be
+ * detected, and no event is detected during the refractory period that follows. Windowed
+ * statistics are only compared once the window is full.
+ *
+ * All working buffers are allocated in init(), process() does not allocate while running as long
+ * as blocks are not longer than the maximum block size given to init().
+ */
+
+class ClosedLoopDetector
+{
+public:
+    enum DETECTOR {
+        DETECTOR_THRESHOLD,
+        DETECTOR_BAND_POWER,
+        DETECTOR_LINE_LENGTH,
+    };
+
+    struct Detection {
+        qint64 index;   // sample index in the stream
+        double value;   // statistic at detection
+    };
+
+    ClosedLoopDetector();
+
+    void init(double sampleRate, int maxBlockSize);
+    void reset();
+    qint64 maxDetections(qint64 nSamples) const;
+
+    int process(const double *in, size_t n, qint64 firstIndex);
+    const QVector<Detection> &getDetections() const;
+
+    DETECTOR getDetector() const;
+    void setDetector(const DETECTOR &value);
+
+    double getThreshold() const;
+    void setThreshold(double value);
+
+    double getWindow() const;
+    void setWindow(double s);
+
+    double getBandLow() const;
+    void setBandLow(double Hz);
+
+    double getBandHigh() const;
+    void setBandHigh(double Hz);
+
+    double getRefractoryPeriod() const;
+    void setRefractoryPeriod(double s);
+
+    static QString detectorName(DETECTOR detector);
+
+private:
+    double update(double x);
+    void push(double v);
+
+    DETECTOR detector = DETECTOR_THRESHOLD;
+    double threshold = 1;
+    double window = 0.01;
+    double bandLow = 4;
+    double bandHigh = 12;
+    double refractoryPeriod = 1;
+    double sampleRate = 0;
+
+    // band-pass biquad
+    double b0 = 0, b2 = 0, a1 = 0, a2 = 0;
+    double z1 = 0, z2 = 0;
+
+    // running sum over the window
+    QVector<double> ring;
+    double ringSum = 0;
+    int ringPos = 0;
+    int ringFill = 0;
+
+    double previous = 0;
+    bool hasPrevious = false;
+    bool armed = true;
+    qint64 refractorySamples = 0;
+    qint64 nextAllowed = 0;
+
+    QVector<Detection> detections;
+};
+
+#endif // CLOSEDLOOPDETECTOR_H
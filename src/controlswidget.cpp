@@ -1,4 +1,5 @@
 #include <functional>
+#include <stdexcept>
 
 #include <QPushButton>
 #include <QVBoxLayout>
@@ -23,9 +24,14 @@
 #include "elreadoutworker.h"
 #include "tasks.h"
 #include "dds.h"
+#include "edgerecorder.h"
 #include "chameleoncamera.h"
 #include "savestackworker.h"
 #include "camdisplay.h"
+#include "behavworker.h"
+
+#define MAX_AOD_TARGETS 64
+#include "videoencoder.h"
 
 ControlsWidget::ControlsWidget(QWidget *parent) : QWidget(parent)
 {
@@ -92,6 +98,12 @@ void ControlsWidget::setupUi()
     electrodeSampRateSpinBox->setSuffix("Hz");
     electrodeSampRateSpinBox->setRange(25, 50000);
     electrodeSampRateSpinBox->setValue(t->getElectrodeReadoutRate());
+    QCheckBox *electrodeFilterCheckBox = new QCheckBox("Split LFP / spikes");
+    electrodeFilterCheckBox->setChecked(optrode().getElReadoutWorker()->isFilterEnabled());
+    QCheckBox *electrodeRawCheckBox = new QCheckBox("Raw 16 bit");
+    electrodeRawCheckBox->setChecked(optrode().getElReadoutWorker()->isRawEnabled());
+    QCheckBox *electrodeSpectrumCheckBox = new QCheckBox("Spectrum");
+    electrodeSpectrumCheckBox->setChecked(optrode().getElReadoutWorker()->isSpectrumEnabled());
 
     row = 0;
     grid = new QGridLayout();
@@ -99,6 +111,9 @@ void ControlsWidget::setupUi()
     grid->addWidget(electrodePhysChanComboBox, row++, 1);
     grid->addWidget(new QLabel("Sampling rate"), row, 0);
     grid->addWidget(electrodeSampRateSpinBox, row++, 1);
+    grid->addWidget(electrodeRawCheckBox, row, 0);
+    grid->addWidget(electrodeFilterCheckBox, row++, 1);
+    grid->addWidget(electrodeSpectrumCheckBox, row++, 0);
     QGroupBox *electrodeGb = new QGroupBox("Electrode readout");
     electrodeGb->setCheckable(true);
     electrodeGb->setChecked(t->getElectrodeReadoutEnabled());
@@ -131,18 +146,66 @@ void ControlsWidget::setupUi()
     ddsDevComboBox->setCurrentText(t->getDDS()->getDevName());
 
     QCheckBox *continuousStimulationCheckBox = new QCheckBox("Always on");
-    connect(continuousStimulationCheckBox, &QCheckBox::toggled, [ = ](bool checked){
-        stimulationHighTimeSpinBox->setEnabled(!checked);
-        stimulationLowTimeSpinBox->setEnabled(!checked);
-    });
-
     continuousStimulationCheckBox->setChecked(t->getContinuousStimulation());
 
+    QCheckBox *protocolCheckBox = new QCheckBox("Protocol");
+    protocolCheckBox->setChecked(t->isStimulationProtocolEnabled());
+    protocolCheckBox->setToolTip("Play the pulse train of a protocol file (onset and width "
+                                 "of each pulse, one per line)");
+    QLineEdit *protocolLineEdit = new QLineEdit();
+    protocolLineEdit->setText(t->getStimulationProtocol()->getFileName());
+    QPushButton *protocolPushButton = new QPushButton("...");
+
+    auto updatePulseUi = [ = ](){
+        bool protocol = protocolCheckBox->isChecked();
+        bool pulses = !protocol && !continuousStimulationCheckBox->isChecked();
+        stimulationHighTimeSpinBox->setEnabled(pulses);
+        stimulationLowTimeSpinBox->setEnabled(pulses);
+        continuousStimulationCheckBox->setEnabled(!protocol);
+        protocolLineEdit->setEnabled(protocol);
+        protocolPushButton->setEnabled(protocol);
+    };
+    connect(continuousStimulationCheckBox, &QCheckBox::toggled, this, updatePulseUi);
+    connect(protocolCheckBox, &QCheckBox::toggled, this, updatePulseUi);
+    updatePulseUi();
+
+    connect(protocolPushButton, &QPushButton::clicked, this, [ = ](){
+        QString fileName = QFileDialog::getOpenFileName(
+            nullptr, "Stimulation protocol", protocolLineEdit->text(),
+            "Protocol files (*.txt *.csv);;All files (*)");
+        if (!fileName.isEmpty()) {
+            protocolLineEdit->setText(fileName);
+        }
+    });
+
     QRadioButton *pulseRadio = new QRadioButton("Pulse");
     QRadioButton *aodRadio = new QRadioButton("AOD");
     pulseRadio->setChecked(!t->isAODEnabled());
     aodRadio->setChecked(t->isAODEnabled());
 
+    QCheckBox *aodSequenceCheckBox = new QCheckBox("Target sequence");
+    aodSequenceCheckBox->setChecked(t->isAODSequenceEnabled());
+    aodSequenceCheckBox->setToolTip("Hop between all the markers (SHIFT+click), in order, for "
+                                    "the whole stimulation duration");
+    QDoubleSpinBox *aodDwellSpinBox = new QDoubleSpinBox();
+    aodDwellSpinBox->setSuffix("ms");
+    aodDwellSpinBox->setRange(0.05, 10000);
+    aodDwellSpinBox->setDecimals(3);
+    aodDwellSpinBox->setValue(t->getAODSequence()->isEmpty()
+                              ? 1 : t->getAODSequence()->getTargets().first().dwell * 1e3);
+    aodDwellSpinBox->setToolTip("Dwell time on each target");
+
+    auto updateAODUi = [ = ](){
+        aodSequenceCheckBox->setEnabled(aodRadio->isChecked());
+        aodDwellSpinBox->setEnabled(aodRadio->isChecked() && aodSequenceCheckBox->isChecked());
+        if (camDisplay) {
+            camDisplay->setMaxPoints(aodSequenceCheckBox->isChecked() ? MAX_AOD_TARGETS : 1);
+        }
+    };
+    connect(aodRadio, &QRadioButton::toggled, this, updateAODUi);
+    connect(aodSequenceCheckBox, &QCheckBox::toggled, this, updateAODUi);
+    updateAODUi();
+
     row = 0;
     grid = new QGridLayout();
     grid->addWidget(new QLabel("Terminal"), row, 0);
@@ -154,8 +217,15 @@ void ControlsWidget::setupUi()
     grid->addWidget(stimulationHighTimeSpinBox, row++, 1);
     grid->addWidget(new QLabel("Low time"), row, 0);
     grid->addWidget(stimulationLowTimeSpinBox, row++, 1);
+    QHBoxLayout *protocolLayout = new QHBoxLayout();
+    protocolLayout->addWidget(protocolLineEdit);
+    protocolLayout->addWidget(protocolPushButton);
+    grid->addWidget(protocolCheckBox, row, 0);
+    grid->addLayout(protocolLayout, row++, 1);
     grid->addWidget(pulseRadio, row, 0);
     grid->addWidget(aodRadio, row++, 1);
+    grid->addWidget(aodSequenceCheckBox, row, 0);
+    grid->addWidget(aodDwellSpinBox, row++, 1);
 
     QGroupBox *stimulationGb = new QGroupBox("Stimulation");
     stimulationGb->setLayout(grid);
@@ -203,6 +273,159 @@ void ControlsWidget::setupUi()
     auxStimulationGb->setChecked(t->getAuxStimulationEnabled());
     auxStimulationGb->setLayout(grid);
 
+    // analog modulation
+
+    QList<QCheckBox *> aoCheckBoxes;
+    QList<QComboBox *> aoPhysChanComboBoxes, aoShapeComboBoxes;
+    QList<QDoubleSpinBox *> aoAmplitudeSpinBoxes, aoOffsetSpinBoxes, aoFreqSpinBoxes;
+
+    row = 0;
+    grid = new QGridLayout();
+    grid->addWidget(new QLabel("Channel"), row, 1);
+    grid->addWidget(new QLabel("Shape"), row, 2);
+    grid->addWidget(new QLabel("Amplitude"), row, 3);
+    grid->addWidget(new QLabel("Offset"), row, 4);
+    grid->addWidget(new QLabel("Frequency"), row++, 5);
+    for (int i = 0; i < Tasks::N_AO_OUTPUTS; ++i) {
+        Tasks::AO_OUTPUT o = static_cast<Tasks::AO_OUTPUT>(i);
+        const WaveformSynth *w = t->getWaveform(o);
+
+        QCheckBox *cb = new QCheckBox(o == Tasks::AO_LED ? "LED" : "Stimulation");
+        cb->setChecked(t->isAnalogOutputEnabled(o));
+        QComboBox *physChanComboBox = new QComboBox();
+        physChanComboBox->addItems(NI::getAOPhysicalChans());
+        physChanComboBox->setCurrentText(t->getAnalogOutputPhysChan(o));
+        QComboBox *shapeComboBox = new QComboBox();
+        for (int s = 0; s < WaveformSynth::N_SHAPES; ++s) {
+            shapeComboBox->addItem(
+                WaveformSynth::shapeName(static_cast<WaveformSynth::SHAPE>(s)), s);
+        }
+        shapeComboBox->setCurrentIndex(w->getShape());
+        QDoubleSpinBox *amplitudeSpinBox = new QDoubleSpinBox();
+        amplitudeSpinBox->setSuffix("V");
+        amplitudeSpinBox->setRange(-10, 10);
+        amplitudeSpinBox->setValue(w->getAmplitude());
+        QDoubleSpinBox *offsetSpinBox = new QDoubleSpinBox();
+        offsetSpinBox->setSuffix("V");
+        offsetSpinBox->setRange(-10, 10);
+        offsetSpinBox->setValue(w->getOffset());
+        QDoubleSpinBox *freqSpinBox = new QDoubleSpinBox();
+        freqSpinBox->setSuffix("Hz");
+        freqSpinBox->setRange(0, 5000);
+        freqSpinBox->setDecimals(1);
+        freqSpinBox->setValue(w->getFrequency());
+
+        grid->addWidget(cb, row, 0);
+        grid->addWidget(physChanComboBox, row, 1);
+        grid->addWidget(shapeComboBox, row, 2);
+        grid->addWidget(amplitudeSpinBox, row, 3);
+        grid->addWidget(offsetSpinBox, row, 4);
+        grid->addWidget(freqSpinBox, row++, 5);
+
+        aoCheckBoxes << cb;
+        aoPhysChanComboBoxes << physChanComboBox;
+        aoShapeComboBoxes << shapeComboBox;
+        aoAmplitudeSpinBoxes << amplitudeSpinBox;
+        aoOffsetSpinBoxes << offsetSpinBox;
+        aoFreqSpinBoxes << freqSpinBox;
+    }
+
+    QDoubleSpinBox *aoRateSpinBox = new QDoubleSpinBox();
+    aoRateSpinBox->setSuffix("Hz");
+    aoRateSpinBox->setRange(100, 1e6);
+    aoRateSpinBox->setDecimals(0);
+    aoRateSpinBox->setValue(t->getAnalogOutputRate());
+    grid->addWidget(new QLabel("Update rate"), row, 0);
+    grid->addWidget(aoRateSpinBox, row++, 1);
+
+    QGroupBox *analogOutGb = new QGroupBox("Analog modulation");
+    analogOutGb->setToolTip("Intensity waveforms played on analog outputs. The stimulation "
+                            "waveform is only output during the stimulation.");
+    analogOutGb->setLayout(grid);
+
+    // closed loop
+
+    const ClosedLoopDetector *detector = optrode().getElReadoutWorker()->getClosedLoopDetector();
+    QComboBox *closedLoopDetectorComboBox = new QComboBox();
+    closedLoopDetectorComboBox->addItem("Threshold", ClosedLoopDetector::DETECTOR_THRESHOLD);
+    closedLoopDetectorComboBox->addItem("Band power", ClosedLoopDetector::DETECTOR_BAND_POWER);
+    closedLoopDetectorComboBox->addItem("Line length", ClosedLoopDetector::DETECTOR_LINE_LENGTH);
+    closedLoopDetectorComboBox->setCurrentIndex(
+        closedLoopDetectorComboBox->findData(detector->getDetector()));
+
+    QDoubleSpinBox *closedLoopThresholdSpinBox = new QDoubleSpinBox();
+    closedLoopThresholdSpinBox->setRange(-100, 100);
+    closedLoopThresholdSpinBox->setDecimals(4);
+    closedLoopThresholdSpinBox->setValue(detector->getThreshold());
+    closedLoopThresholdSpinBox->setToolTip("V (V^2 for band power). A negative threshold "
+                                           "detects negative-going crossings.");
+
+    QDoubleSpinBox *closedLoopWindowSpinBox = new QDoubleSpinBox();
+    closedLoopWindowSpinBox->setSuffix("ms");
+    closedLoopWindowSpinBox->setRange(0.1, 10000);
+    closedLoopWindowSpinBox->setValue(detector->getWindow() * 1e3);
+
+    QDoubleSpinBox *closedLoopBandLowSpinBox = new QDoubleSpinBox();
+    closedLoopBandLowSpinBox->setSuffix("Hz");
+    closedLoopBandLowSpinBox->setRange(0.1, 50000);
+    closedLoopBandLowSpinBox->setValue(detector->getBandLow());
+    QDoubleSpinBox *closedLoopBandHighSpinBox = new QDoubleSpinBox();
+    closedLoopBandHighSpinBox->setSuffix("Hz");
+    closedLoopBandHighSpinBox->setRange(0.1, 50000);
+    closedLoopBandHighSpinBox->setValue(detector->getBandHigh());
+
+    QDoubleSpinBox *closedLoopRefractorySpinBox = new QDoubleSpinBox();
+    closedLoopRefractorySpinBox->setSuffix("s");
+    closedLoopRefractorySpinBox->setRange(0, 3600);
+    closedLoopRefractorySpinBox->setDecimals(3);
+    closedLoopRefractorySpinBox->setValue(detector->getRefractoryPeriod());
+
+    QComboBox *closedLoopOutputComboBox = new QComboBox();
+    closedLoopOutputComboBox->addItem("Stimulation", Tasks::CLOSED_LOOP_STIMULATION);
+    closedLoopOutputComboBox->addItem("Aux stimulation", Tasks::CLOSED_LOOP_AUX_STIMULATION);
+    closedLoopOutputComboBox->setCurrentIndex(
+        closedLoopOutputComboBox->findData(t->getClosedLoopOutput()));
+
+    QSpinBox *closedLoopNPulsesSpinBox = new QSpinBox();
+    closedLoopNPulsesSpinBox->setRange(1, 10000);
+    closedLoopNPulsesSpinBox->setValue(t->getClosedLoopNPulses());
+
+    auto updateClosedLoopUi = [ = ](){
+        const int d = closedLoopDetectorComboBox->currentData().toInt();
+        closedLoopWindowSpinBox->setEnabled(d != ClosedLoopDetector::DETECTOR_THRESHOLD);
+        closedLoopBandLowSpinBox->setEnabled(d == ClosedLoopDetector::DETECTOR_BAND_POWER);
+        closedLoopBandHighSpinBox->setEnabled(d == ClosedLoopDetector::DETECTOR_BAND_POWER);
+    };
+    connect(closedLoopDetectorComboBox, qOverload<int>(&QComboBox::currentIndexChanged),
+            this, updateClosedLoopUi);
+    updateClosedLoopUi();
+
+    row = 0;
+    grid = new QGridLayout();
+    grid->addWidget(new QLabel("Detector"), row, 0);
+    grid->addWidget(closedLoopDetectorComboBox, row++, 1);
+    grid->addWidget(new QLabel("Threshold"), row, 0);
+    grid->addWidget(closedLoopThresholdSpinBox, row++, 1);
+    grid->addWidget(new QLabel("Window"), row, 0);
+    grid->addWidget(closedLoopWindowSpinBox, row++, 1);
+    grid->addWidget(new QLabel("Band"), row, 0);
+    grid->addWidget(closedLoopBandLowSpinBox, row, 1);
+    grid->addWidget(closedLoopBandHighSpinBox, row++, 2);
+    grid->addWidget(new QLabel("Refractory period"), row, 0);
+    grid->addWidget(closedLoopRefractorySpinBox, row++, 1);
+    grid->addWidget(new QLabel("Output"), row, 0);
+    grid->addWidget(closedLoopOutputComboBox, row++, 1);
+    grid->addWidget(new QLabel("N Pulses"), row, 0);
+    grid->addWidget(closedLoopNPulsesSpinBox, row++, 1);
+
+    QGroupBox *closedLoopGb = new QGroupBox("Closed loop");
+    closedLoopGb->setToolTip("Stimulation pulses (stimulation high and low times) output on "
+                             "events detected in the electrode signal, instead of the "
+                             "scheduled ones.");
+    closedLoopGb->setCheckable(true);
+    closedLoopGb->setChecked(t->isClosedLoopEnabled());
+    closedLoopGb->setLayout(grid);
+
     // Timing
 
     QDoubleSpinBox *baselineSpinBox = new QDoubleSpinBox();
@@ -228,6 +451,7 @@ void ControlsWidget::setupUi()
         stimulationSpinBox->setEnabled(checked);
         stimulationGb->setEnabled(checked);
         auxStimulationGb->setEnabled(checked);
+        closedLoopGb->setEnabled(checked);
         postStimulationSpinBox->setEnabled(checked);
     };
 
@@ -255,6 +479,7 @@ void ControlsWidget::setupUi()
     QPushButton *startFreeRunButton = new QPushButton("Start free run");
     QPushButton *startButton = new QPushButton("Start");
     QPushButton *stopButton = new QPushButton("Stop");
+    QPushButton *timelineButton = new QPushButton("Check timeline");
     QLabel *successLabel = new QLabel();
 
     QProgressBar *progressBar = new QProgressBar();
@@ -282,7 +507,11 @@ void ControlsWidget::setupUi()
                 successLabel->setText("ERRORS");
                 successLabel->setStyleSheet("QLabel {color: red};");
             }
-            if (optrode().isMultiRunEnabled()) {
+            if (optrode().NITasks()->isTrialModeEnabled()) {
+                SaveStackWorker *ssWorker = optrode().getSSWorker();
+                multiRunProgressBar->setValue(
+                    ssWorker->getReadFrames() / ssWorker->getFramesPerTrial());
+            } else if (optrode().isMultiRunEnabled()) {
                 multiRunProgressBar->setValue(multiRunProgressBar->value() + 1);
             }
         }
@@ -293,7 +522,12 @@ void ControlsWidget::setupUi()
         successLabel->setStyleSheet("QLabel {color: DarkOrange};");
     });
     connect(timer, &QTimer::timeout, this, [ = ](){
-        progressBar->setValue(optrode().getSSWorker()->getReadFrames());
+        SaveStackWorker *ssWorker = optrode().getSSWorker();
+        progressBar->setValue(ssWorker->getReadFrames());
+        size_t framesPerTrial = ssWorker->getFramesPerTrial();
+        if (framesPerTrial > 0) {
+            multiRunProgressBar->setValue(ssWorker->getReadFrames() / framesPerTrial);
+        }
     });
 
     QVBoxLayout *vLayout = new QVBoxLayout();
@@ -301,6 +535,7 @@ void ControlsWidget::setupUi()
     vLayout->addWidget(startFreeRunButton);
     vLayout->addWidget(startButton);
     vLayout->addWidget(stopButton);
+    vLayout->addWidget(timelineButton);
     vLayout->addStretch();
     vLayout->addWidget(successLabel);
     vLayout->addWidget(progressBar);
@@ -336,6 +571,17 @@ void ControlsWidget::setupUi()
     grid->addWidget(ROIWidthSpinBox, row++, 1);
     grid->addWidget(new QLabel("Height"), row, 0);
     grid->addWidget(ROIHeightSpinBox, row++, 1);
+    QCheckBox *motionEnergyCheckBox = new QCheckBox("Motion energy");
+    motionEnergyCheckBox->setChecked(optrode().getBehavWorker()->isMotionEnergyEnabled());
+    grid->addWidget(motionEnergyCheckBox, row++, 0, 1, 2);
+    QCheckBox *pupilCheckBox = new QCheckBox("Pupil");
+    pupilCheckBox->setChecked(optrode().getBehavWorker()->isPupilTrackingEnabled());
+    QSpinBox *pupilThresholdSpinBox = new QSpinBox();
+    pupilThresholdSpinBox->setRange(0, 255);
+    pupilThresholdSpinBox->setValue(optrode().getBehavWorker()->getPupilTracker()->getThreshold());
+    pupilThresholdSpinBox->setToolTip("Pupil threshold");
+    grid->addWidget(pupilCheckBox, row, 0);
+    grid->addWidget(pupilThresholdSpinBox, row++, 1);
 
     QGroupBox *ROIGb = new QGroupBox("BehavCam ROI");
     ROIGb->setLayout(grid);
@@ -344,9 +590,23 @@ void ControlsWidget::setupUi()
     QSpinBox *nRunsSpinBox = new QSpinBox();
     nRunsSpinBox->setRange(2, 10000);
     nRunsSpinBox->setValue(optrode().getNRuns());
+    QCheckBox *trialModeCheckBox = new QCheckBox("Hardware retriggered trials");
+    trialModeCheckBox->setChecked(optrode().isTrialModeEnabled());
+    trialModeCheckBox->setToolTip("Acquire all runs as a single acquisition, with trials "
+                                  "retriggered by the NI board");
+    QDoubleSpinBox *interTrialSpinBox = new QDoubleSpinBox();
+    interTrialSpinBox->setRange(0.01, 3600);
+    interTrialSpinBox->setDecimals(3);
+    interTrialSpinBox->setSuffix(" s");
+    interTrialSpinBox->setValue(optrode().NITasks()->getInterTrialInterval());
+    interTrialSpinBox->setEnabled(trialModeCheckBox->isChecked());
+    connect(trialModeCheckBox, &QCheckBox::toggled, interTrialSpinBox, &QWidget::setEnabled);
     grid = new QGridLayout();
     grid->addWidget(new QLabel("Number of runs"), 0, 0);
     grid->addWidget(nRunsSpinBox, 0, 1);
+    grid->addWidget(trialModeCheckBox, 1, 0, 1, 2);
+    grid->addWidget(new QLabel("Inter-trial interval"), 2, 0);
+    grid->addWidget(interTrialSpinBox, 2, 1);
     QGroupBox *multiRunGb = new QGroupBox("Multiple runs");
     multiRunGb->setCheckable(true);
     multiRunGb->setChecked(optrode().isMultiRunEnabled());
@@ -373,9 +633,60 @@ void ControlsWidget::setupUi()
     QCheckBox *saveBehavCheckBox = new QCheckBox("Behavior");
     saveBehavCheckBox->setChecked(optrode().isSaveBehaviorEnabled());
 
+    VideoEncoder *encoder = optrode().getBehavWorker()->getEncoder();
+    QComboBox *behavCodecComboBox = new QComboBox();
+    QList<VideoEncoder::CODEC> codecs = {
+        VideoEncoder::CODEC_H264, VideoEncoder::CODEC_MJPEG, VideoEncoder::CODEC_RAW
+    };
+    for (VideoEncoder::CODEC c : codecs) {
+        behavCodecComboBox->addItem(VideoEncoder::codecName(c), c);
+    }
+    behavCodecComboBox->setCurrentIndex(behavCodecComboBox->findData(encoder->getCodec()));
+
+    QSpinBox *behavBitrateSpinBox = new QSpinBox();
+    behavBitrateSpinBox->setRange(100, 50000);
+    behavBitrateSpinBox->setSingleStep(100);
+    behavBitrateSpinBox->setSuffix("kbit/s");
+    behavBitrateSpinBox->setValue(encoder->getBitrate() / 1000);
+    behavBitrateSpinBox->setEnabled(encoder->getCodec() == VideoEncoder::CODEC_H264);
+
+    connect(behavCodecComboBox, qOverload<int>(&QComboBox::currentIndexChanged), [ = ](){
+        behavBitrateSpinBox->setEnabled(
+            behavCodecComboBox->currentData().toInt() == VideoEncoder::CODEC_H264);
+    });
+
+    QCheckBox *eventWindowsCheckBox = new QCheckBox("Event windows");
+    eventWindowsCheckBox->setChecked(optrode().getBehavWorker()->getRecordingMode()
+                                     == BehavWorker::RECORDING_EVENT_WINDOWS);
+    EventWindowRecorder *ewr = optrode().getBehavWorker()->getEventWindowRecorder();
+    eventWindowsCheckBox->setToolTip(
+        QString("Save behavior video only from %1s before to %2s after each stimulation onset "
+                "or marked event").arg(ewr->getPreEventTime()).arg(ewr->getPostEventTime()));
+
+    QPushButton *markEventPushButton = new QPushButton("Mark event");
+    markEventPushButton->setEnabled(eventWindowsCheckBox->isChecked());
+    connect(eventWindowsCheckBox, &QCheckBox::toggled,
+            markEventPushButton, &QPushButton::setEnabled);
+    connect(markEventPushButton, &QPushButton::clicked, [ = ](){
+        for (int i = 0; i < optrode().behaviorCameraCount(); ++i) {
+            optrode().getBehavWorker(i)->markEvent();
+        }
+    });
+
+    QCheckBox *saveEdgesCheckBox = new QCheckBox("Hardware edges");
+    saveEdgesCheckBox->setChecked(optrode().NITasks()->getEdgeRecorder()->isEnabled());
+    saveEdgesCheckBox->setToolTip(
+        "Timestamp the actual edges of the trigger, LED, stimulation and camera exposure lines "
+        "(wired to digital inputs)");
+
     QHBoxLayout *saveLayout = new QHBoxLayout();
     saveLayout->addWidget(saveElReadoutCheckBox);
     saveLayout->addWidget(saveBehavCheckBox);
+    saveLayout->addWidget(behavCodecComboBox);
+    saveLayout->addWidget(behavBitrateSpinBox);
+    saveLayout->addWidget(eventWindowsCheckBox);
+    saveLayout->addWidget(markEventPushButton);
+    saveLayout->addWidget(saveEdgesCheckBox);
 
     grid->addWidget(new QLabel("Save"), ++row, 0);
     grid->addLayout(saveLayout, row, 1);
@@ -389,6 +700,8 @@ void ControlsWidget::setupUi()
     vLayout->addWidget(electrodeGb);
     vLayout->addWidget(stimulationGb);
     vLayout->addWidget(auxStimulationGb);
+    vLayout->addWidget(analogOutGb);
+    vLayout->addWidget(closedLoopGb);
 
     QVBoxLayout *vLayout2 = new QVBoxLayout();
     vLayout2->addWidget(timingGb);
@@ -428,6 +741,7 @@ void ControlsWidget::setupUi()
         startFreeRunButton,
         stopButton,
         startButton,
+        timelineButton,
     };
 
     for (QWidget * w : wList) {
@@ -447,11 +761,14 @@ void ControlsWidget::setupUi()
     wList = {
         startFreeRunButton,
         startButton,
+        timelineButton,
         trigGb,
         LEDGb,
         ROIGb,
         electrodeGb,
         stimulationGb,
+        analogOutGb,
+        closedLoopGb,
         outputGb,
         timingGb,
         multiRunGb,
@@ -479,19 +796,78 @@ void ControlsWidget::setupUi()
         t->setStimulationLowTime(stimulationLowTimeSpinBox->value());
         t->setStimulationDuration(stimulationSpinBox->value());
         t->setContinuousStimulation(continuousStimulationCheckBox->isChecked());
+        t->setStimulationProtocolEnabled(protocolCheckBox->isChecked());
+        const StimulationProtocol *protocol = t->getStimulationProtocol();
+        if (protocolCheckBox->isChecked() && (protocolLineEdit->text() != protocol->getFileName()
+                                              || protocol->isOutdated())) {
+            try {
+                t->loadStimulationProtocol(protocolLineEdit->text());
+            } catch (std::runtime_error e) {
+                QMessageBox::critical(nullptr, "Error", e.what());
+            }
+        }
+        if (protocol->isLoaded() && protocolCheckBox->isChecked()) {
+            stimulationSpinBox->setValue(t->stimulationDuration());
+        }
         t->setStimulationEnabled(stimulationCheckBox->isChecked());
         t->setAODEnabled(aodRadio->isChecked());
         if (camDisplay->getPoints().size() > 0) {
             t->setPoint(camDisplay->getPoints().at(0));
         }
+        t->setAODSequenceEnabled(aodSequenceCheckBox->isChecked());
+        if (aodSequenceCheckBox->isChecked() && camDisplay->getPoints().size() > 0) {
+            // amplitudes are kept for unchanged targets
+            AODSequence *sequence = t->getAODSequence();
+            const QVector<AODTarget> oldTargets = sequence->getTargets();
+            const QVector<QPointF> points = camDisplay->getPoints();
+            QVector<AODTarget> targets;
+            for (int i = 0; i < points.size(); ++i) {
+                AODTarget target;
+                target.point = points.at(i);
+                target.dwell = aodDwellSpinBox->value() * 1e-3;
+                if (i < oldTargets.size() && oldTargets.at(i).point == target.point) {
+                    target.amplitude = oldTargets.at(i).amplitude;
+                }
+                targets << target;
+            }
+            sequence->setTargets(targets);
+        }
         t->setAuxStimulationEnabled(auxStimulationGb->isChecked());
         t->setAuxStimulationTerm(auxStimulationTermComboBox->currentText());
         t->setAuxStimulationHighTime(auxStimulationHighTimeSpinBox->value());
         t->setAuxStimulationNPulses(auxStimulationNPulsesSpinBox->value());
         t->setAuxStimulationDelay(auxStimulationDelaySpinBox->value());
+        for (int i = 0; i < Tasks::N_AO_OUTPUTS; ++i) {
+            Tasks::AO_OUTPUT o = static_cast<Tasks::AO_OUTPUT>(i);
+            t->setAnalogOutputEnabled(o, aoCheckBoxes.at(i)->isChecked());
+            t->setAnalogOutputPhysChan(o, aoPhysChanComboBoxes.at(i)->currentText());
+            WaveformSynth *w = t->getWaveform(o);
+            w->setShape(static_cast<WaveformSynth::SHAPE>(
+                            aoShapeComboBoxes.at(i)->currentData().toInt()));
+            w->setAmplitude(aoAmplitudeSpinBoxes.at(i)->value());
+            w->setOffset(aoOffsetSpinBoxes.at(i)->value());
+            w->setFrequency(aoFreqSpinBoxes.at(i)->value());
+        }
+        t->setAnalogOutputRate(aoRateSpinBox->value());
+        t->setClosedLoopEnabled(closedLoopGb->isChecked());
+        t->setClosedLoopOutput(static_cast<Tasks::CLOSED_LOOP_OUTPUT>(
+                                   closedLoopOutputComboBox->currentData().toInt()));
+        t->setClosedLoopNPulses(closedLoopNPulsesSpinBox->value());
+        ClosedLoopDetector *det = optrode().getElReadoutWorker()->getClosedLoopDetector();
+        det->setDetector(static_cast<ClosedLoopDetector::DETECTOR>(
+                             closedLoopDetectorComboBox->currentData().toInt()));
+        det->setThreshold(closedLoopThresholdSpinBox->value());
+        det->setWindow(closedLoopWindowSpinBox->value() * 1e-3);
+        det->setBandLow(closedLoopBandLowSpinBox->value());
+        det->setBandHigh(closedLoopBandHighSpinBox->value());
+        det->setRefractoryPeriod(closedLoopRefractorySpinBox->value());
         t->setElectrodeReadoutPhysChan(electrodePhysChanComboBox->currentText());
         t->setElectrodeReadoutRate(electrodeSampRateSpinBox->value());
         t->setElectrodeReadoutEnabled(electrodeGb->isChecked());
+        optrode().getElReadoutWorker()->setFilterEnabled(electrodeFilterCheckBox->isChecked());
+        optrode().getElReadoutWorker()->setRawEnabled(electrodeRawCheckBox->isChecked());
+        optrode().getElReadoutWorker()->setSpectrumEnabled(
+            electrodeSpectrumCheckBox->isChecked());
 
         t->setStimulationInitialDelay(baselineSpinBox->value());
         optrode().setPostStimulation(postStimulationSpinBox->value());
@@ -501,9 +877,21 @@ void ControlsWidget::setupUi()
 
         optrode().setSaveElectrodeEnabled(saveElReadoutCheckBox->isChecked());
         optrode().setSaveBehaviorEnabled(saveBehavCheckBox->isChecked());
+        t->getEdgeRecorder()->setEnabled(saveEdgesCheckBox->isChecked());
+        for (int i = 0; i < optrode().behaviorCameraCount(); ++i) {
+            VideoEncoder *enc = optrode().getBehavWorker(i)->getEncoder();
+            enc->setCodec(static_cast<VideoEncoder::CODEC>(
+                              behavCodecComboBox->currentData().toInt()));
+            enc->setBitrate(static_cast<unsigned int>(behavBitrateSpinBox->value()) * 1000);
+            optrode().getBehavWorker(i)->setRecordingMode(
+                eventWindowsCheckBox->isChecked() ? BehavWorker::RECORDING_EVENT_WINDOWS
+                                                  : BehavWorker::RECORDING_CONTINUOUS);
+        }
 
         optrode().setMultiRunEnabled(multiRunGb->isChecked());
         optrode().setNRuns(nRunsSpinBox->value());
+        optrode().setTrialModeEnabled(trialModeCheckBox->isChecked());
+        t->setInterTrialInterval(interTrialSpinBox->value());
 
         QRect roi;
         roi.setX(ROIxSpinBox->value());
@@ -511,6 +899,10 @@ void ControlsWidget::setupUi()
         roi.setWidth(ROIWidthSpinBox->value());
         roi.setHeight(ROIHeightSpinBox->value());
         optrode().getBehaviorCamera()->setROI(roi);
+        optrode().getBehavWorker()->setMotionEnergyEnabled(motionEnergyCheckBox->isChecked());
+        optrode().getBehavWorker()->setPupilTrackingEnabled(pupilCheckBox->isChecked());
+        optrode().getBehavWorker()->getPupilTracker()->setThreshold(
+            pupilThresholdSpinBox->value());
     };
 
     auto clicked = &QPushButton::clicked;
@@ -550,6 +942,35 @@ void ControlsWidget::setupUi()
         optrode().start();
     });
     connect(stopButton, clicked, &optrode(), &Optrode::multiRunStop);
+    connect(timelineButton, clicked, this, [ = ](){
+        applyValues();
+        Timeline timeline = optrode().compileTimeline(
+            optrode().getOrca()->getLineInterval());
+
+        QMessageBox msgBox;
+        msgBox.setWindowTitle("Timeline");
+        msgBox.setIcon(timeline.getConflicts().isEmpty() ? QMessageBox::Information
+                                                         : QMessageBox::Warning);
+        msgBox.setText(timeline.summary());
+        QPushButton *exportButton = msgBox.addButton("Export VCD...", QMessageBox::ActionRole);
+        msgBox.addButton(QMessageBox::Close);
+        msgBox.exec();
+        if (msgBox.clickedButton() != exportButton) {
+            return;
+        }
+
+        QString fileName = QFileDialog::getSaveFileName(
+            nullptr, "Export timeline", optrode().outputFileFullPath() + "_timeline.vcd",
+            "Value change dump (*.vcd)");
+        if (fileName.isEmpty()) {
+            return;
+        }
+        try {
+            timeline.saveVCD(fileName);
+        } catch (std::runtime_error e) {
+            QMessageBox::critical(nullptr, "Error", e.what());
+        }
+    });
 
     connect(outputPathPushButton, &QPushButton::clicked, this, [ = ](){
         QFileDialog dialog;
@@ -568,4 +989,16 @@ void ControlsWidget::setupUi()
 void ControlsWidget::setCamDisplay(CamDisplay *value)
 {
     camDisplay = value;
+
+    Tasks *t = optrode().NITasks();
+    if (t->isAODSequenceEnabled()) {
+        camDisplay->setMaxPoints(MAX_AOD_TARGETS);
+        QVector<QPointF> points;
+        for (const AODTarget &target : t->getAODSequence()->getTargets()) {
+            points << target.point;
+        }
+        camDisplay->setPoints(points);
+    } else if (t->isAODEnabled()) {
+        camDisplay->setPoints({t->getPoint()});
+    }
 }
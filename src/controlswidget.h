@@ -18,7 +18,7 @@ signals:
 private:
     void setupUi();
 
-    CamDisplay *camDisplay;
+    CamDisplay *camDisplay = nullptr;
 };
 
 #endif // CONTROLSWIDGET_H
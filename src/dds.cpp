@@ -18,6 +18,9 @@
 #define CONTROL_PORT_MASTER_RESET 0x1
 #define CONTROL_PORT_NWRITE 0x2
 
+#define N_PORTS 3                // control, data, data 2
+#define WRITE8_SAMPS_PER_CHAN 4  // samples per port of each register byte written
+
 #define SETBIT(var, bit, enable) enable ? var |= (1 << bit) : b &= ~(1 << bit);
 
 
@@ -319,11 +322,44 @@ int DDS::getBufferSize() const
     return buffer.size();
 }
 
+/**
+ * @brief Buffer size (see getBufferSize()) taken by the given number of register bytes written in
+ * WRITE_MODE_TO_BUFFER, e.g. 2 for each setOSKI(), without writing anything.
+ */
+
+int DDS::bufferSizeOfWrites(int nBytes)
+{
+    return nBytes * N_PORTS * WRITE8_SAMPS_PER_CHAN;
+}
+
 void DDS::clearBuffer()
 {
     buffer.clear();
 }
 
+/**
+ * @brief Samples written in WRITE_MODE_TO_BUFFER (GroupByScanNumber).
+ */
+
+const QVector<uInt32> &DDS::getBuffer() const
+{
+    return buffer;
+}
+
+void DDS::reserveBuffer(int size)
+{
+    buffer.reserve(size);
+}
+
+/**
+ * @brief Append samples previously obtained with getBuffer().
+ */
+
+void DDS::appendToBuffer(const QVector<uInt32> &samples)
+{
+    buffer.append(samples);
+}
+
 QString DDS::getDevName() const
 {
     return devName;
@@ -368,8 +404,8 @@ void DDS::udclkPulse()
 
 void DDS::write8(quint8 addr, quint8 value1, quint8 value2)
 {
-    const int sampsPerChan = 4;
-    const int nSamples = 3 * sampsPerChan;
+    const int sampsPerChan = WRITE8_SAMPS_PER_CHAN;
+    const int nSamples = N_PORTS * sampsPerChan;
     uInt32 samps[nSamples];
     memset(samps, 0, nSamples * sizeof(uInt32));
 
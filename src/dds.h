@@ -85,7 +85,11 @@ public:
 
     void nop();
     int getBufferSize() const;
+    static int bufferSizeOfWrites(int nBytes);
     void clearBuffer();
+    const QVector<uInt32> &getBuffer() const;
+    void reserveBuffer(int size);
+    void appendToBuffer(const QVector<uInt32> &samples);
 
     QString getDevName() const;
     void setDevName(const QString &value);
@@ -0,0 +1,212 @@
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "displaystats.h"
+
+#define HISTOGRAM_BINS 65536
+#define MAX_RING_BYTES (32 << 20)
+
+/**
+ * @brief sum += add - sub, eight pixels per iteration. sub can be null.
+ */
+
+static void updateSum(quint32 *sum, const quint16 *add, const quint16 *sub, int n)
+{
+    int i = 0;
+#ifdef HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(add + i));
+        __m128i lo = _mm_unpacklo_epi16(a, zero);
+        __m128i hi = _mm_unpackhi_epi16(a, zero);
+        if (sub) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(sub + i));
+            lo = _mm_sub_epi32(lo, _mm_unpacklo_epi16(s, zero));
+            hi = _mm_sub_epi32(hi, _mm_unpackhi_epi16(s, zero));
+        }
+        __m128i *dst = reinterpret_cast<__m128i *>(sum + i);
+        _mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), lo));
+        _mm_storeu_si128(dst + 1, _mm_add_epi32(_mm_loadu_si128(dst + 1), hi));
+    }
+#endif
+    for (; i < n; ++i) {
+        sum[i] += add[i] - (sub ? sub[i] : 0);
+    }
+}
+
+/**
+ * @brief dest = max(dest, src), eight pixels per iteration.
+ *
+ * SSE2 only has a signed 16 bit max: flipping the sign bit maps unsigned to signed order.
+ */
+
+static void updateMax(quint16 *dest, const quint16 *src, int n)
+{
+    int i = 0;
+#ifdef HAVE_SSE2
+    const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+    for (; i + 8 <= n; i += 8) {
+        __m128i *d = reinterpret_cast<__m128i *>(dest + i);
+        __m128i a = _mm_xor_si128(_mm_loadu_si128(d), flip);
+        __m128i b = _mm_xor_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)), flip);
+        _mm_storeu_si128(d, _mm_xor_si128(_mm_max_epi16(a, b), flip));
+    }
+#endif
+    for (; i < n; ++i) {
+        dest[i] = qMax(dest[i], src[i]);
+    }
+}
+
+
+DisplayStats::DisplayStats(int nPixels)
+{
+    this->nPixels = nPixels;
+    histogram.resize(HISTOGRAM_BINS);
+    histogram2.resize(HISTOGRAM_BINS);
+}
+
+/**
+ * @brief Forget all frames and (re)allocate the accumulators.
+ */
+
+void DisplayStats::reset()
+{
+    ring.resize(rollingFrames * nPixels);
+    ring.squeeze();  // give back the memory of a longer ring
+    ringHead = ringCount = 0;
+    sum.fill(0, nPixels);
+    maxProjection.fill(0, nPixels);
+    frames = 0;
+}
+
+void DisplayStats::add(const quint16 *frame)
+{
+    if (sum.size() != nPixels) {
+        reset();
+    }
+
+    quint16 *slot = ring.data() + ringHead * nPixels;
+    updateSum(sum.data(), frame, ringCount == rollingFrames ? slot : nullptr, nPixels);
+    memcpy(slot, frame, nPixels * sizeof(quint16));
+    ringHead = (ringHead + 1) % rollingFrames;
+    ringCount = qMin(ringCount + 1, rollingFrames);
+
+    updateMax(maxProjection.data(), frame, nPixels);
+    frames++;
+}
+
+/**
+ * @brief Mean of the last getRollingFrames() frames (or fewer, right after a reset), rounded.
+ */
+
+void DisplayStats::mean(quint16 *dest) const
+{
+    if (ringCount == 0) {
+        memset(dest, 0, nPixels * sizeof(quint16));
+        return;
+    }
+    const quint32 *s = sum.constData();
+    const quint32 half = ringCount / 2;
+    for (int i = 0; i < nPixels; ++i) {
+        dest[i] = static_cast<quint16>((s[i] + half) / ringCount);
+    }
+}
+
+/**
+ * @brief Max projection of all frames since the last reset.
+ */
+
+void DisplayStats::max(quint16 *dest) const
+{
+    if (maxProjection.size() != nPixels) {
+        memset(dest, 0, nPixels * sizeof(quint16));
+        return;
+    }
+    memcpy(dest, maxProjection.constData(), nPixels * sizeof(quint16));
+}
+
+/**
+ * @brief Number of frames added since the last reset.
+ */
+
+int DisplayStats::getFrames() const
+{
+    return frames;
+}
+
+int DisplayStats::getRollingFrames() const
+{
+    return rollingFrames;
+}
+
+/**
+ * @brief Number of frames of the rolling mean, at most getMaxRollingFrames(). Resets the
+ * statistics.
+ */
+
+void DisplayStats::setRollingFrames(int value)
+{
+    rollingFrames = qBound(1, value, getMaxRollingFrames());
+    if (sum.size() == nPixels) {
+        reset();
+    }
+}
+
+/**
+ * @brief Number of frames of the rolling mean fitting in MAX_RING_BYTES.
+ */
+
+int DisplayStats::getMaxRollingFrames() const
+{
+    return qMax(1, MAX_RING_BYTES / static_cast<int>(nPixels * sizeof(quint16)));
+}
+
+/**
+ * @brief Compute the full 16 bit histogram of img.
+ *
+ * Pixels are counted into two interleaved histograms, so that runs of equal values (common in dark
+ * images) do not serialize on the same counter, then merged.
+ */
+
+void DisplayStats::updateHistogram(const quint16 *img)
+{
+    histogram.fill(0);
+    histogram2.fill(0);
+
+    quint32 *h = histogram.data();
+    quint32 *g = histogram2.data();
+    int i = 0;
+    for (; i + 2 <= nPixels; i += 2) {
+        h[img[i]]++;
+        g[img[i + 1]]++;
+    }
+    for (; i < nPixels; ++i) {
+        h[img[i]]++;
+    }
+    for (int b = 0; b < HISTOGRAM_BINS; ++b) {
+        h[b] += g[b];
+    }
+}
+
+/**
+ * @brief Intensity below which a fraction p of the pixels of the last histogram lie.
+ * @param p Between 0 and 1
+ */
+
+quint16 DisplayStats::percentile(double p) const
+{
+    const quint64 target = static_cast<quint64>(qBound(0., p, 1.) * nPixels);
+    quint64 cumulative = 0;
+    for (int b = 0; b < HISTOGRAM_BINS; ++b) {
+        cumulative += histogram.at(b);
+        if (cumulative > target || cumulative == static_cast<quint64>(nPixels)) {
+            return static_cast<quint16>(b);
+        }
+    }
+    return HISTOGRAM_BINS - 1;
+}
@@ -0,0 +1,52 @@
+#ifndef DISPLAYSTATS_H
+#define DISPLAYSTATS_H
+
+#include <QVector>
+
+/**
+ * @brief Running statistics over the displayed frame stream.
+ *
+ * Keeps a rolling mean over the last N frames (as a sum of the frames in a ring, updated by adding
+ * the newest frame and subtracting the oldest one) and a max projection since the last reset.
+ * Also computes the intensity histogram of an image, used for percentile auto-contrast.
+ *
+ * Accumulators are updated with SSE2 where available. They are allocated by the first frame
+ * added, so that statistics of a channel that is never displayed take no memory; the ring is
+ * limited to MAX_RING_BYTES.
+ */
+
+class DisplayStats
+{
+public:
+    explicit DisplayStats(int nPixels);
+
+    void reset();
+    void add(const quint16 *frame);
+
+    void mean(quint16 *dest) const;
+    void max(quint16 *dest) const;
+    int getFrames() const;
+
+    int getRollingFrames() const;
+    void setRollingFrames(int value);
+    int getMaxRollingFrames() const;
+
+    void updateHistogram(const quint16 *img);
+    quint16 percentile(double p) const;
+
+private:
+    int nPixels;
+    int rollingFrames = 16;
+
+    QVector<quint16> ring;  // rollingFrames images
+    int ringHead = 0;
+    int ringCount = 0;
+    QVector<quint32> sum;
+    QVector<quint16> maxProjection;
+    int frames = 0;
+
+    QVector<quint32> histogram;
+    QVector<quint32> histogram2;
+};
+
+#endif // DISPLAYSTATS_H
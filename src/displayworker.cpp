@@ -1,25 +1,118 @@
 #include "displayworker.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <QElapsedTimer>
+
 #include <qtlab/hw/hamamatsu/orcaflash.h>
 #include <qtlab/widgets/cameradisplay.h>
 #include <qtlab/widgets/cameraplot.h>
 
+#include "framemailbox.h"
 #include "optrode.h"
 #include "tasks.h"
 
-#define BUFSIZE (512 * 512)
+#define FRAME_SIDE 512
+#define BUFSIZE (FRAME_SIDE * FRAME_SIDE)
 
 using namespace DCAM;
 
+/**
+ * @brief dst = a / b (b is taken as at least 1), eight pixels per iteration.
+ */
+
+static void ratio(const quint16 *a, const quint16 *b, float *dst, size_t n)
+{
+    size_t i = 0;
+#ifdef HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 one = _mm_set1_ps(1);
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        __m128 lo = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(va, zero)),
+                               _mm_max_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(vb, zero)), one));
+        __m128 hi = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(va, zero)),
+                               _mm_max_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(vb, zero)), one));
+        _mm_storeu_ps(dst + i, lo);
+        _mm_storeu_ps(dst + i + 4, hi);
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = a[i] / qMax(1.f, static_cast<float>(b[i]));
+    }
+}
+
+/**
+ * @brief Clamp pixels to [lo, hi] in place, eight pixels per iteration.
+ */
+
+static void clamp(quint16 *data, quint16 lo, quint16 hi, size_t n)
+{
+    size_t i = 0;
+#ifdef HAVE_SSE2
+    // SSE2 only has signed 16 bit min/max: flipping the sign bit maps unsigned to signed order
+    const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i vlo = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(lo)), flip);
+    const __m128i vhi = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(hi)), flip);
+    for (; i + 8 <= n; i += 8) {
+        __m128i *p = reinterpret_cast<__m128i *>(data + i);
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(p), flip);
+        v = _mm_min_epi16(_mm_max_epi16(v, vlo), vhi);
+        _mm_storeu_si128(p, _mm_xor_si128(v, flip));
+    }
+#endif
+    for (; i < n; ++i) {
+        data[i] = qBound(lo, data[i], hi);
+    }
+}
+
+/**
+ * @brief Convert unsigned 16 bit pixels to double, eight pixels per iteration.
+ */
+
+static void convert(const quint16 *src, double *dst, size_t n)
+{
+    size_t i = 0;
+#ifdef HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i lo = _mm_unpacklo_epi16(v, zero);
+        __m128i hi = _mm_unpackhi_epi16(v, zero);
+        _mm_storeu_pd(dst + i, _mm_cvtepi32_pd(lo));
+        _mm_storeu_pd(dst + i + 2, _mm_cvtepi32_pd(_mm_srli_si128(lo, 8)));
+        _mm_storeu_pd(dst + i + 4, _mm_cvtepi32_pd(hi));
+        _mm_storeu_pd(dst + i + 6, _mm_cvtepi32_pd(_mm_srli_si128(hi, 8)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = src[i];
+    }
+}
+
 
 DisplayWorker::DisplayWorker(OrcaFlash *camera, QObject *parent)
-    : QThread(parent)
+    : QThread(parent), led1Stats(BUFSIZE), led2Stats(BUFSIZE)
 {
-    displayWhat = DISPLAY_ALL;
+    displayWhat.storeRelease(DISPLAY_ALL);
+    displayMode.storeRelease(DISPLAY_MODE_LIVE);
+    rollingMeanFrames.storeRelease(led1Stats.getRollingFrames());
+    autoContrast.storeRelease(0);
+    lowPercentile = 0.005;
+    highPercentile = 0.995;
     qRegisterMetaType<size_t>("size_t");
+    qRegisterMetaType<const double *>("const double*");
 
-    buf = new quint16[BUFSIZE];
-    bufd = new double[BUFSIZE];
+    buf = new quint16[2 * BUFSIZE];  // room for one frame per LED
+    composite = new quint16[2 * BUFSIZE];
+    ratioBuf = new float[BUFSIZE];
+    for (int i = 0; i < DISPLAY_POOL_SIZE; ++i) {
+        pool[i] = new double[2 * BUFSIZE];
+    }
 
     orca = camera;
 
@@ -36,72 +129,333 @@ DisplayWorker::DisplayWorker(OrcaFlash *camera, QObject *parent)
 DisplayWorker::~DisplayWorker()
 {
     delete[] buf;
-    delete[] bufd;
+    delete[] composite;
+    delete[] ratioBuf;
+    for (int i = 0; i < DISPLAY_POOL_SIZE; ++i) {
+        delete[] pool[i];
+    }
 }
 
 void DisplayWorker::run()
 {
     running = true;
-    int triggerPeriod_ms = 1 / optrode().NITasks()->getMainTrigFreq() * 1000;
+    resetRequested.storeRelease(1);
+    useMailbox = frameMailbox && !optrode().isFreeRunEnabled();
+    triggerPeriod_ms = 1 / optrode().NITasks()->getMainTrigFreq() * 1000;
 
-    int skipFrames = qMax(40, triggerPeriod_ms) / triggerPeriod_ms;  // 40ms is 25 fps
-    while (true) {
-        msleep(skipFrames * triggerPeriod_ms);
-        if (displayWhat != DISPLAY_ALL) {
-            msleep(triggerPeriod_ms);
-        }
+    QElapsedTimer timer;
+    timer.start();
 
-        int32_t frameStamp = -1;
-        int exceptionCounter = 0;
+    while (running) {
+        const qint64 wait = 40 - timer.elapsed();  // 40ms is 25 fps
+        if (wait > 0) {
+            msleep(wait);
+        }
+        timer.restart();
 
-        int i = 0;
-        while (true) {
-            if (!running) {
-                return;
-            }
+        int slot = acquireBuffer();
+        if (slot < 0) {
+            continue;  // GUI is lagging behind, skip this frame
+        }
 
-            try {
-                orca->copyFrame(buf, BUFSIZE * sizeof(quint16), -1, &frameStamp);
-#ifdef DEMO_MODE
-                frameStamp = i;
-#endif
-            }
-            catch (std::exception) {
-                exceptionCounter++;
+        const DISPLAY_WHAT what = static_cast<DISPLAY_WHAT>(displayWhat.loadAcquire());
+        if (what == DISPLAY_BOTH || what == DISPLAY_RATIO) {
+            // the newest frame of each channel, i.e. two consecutive frames
+            if (!grabFrame(FrameMailbox::CHANNEL_LED1, buf)
+                || !grabFrame(FrameMailbox::CHANNEL_LED2, buf + BUFSIZE)) {
+                poolBusy[slot].storeRelease(0);
                 continue;
             }
-
-            if (displayWhat == DISPLAY_LED1 && (frameStamp % 2 == 0)) {
-                break;
-            } else if (displayWhat == DISPLAY_LED2 && (frameStamp % 2 == 1)) {
-                break;
-            } else if (displayWhat == DISPLAY_ALL) {
-                break;
+            if (what == DISPLAY_BOTH) {
+                emitBoth(slot);
+            } else {
+                emitRatio(slot);
             }
+            continue;
+        }
 
-            i++;
-            msleep(triggerPeriod_ms);
+        FrameMailbox::CHANNEL channel = FrameMailbox::CHANNEL_ANY;
+        if (what == DISPLAY_LED1) {
+            channel = FrameMailbox::CHANNEL_LED1;
+        } else if (what == DISPLAY_LED2) {
+            channel = FrameMailbox::CHANNEL_LED2;
         }
 
-#ifndef DEMO_MODE
-        if (frameStamp == -1) {
+        FrameMailbox::CHANNEL grabbed = channel;
+        if (!grabFrame(channel, buf, &grabbed)) {
+            poolBusy[slot].storeRelease(0);
             continue;
         }
+        processFrame(grabbed == FrameMailbox::CHANNEL_LED2 ? led2Stats : led1Stats, buf,
+                     autoContrast.loadAcquire());
+        emitImage(slot, buf, BUFSIZE);
+    }
+}
+
+/**
+ * @brief Wait for the next frame of the given channel.
+ * @param grabbed If not null, set to the channel of the frame (useful with CHANNEL_ANY)
+ * @return false on timeout or when stopped
+ *
+ * While saving, frames come from the ones locked by the capture loop. In free run nobody locks
+ * frames, so the last frame is polled from the camera until it has the right parity.
+ */
+
+bool DisplayWorker::grabFrame(FrameMailbox::CHANNEL channel, quint16 *dest,
+                              FrameMailbox::CHANNEL *grabbed)
+{
+    if (useMailbox) {
+        qint64 frameIndex = 0;
+        // short timeout, so that a stop is noticed quickly
+        if (!frameMailbox->take(channel, dest, BUFSIZE, 200, &frameIndex)) {
+            return false;
+        }
+        if (grabbed) {
+            *grabbed = static_cast<FrameMailbox::CHANNEL>(frameIndex % 2);
+        }
+        return true;
+    }
+
+    int32_t frameStamp = -1;
+    int i = 0;
+    while (running) {
+        try {
+            orca->copyFrame(dest, BUFSIZE * sizeof(quint16), -1, &frameStamp);
+#ifdef DEMO_MODE
+            frameStamp = i;
 #endif
+        }
+        catch (std::exception) {
+            continue;
+        }
 
-        for (int i = 0; i < BUFSIZE; ++i) {
-            bufd[i] = buf[i];
+        if (frameStamp == -1) {
+            return false;
+        }
+        if (channel == FrameMailbox::CHANNEL_ANY || frameStamp % 2 == channel) {
+            if (grabbed) {
+                *grabbed = static_cast<FrameMailbox::CHANNEL>(frameStamp % 2);
+            }
+            return true;
+        }
+
+        i++;
+        msleep(triggerPeriod_ms);
+    }
+    return false;
+}
+
+/**
+ * @brief Update the statistics and compute the image to display.
+ * @param s Statistics of the channel of img
+ * @param img Overwritten with the displayed image
+ * @param clip Apply auto contrast
+ */
+
+void DisplayWorker::processFrame(DisplayStats &s, quint16 *img, bool clip)
+{
+    if (resetRequested.testAndSetAcquire(1, 0)) {
+        led1Stats.setRollingFrames(rollingMeanFrames.loadAcquire());
+        led2Stats.setRollingFrames(rollingMeanFrames.loadAcquire());
+    }
+    s.add(img);
+
+    switch (displayMode.loadAcquire()) {
+    case DISPLAY_MODE_MEAN:
+        s.mean(img);
+        break;
+    case DISPLAY_MODE_MAX:
+        s.max(img);
+        break;
+    case DISPLAY_MODE_LIVE:
+    default:
+        break;
+    }
+
+    if (clip) {
+        // clipping makes the plot autoscale to the percentile levels
+        s.updateHistogram(img);
+        const quint16 l = s.percentile(lowPercentile);
+        const quint16 h = qMax(s.percentile(highPercentile), quint16(l + 1));
+        clamp(img, l, h, BUFSIZE);
+    }
+}
+
+/**
+ * @brief Hand over img, converted into the given pool buffer.
+ * @param n Number of pixels
+ */
+
+void DisplayWorker::emitImage(int slot, const quint16 *img, size_t n)
+{
+    convert(img, pool[slot], n);
+    emit newImage(pool[slot], n);
+}
+
+/**
+ * @brief Display the LED 1 and LED 2 frames in buf side by side, in a single image twice as wide.
+ */
+
+void DisplayWorker::emitBoth(int slot)
+{
+    const bool clip = autoContrast.loadAcquire();
+    processFrame(led1Stats, buf, clip);
+    processFrame(led2Stats, buf + BUFSIZE, clip);
+
+    const size_t rowBytes = FRAME_SIDE * sizeof(quint16);
+    for (int y = 0; y < FRAME_SIDE; ++y) {
+        memcpy(composite + 2 * y * FRAME_SIDE, buf + y * FRAME_SIDE, rowBytes);
+        memcpy(composite + (2 * y + 1) * FRAME_SIDE, buf + BUFSIZE + y * FRAME_SIDE, rowBytes);
+    }
+    emitImage(slot, composite, 2 * BUFSIZE);
+}
+
+/**
+ * @brief Display the ratio LED 1 / LED 2 of the frames in buf (of the mean or max images,
+ * depending on the display mode).
+ *
+ * Auto contrast does not apply.
+ */
+
+void DisplayWorker::emitRatio(int slot)
+{
+    processFrame(led1Stats, buf, false);
+    processFrame(led2Stats, buf + BUFSIZE, false);
+
+    ratio(buf, buf + BUFSIZE, ratioBuf, BUFSIZE);
+    for (int i = 0; i < BUFSIZE; ++i) {
+        pool[slot][i] = ratioBuf[i];
+    }
+    emit newImage(pool[slot], BUFSIZE);
+}
+
+/**
+ * @brief A display buffer not owned by any receiver, -1 if all are in use.
+ */
+
+int DisplayWorker::acquireBuffer()
+{
+    for (int i = 0; i < DISPLAY_POOL_SIZE; ++i) {
+        if (poolBusy[i].testAndSetAcquire(0, 1)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Give back a buffer received through newImage(). Thread safe.
+ *
+ * Receivers own the data until they call this, so that the buffer is not overwritten while they
+ * are reading it. Frames are skipped while all buffers are owned by receivers.
+ */
+
+void DisplayWorker::releaseBuffer(const void *data)
+{
+    for (int i = 0; i < DISPLAY_POOL_SIZE; ++i) {
+        if (pool[i] == data) {
+            poolBusy[i].storeRelease(0);
+            return;
         }
-        emit newImage(bufd, BUFSIZE);
     }
 }
 
 DisplayWorker::DISPLAY_WHAT DisplayWorker::getDisplayWhat() const
 {
-    return displayWhat;
+    return static_cast<DISPLAY_WHAT>(displayWhat.loadAcquire());
 }
 
+/**
+ * @brief Channel(s) to display. DISPLAY_BOTH shows the newest LED 1 and LED 2 frames side by side
+ * (images twice as wide), DISPLAY_RATIO their ratio LED 1 / LED 2.
+ */
+
 void DisplayWorker::setDisplayWhat(const DISPLAY_WHAT &value)
 {
-    displayWhat = value;
+    displayWhat.storeRelease(value);
+}
+
+DisplayWorker::DISPLAY_MODE DisplayWorker::getDisplayMode() const
+{
+    return static_cast<DISPLAY_MODE>(displayMode.loadAcquire());
+}
+
+/**
+ * @brief Display each frame, the rolling mean of the last frames or their max projection.
+ */
+
+void DisplayWorker::setDisplayMode(const DISPLAY_MODE &value)
+{
+    displayMode.storeRelease(value);
+}
+
+int DisplayWorker::getRollingMeanFrames() const
+{
+    return rollingMeanFrames.loadAcquire();
+}
+
+/**
+ * @brief Number of displayed frames averaged in DISPLAY_MODE_MEAN, at most
+ * getMaxRollingMeanFrames(). Resets the statistics.
+ */
+
+void DisplayWorker::setRollingMeanFrames(int value)
+{
+    rollingMeanFrames.storeRelease(qBound(1, value, getMaxRollingMeanFrames()));
+    resetStats();
+}
+
+/**
+ * @brief Longest rolling mean, limited by the memory of the ring of frames of each LED.
+ */
+
+int DisplayWorker::getMaxRollingMeanFrames() const
+{
+    return led1Stats.getMaxRollingFrames();
+}
+
+/**
+ * @brief Restart rolling mean and max projection from the next frame. Thread safe.
+ */
+
+void DisplayWorker::resetStats()
+{
+    resetRequested.storeRelease(1);
+}
+
+bool DisplayWorker::isAutoContrastEnabled() const
+{
+    return autoContrast.loadAcquire();
+}
+
+/**
+ * @brief Clip the displayed image to the given intensity percentiles.
+ */
+
+void DisplayWorker::setAutoContrastEnabled(bool value)
+{
+    autoContrast.storeRelease(value);
+}
+
+/**
+ * @brief Percentiles used by auto contrast. Call while the display is not running.
+ * @param low Between 0 and 1
+ * @param high Between 0 and 1
+ */
+
+void DisplayWorker::setAutoContrastPercentiles(double low, double high)
+{
+    lowPercentile = low;
+    highPercentile = high;
+}
+
+/**
+ * @brief Source of the frames while saving (see SaveStackWorker::getFrameMailbox()).
+ *
+ * If not set, or in free run, the last frame is polled from the camera instead.
+ */
+
+void DisplayWorker::setFrameMailbox(FrameMailbox *value)
+{
+    frameMailbox = value;
 }
@@ -1,8 +1,14 @@
 #ifndef DISPLAYWORKER_H
 #define DISPLAYWORKER_H
 
+#include <QAtomicInt>
 #include <QThread>
 
+#include "displaystats.h"
+#include "framemailbox.h"
+
+#define DISPLAY_POOL_SIZE 3
+
 class OrcaFlash;
 
 class DisplayWorker : public QThread
@@ -13,6 +19,14 @@ public:
         DISPLAY_ALL,
         DISPLAY_LED1,
         DISPLAY_LED2,
+        DISPLAY_BOTH,
+        DISPLAY_RATIO,
+    };
+
+    enum DISPLAY_MODE {
+        DISPLAY_MODE_LIVE,
+        DISPLAY_MODE_MEAN,
+        DISPLAY_MODE_MAX,
     };
 
     DisplayWorker(OrcaFlash *orca, QObject *parent = nullptr);
@@ -21,19 +35,57 @@ public:
     DISPLAY_WHAT getDisplayWhat() const;
     void setDisplayWhat(const DISPLAY_WHAT &value);
 
+    DISPLAY_MODE getDisplayMode() const;
+    void setDisplayMode(const DISPLAY_MODE &value);
+
+    int getRollingMeanFrames() const;
+    void setRollingMeanFrames(int value);
+    int getMaxRollingMeanFrames() const;
+    void resetStats();
+
+    bool isAutoContrastEnabled() const;
+    void setAutoContrastEnabled(bool value);
+    void setAutoContrastPercentiles(double low, double high);
+
+    void setFrameMailbox(FrameMailbox *value);
+
+    void releaseBuffer(const void *data);
+
 signals:
-    void newImage(double *data, size_t n);
+    void newImage(const double *data, size_t n);
 
 protected:
     virtual void run();
 
 private:
+    bool grabFrame(FrameMailbox::CHANNEL channel, quint16 *dest,
+                   FrameMailbox::CHANNEL *grabbed = nullptr);
+    void processFrame(DisplayStats &s, quint16 *img, bool clip);
+    void emitImage(int slot, const quint16 *img, size_t n);
+    void emitBoth(int slot);
+    void emitRatio(int slot);
+    int acquireBuffer();
+
     OrcaFlash *orca;
+    FrameMailbox *frameMailbox = nullptr;
+    bool useMailbox;
+    int triggerPeriod_ms;
     uint16_t *buf;
-    double *bufd;
+    uint16_t *composite;
+    float *ratioBuf;
+    double *pool[DISPLAY_POOL_SIZE];  // two frames each
+    QAtomicInt poolBusy[DISPLAY_POOL_SIZE];
     bool running;
 
-    DISPLAY_WHAT displayWhat;
+    // set from the GUI thread, read by the worker once per frame
+    QAtomicInt displayWhat;
+    QAtomicInt displayMode;
+    QAtomicInt rollingMeanFrames;
+    QAtomicInt autoContrast;
+
+    DisplayStats led1Stats, led2Stats;
+    QAtomicInt resetRequested;
+    double lowPercentile, highPercentile;
 };
 
 #endif // DISPLAYWORKER_H
@@ -0,0 +1,325 @@
+#include <stdexcept>
+
+#include <QTimer>
+
+#include <qtlab/core/logmanager.h>
+
+#include "edgerecorder.h"
+#include "timeline.h"
+
+#define EDGES_MAGIC "OLEDGLOG"
+#define EDGES_VERSION 2
+#define INTERVALMSEC 100
+#define BUFFER_SAMPLES (1 << 18)    // on board/in driver, per task
+
+static Logger *logger = logManager().getLogger("EdgeRecorder");
+
+
+EdgeRecorder::EdgeRecorder(QObject *parent) : QObject(parent)
+{
+    diTask = new NITask(this);
+    ciTask = new NITask(this);
+
+    timer = new QTimer(this);
+    timer->setInterval(INTERVALMSEC);
+    connect(timer, &QTimer::timeout, this, &EdgeRecorder::readOut);
+
+    for (int i = 0; i < N_LINES; ++i) {
+        physChan[i] = QString("Dev2/port0/line%1").arg(i);
+    }
+}
+
+bool EdgeRecorder::isEnabled() const
+{
+    return enabled;
+}
+
+void EdgeRecorder::setEnabled(bool value)
+{
+    enabled = value;
+}
+
+QString EdgeRecorder::getLinePhysChan(EdgeRecorder::LINE line) const
+{
+    return physChan[line];
+}
+
+/**
+ * @brief Digital input line the signal is wired to, e.g. Dev2/port0/line0.
+ * @param value Empty not to record this signal.
+ */
+
+void EdgeRecorder::setLinePhysChan(EdgeRecorder::LINE line, const QString &value)
+{
+    physChan[line] = value;
+}
+
+/**
+ * @brief File the edges of the next recording are written to, empty to only count them.
+ */
+
+void EdgeRecorder::setOutputFile(const QString &value)
+{
+    outputFile = value;
+}
+
+/**
+ * @brief Create the change detection and timestamping tasks.
+ * @param counter Counter used to timestamp the edges, on the device of the DI lines.
+ */
+
+void EdgeRecorder::createTasks(const QString &counter)
+{
+    clearTasks();
+#ifndef DEMO_MODE
+    QStringList lines;
+    recordedLines.clear();
+    for (int i = 0; i < N_LINES; ++i) {
+        if (!physChan[i].isEmpty()) {
+            lines << physChan[i];
+            recordedLines << static_cast<LINE>(i);
+        }
+    }
+    if (lines.isEmpty()) {
+        throw std::runtime_error("No line to record hardware edges from");
+    }
+
+    const QString dev = counter.section('/', 0, 0, QString::SectionSkipEmpty);
+    for (const QString &line : lines) {
+        if (line.section('/', 0, 0, QString::SectionSkipEmpty) != dev) {
+            throw std::runtime_error(
+                QString("Hardware edges: %1 is not on the device of counter %2")
+                .arg(line).arg(counter).toStdString());
+        }
+    }
+    const QByteArray lineList = lines.join(",").toLatin1();
+    const QByteArray changeDetectionEvent =
+        QString("/%1/ChangeDetectionEvent").arg(dev).toLatin1();
+
+    diTask->createTask("edgesDI");
+    diTask->createDIChan(lineList, nullptr, NITask::LineGrp_ChanPerLine);
+    diTask->cfgChangeDetectionTiming(lineList, lineList, NITask::SampMode_ContSamps,
+                                     BUFFER_SAMPLES);
+
+    // latch the 100 MHz timebase count on every change detected by diTask
+    ciTask->createTask("edgesCI");
+    ciTask->createCICountEdgesChan(counter.toLatin1(), nullptr, NITask::Edge_Rising, 0,
+                                   DAQmx_Val_CountUp);
+    ciTask->setCICountEdgesTerm(nullptr, QString("/%1/100MHzTimebase").arg(dev).toLatin1());
+    ciTask->cfgSampClkTiming(changeDetectionEvent, 1e6, NITask::Edge_Rising,
+                             NITask::SampMode_ContSamps, BUFFER_SAMPLES);
+
+    lineBuf.resize(BUFFER_SAMPLES * recordedLines.size());
+    countBuf.resize(BUFFER_SAMPLES);
+    edgeBuf.reserve(BUFFER_SAMPLES);
+#else
+    Q_UNUSED(counter)
+#endif
+}
+
+bool EdgeRecorder::isInitialized() const
+{
+    return diTask->isInitialized() && ciTask->isInitialized();
+}
+
+/**
+ * @brief Read the initial levels and start recording, before any of the recorded outputs starts.
+ */
+
+void EdgeRecorder::start()
+{
+    QStringList lines;
+    for (LINE line : recordedLines) {
+        lines << physChan[line];
+    }
+
+    // on demand read of the levels the edges apply to
+    NITask probe;
+    probe.createTask("edgesInitialLevels");
+    probe.createDIChan(lines.join(",").toLatin1(), nullptr, NITask::LineGrp_ChanPerLine);
+    int32 read = 0, bytesPerSamp = 0;
+    probe.readDigitalLines(1, 1, DAQmx_Val_GroupByScanNumber, lineBuf.data(), lineBuf.size(),
+                           &read, &bytesPerSamp);
+    probe.clearTask();
+
+    for (int i = 0; i < N_LINES; ++i) {
+        level[i] = false;
+    }
+    for (int c = 0; c < recordedLines.size(); ++c) {
+        level[recordedLines.at(c)] = lineBuf.at(c);
+    }
+    lastCount = 0;
+    tick = 0;
+    lastWrittenTick = 0;
+    mainTriggerTick = -1;
+    edgeCount = 0;
+    readError = false;
+    openOutputFile();
+
+    // ciTask must be running when the first change is detected
+    ciTask->startTask();
+    diTask->startTask();
+    running = true;
+    timer->start();
+}
+
+/**
+ * @brief Read the edges still in the buffers, stop the tasks and finalize the output file.
+ */
+
+void EdgeRecorder::stop()
+{
+    if (!running) {
+        return;
+    }
+    running = false;
+    timer->stop();
+    if (!readError) {
+        readOut();
+    }
+    diTask->stopTask();
+    ciTask->stopTask();
+    closeOutputFile();
+    logger->info(QString("%1 hardware edges recorded").arg(edgeCount));
+}
+
+void EdgeRecorder::clearTasks()
+{
+    running = false;
+    timer->stop();
+    closeOutputFile();
+    if (diTask->isInitialized()) {
+        diTask->clearTask();
+    }
+    if (ciTask->isInitialized()) {
+        ciTask->clearTask();
+    }
+}
+
+quint64 EdgeRecorder::getEdgeCount() const
+{
+    return edgeCount;
+}
+
+QString EdgeRecorder::lineName(EdgeRecorder::LINE line)
+{
+    switch (line) {
+    case LINE_MAIN_TRIGGER:
+        return Timeline::lineName(Timeline::LINE_MAIN_TRIGGER);
+    case LINE_LED1:
+        return Timeline::lineName(Timeline::LINE_LED1);
+    case LINE_LED2:
+        return Timeline::lineName(Timeline::LINE_LED2);
+    case LINE_STIMULATION:
+        return Timeline::lineName(Timeline::LINE_STIMULATION);
+    case LINE_AUX_STIMULATION:
+        return Timeline::lineName(Timeline::LINE_AUX_STIMULATION);
+    case LINE_CAMERA_EXPOSURE:
+        return "camera_exposure";
+    default:
+        return "";
+    }
+}
+
+void EdgeRecorder::readOut()
+{
+    const int nChans = recordedLines.size();
+    int32 read = 0, countRead = 0;
+    try {
+        // both tasks are sampled by the same event, but are not read at the same instant
+        const quint32 avail = qMin(diTask->getReadAvailSampPerChan(),
+                                   ciTask->getReadAvailSampPerChan());
+        if (!avail) {
+            return;
+        }
+        int32 bytesPerSamp = 0;
+        diTask->readDigitalLines(avail, INTERVALMSEC / 1000., DAQmx_Val_GroupByScanNumber,
+                                 lineBuf.data(), lineBuf.size(), &read, &bytesPerSamp);
+        ciTask->readCounterU32(read, INTERVALMSEC / 1000., countBuf.data(), countBuf.size(),
+                               &countRead);
+    } catch (std::runtime_error e) {
+        // a DAQmx error (e.g. buffer overflow) does not go away: do not retry every interval
+        timer->stop();
+        readError = true;
+        logger->critical(QString("%1. Hardware edges are not recorded any more").arg(e.what()));
+        return;
+    }
+
+    edgeBuf.clear();
+    const uInt8 *state = lineBuf.constData();
+    const int n = qMin(read, countRead);
+    for (int i = 0; i < n; ++i, state += nChans) {
+        tick += static_cast<uInt32>(countBuf.at(i) - lastCount);  // unwrap
+        lastCount = countBuf.at(i);
+        for (int c = 0; c < nChans; ++c) {
+            const LINE line = recordedLines.at(c);
+            const bool l = state[c];
+            if (l == level[line]) {
+                continue;
+            }
+            level[line] = l;
+            if (line == LINE_MAIN_TRIGGER && l && mainTriggerTick < 0) {
+                mainTriggerTick = tick;
+            }
+            quint64 delta = tick - lastWrittenTick;
+            lastWrittenTick = tick;
+            do {
+                quint8 b = delta & 0x7f;
+                delta >>= 7;
+                edgeBuf.append(char(delta ? b | 0x80 : b));
+            } while (delta);
+            edgeBuf.append(char(line << 1 | l));
+            ++edgeCount;
+        }
+    }
+    if (file.isOpen()) {
+        stream.writeRawData(edgeBuf.constData(), edgeBuf.size());
+    }
+}
+
+/**
+ * @brief Write the header, with the layout of Timeline::saveBinary() plus the main trigger tick.
+ *
+ * The main trigger tick and the number of edges are written by closeOutputFile().
+ */
+
+void EdgeRecorder::openOutputFile()
+{
+    if (outputFile.isEmpty()) {
+        return;
+    }
+    file.setFileName(outputFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + outputFile).toStdString());
+    }
+
+    stream.setDevice(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+    stream.writeRawData(EDGES_MAGIC, 8);
+    stream << quint32(EDGES_VERSION);
+    stream << double(TIMELINE_TICK);
+    stream << quint32(N_LINES);
+    for (int i = 0; i < N_LINES; ++i) {
+        QByteArray name = lineName(static_cast<LINE>(i)).toLatin1();
+        stream << quint8(name.size());
+        stream.writeRawData(name.constData(), name.size());
+        stream << quint8(level[i]);
+    }
+    headerEndPos = file.pos();
+    stream << qint64(-1);
+    stream << quint64(0);
+}
+
+void EdgeRecorder::closeOutputFile()
+{
+    if (!file.isOpen()) {
+        return;
+    }
+    file.seek(headerEndPos);
+    stream << qint64(mainTriggerTick);
+    stream << quint64(edgeCount);
+    stream.setDevice(nullptr);
+    file.close();
+}
@@ -0,0 +1,99 @@
+#ifndef EDGERECORDER_H
+#define EDGERECORDER_H
+
+#include <QDataStream>
+#include <QFile>
+#include <QObject>
+#include <QVector>
+
+#include <qtlab/hw/ni/nitask.h>
+
+class QTimer;
+
+/**
+ * @brief Timestamps of the actual edges of the trigger, illumination and stimulation lines.
+ *
+ * Each recorded signal is wired to a digital input line (port0 of an X series device, the only
+ * port supporting change detection). A buffered change detection DI task samples the state of
+ * all lines on every rising or falling edge of any of them, and a counter input task, sampled by
+ * the same ChangeDetectionEvent, latches the count of the 100 MHz timebase: every edge is
+ * timestamped in hardware with 10 ns resolution, software only empties the buffers every
+ * INTERVALMSEC ms. The counter must be on the device of the DI lines.
+ *
+ * The 32 bit count wraps every ~43 s: consecutive edges must be closer than that, which is always
+ * the case when the main trigger is recorded.
+ *
+ * Edges are streamed to file with the layout of Timeline::saveBinary() (magic "OLEDGLOG"), with
+ * one more header field before the number of edges: the tick of the first rising edge of the main
+ * trigger (qint64, -1 if none was recorded). Ticks are counted from the start of the recording,
+ * which precedes the main trigger: subtracting that tick gives the times of the compiled
+ * timeline. The initial level of each line is read before starting.
+ */
+
+class EdgeRecorder : public QObject
+{
+    Q_OBJECT
+public:
+    enum LINE {
+        LINE_MAIN_TRIGGER,
+        LINE_LED1,
+        LINE_LED2,
+        LINE_STIMULATION,
+        LINE_AUX_STIMULATION,
+        LINE_CAMERA_EXPOSURE,
+
+        N_LINES,
+    };
+
+    explicit EdgeRecorder(QObject *parent = nullptr);
+
+    bool isEnabled() const;
+    void setEnabled(bool value);
+
+    QString getLinePhysChan(LINE line) const;
+    void setLinePhysChan(LINE line, const QString &value);
+
+    void setOutputFile(const QString &value);
+
+    void createTasks(const QString &counter);
+    bool isInitialized() const;
+    void start();
+    void stop();
+    void clearTasks();
+
+    quint64 getEdgeCount() const;
+
+    static QString lineName(LINE line);
+
+private:
+    void readOut();
+    void openOutputFile();
+    void closeOutputFile();
+
+    NITask *diTask;
+    NITask *ciTask;
+    QTimer *timer;
+
+    bool enabled = false;
+    QString physChan[N_LINES];
+    QString outputFile;
+
+    QVector<LINE> recordedLines;    // one per DI channel
+    QVector<uInt8> lineBuf;
+    QVector<uInt32> countBuf;
+    QByteArray edgeBuf;
+    bool level[N_LINES] = {};
+    uInt32 lastCount = 0;
+    qint64 tick = 0;                // unwrapped count of the last sample
+    qint64 lastWrittenTick = 0;
+    qint64 mainTriggerTick = -1;    // first rising edge of the main trigger
+    bool running = false;
+    bool readError = false;
+
+    QFile file;
+    QDataStream stream;
+    qint64 headerEndPos = 0;        // file offset of the main trigger tick
+    quint64 edgeCount = 0;
+};
+
+#endif // EDGERECORDER_H
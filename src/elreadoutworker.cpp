@@ -1,13 +1,17 @@
 #include <QFile>
 #include <QTextStream>
 
+#include "optrode.h"
 #include "tasks.h"
 
 #include "elreadoutworker.h"
+#include "synctable.h"
 
 #include <qtlab/core/logmanager.h>
 
 #define INTERVALMSEC 100
+#define CLOSED_LOOP_INTERVALMSEC 1  // short blocks, bounded detection latency
+#define CLOSED_LOOP_MAX_EVENTS (1 << 16)  // preallocated, beyond this events are still recorded
 
 static Logger *logger = logManager().getLogger("ElReadoutWorker");
 
@@ -23,31 +27,195 @@ void ElReadoutWorker::start()
 {
     totRead = 0;
     totEmitted = 0;
-    mainBuffer.clear();
-    if (!freeRun) {
-        mainBuffer.reserve(totToBeRead);
-    }
 
     try {
         readoutRate = task->getSampClkRate();
+        if (rawEnabled) {
+            scalingCoeffs = optrode().NITasks()->getElectrodeScalingCoeffs();
+        }
     } catch (std::runtime_error e) {
         logger->critical(e.what());
         return;
     }
+    if (syncTable && !freeRun) {
+        // the rate actually set by the driver
+        syncTable->setStreamPeriod(SyncTable::STREAM_ELECTRODE, 1. / readoutRate);
+    }
+
+    // the user setting is kept, the spectrum is only skipped for this acquisition if it fails
+    spectrumActive = spectrumEnabled;
+    if (spectrumActive) {
+        try {
+            spectrum.init(readoutRate);
+        } catch (std::runtime_error e) {
+            logger->critical(QString("Cannot compute the spectrum in this acquisition: %1")
+                             .arg(e.what()));
+            spectrumActive = false;
+        }
+        const QStringList unresolved = spectrum.getUnresolvedBands();
+        if (spectrumActive && !unresolved.isEmpty()) {
+            logger->warning(QString("Spectrum resolution %1 Hz is too coarse for bands %2, "
+                                    "increase the segment size")
+                            .arg(spectrum.getFrequencyResolution())
+                            .arg(unresolved.join(", ")));
+        }
+        spectrum.setBandPowerRecordingEnabled(!freeRun && saveToFileEnabled);
+        if (!freeRun && saveToFileEnabled) {
+            spectrum.reserveBandPowers(totToBeRead / (spectrum.getEffectiveSegmentSize()
+                                                      * (1 - spectrum.getOverlap())) + 1);
+        }
+    }
+
+    filterActive = filterEnabled;
+    if (filterActive) {
+        try {
+            filterBank.design(readoutRate);
+        } catch (std::runtime_error e) {
+            logger->critical(QString("Cannot filter in this acquisition: %1").arg(e.what()));
+            filterActive = false;
+        }
+    }
+    if (filterActive) {
+        if (filterBank.getEffectiveLFPCutoff() < filterBank.getLFPCutoff()) {
+            logger->warning(QString("LFP cutoff clamped to %1 Hz (LFP rate %2 Hz)")
+                            .arg(filterBank.getEffectiveLFPCutoff())
+                            .arg(filterBank.getEffectiveLFPRate()));
+        }
+    }
+
+    closedLoop = !freeRun && optrode().NITasks()->isClosedLoopActive();
+    closedLoopEvents.clear();
+    if (closedLoop) {
+        detector.init(readoutRate, readBufferSize());
+        // no allocation on the readout thread while detecting
+        closedLoopEvents.reserve(qMin<qint64>(detector.maxDetections(totToBeRead),
+                                              CLOSED_LOOP_MAX_EVENTS));
+        logger->info(QString("Closed loop: %1 detector, threshold %2")
+                     .arg(ClosedLoopDetector::detectorName(detector.getDetector()))
+                     .arg(detector.getThreshold()));
+    }
 
-    timer->start(INTERVALMSEC);
+    if (saveToFileEnabled && !freeRun) {
+        try {
+            openOutputFiles();
+        } catch (std::runtime_error e) {
+            logger->critical(e.what());
+            closeOutputFiles();
+        }
+    }
+
+    timer->setTimerType(closedLoop ? Qt::PreciseTimer : Qt::CoarseTimer);
+    timer->start(closedLoop ? CLOSED_LOOP_INTERVALMSEC : INTERVALMSEC);
     et.restart();
 }
 
 void ElReadoutWorker::stop()
 {
-    timer->stop();
-    if (saveToFileEnabled) {
-        saveToFile(outputFile);
+    if (timer->isActive()) {
+        // stopped before all samples were read
+        timer->stop();
+        emit acquisitionCompleted(false);
+    }
+    if (closedLoop && saveToFileEnabled) {
+        try {
+            writeClosedLoopEventsToFile(outputFile + "_closedloop.dat");
+        } catch (std::runtime_error e) {
+            logger->critical(e.what());
+        }
+    }
+    if (!mainStorage.isOpen()) {
+        return;
+    }
+    closeOutputFiles();
+    if (spectrumActive) {
+        try {
+            writeBandPowersToFile(outputFile + "_bandpower.dat");
+        } catch (std::runtime_error e) {
+            logger->critical(e.what());
+        }
+    }
+}
+
+/**
+ * @brief Create output files, samples are then written to disk as they are acquired.
+ *
+ * Files (see MappedStorage for the format): <outputFile>_electrode.bin (Volts, or raw ADC codes
+ * together with their scaling coefficients), and if the filter bank is enabled
+ * <outputFile>_lfp.bin and <outputFile>_spikes.bin (Volts).
+ *
+ * In trial mode, electrode samples go to one file per trial, <outputFile>_<trial>_electrode.bin.
+ * Filtered streams and band powers are continuous over all trials.
+ */
+
+void ElReadoutWorker::openOutputFiles()
+{
+    openMainStorage(0);
+
+    if (filterActive) {
+        lfpStorage.open(outputFile + "_lfp.bin", MappedStorage::SAMPLE_TYPE_F64,
+                        filterBank.getEffectiveLFPRate());
+        spikeStorage.open(outputFile + "_spikes.bin", MappedStorage::SAMPLE_TYPE_F64,
+                          readoutRate);
+    }
+}
+
+void ElReadoutWorker::openMainStorage(size_t trial)
+{
+    QString fname = outputFile;
+    if (samplesPerTrial > 0) {
+        fname += QString("_%1").arg(trial, 5, 10, QChar('0'));
+    }
+    fname += "_electrode.bin";
+
+    if (rawEnabled) {
+        mainStorage.open(fname, MappedStorage::SAMPLE_TYPE_I16, readoutRate, scalingCoeffs);
+    } else {
+        mainStorage.open(fname, MappedStorage::SAMPLE_TYPE_F64, readoutRate);
+    }
+}
+
+/**
+ * @brief Append the samples that follow the first totRead ones, moving on to the file of the next
+ * trial at trial boundaries.
+ */
+
+void ElReadoutWorker::appendToMainStorage(const void *samples, size_t n)
+{
+    const size_t sampleSize = rawEnabled ? sizeof(qint16) : sizeof(double);
+    const char *p = static_cast<const char *>(samples);
+    size_t i = totRead;
+    while (n > 0) {
+        size_t chunk = n;
+        if (samplesPerTrial > 0) {
+            if (i > 0 && i % samplesPerTrial == 0) {
+                mainStorage.close();
+                openMainStorage(i / samplesPerTrial);
+            }
+            chunk = qMin(n, samplesPerTrial - i % samplesPerTrial);
+        }
+        mainStorage.append(p, chunk);
+        p += chunk * sampleSize;
+        i += chunk;
+        n -= chunk;
     }
 }
 
-void ElReadoutWorker::saveToFile(QString fullPath)
+void ElReadoutWorker::closeOutputFiles()
+{
+    mainStorage.close();
+    lfpStorage.close();
+    spikeStorage.close();
+}
+
+/**
+ * @brief Save the band power time series (text, tab separated).
+ * @param fullPath
+ *
+ * One row per spectrum segment: segment center time (s) followed by the power (V^2) in each
+ * band. The first line is a header with the band limits.
+ */
+
+void ElReadoutWorker::writeBandPowersToFile(const QString &fullPath)
 {
     QFile outFile(fullPath);
     if (!outFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
@@ -55,53 +223,249 @@ void ElReadoutWorker::saveToFile(QString fullPath)
                   QString("Cannot open output file " + fullPath).toStdString());
     }
 
+    const QVector<SpectrumAnalyzer::Band> bands = spectrum.getBands();
+    const QStringList names = spectrum.getBandNames();
+    const QVector<double> &times = spectrum.getBandPowerTimes();
+    const QVector<double> &powers = spectrum.getBandPowers();
+
     QTextStream stream(&outFile);
-    for (double v : mainBuffer) {
-        stream << v << "\n";
+    stream << "# t";
+    for (int i = 0; i < bands.size(); ++i) {
+        stream << "\t" << names.value(i) << QString("[%1-%2Hz]")
+            .arg(bands.at(i).first).arg(bands.at(i).second);
+    }
+    stream << "\n";
+
+    auto p = powers.constBegin();
+    for (double t : times) {
+        stream << t;
+        for (int i = 0; i < bands.size(); ++i) {
+            stream << "\t" << *p++;
+        }
+        stream << "\n";
     }
 
     outFile.close();
 }
 
+/**
+ * @brief Samples per channel of the read buffer: three times those expected in a read interval.
+ */
+
+int ElReadoutWorker::readBufferSize() const
+{
+    return readoutRate * INTERVALMSEC / 1000. * 3;
+}
+
 void ElReadoutWorker::readOut()
 {
-    int32 sampsPerChanRead;
+    int32 sampsPerChanRead = 0;
+    qint64 readTime = 0;
 
 #ifndef DEMO_MODE
-    buf.resize(readoutRate * INTERVALMSEC / 1000. * 3);
+    const int bufSize = readBufferSize();
     try {
         quint32 avail = task->getReadAvailSampPerChan();
         if (!avail)
             return;
-        task->readAnalogF64(avail, INTERVALMSEC / 1000.,
-                            DAQmx_Val_GroupByChannel,
-                            buf.data(), buf.size(), &sampsPerChanRead);
+        if (rawEnabled) {
+            rawBuf.resize(bufSize);
+            task->readBinaryI16(avail, INTERVALMSEC / 1000.,
+                                DAQmx_Val_GroupByChannel,
+                                rawBuf.data(), rawBuf.size(), &sampsPerChanRead);
+        } else {
+            buf.resize(bufSize);
+            task->readAnalogF64(avail, INTERVALMSEC / 1000.,
+                                DAQmx_Val_GroupByChannel,
+                                buf.data(), buf.size(), &sampsPerChanRead);
+        }
+        readTime = et.nsecsElapsed();
     } catch (std::runtime_error e) {
         logger->critical(e.what());
     }
 #else
-    sampsPerChanRead = readoutRate * INTERVALMSEC / 1000.;
+    sampsPerChanRead = readoutRate * timer->interval() / 1000.;
+    readTime = et.nsecsElapsed();
     buf = QVector<double>(sampsPerChanRead, rand());
+    rawBuf = QVector<qint16>(sampsPerChanRead, static_cast<qint16>(rand()));
 #endif
     if (!sampsPerChanRead) {
         return;
     }
-    buf.resize(sampsPerChanRead);
 
-    if (!freeRun && (totRead + sampsPerChanRead >= totToBeRead)) {
-        buf.resize(totToBeRead - totRead);
-        mainBuffer.append(buf);
+    size_t n = sampsPerChanRead;
+    bool completed = false;
+    if (!freeRun && (totRead + n >= totToBeRead)) {
+        n = totToBeRead - totRead;
+        completed = true;
+    }
+
+    if (rawEnabled) {
+        rawBuf.resize(n);
+        if (filterActive || spectrumActive || closedLoop) {
+            // only the filter bank, the spectrum and the detector need the whole block in Volts
+            buf = toVolts(rawBuf);
+        }
+    } else {
+        buf.resize(n);
+    }
+
+    if (closedLoop) {
+        // before anything else, the output latency includes all the processing done until here
+        runClosedLoop(readTime);
+    }
+
+    try {
+        if (mainStorage.isOpen()) {
+            if (rawEnabled) {
+                appendToMainStorage(rawBuf.constData(), n);
+            } else {
+                appendToMainStorage(buf.constData(), n);
+            }
+        }
+    } catch (std::runtime_error e) {
+        logger->critical(e.what());
+        closeOutputFiles();
+    }
+
+    totRead += n;
+
+    if (syncTable && !freeRun) {
+        // arrival time of the last sample of the block
+        syncTable->addClockPoint(SyncTable::STREAM_ELECTRODE, totRead - 1, syncTable->hostTime());
+    }
+
+    if (completed) {
+        // after the last clock point, the sync table is saved when all jobs are completed
         timer->stop();
         emit acquisitionCompleted(true);
     }
-    else {
-        mainBuffer.append(buf);
+
+    if (filterActive) {
+        filterBank.process(buf.constData(), buf.size(), lfpBuf, spikeBuf);
+        try {
+            if (lfpStorage.isOpen()) {
+                lfpStorage.append(lfpBuf.constData(), lfpBuf.size());
+                spikeStorage.append(spikeBuf.constData(), spikeBuf.size());
+            }
+        } catch (std::runtime_error e) {
+            logger->critical(e.what());
+            closeOutputFiles();
+        }
+    }
+
+    if (spectrumActive && spectrum.process(buf.constData(), buf.size())) {
+        emit newSpectrum(spectrum.getPSD(), spectrum.getSegmentPSD(),
+                         spectrum.getFrequencyResolution());
+    }
+
+    switch (filterActive ? plotSource : PLOT_SOURCE_RAW) {
+    case PLOT_SOURCE_LFP:
+        emitData(lfpBuf, filterBank.getEffectiveLFPRate());
+        break;
+    case PLOT_SOURCE_SPIKES:
+        emitData(spikeBuf, readoutRate);
+        break;
+    case PLOT_SOURCE_RAW:
+    default:
+        if (rawEnabled) {
+            emitData(rawBuf, readoutRate);
+        } else {
+            emitData(buf, readoutRate);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Detect events in the current block and fire the closed-loop output for each of them.
+ * @param readTime et time (ns) at which the block was read
+ *
+ * For each event, the latency from the detected sample to the output command is estimated as the
+ * age of the sample when its block was read (samples acquired after it in the same block), plus
+ * the processing time until the output command, plus the time taken by the output command.
+ */
+
+void ElReadoutWorker::runClosedLoop(qint64 readTime)
+{
+    if (detector.process(buf.constData(), buf.size(), totRead) == 0) {
+        return;
+    }
+    const qint64 lastIndex = totRead + buf.size() - 1;
+    for (const ClosedLoopDetector::Detection &d : detector.getDetections()) {
+        ClosedLoopEvent e;
+        e.index = d.index;
+        e.value = d.value;
+        const qint64 t0 = et.nsecsElapsed();
+        e.fired = optrode().NITasks()->fireClosedLoopOutput();
+        const qint64 t1 = et.nsecsElapsed();
+        e.sampleAge = (lastIndex - d.index) / readoutRate;
+        e.processing = (t0 - readTime) * 1e-9;
+        e.output = (t1 - t0) * 1e-9;
+        closedLoopEvents << e;
+
+        const double t = syncTable ? syncTable->toCommonTime(SyncTable::STREAM_ELECTRODE, d.index)
+                                   : d.index / readoutRate;
+        if (e.fired && syncTable) {
+            syncTable->addEvent(SyncTable::EVENT_CLOSED_LOOP, t);
+        }
+        // after the output was fired, so that receivers do not add to its latency
+        emit eventDetected(t);
+    }
+}
+
+/**
+ * @brief Save the closed-loop events (text, tab separated) and log a latency summary.
+ * @param fullPath
+ *
+ * One row per detected event: sample index, detector value, whether the output was fired (it is
+ * not while the previous pulse train is still running) and the latency terms in ms, see
+ * runClosedLoop().
+ */
+
+void ElReadoutWorker::writeClosedLoopEventsToFile(const QString &fullPath)
+{
+    QFile outFile(fullPath);
+    if (!outFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fullPath).toStdString());
+    }
+
+    QTextStream stream(&outFile);
+    stream << "# index\tvalue\tfired\tsample_age_ms\tprocessing_ms\toutput_ms\ttotal_ms\n";
+    int fired = 0;
+    double sum = 0, max = 0;
+    for (const ClosedLoopEvent &e : closedLoopEvents) {
+        const double total = e.sampleAge + e.processing + e.output;
+        stream << e.index << "\t" << e.value << "\t" << (e.fired ? 1 : 0) << "\t"
+               << e.sampleAge * 1e3 << "\t" << e.processing * 1e3 << "\t"
+               << e.output * 1e3 << "\t" << total * 1e3 << "\n";
+        if (e.fired) {
+            fired++;
+            sum += total;
+            max = qMax(max, total);
+        }
     }
+    outFile.close();
+
+    logger->info(QString("Closed loop: %1 events, %2 fired, latency mean %3 ms, max %4 ms")
+                 .arg(closedLoopEvents.size()).arg(fired)
+                 .arg(fired > 0 ? sum / fired * 1e3 : 0).arg(max * 1e3));
+}
 
-    totRead += buf.size();
+/**
+ * @brief Emit newData(), downsampling to emissionRate if needed.
+ * @param data Block of samples (Volts or raw ADC codes)
+ * @param rate Sample rate of data
+ *
+ * Raw ADC codes are converted to Volts only for the samples that are actually emitted.
+ */
 
+template<typename T>
+void ElReadoutWorker::emitData(const QVector<T> &data, double rate)
+{
     if (emissionRate <= 0) {
-        emit newData(buf);
+        emit newData(toVolts(data));
         return;
     }
 
@@ -115,19 +479,158 @@ void ElReadoutWorker::readOut()
     tempSize = elapsed * emissionRate - totEmitted;
     temp.resize(tempSize);
 
-    size_t stride = readoutRate / emissionRate;
+    size_t stride = qMax(1., rate / emissionRate);
     auto it = temp.begin();
-    auto buf_it = buf.begin();
-    while (it < temp.end()) {
-        *it = *buf_it;
+    auto buf_it = data.begin();
+    while (it < temp.end() && buf_it < data.end()) {
+        *it = toVolts(*buf_it);
         it++;
         buf_it += stride;
     }
+    temp.resize(it - temp.begin());
 
     totEmitted += temp.size();
     emit newData(temp);
 }
 
+double ElReadoutWorker::toVolts(double value) const
+{
+    return value;
+}
+
+/**
+ * @brief Apply the device scaling polynomial to a raw ADC code
+ */
+
+double ElReadoutWorker::toVolts(qint16 value) const
+{
+    double ret = 0;
+    for (int i = scalingCoeffs.size() - 1; i >= 0; --i) {
+        ret = ret * value + scalingCoeffs.at(i);
+    }
+    return ret;
+}
+
+QVector<double> ElReadoutWorker::toVolts(const QVector<double> &data) const
+{
+    return data;
+}
+
+QVector<double> ElReadoutWorker::toVolts(const QVector<qint16> &data) const
+{
+    QVector<double> ret(data.size());
+    double *out = ret.data();
+    for (qint16 v : data) {
+        *out++ = toVolts(v);
+    }
+    return ret;
+}
+
+ElReadoutWorker::PLOT_SOURCE ElReadoutWorker::getPlotSource() const
+{
+    return plotSource;
+}
+
+/**
+ * @brief Select which stream is sent to plots through newData()
+ * @param value
+ *
+ * Filtered streams are only available when the filter bank is enabled, otherwise raw data is
+ * emitted.
+ */
+
+void ElReadoutWorker::setPlotSource(const PLOT_SOURCE &value)
+{
+    plotSource = value;
+}
+
+bool ElReadoutWorker::isRawEnabled() const
+{
+    return rawEnabled;
+}
+
+/**
+ * @brief Read unscaled 16 bit ADC codes instead of Volts
+ * @param value
+ *
+ * Raw codes are saved to file (<run>_electrode.bin) together with the device scaling
+ * coefficients. Conversion to Volts is only performed for data emitted for plotting and when the
+ * filter bank is enabled.
+ */
+
+void ElReadoutWorker::setRawEnabled(bool value)
+{
+    rawEnabled = value;
+}
+
+QVector<double> ElReadoutWorker::getScalingCoeffs() const
+{
+    return scalingCoeffs;
+}
+
+void ElReadoutWorker::setSyncTable(SyncTable *value)
+{
+    syncTable = value;
+}
+
+bool ElReadoutWorker::isSpectrumEnabled() const
+{
+    return spectrumEnabled;
+}
+
+/**
+ * @brief Compute the power spectrum of the signal while acquiring
+ * @param value
+ *
+ * When enabled, newSpectrum() is emitted whenever new segments have been analyzed and the band
+ * power time series is saved as <run>_bandpower.dat.
+ */
+
+void ElReadoutWorker::setSpectrumEnabled(bool value)
+{
+    spectrumEnabled = value;
+}
+
+SpectrumAnalyzer *ElReadoutWorker::getSpectrumAnalyzer()
+{
+    return &spectrum;
+}
+
+/**
+ * @brief Detector used for closed-loop stimulation, see Tasks::setClosedLoopEnabled().
+ *
+ * Parameters are taken into account at start(). While closed loop is active, the electrode
+ * readout is polled every CLOSED_LOOP_INTERVALMSEC ms instead of every INTERVALMSEC ms.
+ */
+
+ClosedLoopDetector *ElReadoutWorker::getClosedLoopDetector()
+{
+    return &detector;
+}
+
+FilterBank *ElReadoutWorker::getFilterBank()
+{
+    return &filterBank;
+}
+
+bool ElReadoutWorker::isFilterEnabled() const
+{
+    return filterEnabled;
+}
+
+/**
+ * @brief Split the signal in LFP and spike band while acquiring
+ * @param value
+ *
+ * When enabled, the two bands are saved to separate files next to the raw data (LFP decimated
+ * to FilterBank::getLFPRate()). Filter parameters are taken from getFilterBank() at start().
+ */
+
+void ElReadoutWorker::setFilterEnabled(bool value)
+{
+    filterEnabled = value;
+}
+
 void ElReadoutWorker::setSaveToFileEnabled(bool value)
 {
     saveToFileEnabled = value;
@@ -152,6 +655,11 @@ size_t ElReadoutWorker::getTotRead() const
     return totRead;
 }
 
+/**
+ * @brief Set the output file name
+ * @param value Full path without extension (suffixes are appended for each stream)
+ */
+
 void ElReadoutWorker::setOutputFile(const QString &value)
 {
     outputFile = value;
@@ -166,3 +674,13 @@ void ElReadoutWorker::setTotToBeRead(const size_t &value)
 {
     totToBeRead = value;
 }
+
+/**
+ * @brief Save the electrode samples of each trial to a separate file.
+ * @param value Samples per trial, 0 to disable trial mode
+ */
+
+void ElReadoutWorker::setSamplesPerTrial(const size_t &value)
+{
+    samplesPerTrial = value;
+}
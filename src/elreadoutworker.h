@@ -7,13 +7,27 @@
 
 #include <qtlab/hw/ni/nitask.h>
 
+#include "closedloopdetector.h"
+#include "filterbank.h"
+#include "mappedstorage.h"
+#include "spectrum.h"
+
+class SyncTable;
+
 class ElReadoutWorker : public QObject
 {
     Q_OBJECT
 public:
+    enum PLOT_SOURCE {
+        PLOT_SOURCE_RAW,
+        PLOT_SOURCE_LFP,
+        PLOT_SOURCE_SPIKES,
+    };
+
     ElReadoutWorker(NITask *elReadoutTask, QObject *parent = nullptr);
 
     void setTotToBeRead(const size_t &value);
+    void setSamplesPerTrial(const size_t &value);
 
     void setFreeRun(bool value);
 
@@ -25,34 +39,97 @@ public:
 
     void setSaveToFileEnabled(bool value);
 
+    bool isFilterEnabled() const;
+    void setFilterEnabled(bool value);
+
+    FilterBank *getFilterBank();
+
+    bool isRawEnabled() const;
+    void setRawEnabled(bool value);
+
+    QVector<double> getScalingCoeffs() const;
+
+    void setSyncTable(SyncTable *value);
+
+    bool isSpectrumEnabled() const;
+    void setSpectrumEnabled(bool value);
+
+    SpectrumAnalyzer *getSpectrumAnalyzer();
+
+    PLOT_SOURCE getPlotSource() const;
+    void setPlotSource(const PLOT_SOURCE &value);
+
+    ClosedLoopDetector *getClosedLoopDetector();
+
 public slots:
     void start();
     void stop();
-    void saveToFile(QString fullPath);
 
 signals:
     void newData(const QVector<double> &buf);
+    void newSpectrum(const QVector<double> &psd, const QVector<double> &segmentPSD, double df);
     void acquisitionCompleted(bool ok);
+    void eventDetected(double commonTime);
 
 private:
     void readOut();
+    int readBufferSize() const;
+    template<typename T>
+    void emitData(const QVector<T> &data, double rate);
+    void openOutputFiles();
+    void openMainStorage(size_t trial);
+    void appendToMainStorage(const void *samples, size_t n);
+    void closeOutputFiles();
+    void writeBandPowersToFile(const QString &fullPath);
+    void runClosedLoop(qint64 readTime);
+    void writeClosedLoopEventsToFile(const QString &fullPath);
+
+    double toVolts(double value) const;
+    double toVolts(qint16 value) const;
+    QVector<double> toVolts(const QVector<double> &data) const;
+    QVector<double> toVolts(const QVector<qint16> &data) const;
+
+    struct ClosedLoopEvent {
+        qint64 index;
+        double value;
+        bool fired;
+        double sampleAge;   // s, from the detected sample to the end of its block
+        double processing;  // s, from the end of the read to the output command
+        double output;      // s, output command
+    };
 
     QTimer *timer;
     QElapsedTimer et;
     QVector<double> buf;
-    QVector<double> mainBuffer;
+    QVector<qint16> rawBuf;
+    QVector<double> scalingCoeffs;
+    QVector<double> lfpBuf, spikeBuf;
+    MappedStorage mainStorage, lfpStorage, spikeStorage;
+    FilterBank filterBank;
+    SpectrumAnalyzer spectrum;
     QString outputFile;
     double emissionRate = -1;
 
     bool freeRun = true;
     bool saveToFileEnabled = false;
+    bool filterEnabled = false;
+    bool rawEnabled = false;
+    bool spectrumEnabled = false;
+    bool spectrumActive = false;  // in the current acquisition
+    bool filterActive = false;    // in the current acquisition
+    PLOT_SOURCE plotSource = PLOT_SOURCE_RAW;
+    ClosedLoopDetector detector;
+    bool closedLoop = false;
+    QVector<ClosedLoopEvent> closedLoopEvents;
     size_t totRead;
     size_t totToBeRead;
+    size_t samplesPerTrial = 0;
     size_t totEmitted;
 
     double readoutRate;
 
     NITask *task;
+    SyncTable *syncTable = nullptr;
 };
 
 #endif // ELREADOUTWORKER_H
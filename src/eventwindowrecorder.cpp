@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <QFile>
+#include <QTextStream>
+#include <QtMath>
+
+#include "eventwindowrecorder.h"
+#include "videoencoder.h"
+
+using namespace Spinnaker;
+
+
+EventWindowRecorder::EventWindowRecorder()
+{
+}
+
+EventWindowRecorder::~EventWindowRecorder()
+{
+    stop();
+}
+
+/**
+ * @brief Allocate the ring and schedule the windows of the events known in advance.
+ * @param encoder Already opened, frames are pushed to it
+ * @param frameRate Hz
+ */
+
+void EventWindowRecorder::start(VideoEncoder *encoder, double frameRate)
+{
+    this->encoder = encoder;
+    this->frameRate = frameRate;
+
+    const int ringSize = qMax(1, qCeil(preEventTime * frameRate));
+    ring.resize(ringSize);
+    for (RingFrame &f : ring) {
+        f.index = -1;
+        f.img = Image::Create();
+    }
+    ringHead = ringCount = 0;
+
+    windows.clear();
+    segments.clear();
+    encodeUntil = 0;
+
+    QMutexLocker locker(&mutex);
+    lastIndex = -1;
+    pendingEvents = eventTimes;
+    running = true;
+}
+
+/**
+ * @brief Handle a grabbed frame.
+ * @param index Frame index in the camera stream, counting lost frames and missed triggers (see
+ * FrameLog::getLastFrameIndex()), so that it stays aligned with common time
+ * @param img Stream image, ownership is taken
+ */
+
+void EventWindowRecorder::process(qint64 index, ImagePtr img)
+{
+    fetchEvents();
+
+    mutex.lock();
+    lastIndex = index;
+    mutex.unlock();
+
+    while (!windows.isEmpty() && windows.first().first <= index) {
+        Segment w = windows.takeFirst();
+        if (index >= encodeUntil) {
+            // a new window opens: encode what is left of its pre-event margin
+            flushRing(w.first, w.second);
+        }
+        encodeUntil = qMax(encodeUntil, w.second + 1);
+    }
+
+    if (index < encodeUntil) {
+        encode(index, img);
+    } else {
+        store(index, img);
+    }
+}
+
+/**
+ * @brief Drop the frames left in the ring.
+ */
+
+void EventWindowRecorder::stop()
+{
+    mutex.lock();
+    running = false;
+    pendingEvents.clear();
+    mutex.unlock();
+
+    ring.clear();
+    ringHead = ringCount = 0;
+}
+
+/**
+ * @brief Events known before the acquisition starts (e.g. stimulation onsets).
+ * @param times Common time (s)
+ */
+
+void EventWindowRecorder::setEventTimes(const QVector<double> &times)
+{
+    QMutexLocker locker(&mutex);
+    eventTimes = times;
+}
+
+/**
+ * @brief Add an event while acquiring. Thread safe.
+ * @param commonTime s
+ *
+ * Ignored when not recording, e.g. when the behavior video is saved continuously.
+ */
+
+void EventWindowRecorder::addEvent(double commonTime)
+{
+    QMutexLocker locker(&mutex);
+    if (running) {
+        pendingEvents.append(commonTime);
+    }
+}
+
+/**
+ * @brief Add an event at the last grabbed frame (manual mark), by its index as given to process().
+ * Thread safe.
+ */
+
+void EventWindowRecorder::markEvent()
+{
+    QMutexLocker locker(&mutex);
+    if (lastIndex >= 0 && frameRate > 0) {
+        pendingEvents.append(lastIndex / frameRate);
+    }
+}
+
+void EventWindowRecorder::fetchEvents()
+{
+    mutex.lock();
+    QVector<double> events = pendingEvents;
+    pendingEvents.clear();
+    mutex.unlock();
+
+    if (events.isEmpty()) {
+        return;
+    }
+
+    for (double t : events) {
+        qint64 i = qRound64(t * frameRate);
+        windows.append(Segment(qMax<qint64>(0, i - qCeil(preEventTime * frameRate)),
+                               i + qCeil(postEventTime * frameRate)));
+    }
+    std::sort(windows.begin(), windows.end());
+}
+
+/**
+ * @brief Send the frames in the ring with index in [first, last] to the encoder, oldest first.
+ *
+ * Older frames are discarded as well, since they could not be encoded anymore without breaking the
+ * frame order in the video.
+ */
+
+void EventWindowRecorder::flushRing(qint64 first, qint64 last)
+{
+    const int size = ring.size();
+    int slot = (ringHead - ringCount + size) % size;
+    for (int k = 0; k < ringCount; ++k) {
+        RingFrame &f = ring[slot];
+        if (f.index >= 0 && f.index <= last) {
+            if (f.index >= first) {
+                encode(f.index, f.img);
+                f.img = Image::Create();  // the encoder now owns the copy
+            }
+            f.index = -1;
+        }
+        slot = (slot + 1) % size;
+    }
+}
+
+void EventWindowRecorder::encode(qint64 index, ImagePtr img)
+{
+    if (!segments.isEmpty() && segments.last().second == index - 1) {
+        segments.last().second = index;
+    } else {
+        segments.append(Segment(index, index));
+    }
+    encoder->push(img, index);
+}
+
+void EventWindowRecorder::store(qint64 index, ImagePtr img)
+{
+    RingFrame &f = ring[ringHead];
+    try {
+        f.img->DeepCopy(img);
+        f.index = index;
+    }
+    catch (Spinnaker::Exception e) {
+        f.index = -1;
+    }
+    img->Release();
+
+    ringHead = (ringHead + 1) % ring.size();
+    ringCount = qMin(ringCount + 1, ring.size());
+}
+
+double EventWindowRecorder::getPreEventTime() const
+{
+    return preEventTime;
+}
+
+/**
+ * @brief Margin before each event (s), determines the ring size. Has effect at the next start().
+ */
+
+void EventWindowRecorder::setPreEventTime(double value)
+{
+    preEventTime = qMax(0., value);
+}
+
+double EventWindowRecorder::getPostEventTime() const
+{
+    return postEventTime;
+}
+
+/**
+ * @brief Margin after each event (s).
+ */
+
+void EventWindowRecorder::setPostEventTime(double value)
+{
+    postEventTime = qMax(0., value);
+}
+
+/**
+ * @brief Frame intervals that have been sent to the encoder, in acquisition order.
+ *
+ * Frames dropped by the encoder because of a full queue are not accounted for, the frame log
+ * holds the actual video frame of each grabbed frame (see FrameLog).
+ */
+
+QVector<EventWindowRecorder::Segment> EventWindowRecorder::getSegments() const
+{
+    return segments;
+}
+
+/**
+ * @brief Write the recorded segments (tab separated): first and last frame index of each segment
+ * and the corresponding frame index in the video.
+ */
+
+void EventWindowRecorder::saveSegments(const QString &fileName) const
+{
+    QFile outFile(fileName);
+    if (!outFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fileName).toStdString());
+    }
+
+    QTextStream out(&outFile);
+    out << "first_frame\tlast_frame\tvideo_frame\n";
+    qint64 videoFrame = 0;
+    for (const Segment &s : segments) {
+        out << s.first << "\t" << s.second << "\t" << videoFrame << "\n";
+        videoFrame += s.second - s.first + 1;
+    }
+
+    outFile.close();
+}
@@ -0,0 +1,82 @@
+#ifndef EVENTWINDOWRECORDER_H
+#define EVENTWINDOWRECORDER_H
+
+#include <Spinnaker.h>
+
+#include <QMutex>
+#include <QPair>
+#include <QVector>
+
+class VideoEncoder;
+
+/**
+ * @brief Records behavior video only in windows around events.
+ *
+ * Frames are continuously copied into a fixed ring holding the last pre-event margin, and the
+ * stream buffers are immediately given back to the camera. When a window opens, the frames of the
+ * pre-event margin still in the ring are sent to the encoder, followed by live frames until the end
+ * of the post-event margin. Overlapping windows are merged.
+ *
+ * Events are given in common time (seconds from the first main trigger, see SyncTable); frame i is
+ * at i / frameRate, i being the frame index of FrameLog (grabbed frames are not counted, since
+ * lost frames would shift them). They can be known in advance (setEventTimes()) or added while
+ * acquiring from any thread (addEvent(), markEvent()).
+ */
+
+class EventWindowRecorder
+{
+public:
+    typedef QPair<qint64, qint64> Segment;  // [first, last] frame index
+
+    EventWindowRecorder();
+    virtual ~EventWindowRecorder();
+
+    void start(VideoEncoder *encoder, double frameRate);
+    void process(qint64 index, Spinnaker::ImagePtr img);
+    void stop();
+
+    void setEventTimes(const QVector<double> &times);
+    void addEvent(double commonTime);
+    void markEvent();
+
+    double getPreEventTime() const;
+    void setPreEventTime(double value);
+
+    double getPostEventTime() const;
+    void setPostEventTime(double value);
+
+    QVector<Segment> getSegments() const;
+    void saveSegments(const QString &fileName) const;
+
+private:
+    struct RingFrame {
+        qint64 index;
+        Spinnaker::ImagePtr img;
+    };
+
+    VideoEncoder *encoder = nullptr;
+    double preEventTime = 1;
+    double postEventTime = 2;
+    double frameRate = 0;
+
+    QVector<RingFrame> ring;
+    int ringHead = 0;  // next slot to be written
+    int ringCount = 0;
+
+    mutable QMutex mutex;
+    QVector<double> eventTimes;
+    QVector<double> pendingEvents;
+    qint64 lastIndex = -1;
+    bool running = false;  // between start() and stop()
+
+    QVector<Segment> windows;  // not yet open, sorted by start
+    qint64 encodeUntil = 0;    // exclusive
+    QVector<Segment> segments;
+
+    void fetchEvents();
+    void flushRing(qint64 first, qint64 last);
+    void encode(qint64 index, Spinnaker::ImagePtr img);
+    void store(qint64 index, Spinnaker::ImagePtr img);
+};
+
+#endif // EVENTWINDOWRECORDER_H
@@ -0,0 +1,234 @@
+#include <cmath>
+#include <stdexcept>
+
+#include <QtMath>
+
+#include "filterbank.h"
+
+#define FILTER_ORDER 4
+#define MAX_CUTOFF_FRACTION 0.45  // of the sample rate
+
+
+FilterBank::FilterBank()
+{
+}
+
+/**
+ * @brief Compute filter coefficients for the given sample rate and reset the filter state.
+ * @param sampleRate Hz
+ *
+ * Cutoff frequencies are clamped below Nyquist. The LFP decimation factor is the closest integer
+ * to sampleRate / lfpRate, see getEffectiveLFPRate(); the LFP cutoff is also clamped below the
+ * Nyquist frequency of the decimated stream, so that decimation does not alias, see
+ * getEffectiveLFPCutoff().
+ *
+ * Throws std::runtime_error if the spike band is empty once clamped.
+ */
+
+void FilterBank::design(double sampleRate)
+{
+    this->sampleRate = sampleRate;
+
+    const double maxCutoff = MAX_CUTOFF_FRACTION * sampleRate;
+
+    decimation = qMax(1, qRound(sampleRate / lfpRate));
+    effectiveLFPCutoff = qMin(lfpCutoff, maxCutoff / decimation);
+
+    const double spikeLow = qMin(spikeLowCut, maxCutoff);
+    if (spikeLow >= spikeHighCut) {
+        throw std::runtime_error(
+                  QString("Invalid spike band [%1, %2] Hz at %3 Hz")
+                  .arg(spikeLowCut).arg(spikeHighCut).arg(sampleRate).toStdString());
+    }
+
+    QVector<Biquad> lfpSections
+        = butterworth(FILTER_ORDER, effectiveLFPCutoff, sampleRate, false);
+
+    QVector<Biquad> spikeSections
+        = butterworth(FILTER_ORDER, spikeLow, sampleRate, true);
+    if (spikeHighCut < maxCutoff) {
+        spikeSections << butterworth(FILTER_ORDER, spikeHighCut, sampleRate, false);
+    }
+
+    // pad the shorter cascade with identity sections so that lanes can run in lockstep
+    const Biquad identity = {1, 0, 0, 0, 0};
+    const int nSections = qMax(lfpSections.size(), spikeSections.size());
+    while (lfpSections.size() < nSections) {
+        lfpSections << identity;
+    }
+    while (spikeSections.size() < nSections) {
+        spikeSections << identity;
+    }
+
+    sections.resize(nSections);
+    for (int i = 0; i < nSections; ++i) {
+        const Biquad *lanes[N_LANES];
+        lanes[LANE_LFP] = &lfpSections.at(i);
+        lanes[LANE_SPIKES] = &spikeSections.at(i);
+
+        Section &s = sections[i];
+        for (int l = 0; l < N_LANES; ++l) {
+            s.b0[l] = lanes[l]->b0;
+            s.b1[l] = lanes[l]->b1;
+            s.b2[l] = lanes[l]->b2;
+            s.a1[l] = lanes[l]->a1;
+            s.a2[l] = lanes[l]->a2;
+        }
+    }
+
+    reset();
+}
+
+void FilterBank::reset()
+{
+    for (Section &s : sections) {
+        for (int l = 0; l < N_LANES; ++l) {
+            s.z1[l] = s.z2[l] = 0;
+        }
+    }
+    // so that the very first sample is kept
+    decimationPhase = decimation - 1;
+}
+
+/**
+ * @brief Filter a block of samples.
+ * @param in Input samples
+ * @param n Number of input samples
+ * @param lfp Output LFP, decimated (resized as needed)
+ * @param spikes Output spike band, at the input sample rate (resized to n)
+ *
+ * Filter state is kept across calls, so consecutive blocks are filtered as a continuous stream.
+ */
+
+void FilterBank::process(const double *in, size_t n,
+                         QVector<double> &lfp, QVector<double> &spikes)
+{
+    spikes.resize(n);
+    lfp.resize(0);
+    lfp.reserve(n / decimation + 1);
+
+    Section *begin = sections.data();
+    Section *end = begin + sections.size();
+
+    for (size_t i = 0; i < n; ++i) {
+        double x[N_LANES];
+        for (int l = 0; l < N_LANES; ++l) {
+            x[l] = in[i];
+        }
+
+        // transposed direct form II
+        for (Section *s = begin; s < end; ++s) {
+            for (int l = 0; l < N_LANES; ++l) {
+                double y = s->b0[l] * x[l] + s->z1[l];
+                s->z1[l] = s->b1[l] * x[l] - s->a1[l] * y + s->z2[l];
+                s->z2[l] = s->b2[l] * x[l] - s->a2[l] * y;
+                x[l] = y;
+            }
+        }
+
+        spikes[i] = x[LANE_SPIKES];
+        if (++decimationPhase >= decimation) {
+            decimationPhase = 0;
+            lfp.append(x[LANE_LFP]);
+        }
+    }
+}
+
+/**
+ * @brief Butterworth filter as a cascade of biquads (bilinear transform).
+ * @param order Must be even
+ * @param fc Cutoff frequency (Hz)
+ * @param fs Sample rate (Hz)
+ * @param highpass Highpass if true, lowpass otherwise
+ * @return Normalized sections (a0 = 1)
+ */
+
+QVector<FilterBank::Biquad> FilterBank::butterworth(int order, double fc, double fs,
+                                                    bool highpass)
+{
+    QVector<Biquad> ret;
+
+    const double w0 = 2 * M_PI * fc / fs;
+    const double cosw0 = cos(w0);
+    const double sinw0 = sin(w0);
+
+    for (int k = 1; k <= order / 2; ++k) {
+        double Q = 1. / (2 * cos(M_PI * (2 * k - 1) / (2. * order)));
+        double alpha = sinw0 / (2 * Q);
+        double a0 = 1 + alpha;
+
+        Biquad bq;
+        if (highpass) {
+            bq.b0 = (1 + cosw0) / 2 / a0;
+            bq.b1 = -(1 + cosw0) / a0;
+        } else {
+            bq.b0 = (1 - cosw0) / 2 / a0;
+            bq.b1 = (1 - cosw0) / a0;
+        }
+        bq.b2 = bq.b0;
+        bq.a1 = -2 * cosw0 / a0;
+        bq.a2 = (1 - alpha) / a0;
+
+        ret << bq;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Actual rate of the LFP stream, after rounding of the decimation factor.
+ */
+
+double FilterBank::getEffectiveLFPRate() const
+{
+    return sampleRate / decimation;
+}
+
+double FilterBank::getLFPCutoff() const
+{
+    return lfpCutoff;
+}
+
+/**
+ * @brief LFP cutoff actually used, after clamping below the Nyquist frequency of the LFP stream.
+ */
+
+double FilterBank::getEffectiveLFPCutoff() const
+{
+    return effectiveLFPCutoff;
+}
+
+void FilterBank::setLFPCutoff(double Hz)
+{
+    lfpCutoff = Hz;
+}
+
+double FilterBank::getLFPRate() const
+{
+    return lfpRate;
+}
+
+void FilterBank::setLFPRate(double Hz)
+{
+    lfpRate = Hz;
+}
+
+double FilterBank::getSpikeLowCut() const
+{
+    return spikeLowCut;
+}
+
+void FilterBank::setSpikeLowCut(double Hz)
+{
+    spikeLowCut = Hz;
+}
+
+double FilterBank::getSpikeHighCut() const
+{
+    return spikeHighCut;
+}
+
+void FilterBank::setSpikeHighCut(double Hz)
+{
+    spikeHighCut = Hz;
+}
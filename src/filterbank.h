@@ -0,0 +1,71 @@
+#ifndef FILTERBANK_H
+#define FILTERBANK_H
+
+#include <QVector>
+
+/**
+ * @brief Streaming IIR filter bank splitting the electrode signal into LFP and spike band.
+ *
+ * Both bands are computed in a single pass over each block: the two biquad cascades are run in
+ * lockstep, one per lane, so that the inner loop over the lanes can be vectorized by the
+ * compiler. The LFP lane is decimated on the fly to the requested LFP rate.
+ */
+
+class FilterBank
+{
+public:
+    FilterBank();
+
+    void design(double sampleRate);
+    void reset();
+
+    void process(const double *in, size_t n, QVector<double> &lfp, QVector<double> &spikes);
+
+    double getLFPCutoff() const;
+    void setLFPCutoff(double Hz);
+
+    double getLFPRate() const;
+    void setLFPRate(double Hz);
+
+    double getSpikeLowCut() const;
+    void setSpikeLowCut(double Hz);
+
+    double getSpikeHighCut() const;
+    void setSpikeHighCut(double Hz);
+
+    double getEffectiveLFPRate() const;
+    double getEffectiveLFPCutoff() const;
+
+private:
+    enum LANE {
+        LANE_LFP,
+        LANE_SPIKES,
+
+        N_LANES,
+    };
+
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+    };
+
+    struct Section {
+        double b0[N_LANES], b1[N_LANES], b2[N_LANES], a1[N_LANES], a2[N_LANES];
+        double z1[N_LANES], z2[N_LANES];
+    };
+
+    QVector<Section> sections;
+
+    double sampleRate = 0;
+    double lfpCutoff = 300;
+    double lfpRate = 1000;
+    double spikeLowCut = 300;
+    double spikeHighCut = 5000;
+
+    int decimation = 1;
+    double effectiveLFPCutoff = 300;
+    int decimationPhase = 0;
+
+    static QVector<Biquad> butterworth(int order, double fc, double fs, bool highpass);
+};
+
+#endif // FILTERBANK_H
@@ -0,0 +1,231 @@
+#include <stdexcept>
+
+#include <QDataStream>
+#include <QStringList>
+#include <QtMath>
+
+#include <qtlab/core/logmanager.h>
+
+#include "framelog.h"
+
+#define FRAMELOG_MAGIC "BHFRAMES"
+#define FRAMELOG_VERSION 2
+#define FRAMELOG_HEADER_SIZE 16
+#define PATCH_CHUNK 4096  // records read back at once by setVideoFrames()
+#define MAX_LISTED_GAPS 10
+
+static Logger *logger = logManager().getLogger("FrameLog");
+
+FrameLog::FrameLog()
+{
+}
+
+FrameLog::~FrameLog()
+{
+    close();
+}
+
+/**
+ * @brief Create the sidecar file and reset gap statistics.
+ */
+
+void FrameLog::open(const QString &fileName)
+{
+    close();
+
+    frames = frameIndex = frameIDGaps = frameIDResets = timestampGaps = missingFrames = 0;
+    gaps.clear();
+
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fileName).toStdString());
+    }
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.writeRawData(FRAMELOG_MAGIC, 8);
+    stream << quint32(FRAMELOG_VERSION);
+    stream << quint32(sizeof(Record));
+}
+
+void FrameLog::close()
+{
+    if (file.isOpen()) {
+        file.close();
+    }
+}
+
+bool FrameLog::isOpen() const
+{
+    return file.isOpen();
+}
+
+/**
+ * @brief Write the record of a grabbed frame and update gap statistics.
+ * @param frameID
+ * @param deviceTimestamp ns
+ * @param hostTime s
+ */
+
+void FrameLog::append(quint64 frameID, quint64 deviceTimestamp, double hostTime)
+{
+    Record r = {frameID, deviceTimestamp, hostTime, 0, -1};
+
+    if (frames > 0 && frameID <= last.frameID) {
+        // the camera counter was reset, nothing can be told about missing frames
+        frameIDResets++;
+        frameIndex++;
+        logger->warning(QString("%1: frame ID reset from %2 to %3")
+                        .arg(file.fileName()).arg(last.frameID).arg(frameID));
+    } else if (frames > 0) {
+        qint64 missing = 0;
+        if (frameID != last.frameID + 1) {
+            frameIDGaps++;
+            missing = static_cast<qint64>(frameID - last.frameID) - 1;
+        } else if (expectedPeriod > 0) {
+            double dt = (deviceTimestamp - last.deviceTimestamp) * 1e-9;
+            if (dt > 1.5 * expectedPeriod) {
+                timestampGaps++;
+                missing = qRound64(dt / expectedPeriod) - 1;
+            }
+        }
+        if (missing != 0) {
+            missingFrames += missing;
+            gaps.append({frameID, missing});
+        }
+        frameIndex += 1 + missing;
+    }
+
+    r.frameIndex = frameIndex;
+    if (file.isOpen()) {
+        file.write(reinterpret_cast<const char *>(&r), sizeof(Record));
+    }
+
+    last = r;
+    frames++;
+}
+
+/**
+ * @brief Fill in the video frame number of the records, once the encoder has finished.
+ * @param encodedFrameIndices Frame index of each video frame, see
+ * VideoEncoder::getEncodedFrameIndices()
+ *
+ * Frames are encoded in acquisition order, so the records are patched in a single pass. Records
+ * of frames that were not pushed to the encoder, or dropped by it, keep -1.
+ */
+
+void FrameLog::setVideoFrames(const QVector<qint64> &encodedFrameIndices)
+{
+    if (!file.isOpen() || encodedFrameIndices.isEmpty()) {
+        return;
+    }
+
+    QVector<Record> chunk(PATCH_CHUNK);
+    char *buf = reinterpret_cast<char *>(chunk.data());
+    qint64 pos = FRAMELOG_HEADER_SIZE;
+    int k = 0;
+
+    while (k < encodedFrameIndices.size() && file.seek(pos)) {
+        const int n = static_cast<int>(file.read(buf, PATCH_CHUNK * sizeof(Record))
+                                       / static_cast<qint64>(sizeof(Record)));
+        if (n <= 0) {
+            break;
+        }
+        for (int j = 0; j < n; ++j) {
+            Record &r = chunk[j];
+            while (k < encodedFrameIndices.size() && encodedFrameIndices.at(k) < r.frameIndex) {
+                k++;  // not in the log, can not happen with a monotonic frame index
+            }
+            if (k < encodedFrameIndices.size() && encodedFrameIndices.at(k) == r.frameIndex) {
+                r.videoFrame = k++;
+            }
+        }
+        file.seek(pos);
+        file.write(buf, n * sizeof(Record));
+        pos += n * sizeof(Record);
+    }
+
+    file.seek(file.size());
+}
+
+double FrameLog::getExpectedPeriod() const
+{
+    return expectedPeriod;
+}
+
+/**
+ * @brief Nominal frame period (s), used to detect missed triggers. 0 to disable.
+ */
+
+void FrameLog::setExpectedPeriod(double value)
+{
+    expectedPeriod = value;
+}
+
+qint64 FrameLog::getFrames() const
+{
+    return frames;
+}
+
+/**
+ * @brief Index of the last appended frame in the camera stream, 0 being the first frame.
+ *
+ * Follows the hardware frame ID and the missed triggers, so that the index of a frame is not
+ * skewed by the frames lost before it (unlike a count of grabbed frames).
+ */
+
+qint64 FrameLog::getLastFrameIndex() const
+{
+    return frameIndex;
+}
+
+qint64 FrameLog::getFrameIDGaps() const
+{
+    return frameIDGaps;
+}
+
+qint64 FrameLog::getFrameIDResets() const
+{
+    return frameIDResets;
+}
+
+qint64 FrameLog::getTimestampGaps() const
+{
+    return timestampGaps;
+}
+
+qint64 FrameLog::getMissingFrames() const
+{
+    return missingFrames;
+}
+
+const QVector<FrameLog::Gap> &FrameLog::getGaps() const
+{
+    return gaps;
+}
+
+/**
+ * @brief One line description of the detected gaps, to be logged at the end of a run.
+ */
+
+QString FrameLog::summary() const
+{
+    const QString resets = frameIDResets
+                           ? QString(", %1 frame ID resets").arg(frameIDResets) : QString();
+    if (gaps.isEmpty()) {
+        return QString("%1 frames, no gaps%2").arg(frames).arg(resets);
+    }
+
+    QStringList l;
+    for (int i = 0; i < qMin(gaps.size(), MAX_LISTED_GAPS); ++i) {
+        l << QString("%1 before frame ID %2").arg(gaps.at(i).missing).arg(gaps.at(i).frameID);
+    }
+    if (gaps.size() > MAX_LISTED_GAPS) {
+        l << "...";
+    }
+
+    return QString("%1 frames, %2 missing (%3 frame ID gaps, %4 missed triggers)%5: %6")
+           .arg(frames).arg(missingFrames).arg(frameIDGaps).arg(timestampGaps)
+           .arg(resets).arg(l.join(", "));
+}
@@ -0,0 +1,77 @@
+#ifndef FRAMELOG_H
+#define FRAMELOG_H
+
+#include <QFile>
+#include <QVector>
+
+/**
+ * @brief Per-frame metadata of a camera stream, streamed to a binary sidecar file.
+ *
+ * File layout (little endian): magic "BHFRAMES", version (quint32), record size (quint32),
+ * followed by one record per grabbed frame: frame ID (quint64, as counted by the camera), device
+ * timestamp (quint64, ns), host receive time (double, s, see SyncTable::hostTime()), frame index
+ * (qint64, see getLastFrameIndex()) and frame number in the video (qint64, -1 if the frame was not
+ * encoded, see setVideoFrames()).
+ *
+ * Gaps are detected while writing: a jump in the frame ID means the frame was produced by the
+ * camera but lost on the way, a jump in the device timestamp larger than 1.5 expected periods
+ * means that the camera missed a trigger. A frame ID that does not increase means that the
+ * camera counter was reset: it is logged and counted apart, not as missing frames.
+ */
+
+class FrameLog
+{
+public:
+    struct Gap {
+        quint64 frameID;   // first frame after the gap
+        qint64 missing;    // estimated number of missing frames
+    };
+
+    FrameLog();
+    virtual ~FrameLog();
+
+    void open(const QString &fileName);
+    void close();
+    bool isOpen() const;
+
+    void append(quint64 frameID, quint64 deviceTimestamp, double hostTime);
+    void setVideoFrames(const QVector<qint64> &encodedFrameIndices);
+
+    double getExpectedPeriod() const;
+    void setExpectedPeriod(double value);
+
+    qint64 getFrames() const;
+    qint64 getLastFrameIndex() const;
+    qint64 getFrameIDGaps() const;
+    qint64 getFrameIDResets() const;
+    qint64 getTimestampGaps() const;
+    qint64 getMissingFrames() const;
+    const QVector<Gap> &getGaps() const;
+
+    QString summary() const;
+
+private:
+#pragma pack(push, 1)
+    struct Record {
+        quint64 frameID;
+        quint64 deviceTimestamp;
+        double hostTime;
+        qint64 frameIndex;
+        qint64 videoFrame;
+    };
+#pragma pack(pop)
+
+    QFile file;
+    double expectedPeriod = 0;
+
+    qint64 frames = 0;
+    qint64 frameIndex = 0;      // of the last frame, see getLastFrameIndex()
+    qint64 frameIDGaps = 0;
+    qint64 frameIDResets = 0;
+    qint64 timestampGaps = 0;
+    qint64 missingFrames = 0;
+    QVector<Gap> gaps;
+    Record last;
+};
+
+#endif // FRAMELOG_H
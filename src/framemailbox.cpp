@@ -0,0 +1,62 @@
+#include <cstring>
+
+#include "framemailbox.h"
+
+
+FrameMailbox::FrameMailbox()
+{
+}
+
+/**
+ * @brief Offer a frame to the consumer. Called by the capture loop while the frame is locked.
+ * @param frameIndex Index of the frame since the start of the acquisition
+ * @param data
+ * @param n Number of pixels
+ */
+
+void FrameMailbox::post(qint64 frameIndex, const quint16 *data, size_t n)
+{
+    QMutexLocker locker(&mutex);
+    if (!requestDest) {
+        return;
+    }
+    if (requestedChannel != CHANNEL_ANY && frameIndex % 2 != requestedChannel) {
+        return;
+    }
+
+    memcpy(requestDest, data, qMin(n, requestSize) * sizeof(quint16));
+    requestDest = nullptr;
+    deliveredIndex = frameIndex;
+    delivered.wakeAll();
+}
+
+/**
+ * @brief Wait for the next frame of the given channel.
+ * @param channel
+ * @param dest Filled with the frame
+ * @param n Size of dest (pixels)
+ * @param timeout ms
+ * @param frameIndex If not null, set to the index of the frame
+ * @return false on timeout, in which case dest has not been written
+ */
+
+bool FrameMailbox::take(FrameMailbox::CHANNEL channel, quint16 *dest, size_t n,
+                        unsigned long timeout, qint64 *frameIndex)
+{
+    QMutexLocker locker(&mutex);
+    requestedChannel = channel;
+    requestDest = dest;
+    requestSize = n;
+
+    while (requestDest) {
+        if (!delivered.wait(&mutex, timeout) && requestDest) {
+            requestDest = nullptr;  // withdraw the request
+            return false;
+        }
+    }
+
+    if (frameIndex) {
+        *frameIndex = deliveredIndex;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef FRAMEMAILBOX_H
+#define FRAMEMAILBOX_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+/**
+ * @brief Hands the newest frame of a given LED channel from the capture loop to a consumer.
+ *
+ * The consumer asks for a frame with take(), passing its own buffer; the capture loop calls post()
+ * on each frame it has locked, and copies the first frame of the requested channel straight into
+ * that buffer. Frames are copied only when requested, so posting is almost free when nobody is
+ * waiting.
+ *
+ * Frames with an even index are LED 1, odd ones LED 2 (see SaveStackWorker).
+ */
+
+class FrameMailbox
+{
+public:
+    enum CHANNEL {
+        CHANNEL_ANY = -1,
+        CHANNEL_LED1 = 0,
+        CHANNEL_LED2 = 1,
+    };
+
+    FrameMailbox();
+
+    void post(qint64 frameIndex, const quint16 *data, size_t n);
+    bool take(CHANNEL channel, quint16 *dest, size_t n, unsigned long timeout,
+              qint64 *frameIndex = nullptr);
+
+private:
+    QMutex mutex;
+    QWaitCondition delivered;
+
+    CHANNEL requestedChannel = CHANNEL_ANY;
+    quint16 *requestDest = nullptr;
+    size_t requestSize = 0;
+    qint64 deliveredIndex = -1;
+};
+
+#endif // FRAMEMAILBOX_H
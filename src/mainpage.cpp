@@ -2,6 +2,11 @@
 #include <QLabel>
 #include <QSettings>
 #include <QRadioButton>
+#include <QComboBox>
+#include <QCheckBox>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QEvent>
 #include <QtSvg/QSvgRenderer>
 
 #include <qwt_plot_marker.h>
@@ -18,6 +23,7 @@
 #include "behavworker.h"
 #include "elreadoutworker.h"
 #include "displayworker.h"
+#include "savestackworker.h"
 
 #include "optrode.h"
 #include "tasks.h"
@@ -26,6 +32,7 @@
 
 #include "mainpage.h"
 #include "camdisplay.h"
+#include "spectrumwidget.h"
 
 #define SETTING_BEHAVCAM_FLIPLR "behavCamFlipLr"
 #define SETTING_BEHAVCAM_FLIPUD "behavCamFlipUd"
@@ -62,7 +69,28 @@ void MainPage::setupUi()
         pmw->flipud();
     pmw->setRotationStep(sett.value(SETTING_BEHAVCAM_ROTSTEP).toUInt());
 
-    connect(optrode().getBehavWorker(), &BehavWorker::newImage, pmw, &PixmapWidget::setPixmap);
+    // preview images come already downscaled to (at least) the widget size
+    connect(optrode().getBehavWorker(), &BehavWorker::newImage, pmw, [ = ](const QImage &img) {
+        pmw->setPixmap(QPixmap::fromImage(img));
+    });
+    pmw->installEventFilter(this);
+
+    for (int i = 1; i < optrode().behaviorCameraCount(); ++i) {
+        PixmapWidget *w = new PixmapWidget();
+        connect(optrode().getBehavWorker(i), &BehavWorker::newImage, w, [ = ](const QImage &img) {
+            w->setPixmap(QPixmap::fromImage(img));
+        });
+        w->installEventFilter(this);
+        extraPmws << w;
+    }
+
+    TimePlot *motionPlot = new TimePlot();
+    connect(optrode().getBehavWorker(), &BehavWorker::newMotionEnergy,
+            motionPlot, &TimePlot::appendPoints);
+
+    TimePlot *pupilPlot = new TimePlot();
+    connect(optrode().getBehavWorker(), &BehavWorker::newPupilArea,
+            pupilPlot, &TimePlot::appendPoints);
 
     TimePlot *timePlot = new TimePlot();
 
@@ -82,6 +110,19 @@ void MainPage::setupUi()
     connect(optrode().getElReadoutWorker(), &ElReadoutWorker::newData,
             timePlot, &TimePlot::appendPoints);
 
+    QComboBox *plotSourceComboBox = new QComboBox();
+    plotSourceComboBox->addItem("Raw", ElReadoutWorker::PLOT_SOURCE_RAW);
+    plotSourceComboBox->addItem("LFP", ElReadoutWorker::PLOT_SOURCE_LFP);
+    plotSourceComboBox->addItem("Spikes", ElReadoutWorker::PLOT_SOURCE_SPIKES);
+    connect(plotSourceComboBox, qOverload<int>(&QComboBox::currentIndexChanged), [ = ](){
+        optrode().getElReadoutWorker()->setPlotSource(
+            static_cast<ElReadoutWorker::PLOT_SOURCE>(plotSourceComboBox->currentData().toInt()));
+    });
+
+    SpectrumWidget *spectrumWidget = new SpectrumWidget();
+    connect(optrode().getElReadoutWorker(), &ElReadoutWorker::newSpectrum,
+            spectrumWidget, &SpectrumWidget::setSpectrum);
+
     double sr = 25;  // limit plotting to 25 Hz
 
     optrode().getElReadoutWorker()->setEmissionRate(sr);
@@ -89,9 +130,21 @@ void MainPage::setupUi()
     connect(&optrode(), &Optrode::started, this, [ = ](bool freeRun){
         Tasks *t = optrode().NITasks();
         timePlot->clear();
+        spectrumWidget->clear();
+        spectrumWidget->setVisible(optrode().getElReadoutWorker()->isSpectrumEnabled());
         timePlot->setSamplingRate(sr);
         timePlot->setBufSize(freeRun ? 22.0 : optrode().totalDuration());
 
+        motionPlot->clear();
+        motionPlot->setVisible(optrode().getBehavWorker()->isMotionEnergyEnabled());
+        motionPlot->setSamplingRate(t->getMainTrigFreq());
+        motionPlot->setBufSize(freeRun ? 22.0 : optrode().totalDuration());
+
+        pupilPlot->clear();
+        pupilPlot->setVisible(optrode().getBehavWorker()->isPupilTrackingEnabled());
+        pupilPlot->setSamplingRate(t->getMainTrigFreq());
+        pupilPlot->setBufSize(freeRun ? 22.0 : optrode().totalDuration());
+
         startMarker->setVisible(!freeRun);
         endMarker->setVisible(!freeRun);
 
@@ -100,14 +153,23 @@ void MainPage::setupUi()
     });
 
     DisplayWorker *dispWorker = new DisplayWorker(optrode().getOrca());
+    dispWorker->setFrameMailbox(optrode().getSSWorker()->getFrameMailbox());
 
     CamDisplay *camDisplay = new CamDisplay(this);
     camDisplay->setPlotSize(QSize(512, 512));
 
     camDisplay->setLUTPath(s.value(SETTINGSGROUP_OTHERSETTINGS, SETTING_LUTPATH).toString());
 
-    void (CameraPlot::*fp)(const double*, const size_t) = &CameraPlot::setData;
-    connect(dispWorker, &DisplayWorker::newImage, camDisplay->getPlot(), fp);
+    connect(dispWorker, &DisplayWorker::newImage, camDisplay->getPlot(),
+            [ = ](const double *data, size_t n){
+        // LED 1 and LED 2 side by side are twice as wide
+        QSize size(n > 512 * 512 ? 1024 : 512, 512);
+        if (camDisplay->getPlot()->getPlotSize() != size) {
+            camDisplay->setPlotSize(size);
+        }
+        camDisplay->getPlot()->setData(data, n);  // copies the data
+        dispWorker->releaseBuffer(data);
+    });
 
     AspectRatioWidget *arw = new AspectRatioWidget(camDisplay, 1);
 
@@ -115,12 +177,49 @@ void MainPage::setupUi()
     QRadioButton *allRadioButton = new QRadioButton("All");
     QRadioButton *led1RadioButton = new QRadioButton("LED 1");
     QRadioButton *led2RadioButton = new QRadioButton("LED 2");
+    QRadioButton *bothRadioButton = new QRadioButton("LED 1 | 2");
+    QRadioButton *ratioRadioButton = new QRadioButton("Ratio");
+    ratioRadioButton->setToolTip("LED 1 / LED 2");
 
     QHBoxLayout *hLayout = new QHBoxLayout();
     hLayout->addStretch();
     hLayout->addWidget(allRadioButton);
     hLayout->addWidget(led1RadioButton);
     hLayout->addWidget(led2RadioButton);
+    hLayout->addWidget(bothRadioButton);
+    hLayout->addWidget(ratioRadioButton);
+
+    QComboBox *displayModeComboBox = new QComboBox();
+    displayModeComboBox->addItem("Live", DisplayWorker::DISPLAY_MODE_LIVE);
+    displayModeComboBox->addItem("Mean", DisplayWorker::DISPLAY_MODE_MEAN);
+    displayModeComboBox->addItem("Max", DisplayWorker::DISPLAY_MODE_MAX);
+    connect(displayModeComboBox, qOverload<int>(&QComboBox::currentIndexChanged), [ = ](){
+        dispWorker->setDisplayMode(static_cast<DisplayWorker::DISPLAY_MODE>(
+                                       displayModeComboBox->currentData().toInt()));
+    });
+
+    QSpinBox *meanFramesSpinBox = new QSpinBox();
+    meanFramesSpinBox->setRange(1, dispWorker->getMaxRollingMeanFrames());
+    meanFramesSpinBox->setPrefix("N = ");
+    meanFramesSpinBox->setValue(dispWorker->getRollingMeanFrames());
+    meanFramesSpinBox->setToolTip("Number of frames of the rolling mean");
+    connect(meanFramesSpinBox, qOverload<int>(&QSpinBox::valueChanged),
+            dispWorker, &DisplayWorker::setRollingMeanFrames);
+
+    QPushButton *resetStatsPushButton = new QPushButton("Reset");
+    resetStatsPushButton->setToolTip("Restart rolling mean and max projection");
+    connect(resetStatsPushButton, &QPushButton::clicked, dispWorker, &DisplayWorker::resetStats);
+
+    QCheckBox *autoContrastCheckBox = new QCheckBox("Auto contrast");
+    autoContrastCheckBox->setToolTip("Clip to the 0.5-99.5 intensity percentiles");
+    connect(autoContrastCheckBox, &QCheckBox::toggled,
+            dispWorker, &DisplayWorker::setAutoContrastEnabled);
+
+    hLayout->addSpacing(20);
+    hLayout->addWidget(displayModeComboBox);
+    hLayout->addWidget(meanFramesSpinBox);
+    hLayout->addWidget(resetStatsPushButton);
+    hLayout->addWidget(autoContrastCheckBox);
     hLayout->addStretch();
 
     posCW = new PIPositionControlWidget(this);
@@ -146,6 +245,13 @@ void MainPage::setupUi()
 
     QVBoxLayout *tempVLaout = new QVBoxLayout();
     tempVLaout->addWidget(pmw, 4);
+    for (PixmapWidget *w : extraPmws) {
+        tempVLaout->addWidget(w, 4);
+    }
+    tempVLaout->addWidget(motionPlot, 1);
+    motionPlot->setVisible(optrode().getBehavWorker()->isMotionEnergyEnabled());
+    tempVLaout->addWidget(pupilPlot, 1);
+    pupilPlot->setVisible(optrode().getBehavWorker()->isPupilTrackingEnabled());
     tempVLaout->addStretch(1);
 
     hLayout = new QHBoxLayout();
@@ -155,7 +261,18 @@ void MainPage::setupUi()
 
     QVBoxLayout *vLayout = new QVBoxLayout();
     vLayout->addLayout(hLayout, 8);
-    vLayout->addWidget(timePlot, 2);
+
+    QHBoxLayout *plotLayout = new QHBoxLayout();
+    plotLayout->addWidget(timePlot, 3);
+    plotLayout->addWidget(spectrumWidget, 2);
+    spectrumWidget->setVisible(optrode().getElReadoutWorker()->isSpectrumEnabled());
+    vLayout->addLayout(plotLayout, 2);
+
+    QHBoxLayout *plotSourceLayout = new QHBoxLayout();
+    plotSourceLayout->addWidget(new QLabel("Electrode signal"));
+    plotSourceLayout->addWidget(plotSourceComboBox);
+    plotSourceLayout->addStretch();
+    vLayout->addLayout(plotSourceLayout);
 
     setLayout(vLayout);
 
@@ -176,6 +293,33 @@ void MainPage::setupUi()
             dispWorker->setDisplayWhat(DisplayWorker::DISPLAY_LED2);
         }
     });
+
+    connect(bothRadioButton, &QRadioButton::clicked, [ = ](bool checked){
+        if (checked) {
+            dispWorker->setDisplayWhat(DisplayWorker::DISPLAY_BOTH);
+        }
+    });
+
+    connect(ratioRadioButton, &QRadioButton::clicked, [ = ](bool checked){
+        if (checked) {
+            dispWorker->setDisplayWhat(DisplayWorker::DISPLAY_RATIO);
+        }
+    });
+}
+
+bool MainPage::eventFilter(QObject *obj, QEvent *event)
+{
+    if (event->type() == QEvent::Resize) {
+        if (obj == pmw) {
+            optrode().getBehavWorker()->setPreviewSize(pmw->size());
+        }
+        for (int i = 0; i < extraPmws.size(); ++i) {
+            if (obj == extraPmws.at(i)) {
+                optrode().getBehavWorker(i + 1)->setPreviewSize(extraPmws.at(i)->size());
+            }
+        }
+    }
+    return QWidget::eventFilter(obj, event);
 }
 
 void MainPage::saveSettings()
@@ -14,12 +14,16 @@ public:
     explicit MainPage(QWidget *parent = nullptr);
     virtual ~MainPage();
 
+protected:
+    bool eventFilter(QObject *obj, QEvent *event);
+
 signals:
 
 private:
     void setupUi();
     void saveSettings();
     PixmapWidget *pmw;
+    QList<PixmapWidget *> extraPmws;  // additional behavior cameras
     PIPositionControlWidget *posCW;
 };
 
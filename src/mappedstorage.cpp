@@ -0,0 +1,195 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <QDataStream>
+
+#include "mappedstorage.h"
+
+#define STORAGE_MAGIC "ELDATA\0\0"
+#define STORAGE_VERSION 1
+
+
+MappedStorage::MappedStorage()
+{
+}
+
+MappedStorage::~MappedStorage()
+{
+    close();
+}
+
+/**
+ * @brief Create the output file and write a provisional header.
+ * @param fileName
+ * @param type
+ * @param sampleRate Hz
+ * @param scalingCoeffs Polynomial to convert samples to physical units (empty if not needed)
+ */
+
+void MappedStorage::open(const QString &fileName, MappedStorage::SAMPLE_TYPE type,
+                         double sampleRate, const QVector<double> &scalingCoeffs)
+{
+    close();
+
+    this->type = type;
+    this->sampleRate = sampleRate;
+    this->scalingCoeffs = scalingCoeffs;
+    nSamples = 0;
+
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fileName).toStdString());
+    }
+
+    writeHeader();
+}
+
+/**
+ * @brief Unmap all extents, truncate the file to the actual number of samples and finalize the
+ * header.
+ */
+
+void MappedStorage::close()
+{
+    if (!file.isOpen()) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    for (uchar *p : extents) {
+        file.unmap(p);
+    }
+    extents.clear();
+
+    file.resize(HEADER_SIZE + nSamples * sampleSize());
+    writeHeader();
+    file.close();
+}
+
+bool MappedStorage::isOpen() const
+{
+    return file.isOpen();
+}
+
+/**
+ * @brief Append samples, growing the file by one extent at a time as needed.
+ * @param samples Must be of the type given in open()
+ * @param n Number of samples
+ */
+
+void MappedStorage::append(const void *samples, qint64 n)
+{
+    const int ss = sampleSize();
+    const char *src = static_cast<const char *>(samples);
+
+    qint64 offset = nSamples * ss;
+    qint64 bytes = n * ss;
+
+    while (bytes > 0) {
+        qint64 extent = offset / extentSize;
+        qint64 extentOffset = offset % extentSize;
+        if (extent >= extents.size()) {
+            grow();
+        }
+        qint64 count = qMin(bytes, extentSize - extentOffset);
+        memcpy(extents.at(extent) + extentOffset, src, count);
+        src += count;
+        offset += count;
+        bytes -= count;
+    }
+
+    QMutexLocker locker(&mutex);
+    nSamples += n;
+}
+
+qint64 MappedStorage::size() const
+{
+    QMutexLocker locker(&mutex);
+    return nSamples;
+}
+
+int MappedStorage::sampleSize() const
+{
+    switch (type) {
+    case SAMPLE_TYPE_I16:
+        return sizeof(qint16);
+    case SAMPLE_TYPE_F64:
+    default:
+        return sizeof(double);
+    }
+}
+
+qint64 MappedStorage::getExtentSize() const
+{
+    return extentSize;
+}
+
+/**
+ * @brief Size of the extents by which the file grows.
+ * @param bytes Must be a multiple of the page size and of the sample size. Has effect at the next
+ * open().
+ */
+
+void MappedStorage::setExtentSize(qint64 bytes)
+{
+    extentSize = bytes;
+}
+
+/**
+ * @brief Add one extent to the file, remapping the existing ones, and update the number of
+ * samples in the header.
+ *
+ * Views of a file must be closed before it can be resized (Windows). Unmapping does not discard
+ * the samples already written, they are flushed to the file by the OS.
+ */
+
+void MappedStorage::grow()
+{
+    QMutexLocker locker(&mutex);
+    const int n = extents.size() + 1;
+    for (uchar *p : extents) {
+        file.unmap(p);
+    }
+    extents.clear();
+
+    if (!file.resize(HEADER_SIZE + n * extentSize)) {
+        throw std::runtime_error(QString("Cannot grow file %1: %2")
+                                 .arg(file.fileName()).arg(file.errorString()).toStdString());
+    }
+    for (int i = 0; i < n; ++i) {
+        uchar *p = file.map(HEADER_SIZE + i * extentSize, extentSize);
+        if (!p) {
+            throw std::runtime_error(QString("Cannot map file %1: %2")
+                                     .arg(file.fileName()).arg(file.errorString())
+                                     .toStdString());
+        }
+        extents.append(p);
+    }
+
+    writeHeader();
+}
+
+void MappedStorage::writeHeader()
+{
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+    stream.writeRawData(STORAGE_MAGIC, 8);
+    stream << quint32(STORAGE_VERSION);
+    stream << quint32(type);
+    stream << sampleRate;
+    stream << quint32(scalingCoeffs.size());
+    for (double c : scalingCoeffs) {
+        stream << c;
+    }
+    stream << quint64(nSamples);
+
+    header.append(QByteArray(HEADER_SIZE - header.size(), '\0'));
+
+    file.seek(0);
+    file.write(header);
+    file.flush();
+}
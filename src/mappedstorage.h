@@ -0,0 +1,66 @@
+#ifndef MAPPEDSTORAGE_H
+#define MAPPEDSTORAGE_H
+
+#include <QFile>
+#include <QMutex>
+#include <QVector>
+
+/**
+ * @brief Growable sample storage backed by a memory mapped file.
+ *
+ * The file grows in large extents, each extent being mapped separately. A mapped file cannot be
+ * resized on Windows, so all extents are unmapped before growing the file and mapped again after:
+ * extent pointers are only valid under the mutex, or in the appending thread between two grow().
+ * Samples are persisted by the OS as they are written and memory usage is not bound to the length
+ * of the acquisition.
+ *
+ * File layout (little endian): a fixed size header (see HEADER_SIZE) followed by the samples.
+ * Header: magic "ELDATA" (zero padded to 8 bytes), version (quint32), sample type (quint32, see
+ * SAMPLE_TYPE), sample rate (double), number of scaling coefficients (quint32), scaling
+ * coefficients (double, value = sum_i c_i * sample^i), number of samples (quint64). The number of
+ * samples is rewritten each time the file grows and when it is closed, so after a crash at least
+ * the samples it counts are valid (the file may extend past them by less than one extent).
+ */
+
+class MappedStorage
+{
+public:
+    enum SAMPLE_TYPE {
+        SAMPLE_TYPE_F64,
+        SAMPLE_TYPE_I16,
+    };
+
+    static const qint64 HEADER_SIZE = 4096;
+
+    MappedStorage();
+    virtual ~MappedStorage();
+
+    void open(const QString &fileName, SAMPLE_TYPE type, double sampleRate,
+              const QVector<double> &scalingCoeffs = QVector<double>());
+    void close();
+    bool isOpen() const;
+
+    void append(const void *samples, qint64 n);
+
+    qint64 size() const;
+    int sampleSize() const;
+
+    qint64 getExtentSize() const;
+    void setExtentSize(qint64 bytes);
+
+private:
+    QFile file;
+    mutable QMutex mutex;
+    QVector<uchar *> extents;
+    qint64 extentSize = 64 * 1024 * 1024;
+    qint64 nSamples = 0;
+
+    SAMPLE_TYPE type = SAMPLE_TYPE_F64;
+    double sampleRate = 0;
+    QVector<double> scalingCoeffs;
+
+    void grow();
+    void writeHeader();
+};
+
+#endif // MAPPEDSTORAGE_H
@@ -0,0 +1,199 @@
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <QFile>
+#include <QTextStream>
+
+#include "motionenergy.h"
+
+/**
+ * @brief Sum of absolute differences of two byte rows.
+ */
+
+static quint64 sadRow(const uchar *a, const uchar *b, int n)
+{
+    quint64 sum = 0;
+    int i = 0;
+#ifdef HAVE_SSE2
+    __m128i acc = _mm_setzero_si128();
+    // each _mm_sad_epu8 yields two 16 bit partial sums (max 8 * 255), accumulated in 64 bit lanes
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    sum = static_cast<quint64>(_mm_cvtsi128_si32(acc))
+          + static_cast<quint64>(_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+    for (; i < n; ++i) {
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+    return sum;
+}
+
+
+MotionEnergy::MotionEnergy()
+{
+    setROIs({QRect()}, {"full_frame"});
+}
+
+/**
+ * @brief Forget the previous frame and the time series, to be called at the start of each run.
+ *
+ * The ROIs set with setROIs() are used from now on.
+ */
+
+void MotionEnergy::reset()
+{
+    activeROIs = rois;
+    activeNames = roiNames;
+    lastValues.fill(0, activeROIs.size());
+    havePrevious = false;
+    values.clear();
+}
+
+/**
+ * @brief Compute motion energy of a frame with respect to the previous one.
+ * @param data Mono8 pixels
+ * @param width
+ * @param height
+ * @param stride Bytes per row
+ *
+ * The first frame (and any frame whose size differs from the previous one) gets 0 in all ROIs.
+ */
+
+void MotionEnergy::process(const uchar *data, int width, int height, int stride)
+{
+    const bool comparable = havePrevious && width == prevWidth && height == prevHeight;
+
+    if (!comparable) {
+        const QRect frame(0, 0, width, height);
+        effectiveROIs.clear();
+        for (const QRect &r : activeROIs) {
+            effectiveROIs.append(r.isNull() ? frame : r.intersected(frame));
+        }
+    }
+
+    for (int i = 0; i < effectiveROIs.size(); ++i) {
+        const QRect &r = effectiveROIs.at(i);
+        if (!comparable || r.isEmpty()) {
+            lastValues[i] = 0;
+            continue;
+        }
+        quint64 sad = 0;
+        for (int y = r.top(); y <= r.bottom(); ++y) {
+            sad += sadRow(data + y * stride + r.left(),
+                          previous.constData() + y * width + r.left(), r.width());
+        }
+        lastValues[i] = static_cast<double>(sad) / (r.width() * r.height());
+    }
+    if (recordingEnabled) {
+        values.append(lastValues);
+    }
+
+    previous.resize(width * height);
+    for (int y = 0; y < height; ++y) {
+        memcpy(previous.data() + y * width, data + y * stride, width);
+    }
+    prevWidth = width;
+    prevHeight = height;
+    havePrevious = true;
+}
+
+/**
+ * @brief Motion energy time series, one value per ROI of the current run for each frame.
+ */
+
+const QVector<double> &MotionEnergy::getValues() const
+{
+    return values;
+}
+
+/**
+ * @brief Values of the last processed frame, one per ROI of the current run.
+ */
+
+const QVector<double> &MotionEnergy::getLastValues() const
+{
+    return lastValues;
+}
+
+qint64 MotionEnergy::getFrames() const
+{
+    return activeROIs.isEmpty() ? 0 : values.size() / activeROIs.size();
+}
+
+bool MotionEnergy::isRecordingEnabled() const
+{
+    return recordingEnabled;
+}
+
+/**
+ * @brief Whether the time series is kept (e.g. disable in free run). Has effect immediately.
+ */
+
+void MotionEnergy::setRecordingEnabled(bool value)
+{
+    recordingEnabled = value;
+}
+
+QVector<QRect> MotionEnergy::getROIs() const
+{
+    return rois;
+}
+
+QStringList MotionEnergy::getROINames() const
+{
+    return roiNames;
+}
+
+/**
+ * @brief Set the ROIs, in camera image coordinates. Use a null QRect for the full frame.
+ *
+ * Has effect at the next reset().
+ */
+
+void MotionEnergy::setROIs(const QVector<QRect> &rois, const QStringList &names)
+{
+    this->rois = rois;
+    roiNames = names;
+    while (roiNames.size() < rois.size()) {
+        roiNames << QString("roi%1").arg(roiNames.size());
+    }
+}
+
+/**
+ * @brief Write the time series (tab separated, one row per frame, one column per ROI).
+ */
+
+void MotionEnergy::saveToFile(const QString &fileName) const
+{
+    QFile outFile(fileName);
+    if (!outFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fileName).toStdString());
+    }
+
+    QTextStream out(&outFile);
+    out << "frame";
+    for (int j = 0; j < activeROIs.size(); ++j) {
+        out << "\t" << activeNames.at(j);
+    }
+    out << "\n";
+
+    const int n = activeROIs.size();
+    for (qint64 i = 0; i < getFrames(); ++i) {
+        out << i;
+        for (int j = 0; j < n; ++j) {
+            out << "\t" << values.at(i * n + j);
+        }
+        out << "\n";
+    }
+
+    outFile.close();
+}
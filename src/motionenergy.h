@@ -0,0 +1,58 @@
+#ifndef MOTIONENERGY_H
+#define MOTIONENERGY_H
+
+#include <QRect>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief Motion energy of a Mono8 image stream over a set of ROIs.
+ *
+ * For each frame and each ROI, motion energy is the mean absolute difference between the frame and
+ * the previous one (sum of absolute differences divided by the ROI area, 0-255). It is computed
+ * directly on the camera buffers with SIMD SAD kernels, so that no decoding of the saved video is
+ * needed afterwards.
+ *
+ * ROIs are taken into account at reset(), so that the number of values per frame is constant
+ * within a run. The time series is only kept when recording is enabled (not in free run), the
+ * values of the last frame are always available.
+ */
+
+class MotionEnergy
+{
+public:
+    MotionEnergy();
+
+    void reset();
+    void process(const uchar *data, int width, int height, int stride);
+
+    const QVector<double> &getValues() const;
+    const QVector<double> &getLastValues() const;
+    qint64 getFrames() const;
+
+    bool isRecordingEnabled() const;
+    void setRecordingEnabled(bool value);
+
+    QVector<QRect> getROIs() const;
+    QStringList getROINames() const;
+    void setROIs(const QVector<QRect> &rois, const QStringList &names);
+
+    void saveToFile(const QString &fileName) const;
+
+private:
+    QVector<QRect> rois;  // a null rect means full frame
+    QStringList roiNames;
+    QVector<QRect> activeROIs;  // of the current run, see reset()
+    QStringList activeNames;
+    QVector<QRect> effectiveROIs;
+
+    QVector<uchar> previous;
+    int prevWidth = 0, prevHeight = 0;
+    bool havePrevious = false;
+
+    bool recordingEnabled = true;
+    QVector<double> lastValues;  // activeROIs.size() values
+    QVector<double> values;      // activeROIs.size() values per frame
+};
+
+#endif // MOTIONENERGY_H
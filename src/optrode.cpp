@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <stdexcept>
 #include <memory>
 
 #include <QHistoryState>
 #include <QDir>
+#include <QFileInfo>
+#include <QSettings>
 #include <QThread>
 #include <QTextStream>
 #include <QtMath>
@@ -19,32 +22,55 @@
 #include "savestackworker.h"
 #include "elreadoutworker.h"
 #include "behavworker.h"
+#include "videoencoder.h"
+#include "synctable.h"
+#include "settings.h"
 #include "dds.h"
+#include "edgerecorder.h"
 
 
 static Logger *logger = getLogger("Optrode");
 
 Optrode::Optrode(QObject *parent) : QObject(parent)
 {
-    behaviorCamera = new ChameleonCamera(this);
     tasks = new Tasks(this);
     orca  = new OrcaFlash(this);
     zAxis = new PIDevice("Z Axis", this);
+    syncTable = new SyncTable();
     elReadoutWorker = new ElReadoutWorker(tasks->getElReadout());
+    elReadoutWorker->setSyncTable(syncTable);
     QThread *thread = new QThread();
     thread->setObjectName("ElReadoutWorker_thread");
     elReadoutWorker->moveToThread(thread);
     thread->start();
 
-    thread = new QThread();
-    thread->setObjectName("BehavWorker_thread");
-    behavWorker = new BehavWorker(behaviorCamera);
-    behavWorker->moveToThread(thread);
-    thread->start();
+    // one grab thread per behavior camera, the number of cameras is fixed at startup
+    int nBehavCams = QSettings().value(
+        QString("%1/%2").arg(SETTINGSGROUP_BEHAVIOR).arg(SETTING_N_BEHAVIOR_CAMERAS), 1).toInt();
+    for (int i = 0; i < qMax(1, nBehavCams); ++i) {
+        ChameleonCamera *cam = new ChameleonCamera(this);
+        behaviorCameras << cam;
+
+        thread = new QThread();
+        thread->setObjectName(QString("BehavWorker_thread%1").arg(i));
+        BehavWorker *worker = new BehavWorker(cam);
+        worker->setName(i == 0 ? "Behavior" : QString("Behavior cam %1").arg(i));
+        // all cameras share the main trigger, only the first one is tracked by the sync table
+        if (i == 0) {
+            worker->setSyncTable(syncTable);
+        }
+        worker->moveToThread(thread);
+        thread->start();
+        behavWorkers << worker;
+
+        connect(worker, &BehavWorker::captureCompleted,
+                this, &Optrode::incrementCompleted);
+    }
 
     thread = new QThread();
     thread->setObjectName("SaveStackWorker_thread");
     ssWorker = new SaveStackWorker(orca);
+    ssWorker->setSyncTable(syncTable);
     ssWorker->moveToThread(thread);
     thread->start();
 
@@ -64,10 +90,13 @@ Optrode::Optrode(QObject *parent) : QObject(parent)
 
     connect(tasks, &Tasks::elReadoutStarted, elReadoutWorker, &ElReadoutWorker::start);
     connect(this, &Optrode::stopped, elReadoutWorker, &ElReadoutWorker::stop);
-    connect(behavWorker, &BehavWorker::captureCompleted,
-            this, &Optrode::incrementCompleted);
     connect(elReadoutWorker, &ElReadoutWorker::acquisitionCompleted,
             this, &Optrode::incrementCompleted);
+    for (BehavWorker *worker : behavWorkers) {
+        // direct: the behavior thread is busy in its grab loop, addEvent() is thread safe
+        connect(elReadoutWorker, &ElReadoutWorker::eventDetected,
+                worker, &BehavWorker::addEvent, Qt::DirectConnection);
+    }
 
     postStimulation = 0;
     resetMultiRunCount();
@@ -79,6 +108,7 @@ Optrode::Optrode(QObject *parent) : QObject(parent)
 Optrode::~Optrode()
 {
     uninitialize();
+    delete syncTable;
 }
 
 QState *Optrode::getState(const Optrode::MACHINE_STATE stateEnum)
@@ -103,14 +133,29 @@ void Optrode::initialize()
         orca->setPropertyValue(DCAM::DCAM_IDPROP_BINNING, DCAM::DCAMPROP_BINNING__4);
         orca->buf_alloc(6000);
         orca->logInfo();
-
-        behaviorCamera->open(0);
-        behaviorCamera->logDeviceInfo();
     } catch (std::runtime_error e) {
         onError(e.what());
         return;
-    } catch (Spinnaker::Exception e) {
-        logger->warning(QString("Cannot open behavior camera.\n\n%1").arg(e.what()));
+    }
+
+    QStringList serials = QSettings().value(
+        QString("%1/%2").arg(SETTINGSGROUP_BEHAVIOR).arg(SETTING_BEHAVIOR_CAMERA_SERIALS))
+                          .toStringList();
+    for (int i = 0; i < behaviorCameras.size(); ++i) {
+        try {
+            if (i < serials.size() && !serials.at(i).isEmpty()) {
+                behaviorCameras.at(i)->open(serials.at(i));
+            } else {
+                behaviorCameras.at(i)->open(i);
+            }
+            behaviorCameras.at(i)->logDeviceInfo();
+        } catch (std::runtime_error e) {
+            logger->warning(QString("Cannot open behavior camera %1.\n\n%2")
+                            .arg(i).arg(e.what()));
+        } catch (Spinnaker::Exception e) {
+            logger->warning(QString("Cannot open behavior camera %1.\n\n%2")
+                            .arg(i).arg(e.what()));
+        }
     }
 
     for (int i = 0; i < 6; i++) {
@@ -172,6 +217,11 @@ void Optrode::setupStateMachine()
         if (!multiRunEnabled) {
             return;
         }
+        if (trialModeEnabled) {
+            // all trials were acquired in a single run
+            multiRunStopped = true;
+            return;
+        }
         multiRunCount++;
         if (!multiRunStopped && (multiRunCount < nRuns)) {
             _start();
@@ -194,8 +244,11 @@ void Optrode::startFreeRun()
 {
     logger->info("Start acquisition (free run)");
     tasks->setFreeRunEnabled(true);
-    behavWorker->setSaveToFileEnabled(false);
-    behavWorker->setFrameCount(-1);
+    tasks->setTrialModeEnabled(false);
+    for (BehavWorker *worker : behavWorkers) {
+        worker->setSaveToFileEnabled(false);
+        worker->setFrameCount(-1);
+    }
     elReadoutWorker->setSaveToFileEnabled(false);
     _startAcquisition();
     try {
@@ -217,20 +270,36 @@ void Optrode::start()
 void Optrode::_start()
 {
     completedJobs = successJobs = 0;
+    // orca, electrode readout and one job per behavior camera
+    nJobs = 1;
     if (tasks->getElectrodeReadoutEnabled()) {
-        nJobs = 3;
-    } else {
-        nJobs = 2;
+        nJobs++;
     }
 
-    if (behaviorCamera->isValid()) {
-        behavWorker->setSaveToFileEnabled(saveBehaviorEnabled);
-        behavWorker->setOutputFile(outputFileFullPath());
-    } else {
-        nJobs--;
+    // setup NI tasks
+    tasks->setFreeRunEnabled(false);
+    setupTaskTiming();
+    const int nTrials = tasks->isTrialModeEnabled() ? nRuns : 1;
+
+    // in event window mode, stimulation onsets are known in advance
+    QVector<double> onsets = trialOnsets(tasks->stimulationOnsets()
+                                         + tasks->auxStimulationOnsets());
+    std::sort(onsets.begin(), onsets.end());
+
+    for (int i = 0; i < behaviorCameras.size(); ++i) {
+        if (!behaviorCameras.at(i)->isValid()) {
+            continue;
+        }
+        nJobs++;
+        behavWorkers.at(i)->setSaveToFileEnabled(saveBehaviorEnabled);
+        behavWorkers.at(i)->setOutputFile(behaviorOutputFile(i));
+        behavWorkers.at(i)->getEventWindowRecorder()->setEventTimes(onsets);
     }
 
-    if (multiRunEnabled) {
+    if (tasks->isTrialModeEnabled()) {
+        logger->info(QString("Start acquisition (%1 trials, inter-trial interval %2s)")
+                     .arg(nRuns).arg(tasks->getInterTrialInterval()));
+    } else if (multiRunEnabled) {
         logger->info(QString("Start acquisition (run %1/%2)").arg(multiRunCount + 1).arg(nRuns));
     } else {
         logger->info("Start acquisition");
@@ -244,23 +313,60 @@ void Optrode::_start()
 
     QDir().mkpath(getOutputDir());
 
-    // setup NI tasks
-    tasks->setFreeRunEnabled(false);
-    tasks->setTotalDuration(totalDuration());
-
     // setup worker threads
-    elReadoutWorker->setOutputFile(outputFileFullPath() + ".dat");
+    elReadoutWorker->setOutputFile(outputFileFullPath());
     elReadoutWorker->setSaveToFileEnabled(
         saveElectrodeEnabled && tasks->getElectrodeReadoutEnabled());
 
-    size_t frameCount = tasks->getMainTrigFreq() * totalDuration();
-    ssWorker->setFrameCount(frameCount);
+    size_t frameCount = tasks->getMainTrigFreq() * totalDuration();  // per trial
+    ssWorker->setFrameCount(frameCount * nTrials);
+    ssWorker->setFramesPerTrial(tasks->isTrialModeEnabled() ? frameCount : 0);
     ssWorker->setTimeout(2e6 / tasks->getMainTrigFreq());
     ssWorker->setOutputFile(outputFileFullPath());
-    behavWorker->setFrameCount(frameCount);
+    for (BehavWorker *worker : behavWorkers) {
+        // behavior video is continuous, trials are mapped by the sync table
+        worker->setFrameCount(frameCount * nTrials);
+        worker->getEncoder()->setFrameRate(tasks->getMainTrigFreq());
+    }
+
+    setupSyncTable();
+
+    if (tasks->getElectrodeReadoutEnabled() && elReadoutWorker->isFilterEnabled()) {
+        try {
+            // the worker is idle: this also gives the effective LFP rate of the run params
+            elReadoutWorker->getFilterBank()->design(tasks->getElectrodeReadoutRate());
+        } catch (std::runtime_error e) {
+            emit error(e.what());
+            return;
+        }
+    }
+
+    // nothing is started if the outputs would not be what the parameters ask for
+    Timeline timeline = compileTimeline(orca->getLineInterval());
+    for (const Timeline::Conflict &c : timeline.getConflicts()) {
+        const QString msg = QString("Timeline: %1 at %2s: %3")
+                            .arg(Timeline::lineName(c.line))
+                            .arg(c.tick * TIMELINE_TICK)
+                            .arg(c.description);
+        if (c.severity == Timeline::SEVERITY_ERROR) {
+            logger->critical(msg);
+        } else {
+            logger->warning(msg);
+        }
+    }
+    if (timeline.hasErrors()) {
+        emit error("Invalid timing of the NI outputs, see the log");
+        return;
+    }
+    try {
+        timeline.saveBinary(outputFileFullPath() + "_timeline.bin");
+    } catch (std::runtime_error e) {
+        logger->warning(e.what());
+    }
 
     _startAcquisition();
 
+    tasks->getEdgeRecorder()->setOutputFile(outputFileFullPath() + "_edges.bin");
     try {
         tasks->init();
     } catch (std::runtime_error e) {
@@ -278,7 +384,9 @@ void Optrode::stop()
     running = false;
     emit stopped();
     try {
-        behaviorCamera->stopAcquisition();
+        for (ChameleonCamera *cam : behaviorCameras) {
+            cam->stopAcquisition();
+        }
         orca->cap_stop();
         tasks->stop();
     } catch (std::runtime_error e) {
@@ -316,6 +424,24 @@ void Optrode::setMultiRunEnabled(bool value)
     resetMultiRunCount();
 }
 
+bool Optrode::isTrialModeEnabled() const
+{
+    return trialModeEnabled;
+}
+
+/**
+ * @brief Acquire multiple runs as hardware retriggered trials of a single acquisition.
+ *
+ * Only applies when multiple runs are enabled. Trials are separated by the inter-trial interval
+ * of the NI tasks (see Tasks::setTrialModeEnabled()) instead of being re-armed by software, and
+ * camera and electrode data are split into one file per trial.
+ */
+
+void Optrode::setTrialModeEnabled(bool value)
+{
+    trialModeEnabled = value;
+}
+
 void Optrode::resetMultiRunCount()
 {
     multiRunCount = 0;
@@ -343,12 +469,31 @@ void Optrode::writeRunParams(QString fileName)
     if (tasks->getStimulationEnabled()) {
         out << "  aod:\n";
         out << "    enabled: " << (tasks->isAODEnabled() ? "true" : "false") << "\n";
-        if (tasks->isAODEnabled()) {
+        if (tasks->isAODEnabled() && tasks->isAODSequenceEnabled()) {
+            const AODSequence *sequence = tasks->getAODSequence();
+            out << "    targets:\n";
+            for (const AODTarget &target : sequence->getTargets()) {
+                out << "      - point: " << QString("[%1, %2]")
+                    .arg(target.point.x()).arg(target.point.y()) << "\n";
+                out << "        dwell: " << target.dwell << "\n";
+                out << "        amplitude: " << target.amplitude << "\n";
+            }
+            out << "    period: " << sequence->getPeriod() << "\n";
+        } else if (tasks->isAODEnabled()) {
             QPointF p = tasks->getPoint();
             out << "    point: " << QString("[%1, %2]").arg(p.x()).arg(p.y()) << "\n";
         }
-        out << "  always_on: " << (tasks->getContinuousStimulation() ? "true" : "false") << "\n";
-        if (!tasks->getContinuousStimulation()) {
+        if (tasks->isStimulationProtocolEnabled()) {
+            const StimulationProtocol *protocol = tasks->getStimulationProtocol();
+            out << "  protocol:\n";
+            out << "    file: " << protocol->getFileName() << "\n";
+            out << "    n_pulses: " << protocol->getNPulses() << "\n";
+            out << "    duration: " << protocol->getDuration() << "\n";
+        } else {
+            out << "  always_on: " << (tasks->getContinuousStimulation() ? "true" : "false")
+                << "\n";
+        }
+        if (!tasks->getContinuousStimulation() && !tasks->isStimulationProtocolEnabled()) {
             out << "  high_time: " << tasks->getStimulationHighTime() << "\n";
             out << "  low_time: " << tasks->getStimulationLowTime() << "\n";
             out << "  frequency: " << tasks->getStimulationFrequency() << "\n";
@@ -362,9 +507,111 @@ void Optrode::writeRunParams(QString fileName)
         out << "    n_pulses: " << tasks->getAuxStimulationNPulses() << "\n";
         out << "    delay: " << tasks->getAuxStimulationDelay() << "\n";
     }
+    out << "  closed_loop:\n";
+    out << "    enabled: " << (tasks->isClosedLoopActive() ? "true" : "false") << "\n";
+    if (tasks->isClosedLoopActive()) {
+        const ClosedLoopDetector *det = elReadoutWorker->getClosedLoopDetector();
+        out << "    output: " << (tasks->getClosedLoopOutput() == Tasks::CLOSED_LOOP_STIMULATION
+                                   ? "stimulation" : "aux_stimulation") << "\n";
+        out << "    n_pulses: " << tasks->getClosedLoopNPulses() << "\n";
+        out << "    detector: " << ClosedLoopDetector::detectorName(det->getDetector()) << "\n";
+        out << "    threshold: " << det->getThreshold() << "\n";
+        if (det->getDetector() != ClosedLoopDetector::DETECTOR_THRESHOLD) {
+            out << "    window: " << det->getWindow() << "\n";
+        }
+        if (det->getDetector() == ClosedLoopDetector::DETECTOR_BAND_POWER) {
+            out << "    band: " << QString("[%1, %2]")
+                .arg(det->getBandLow()).arg(det->getBandHigh()) << "\n";
+        }
+        out << "    refractory_period: " << det->getRefractoryPeriod() << "\n";
+    }
+    const EdgeRecorder *edges = tasks->getEdgeRecorder();
+    out << "hardware_edges:\n";
+    out << "  enabled: " << (edges->isEnabled() ? "true" : "false") << "\n";
+    if (edges->isEnabled()) {
+        out << "  file: " << QFileInfo(outputFileFullPath() + "_edges.bin").fileName() << "\n";
+        for (int i = 0; i < EdgeRecorder::N_LINES; ++i) {
+            EdgeRecorder::LINE line = static_cast<EdgeRecorder::LINE>(i);
+            if (!edges->getLinePhysChan(line).isEmpty()) {
+                out << "  " << EdgeRecorder::lineName(line) << ": "
+                    << edges->getLinePhysChan(line) << "\n";
+            }
+        }
+    }
+    out << "analog_output:\n";
+    out << "  rate: " << tasks->getAnalogOutputRate() << "\n";
+    for (int i = 0; i < Tasks::N_AO_OUTPUTS; ++i) {
+        Tasks::AO_OUTPUT o = static_cast<Tasks::AO_OUTPUT>(i);
+        out << (o == Tasks::AO_LED ? "  led:\n" : "  stimulation:\n");
+        out << "    enabled: " << (tasks->isAnalogOutputEnabled(o) ? "true" : "false") << "\n";
+        if (!tasks->isAnalogOutputEnabled(o)) {
+            continue;
+        }
+        const WaveformSynth *w = tasks->getWaveform(o);
+        out << "    channel: " << tasks->getAnalogOutputPhysChan(o) << "\n";
+        out << "    shape: " << WaveformSynth::shapeName(w->getShape()) << "\n";
+        out << "    amplitude: " << w->getAmplitude() << "\n";
+        out << "    offset: " << w->getOffset() << "\n";
+        out << "    frequency: " << w->getFrequency() << "\n";
+        if (w->getShape() == WaveformSynth::SHAPE_PULSES) {
+            out << "    duty_cycle: " << w->getDutyCycle() << "\n";
+            out << "    edge_time: " << w->getEdgeTime() << "\n";
+        }
+    }
     out << "electrode:\n";
     out << "  readout_rate: " << tasks->getElectrodeReadoutRate() << "\n";
     out << "  readout_enabled: " << (tasks->getStimulationEnabled() ? "true" : "false") << "\n";
+    out << "  raw_int16: " << (elReadoutWorker->isRawEnabled() ? "true" : "false") << "\n";
+    if (elReadoutWorker->isRawEnabled() && tasks->getElectrodeReadoutEnabled()) {
+        QStringList coeffs;
+        try {
+            for (double c : tasks->getElectrodeScalingCoeffs()) {
+                coeffs << QString::number(c, 'g', 17);
+            }
+        } catch (std::runtime_error e) {
+            logger->warning(e.what());
+        }
+        out << "  scaling_coeffs: [" << coeffs.join(", ") << "]\n";
+    }
+    out << "  filter:\n";
+    out << "    enabled: " << (elReadoutWorker->isFilterEnabled() ? "true" : "false") << "\n";
+    if (elReadoutWorker->isFilterEnabled()) {
+        FilterBank *fb = elReadoutWorker->getFilterBank();
+        out << "    lfp_cutoff: " << fb->getEffectiveLFPCutoff() << "\n";
+        out << "    lfp_rate: " << fb->getEffectiveLFPRate() << "\n";
+        out << "    spike_band: " << QString("[%1, %2]")
+            .arg(fb->getSpikeLowCut()).arg(fb->getSpikeHighCut()) << "\n";
+    }
+
+    if (saveBehaviorEnabled) {
+        VideoEncoder *encoder = behavWorkers.first()->getEncoder();
+        out << "behavior:\n";
+        QStringList files;
+        for (int i = 0; i < behaviorCameras.size(); ++i) {
+            if (behaviorCameras.at(i)->isValid()) {
+                files << QFileInfo(behaviorOutputFile(i)).fileName();
+            }
+        }
+        out << "  cameras: [" << files.join(", ") << "]\n";
+        // the other cameras are not tracked by the sync table, see their frame logs
+        out << "  sync_table_camera: " << QFileInfo(behaviorOutputFile(0)).fileName() << "\n";
+        out << "  codec: " << VideoEncoder::codecName(encoder->getCodec()) << "\n";
+        out << "  frame_rate: " << encoder->getFrameRate() << "\n";
+        if (encoder->getCodec() == VideoEncoder::CODEC_H264) {
+            out << "  bitrate: " << encoder->getBitrate() << "\n";
+        } else if (encoder->getCodec() == VideoEncoder::CODEC_MJPEG) {
+            out << "  quality: " << encoder->getMJPEGQuality() << "\n";
+        }
+        BehavWorker *worker = behavWorkers.first();
+        if (worker->getRecordingMode() == BehavWorker::RECORDING_EVENT_WINDOWS) {
+            EventWindowRecorder *ewr = worker->getEventWindowRecorder();
+            out << "  recording: event_windows\n";
+            out << "  pre_event: " << ewr->getPreEventTime() << "\n";
+            out << "  post_event: " << ewr->getPostEventTime() << "\n";
+        } else {
+            out << "  recording: continuous\n";
+        }
+    }
 
     out << "timing:" << "\n";
     out << "  baseline: " <<  tasks->getStimulationInitialDelay() << "\n";
@@ -373,6 +620,18 @@ void Optrode::writeRunParams(QString fileName)
         out << "  post: " << getPostStimulation() << "\n";
     }
     out << "  total: " << totalDuration() << "\n";
+    out << "  ni_setup: " << tasks->getLastSetupTime() << "\n";
+    out << "  ni_tasks_reused: " << (tasks->isLastSetupReused() ? "true" : "false") << "\n";
+
+    if (tasks->isTrialModeEnabled()) {
+        out << "trials:\n";
+        out << "  n_trials: " << tasks->getNTrials() << "\n";
+        out << "  inter_trial_interval: " << tasks->getInterTrialInterval() << "\n";
+        out << "  period: " << tasks->getTrialPeriod() << "\n";
+        out << "  frames_per_trial: " << ssWorker->getFramesPerTrial() << "\n";
+        out << "  electrode_samples_per_trial: "
+            << qint64(totalDuration() * tasks->getElectrodeReadoutRate()) << "\n";
+    }
 
     outFile.close();
 
@@ -383,25 +642,19 @@ void Optrode::_startAcquisition()
 {
     running = true;
     try {
-        double Vn = 2048;
-        double lineInterval = orca->getLineInterval();
+        orca->setGetExposureTime(exposureTime());
 
-        // time during which LEDs are switching on/off
-        // (camera should not be recording during this time)
-        double blankTime = 0.0005;
-        if (tasks->getLED1Enabled() && tasks->getLED2Enabled()) {
-            blankTime = 0.002;
+        const size_t samplesPerTrial = totalDuration() * tasks->getElectrodeReadoutRate();
+        if (tasks->isTrialModeEnabled()) {
+            elReadoutWorker->setTotToBeRead(samplesPerTrial * tasks->getNTrials());
+            elReadoutWorker->setSamplesPerTrial(samplesPerTrial);
+        } else {
+            elReadoutWorker->setTotToBeRead(samplesPerTrial);
+            elReadoutWorker->setSamplesPerTrial(0);
         }
-
-        // inverse formula to obtain exposure time
-        double expTime = 1. / tasks->getMainTrigFreq() - (Vn / 2 + 10) * lineInterval;
-        expTime -= blankTime;
-        orca->setGetExposureTime(expTime);
-
-        elReadoutWorker->setTotToBeRead(totalDuration() * tasks->getElectrodeReadoutRate());
         elReadoutWorker->setFreeRun(isFreeRunEnabled());
 
-        tasks->setLEDdelay(blankTime / 2);
+        tasks->setLEDdelay(blankTime() / 2);
 
         uint enabledWriters = 0;
         if (tasks->getLED1Enabled()) {
@@ -413,7 +666,11 @@ void Optrode::_startAcquisition()
 
         ssWorker->setEnabledWriters(enabledWriters);
 
-        behaviorCamera->startAcquisition();
+        for (int i = 0; i < behaviorCameras.size(); ++i) {
+            behaviorCameras.at(i)->setStreamBufferCount(
+                behavWorkers.at(i)->getEncoder()->requiredStreamBuffers());
+            behaviorCameras.at(i)->startAcquisition();
+        }
         orca->cap_start();
     } catch (std::runtime_error e) {
         onError(e.what());
@@ -446,11 +703,99 @@ void Optrode::incrementCompleted(bool ok)
     }
     if (++completedJobs == nJobs) {
         logger->info("All jobs completed");
+        logBehaviorSummary();
         stop();
+        // only now that all workers are done, so that their last clock points are included
+        saveSyncTable();
     }
     logger->info(QString("Completed %1/%2 jobs (ok? %3)").arg(completedJobs).arg(nJobs).arg(ok));
 }
 
+void Optrode::setupSyncTable()
+{
+    syncTable->reset();
+
+    // as generated by the counter: high and low times are whole ticks of its timebase
+    const double mainTrigPeriod =
+        2 * Timeline::toTicks(0.5 / tasks->getMainTrigFreq()) * TIMELINE_TICK;
+    syncTable->setStreamTiming(SyncTable::STREAM_ORCA, mainTrigPeriod);
+    syncTable->setStreamTiming(SyncTable::STREAM_BEHAVIOR, mainTrigPeriod);
+    // updated with the actual sample clock rate when the readout starts
+    syncTable->setStreamTiming(SyncTable::STREAM_ELECTRODE,
+                               1. / tasks->getElectrodeReadoutRate());
+    syncTable->setStreamClock(SyncTable::STREAM_ORCA, SyncTable::CLOCK_DEVICE);
+    syncTable->setStreamClock(SyncTable::STREAM_BEHAVIOR, SyncTable::CLOCK_DEVICE);
+    syncTable->setStreamClock(SyncTable::STREAM_ELECTRODE, SyncTable::CLOCK_HOST);
+
+    if (tasks->isTrialModeEnabled()) {
+        const double trialPeriod = tasks->getTrialPeriod();
+        const qint64 framesPerTrial = tasks->getMainTrigFreq() * totalDuration();
+        syncTable->setTrialTiming(SyncTable::STREAM_ORCA, framesPerTrial, trialPeriod);
+        syncTable->setTrialTiming(SyncTable::STREAM_BEHAVIOR, framesPerTrial, trialPeriod);
+        syncTable->setTrialTiming(
+            SyncTable::STREAM_ELECTRODE,
+            qint64(totalDuration() * tasks->getElectrodeReadoutRate()), trialPeriod);
+    }
+
+    for (double t : trialOnsets(tasks->stimulationOnsets())) {
+        syncTable->addEvent(SyncTable::EVENT_STIMULATION, t);
+    }
+    for (double t : trialOnsets(tasks->auxStimulationOnsets())) {
+        syncTable->addEvent(SyncTable::EVENT_AUX_STIMULATION, t);
+    }
+}
+
+/**
+ * @brief Repeat the given onsets (relative to the start of a trial) for each trial.
+ *
+ * Onsets are returned unchanged if not in trial mode.
+ */
+
+QVector<double> Optrode::trialOnsets(const QVector<double> &onsets) const
+{
+    if (!tasks->isTrialModeEnabled()) {
+        return onsets;
+    }
+    QVector<double> ret;
+    ret.reserve(onsets.size() * tasks->getNTrials());
+    for (uInt64 i = 0; i < tasks->getNTrials(); ++i) {
+        for (double t : onsets) {
+            ret << t + i * tasks->getTrialPeriod();
+        }
+    }
+    return ret;
+}
+
+void Optrode::saveSyncTable()
+{
+    QString fname = outputFileFullPath() + "_sync.yaml";
+    try {
+        syncTable->save(fname);
+    } catch (std::runtime_error e) {
+        logger->warning(e.what());
+        return;
+    }
+
+    for (int i = 0; i < SyncTable::N_STREAMS; ++i) {
+        SyncTable::STREAM stream = static_cast<SyncTable::STREAM>(i);
+        SyncTable::ClockFit fit = syncTable->clockFit(stream);
+        if (fit.n < 2) {
+            continue;
+        }
+        if (syncTable->getStreamClock(stream) == SyncTable::CLOCK_HOST) {
+            logger->info(QString("Host receive jitter (%1): rms %2 ms")
+                         .arg(SyncTable::streamName(stream))
+                         .arg(fit.rmsResidual * 1e3));
+            continue;
+        }
+        logger->info(QString("Clock drift (%1): %2 ppm, rms residual %3 ms")
+                     .arg(SyncTable::streamName(stream))
+                     .arg(fit.driftPpm)
+                     .arg(fit.rmsResidual * 1e3));
+    }
+    logger->info("Saved sync table to " + fname);
+}
+
 void Optrode::writeRunParams()
 {
     QString fname = outputFileFullPath() + ".yaml";
@@ -467,6 +812,71 @@ SaveStackWorker *Optrode::getSSWorker() const
     return ssWorker;
 }
 
+SyncTable *Optrode::getSyncTable() const
+{
+    return syncTable;
+}
+
+/**
+ * @brief Expected edges of all NI outputs for the current parameters, without any hardware.
+ * @param lineInterval Camera line interval (s), e.g. OrcaFlash::getLineInterval()
+ *
+ * Compiled when an acquisition starts, before anything is started, and on demand: it is not
+ * updated on every parameter change. Nothing is set on the tasks or the camera. The camera
+ * exposure time is the one requested by the next acquisition, before the camera rounds it.
+ */
+
+Timeline Optrode::compileTimeline(double lineInterval) const
+{
+    TimelineParams params = tasks->getTimelineParams(
+        totalDuration(), multiRunEnabled && trialModeEnabled, nRuns, blankTime() / 2);
+    params.cameraExposure = exposureTime(lineInterval);
+
+    Timeline timeline;
+    timeline.compile(params);
+    return timeline;
+}
+
+void Optrode::setupTaskTiming()
+{
+    tasks->setTotalDuration(totalDuration());
+    tasks->setTrialModeEnabled(multiRunEnabled && trialModeEnabled);
+    tasks->setNTrials(nRuns);
+}
+
+/**
+ * @brief Time during which LEDs are switching on/off (s), the camera should not be exposing.
+ */
+
+double Optrode::blankTime() const
+{
+    if (tasks->getLED1Enabled() && tasks->getLED2Enabled()) {
+        return 0.002;
+    }
+    return 0.0005;
+}
+
+/**
+ * @brief Exposure time (s) filling the trigger period, minus readout and blank time.
+ */
+
+double Optrode::exposureTime() const
+{
+    return exposureTime(orca->getLineInterval());
+}
+
+/**
+ * @brief Same as exposureTime(), for the given camera line interval (s).
+ */
+
+double Optrode::exposureTime(double lineInterval) const
+{
+    const double Vn = 2048;
+
+    // inverse formula to obtain exposure time
+    return 1. / tasks->getMainTrigFreq() - (Vn / 2 + 10) * lineInterval - blankTime();
+}
+
 bool Optrode::isSaveBehaviorEnabled() const
 {
     return saveBehaviorEnabled;
@@ -487,9 +897,59 @@ void Optrode::setSaveElectrodeEnabled(bool enable)
     saveElectrodeEnabled = enable;
 }
 
-BehavWorker *Optrode::getBehavWorker() const
+BehavWorker *Optrode::getBehavWorker(int i) const
 {
-    return behavWorker;
+    return behavWorkers.at(i);
+}
+
+/**
+ * @brief Output file of the given behavior camera, without extension.
+ *
+ * The first camera keeps the plain run name, the others get a _cam<i> suffix.
+ */
+
+QString Optrode::behaviorOutputFile(int i)
+{
+    QString s = outputFileFullPath();
+    if (i > 0) {
+        s += QString("_cam%1").arg(i);
+    }
+    return s;
+}
+
+/**
+ * @brief Log drop statistics of each behavior camera and the aggregate encoding throughput.
+ */
+
+void Optrode::logBehaviorSummary()
+{
+    if (!saveBehaviorEnabled) {
+        return;
+    }
+
+    qint64 totEncoded = 0, totDropped = 0, totMissing = 0;
+    double totMBps = 0;
+    int n = 0;
+    for (int i = 0; i < behaviorCameras.size(); ++i) {
+        if (!behaviorCameras.at(i)->isValid()) {
+            continue;
+        }
+        VideoEncoder *encoder = behavWorkers.at(i)->getEncoder();
+        QSize size = behaviorCameras.at(i)->getROI().size();
+        totEncoded += encoder->getEncodedFrames();
+        totDropped += encoder->getDroppedFrames();
+        totMissing += behavWorkers.at(i)->getFrameLog()->getMissingFrames();
+        totMBps += encoder->getEncodeThroughput() * size.width() * size.height() * 1e-6;
+        n++;
+    }
+    if (n < 2) {
+        return;
+    }
+
+    logger->info(QString("%1 behavior cameras: %2 frames encoded, %3 dropped by the encoders, "
+                         "%4 missing at the cameras, encoding throughput %5 MB/s")
+                 .arg(n).arg(totEncoded).arg(totDropped).arg(totMissing)
+                 .arg(totMBps, 0, 'f', 1));
 }
 
 bool Optrode::isSuccess()
@@ -530,7 +990,8 @@ void Optrode::setOutputDir(const QString &value)
 QString Optrode::outputFileFullPath()
 {
     QString s = QDir(outputPath).filePath(runName);
-    if (multiRunEnabled) {
+    // in trial mode, the trial number is appended by the workers to per trial files
+    if (multiRunEnabled && !trialModeEnabled) {
         s += QString("_%1").arg(multiRunCount, 5, 10, QChar('0'));
     }
     return s;
@@ -546,9 +1007,14 @@ double Optrode::getPostStimulation() const
     return postStimulation;
 }
 
-ChameleonCamera *Optrode::getBehaviorCamera() const
+ChameleonCamera *Optrode::getBehaviorCamera(int i) const
+{
+    return behaviorCameras.at(i);
+}
+
+int Optrode::behaviorCameraCount() const
 {
-    return behaviorCamera;
+    return behaviorCameras.size();
 }
 
 Tasks *Optrode::NITasks() const
@@ -4,15 +4,19 @@
 #include <QObject>
 #include <QStateMachine>
 #include <QTimer>
+#include <QVector>
 
 #include <qtlab/hw/hamamatsu/orcaflash.h>
 #include <qtlab/hw/pi/pidevice.h>
 
+#include "timeline.h"
+
 class ChameleonCamera;
 class Tasks;
 class ElReadoutWorker;
 class BehavWorker;
 class SaveStackWorker;
+class SyncTable;
 
 class Optrode : public QObject
 {
@@ -31,7 +35,8 @@ public:
     explicit Optrode(QObject *parent = nullptr);
     virtual ~Optrode();
     QState *getState(const MACHINE_STATE stateEnum);
-    ChameleonCamera *getBehaviorCamera() const;
+    ChameleonCamera *getBehaviorCamera(int i = 0) const;
+    int behaviorCameraCount() const;
     Tasks *NITasks() const;
     bool isFreeRunEnabled() const;
     void setPostStimulation(double s);
@@ -43,6 +48,7 @@ public:
     QString getOutputDir() const;
     void setOutputDir(const QString &value);
     QString outputFileFullPath();
+    QString behaviorOutputFile(int i);
 
     QString getRunName() const;
     void setRunName(const QString &value);
@@ -51,7 +57,7 @@ public:
     void writeRunParams();
 
     ElReadoutWorker *getElReadoutWorker() const;
-    BehavWorker *getBehavWorker() const;
+    BehavWorker *getBehavWorker(int i = 0) const;
 
     bool isSuccess();
 
@@ -63,6 +69,10 @@ public:
 
     SaveStackWorker *getSSWorker() const;
 
+    SyncTable *getSyncTable() const;
+
+    Timeline compileTimeline(double lineInterval) const;
+
     bool isMultiRunEnabled() const;
     void setMultiRunEnabled(bool value);
 
@@ -71,6 +81,9 @@ public:
     int getNRuns() const;
     void setNRuns(int value);
 
+    bool isTrialModeEnabled() const;
+    void setTrialModeEnabled(bool value);
+
 signals:
     void initializing() const;
     void initialized() const;
@@ -89,21 +102,23 @@ public slots:
     void multiRunStop();
 
 private:
-    ChameleonCamera *behaviorCamera;
+    QList<ChameleonCamera *> behaviorCameras;
     Tasks *tasks;
     OrcaFlash *orca;
     PIDevice *zAxis;
     QString outputPath;
     QString runName;
     ElReadoutWorker *elReadoutWorker;
-    BehavWorker *behavWorker;
+    QList<BehavWorker *> behavWorkers;
     SaveStackWorker *ssWorker;
+    SyncTable *syncTable;
 
     bool saveElectrodeEnabled = true, saveBehaviorEnabled = true;
     bool multiRunEnabled = false;
     bool multiRunStopped = true;
     int nRuns = 2;
     int multiRunCount = 0;
+    bool trialModeEnabled = false;
 
 
     QMap<MACHINE_STATE, QState *> stateMap;
@@ -115,10 +130,18 @@ private:
     int nJobs;
 
     void setupStateMachine();
+    void setupSyncTable();
+    void setupTaskTiming();
+    double blankTime() const;
+    double exposureTime() const;
+    double exposureTime(double lineInterval) const;
+    QVector<double> trialOnsets(const QVector<double> &onsets) const;
+    void saveSyncTable();
     void onError(const QString &errMsg);
     void _startAcquisition();
     void _start();
     void incrementCompleted(bool ok);
+    void logBehaviorSummary();
 };
 
 Optrode& optrode();
@@ -0,0 +1,318 @@
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <QFile>
+#include <QRunnable>
+#include <QThread>
+#include <QTextStream>
+#include <QtMath>
+
+#include "pupiltracker.h"
+
+
+class PupilTask : public QRunnable
+{
+public:
+    PupilTask(PupilTracker *tracker, qint64 index, QVector<uchar> roi, QRect rect)
+        : tracker(tracker), index(index), roi(roi), rect(rect)
+    {
+    }
+
+    void run()
+    {
+        PupilTracker::Result r = PupilTracker::fit(
+            roi.constData(), rect.width(), rect.height(), tracker->threshold, tracker->minArea);
+        r.cx += rect.x();
+        r.cy += rect.y();
+        tracker->setResult(index, r);
+    }
+
+private:
+    PupilTracker *tracker;
+    qint64 index;
+    QVector<uchar> roi;
+    QRect rect;
+};
+
+
+PupilTracker::PupilTracker()
+{
+    // leave some cores to the grab loop, the encoder and the GUI
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 2));
+    maxPending = 4 * pool.maxThreadCount();
+}
+
+PupilTracker::~PupilTracker()
+{
+    waitForDone();
+    close();
+}
+
+/**
+ * @brief Clear results, to be called at the start of each run.
+ */
+
+void PupilTracker::reset()
+{
+    waitForDone();
+    QMutexLocker locker(&mutex);
+    results.clear();
+    firstIndex = 0;
+    skippedFrames = 0;
+}
+
+/**
+ * @brief Write the results taken from now on (tab separated, one row per frame).
+ */
+
+void PupilTracker::open(const QString &fileName)
+{
+    close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fileName).toStdString());
+    }
+    stream.setDevice(&file);
+    stream << "frame\tvalid\tarea\tcx\tcy\ta\tb\tangle\n";
+}
+
+/**
+ * @brief Wait for the pending frames, write their results and close the file.
+ */
+
+void PupilTracker::close()
+{
+    if (!file.isOpen()) {
+        return;
+    }
+    waitForDone();
+    takeCompleted();
+    stream.flush();
+    stream.setDevice(nullptr);
+    file.close();
+}
+
+/**
+ * @brief Queue a frame for processing.
+ * @param data Mono8 pixels, only the ROI is copied
+ * @param width
+ * @param height
+ * @param stride Bytes per row
+ *
+ * If the pool is lagging behind, the frame is skipped and its result is marked as invalid.
+ */
+
+void PupilTracker::submit(const uchar *data, int width, int height, int stride)
+{
+    QRect rect = (roi.isNull() ? QRect(0, 0, width, height) : roi)
+                 .intersected(QRect(0, 0, width, height));
+
+    QMutexLocker locker(&mutex);
+    const qint64 index = firstIndex + results.size();
+    Result r = {false, false, 0, 0, 0, 0, 0, 0};
+    results.append(r);
+
+    if (pending >= maxPending || rect.isEmpty()) {
+        results.last().done = true;
+        skippedFrames++;
+        return;
+    }
+    pending++;
+    locker.unlock();
+
+    QVector<uchar> buf(rect.width() * rect.height());
+    for (int y = 0; y < rect.height(); ++y) {
+        memcpy(buf.data() + y * rect.width(),
+               data + (rect.y() + y) * stride + rect.x(), rect.width());
+    }
+
+    pool.start(new PupilTask(this, index, buf, rect));
+}
+
+void PupilTracker::setResult(qint64 index, const Result &r)
+{
+    QMutexLocker locker(&mutex);
+    Result &dst = results[static_cast<int>(index - firstIndex)];
+    dst = r;
+    dst.done = true;
+    pending--;
+}
+
+/**
+ * @brief Pupil areas of the frames completed since the last call, in frame order (0 for frames
+ * where no pupil was found).
+ *
+ * The results of these frames are written to file, if open, and then dropped.
+ */
+
+QVector<double> PupilTracker::takeCompleted()
+{
+    QMutexLocker locker(&mutex);
+    QVector<double> areas;
+    int n = 0;
+    while (n < results.size() && results.at(n).done) {
+        const Result &r = results.at(n);
+        areas.append(r.valid ? r.area : 0);
+        if (file.isOpen()) {
+            stream << firstIndex + n << "\t" << (r.valid ? 1 : 0) << "\t"
+                   << r.area << "\t" << r.cx << "\t" << r.cy << "\t"
+                   << r.a << "\t" << r.b << "\t" << r.angle << "\n";
+        }
+        n++;
+    }
+    results.remove(0, n);
+    firstIndex += n;
+    return areas;
+}
+
+void PupilTracker::waitForDone()
+{
+    pool.waitForDone();
+}
+
+/**
+ * @brief Number of frames skipped because the pool was lagging behind.
+ */
+
+qint64 PupilTracker::getSkippedFrames() const
+{
+    QMutexLocker locker(&mutex);
+    return skippedFrames;
+}
+
+/**
+ * @brief Fit an ellipse to the largest dark blob.
+ * @param roi Mono8 pixels, contiguous rows
+ * @param width
+ * @param height
+ * @param threshold Pixels below the threshold belong to the pupil
+ * @param minArea Blobs smaller than this (px) are rejected
+ * @return Center in ROI coordinates
+ */
+
+PupilTracker::Result PupilTracker::fit(const uchar *roi, int width, int height,
+                                       int threshold, int minArea)
+{
+    Result best = {true, false, 0, 0, 0, 0, 0, 0};
+    const int n = width * height;
+
+    // 0: background, 1: dark not yet labeled, 2: labeled
+    QVector<uchar> mask(n);
+    for (int i = 0; i < n; ++i) {
+        mask[i] = roi[i] < threshold ? 1 : 0;
+    }
+
+    QVector<int> stack;
+    stack.reserve(n);
+    qint64 bestCount = 0;
+    double bestM[5] = {0, 0, 0, 0, 0};  // sum x, y, xx, xy, yy
+
+    for (int seed = 0; seed < n; ++seed) {
+        if (mask.at(seed) != 1) {
+            continue;
+        }
+
+        // flood fill (4-connected), accumulating raw moments
+        qint64 count = 0;
+        double m[5] = {0, 0, 0, 0, 0};
+        stack.clear();
+        stack.append(seed);
+        mask[seed] = 2;
+        while (!stack.isEmpty()) {
+            const int p = stack.takeLast();
+            const int x = p % width;
+            const int y = p / width;
+            count++;
+            m[0] += x;
+            m[1] += y;
+            m[2] += double(x) * x;
+            m[3] += double(x) * y;
+            m[4] += double(y) * y;
+
+            if (x > 0 && mask.at(p - 1) == 1) {
+                mask[p - 1] = 2;
+                stack.append(p - 1);
+            }
+            if (x < width - 1 && mask.at(p + 1) == 1) {
+                mask[p + 1] = 2;
+                stack.append(p + 1);
+            }
+            if (y > 0 && mask.at(p - width) == 1) {
+                mask[p - width] = 2;
+                stack.append(p - width);
+            }
+            if (y < height - 1 && mask.at(p + width) == 1) {
+                mask[p + width] = 2;
+                stack.append(p + width);
+            }
+        }
+
+        if (count > bestCount) {
+            bestCount = count;
+            memcpy(bestM, m, sizeof(m));
+        }
+    }
+
+    if (bestCount < qMax(minArea, 5)) {
+        return best;
+    }
+
+    const double cx = bestM[0] / bestCount;
+    const double cy = bestM[1] / bestCount;
+    const double sxx = bestM[2] / bestCount - cx * cx;
+    const double sxy = bestM[3] / bestCount - cx * cy;
+    const double syy = bestM[4] / bestCount - cy * cy;
+
+    // eigenvalues of the covariance matrix
+    const double tr = sxx + syy;
+    const double det = sxx * syy - sxy * sxy;
+    const double disc = sqrt(qMax(0., tr * tr / 4 - det));
+    const double l1 = tr / 2 + disc;
+    const double l2 = qMax(0., tr / 2 - disc);
+
+    // for a uniform ellipse, the variance along a semi-axis s is s^2 / 4
+    best.valid = true;
+    best.cx = cx;
+    best.cy = cy;
+    best.a = 2 * sqrt(l1);
+    best.b = 2 * sqrt(l2);
+    best.angle = 0.5 * atan2(2 * sxy, sxx - syy);
+    best.area = M_PI * best.a * best.b;
+    return best;
+}
+
+QRect PupilTracker::getROI() const
+{
+    return roi;
+}
+
+/**
+ * @brief ROI around the eye, in camera image coordinates (null rect for the full frame).
+ */
+
+void PupilTracker::setROI(const QRect &value)
+{
+    roi = value;
+}
+
+int PupilTracker::getThreshold() const
+{
+    return threshold;
+}
+
+void PupilTracker::setThreshold(int value)
+{
+    threshold = qBound(0, value, 255);
+}
+
+int PupilTracker::getMinArea() const
+{
+    return minArea;
+}
+
+void PupilTracker::setMinArea(int value)
+{
+    minArea = value;
+}
@@ -0,0 +1,81 @@
+#ifndef PUPILTRACKER_H
+#define PUPILTRACKER_H
+
+#include <QFile>
+#include <QMutex>
+#include <QRect>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QVector>
+
+/**
+ * @brief Online pupil size estimation on behavior camera frames.
+ *
+ * Within a ROI, pixels darker than a threshold are segmented, the largest connected dark blob is
+ * taken as the pupil and an ellipse is fitted to it from its second order moments (semi-axes
+ * 2 sqrt(lambda_i), lambda_i eigenvalues of the blob covariance).
+ *
+ * Frames are processed on a thread pool: submit() only copies the ROI, so that the grab loop keeps
+ * up with the frame rate. Results are stored by frame index until they are collected in order with
+ * takeCompleted(), which also writes them to the file given to open(), if any: memory usage does
+ * not grow with the length of the run, as long as takeCompleted() is called regularly.
+ */
+
+class PupilTracker
+{
+public:
+    struct Result {
+        bool done;
+        bool valid;
+        double area;   // px^2, area of the fitted ellipse
+        double cx, cy; // center, in image coordinates
+        double a, b;   // semi-axes (px)
+        double angle;  // rad, orientation of the major axis
+    };
+
+    PupilTracker();
+    virtual ~PupilTracker();
+
+    void reset();
+    void open(const QString &fileName);
+    void close();
+    void submit(const uchar *data, int width, int height, int stride);
+    QVector<double> takeCompleted();
+    void waitForDone();
+
+    qint64 getSkippedFrames() const;
+
+    QRect getROI() const;
+    void setROI(const QRect &value);
+
+    int getThreshold() const;
+    void setThreshold(int value);
+
+    int getMinArea() const;
+    void setMinArea(int value);
+
+    static Result fit(const uchar *roi, int width, int height, int threshold, int minArea);
+
+private:
+    friend class PupilTask;
+
+    QThreadPool pool;
+    int maxPending;
+
+    mutable QMutex mutex;
+    QVector<Result> results;  // not yet taken, results[0] is frame firstIndex
+    qint64 firstIndex = 0;
+    int pending = 0;
+    qint64 skippedFrames = 0;
+
+    QFile file;
+    QTextStream stream;
+
+    QRect roi;
+    int threshold = 40;
+    int minArea = 20;
+
+    void setResult(qint64 index, const Result &r);
+};
+
+#endif // PUPILTRACKER_H
@@ -9,6 +9,7 @@
 #include <qtlab/hw/hamamatsu/orcaflash.h>
 
 #include "savestackworker.h"
+#include "synctable.h"
 
 static Logger *logger = getLogger("SaveStackWorker");
 
@@ -48,25 +49,14 @@ void SaveStackWorker::start()
 
 
     TIFFWriter *writers[2];
-
-    if(enabledWriters == 0b11) {
-        writers[0] = new TIFFWriter(outputFile1, true);
-        writers[1] = new TIFFWriter(outputFile2, true);
-    }
-    else if (enabledWriters == 0b01) {
-        writers[0] = new TIFFWriter(outputFile1, true);
-        writers[1] = writers[0];
-    }
-    else if (enabledWriters == 0b10) {
-        writers[0] = new TIFFWriter(outputFile2, true);
-        writers[1] = writers[0];
-    } else {
-        writers[0] = new TIFFWriter(outputFile1.chopped(10).append(".tiff"), true);
-        writers[1] = writers[0];
-    }
+    openWriters(writers, 0);
 
 
     while (!stopped && readFrames < frameCount) {
+        // first frame of a trial other than the first one (trial mode)
+        const bool newTrial = framesPerTrial > 0 && readFrames > 0
+                              && readFrames % framesPerTrial == 0;
+
 #ifndef DEMO_MODE
         int32_t frame = readFrames % nFramesInBuffer;
         int32_t frameStamp = -1;
@@ -99,7 +89,17 @@ void SaveStackWorker::start()
             }
 
             timeStamps[readFrames] = timeStamp.sec * 1e6 + timeStamp.microsec;
-            if (readFrames != 0) {
+            if (syncTable) {
+                syncTable->addClockPoint(SyncTable::STREAM_ORCA, readFrames,
+                                         timeStamps[readFrames] * 1e-6);
+            }
+            if (newTrial) {
+                double delta = double(timeStamps[readFrames]) - double(timeStamps[readFrames - 1]);
+                logger->info(QString("Trial %1 started, %2 ms after the last frame of trial %3")
+                             .arg(readFrames / framesPerTrial + 1)
+                             .arg(delta * 1e-3, 0, 'f', 3)
+                             .arg(readFrames / framesPerTrial));
+            } else if (readFrames != 0) {
                 double delta = double(timeStamps[readFrames]) - double(timeStamps[readFrames - 1]);
                 if (abs(delta) > timeout) {
                     logger->warning(timeoutString(delta, readFrames));
@@ -123,7 +123,17 @@ void SaveStackWorker::start()
             usleep(20000);
 #endif
 
-            writers[readFrames % 2]->write((quint16 *)buf, width, height, 1);
+            if (newTrial) {
+                closeWriters(writers);
+                openWriters(writers, readFrames / framesPerTrial);
+            }
+
+            {
+                // LEDs restart from LED1 at every trial
+                const size_t i = framesPerTrial > 0 ? readFrames % framesPerTrial : readFrames;
+                frameMailbox.post(i, (quint16 *)buf, width * height);
+                writers[i % 2]->write((quint16 *)buf, width, height, 1);
+            }
             readFrames++;
 
 #ifndef DEMO_MODE
@@ -140,10 +150,7 @@ void SaveStackWorker::start()
     free(buf);
 #endif
 
-    delete writers[0];
-    if(enabledWriters == 0b11) {
-        delete writers[1];
-    }
+    closeWriters(writers);
 
     emit captureCompleted(readFrames == frameCount);
     QString msg = QString("Saved %1/%2 frames").arg(readFrames).arg(frameCount);
@@ -154,11 +161,64 @@ void SaveStackWorker::start()
     }
 }
 
+/**
+ * @brief Create the TIFF writers of the given trial.
+ *
+ * Files are <outputFile>_led1.tiff and <outputFile>_led2.tiff (a single file if only one LED is
+ * enabled). In trial mode, the trial number is appended to outputFile as for multiple runs.
+ */
+
+void SaveStackWorker::openWriters(TIFFWriter *writers[2], size_t trial)
+{
+    QString fname = outputFile;
+    if (framesPerTrial > 0) {
+        fname += QString("_%1").arg(trial, 5, 10, QChar('0'));
+    }
+
+    if(enabledWriters == 0b11) {
+        writers[0] = new TIFFWriter(fname + "_led1.tiff", true);
+        writers[1] = new TIFFWriter(fname + "_led2.tiff", true);
+    }
+    else if (enabledWriters == 0b01) {
+        writers[0] = new TIFFWriter(fname + "_led1.tiff", true);
+        writers[1] = writers[0];
+    }
+    else if (enabledWriters == 0b10) {
+        writers[0] = new TIFFWriter(fname + "_led2.tiff", true);
+        writers[1] = writers[0];
+    } else {
+        writers[0] = new TIFFWriter(fname + ".tiff", true);
+        writers[1] = writers[0];
+    }
+}
+
+void SaveStackWorker::closeWriters(TIFFWriter *writers[2])
+{
+    delete writers[0];
+    if (writers[1] != writers[0]) {
+        delete writers[1];
+    }
+}
+
 void SaveStackWorker::setEnabledWriters(const uint &value)
 {
     enabledWriters = value;
 }
 
+void SaveStackWorker::setSyncTable(SyncTable *value)
+{
+    syncTable = value;
+}
+
+/**
+ * @brief Live display access to the frames being saved.
+ */
+
+FrameMailbox *SaveStackWorker::getFrameMailbox()
+{
+    return &frameMailbox;
+}
+
 void SaveStackWorker::stop()
 {
     stopped = true;
@@ -194,8 +254,25 @@ void SaveStackWorker::setFrameCount(size_t count)
 
 void SaveStackWorker::setOutputFile(const QString &fname)
 {
-    outputFile1 = fname + "_led1.tiff";
-    outputFile2 = fname + "_led2.tiff";
+    outputFile = fname;
+}
+
+/**
+ * @brief Split the stack into trials of count frames each, saved to separate files.
+ * @param count 0 to disable trial mode
+ *
+ * Frame timestamps are not checked against the timeout across trial boundaries, where the
+ * inter-trial interval is logged instead.
+ */
+
+void SaveStackWorker::setFramesPerTrial(size_t count)
+{
+    framesPerTrial = count;
+}
+
+size_t SaveStackWorker::getFramesPerTrial() const
+{
+    return framesPerTrial;
 }
 
 void SaveStackWorker::signalTriggerCompletion()
@@ -4,7 +4,11 @@
 #include <QObject>
 #include <QString>
 
+#include "framemailbox.h"
+
 class OrcaFlash;
+class SyncTable;
+class TIFFWriter;
 
 class SaveStackWorker : public QObject
 {
@@ -16,6 +20,8 @@ public:
     void setTimeout(double value); // ms
     void setFrameCount(size_t count);
     size_t getFrameCount() const;
+    void setFramesPerTrial(size_t count);
+    size_t getFramesPerTrial() const;
     void setOutputFile(const QString &fname);
     void signalTriggerCompletion();
 
@@ -25,6 +31,10 @@ public:
 
     void setEnabledWriters(const uint &value);
 
+    void setSyncTable(SyncTable *value);
+
+    FrameMailbox *getFrameMailbox();
+
     void stop();
 
 signals:
@@ -41,12 +51,17 @@ private:
 
 private:
     void start();
+    void openWriters(TIFFWriter *writers[2], size_t trial);
+    void closeWriters(TIFFWriter *writers[2]);
     bool stopped, triggerCompleted;
     double timeout;
-    QString outputFile1, outputFile2;
+    QString outputFile;
     size_t frameCount, readFrames;
+    size_t framesPerTrial = 0;
     OrcaFlash *orca;
+    SyncTable *syncTable = nullptr;
     uint enabledWriters = 0b11;
+    FrameMailbox frameMailbox;
 
     QString timeoutString(double delta, int i);
 };
@@ -1,20 +1,45 @@
 #include <memory>
+#include <stdexcept>
 
 #include <QSettings>
 #include <QDir>
 #include <QRect>
 #include <QSerialPortInfo>
 
+#include <qtlab/core/logmanager.h>
+
 #include "optrode.h"
 #include "tasks.h"
 #include "chameleoncamera.h"
 #include "dds.h"
+#include "edgerecorder.h"
+#include "elreadoutworker.h"
+#include "filterbank.h"
+#include "behavworker.h"
+#include "videoencoder.h"
 
 #include "settings.h"
 
 #define SET_VALUE(group, key, default_val) \
     setValue(group, key, settings.value(key, default_val))
 
+static Logger *logger = logManager().getLogger("Settings");
+
+// indexed by Tasks::AO_OUTPUT
+static const char *aoGroups[Tasks::N_AO_OUTPUTS] = {
+    SETTINGSGROUP_AO_LED,
+    SETTINGSGROUP_AO_STIMULATION,
+};
+
+/**
+ * @brief Settings key of the ROI of the i-th behavior camera.
+ */
+
+static QString behavCamROIKey(int i)
+{
+    return i == 0 ? QString(SETTING_ROI) : QString("%1%2").arg(SETTING_ROI).arg(i);
+}
+
 Settings::Settings()
 {
     loadSettings();
@@ -91,6 +116,36 @@ void Settings::loadSettings()
     settings.beginGroup(groupName);
 
     SET_VALUE(groupName, SETTING_ROI, QRect(0, 0, 1280, 1024));
+    // ROI1, ROI2, ... for additional behavior cameras
+    for (const QString &key : settings.childKeys()) {
+        if (key.startsWith(SETTING_ROI)) {
+            SET_VALUE(groupName, key, QRect(0, 0, 1280, 1024));
+        }
+    }
+
+    settings.endGroup();
+
+
+    groupName = SETTINGSGROUP_BEHAVIOR;
+    settings.beginGroup(groupName);
+
+    SET_VALUE(groupName, SETTING_N_BEHAVIOR_CAMERAS, 1);
+    SET_VALUE(groupName, SETTING_BEHAVIOR_CAMERA_SERIALS, QStringList());
+    SET_VALUE(groupName, SETTING_ENCODER_QUEUE_SIZE, 64);
+    SET_VALUE(groupName, SETTING_ENCODER_DROP_POLICY, VideoEncoder::DROP_NEWEST);
+    SET_VALUE(groupName, SETTING_ENCODER_CODEC, VideoEncoder::CODEC_H264);
+    SET_VALUE(groupName, SETTING_ENCODER_BITRATE, 1000000);
+    SET_VALUE(groupName, SETTING_ENCODER_MJPEG_QUALITY, 75);
+    SET_VALUE(groupName, SETTING_MOTION_ENERGY_ENABLED, false);
+    SET_VALUE(groupName, SETTING_MOTION_ENERGY_ROIS, QVariantList({QRect()}));
+    SET_VALUE(groupName, SETTING_MOTION_ENERGY_ROI_NAMES, QStringList({"full_frame"}));
+    SET_VALUE(groupName, SETTING_PUPIL_ENABLED, false);
+    SET_VALUE(groupName, SETTING_PUPIL_ROI, QRect());
+    SET_VALUE(groupName, SETTING_PUPIL_THRESHOLD, 40);
+    SET_VALUE(groupName, SETTING_PUPIL_MIN_AREA, 20);
+    SET_VALUE(groupName, SETTING_RECORDING_MODE, BehavWorker::RECORDING_CONTINUOUS);
+    SET_VALUE(groupName, SETTING_PRE_EVENT, 1.);
+    SET_VALUE(groupName, SETTING_POST_EVENT, 2.);
 
     settings.endGroup();
 
@@ -102,6 +157,15 @@ void Settings::loadSettings()
     SET_VALUE(groupName, SETTING_TERM, "/Dev1/PFI0");
     SET_VALUE(groupName, SETTING_FREQ, 50);
     SET_VALUE(groupName, SETTING_ENABLED, true);
+    SET_VALUE(groupName, SETTING_FILTER_ENABLED, false);
+    SET_VALUE(groupName, SETTING_LFP_CUTOFF, 300);
+    SET_VALUE(groupName, SETTING_LFP_RATE, 1000);
+    SET_VALUE(groupName, SETTING_SPIKE_LOWCUT, 300);
+    SET_VALUE(groupName, SETTING_SPIKE_HIGHCUT, 5000);
+    SET_VALUE(groupName, SETTING_RAW_INT16, false);
+    SET_VALUE(groupName, SETTING_SPECTRUM_ENABLED, false);
+    SET_VALUE(groupName, SETTING_SPECTRUM_SEGMENT_SIZE, 0);
+    SET_VALUE(groupName, SETTING_SPECTRUM_AVERAGES, 8);
 
     settings.endGroup();
 
@@ -117,10 +181,31 @@ void Settings::loadSettings()
     SET_VALUE(groupName, SETTING_ENABLED, true);
     SET_VALUE(groupName, SETTING_ALWAYS_ON, false);
     SET_VALUE(groupName, SETTING_AOD_ENABLED, false);
+    SET_VALUE(groupName, SETTING_AOD_SEQUENCE_ENABLED, false);
+    SET_VALUE(groupName, SETTING_AOD_TARGETS, QVariantList());
+    SET_VALUE(groupName, SETTING_PROTOCOL_ENABLED, false);
+    SET_VALUE(groupName, SETTING_PROTOCOL_FILE, "");
 
     settings.endGroup();
 
 
+    for (int i = 0; i < Tasks::N_AO_OUTPUTS; ++i) {
+        groupName = aoGroups[i];
+        settings.beginGroup(groupName);
+
+        SET_VALUE(groupName, SETTING_ENABLED, false);
+        SET_VALUE(groupName, SETTING_PHYSCHAN, QString("Dev1/ao%1").arg(i));
+        SET_VALUE(groupName, SETTING_SHAPE, WaveformSynth::SHAPE_SINE);
+        SET_VALUE(groupName, SETTING_AMPLITUDE, 5);
+        SET_VALUE(groupName, SETTING_OFFSET, 0);
+        SET_VALUE(groupName, SETTING_FREQ, 10);
+        SET_VALUE(groupName, SETTING_DUTY_CYCLE, 0.5);
+        SET_VALUE(groupName, SETTING_EDGE_TIME, 1e-3);
+
+        settings.endGroup();
+    }
+
+
     groupName = SETTINGSGROUP_AUXSTIMULATION;
     settings.beginGroup(groupName);
 
@@ -133,6 +218,35 @@ void Settings::loadSettings()
     settings.endGroup();
 
 
+    groupName = SETTINGSGROUP_CLOSEDLOOP;
+    settings.beginGroup(groupName);
+
+    SET_VALUE(groupName, SETTING_ENABLED, false);
+    SET_VALUE(groupName, SETTING_OUTPUT, Tasks::CLOSED_LOOP_STIMULATION);
+    SET_VALUE(groupName, SETTING_NPULSES, 1);
+    SET_VALUE(groupName, SETTING_DETECTOR, ClosedLoopDetector::DETECTOR_THRESHOLD);
+    SET_VALUE(groupName, SETTING_THRESHOLD, 1.);
+    SET_VALUE(groupName, SETTING_WINDOW, 0.01);
+    SET_VALUE(groupName, SETTING_BAND_LOW, 4);
+    SET_VALUE(groupName, SETTING_BAND_HIGH, 12);
+    SET_VALUE(groupName, SETTING_REFRACTORY, 1.);
+
+    settings.endGroup();
+
+
+    groupName = SETTINGSGROUP_EDGERECORDER;
+    settings.beginGroup(groupName);
+
+    SET_VALUE(groupName, SETTING_ENABLED, false);
+    QStringList edgeLines;
+    for (int i = 0; i < EdgeRecorder::N_LINES; ++i) {
+        edgeLines << QString("Dev2/port0/line%1").arg(i);
+    }
+    SET_VALUE(groupName, SETTING_LINES, edgeLines);
+
+    settings.endGroup();
+
+
     groupName = SETTINGSGROUP_ZAXIS;
     settings.beginGroup(groupName);
 
@@ -174,6 +288,10 @@ void Settings::loadSettings()
 
     SET_VALUE(groupName, SETTING_MULTIRUN_ENABLED, false);
     SET_VALUE(groupName, SETTING_NRUNS, 2);
+    SET_VALUE(groupName, SETTING_TRIAL_MODE, false);
+    SET_VALUE(groupName, SETTING_INTER_TRIAL_INTERVAL, 1);
+    SET_VALUE(groupName, SETTING_REUSE_NI_TASKS, true);
+    SET_VALUE(groupName, SETTING_AO_RATE, 10000);
 
     settings.endGroup();
 
@@ -197,6 +315,18 @@ void Settings::loadSettings()
     t->setElectrodeReadoutPhysChan(value(g, SETTING_PHYSCHAN).toString());
     t->setElectrodeReadoutRate(value(g, SETTING_FREQ).toDouble());
     t->setElectrodeReadoutEnabled(value(g, SETTING_ENABLED).toBool());
+    ElReadoutWorker *elWorker = optrode().getElReadoutWorker();
+    elWorker->setFilterEnabled(value(g, SETTING_FILTER_ENABLED).toBool());
+    elWorker->setRawEnabled(value(g, SETTING_RAW_INT16).toBool());
+    elWorker->setSpectrumEnabled(value(g, SETTING_SPECTRUM_ENABLED).toBool());
+    SpectrumAnalyzer *sa = elWorker->getSpectrumAnalyzer();
+    sa->setSegmentSize(value(g, SETTING_SPECTRUM_SEGMENT_SIZE).toInt());
+    sa->setAveragedSegments(value(g, SETTING_SPECTRUM_AVERAGES).toInt());
+    FilterBank *fb = elWorker->getFilterBank();
+    fb->setLFPCutoff(value(g, SETTING_LFP_CUTOFF).toDouble());
+    fb->setLFPRate(value(g, SETTING_LFP_RATE).toDouble());
+    fb->setSpikeLowCut(value(g, SETTING_SPIKE_LOWCUT).toDouble());
+    fb->setSpikeHighCut(value(g, SETTING_SPIKE_HIGHCUT).toDouble());
 
     g = SETTINGSGROUP_STIMULATION;
     t->setStimulationHighTime(value(g, SETTING_HIGH_TIME).toDouble());
@@ -205,6 +335,39 @@ void Settings::loadSettings()
     t->setStimulationEnabled(value(g, SETTING_ENABLED).toBool());
     t->setContinuousStimulation(value(g, SETTING_ALWAYS_ON).toBool());
     t->setAODEnabled(value(g, SETTING_AOD_ENABLED).toBool());
+    t->setAODSequenceEnabled(value(g, SETTING_AOD_SEQUENCE_ENABLED).toBool());
+    QVector<AODTarget> targets;
+    for (const QVariant &v : value(g, SETTING_AOD_TARGETS).toList()) {
+        QVariantMap m = v.toMap();
+        AODTarget target;
+        target.point = QPointF(m.value("x").toDouble(), m.value("y").toDouble());
+        target.dwell = m.value("dwell", target.dwell).toDouble();
+        target.amplitude = m.value("amplitude", target.amplitude).toDouble();
+        targets << target;
+    }
+    t->getAODSequence()->setTargets(targets);
+    t->setStimulationProtocolEnabled(value(g, SETTING_PROTOCOL_ENABLED).toBool());
+    if (!value(g, SETTING_PROTOCOL_FILE).toString().isEmpty()) {
+        try {
+            t->loadStimulationProtocol(value(g, SETTING_PROTOCOL_FILE).toString());
+        } catch (std::runtime_error e) {
+            logger->warning(e.what());
+        }
+    }
+
+    for (int i = 0; i < Tasks::N_AO_OUTPUTS; ++i) {
+        g = aoGroups[i];
+        Tasks::AO_OUTPUT o = static_cast<Tasks::AO_OUTPUT>(i);
+        t->setAnalogOutputEnabled(o, value(g, SETTING_ENABLED).toBool());
+        t->setAnalogOutputPhysChan(o, value(g, SETTING_PHYSCHAN).toString());
+        WaveformSynth *w = t->getWaveform(o);
+        w->setShape(static_cast<WaveformSynth::SHAPE>(value(g, SETTING_SHAPE).toInt()));
+        w->setAmplitude(value(g, SETTING_AMPLITUDE).toDouble());
+        w->setOffset(value(g, SETTING_OFFSET).toDouble());
+        w->setFrequency(value(g, SETTING_FREQ).toDouble());
+        w->setDutyCycle(value(g, SETTING_DUTY_CYCLE).toDouble());
+        w->setEdgeTime(value(g, SETTING_EDGE_TIME).toDouble());
+    }
 
     g = SETTINGSGROUP_AUXSTIMULATION;
     t->setAuxStimulationEnabled(value(g, SETTING_ENABLED).toBool());
@@ -213,6 +376,28 @@ void Settings::loadSettings()
     t->setAuxStimulationNPulses(value(g, SETTING_NPULSES).toDouble());
     t->setAuxStimulationDelay(value(g, SETTING_INITIALDELAY).toDouble());
 
+    g = SETTINGSGROUP_CLOSEDLOOP;
+    t->setClosedLoopEnabled(value(g, SETTING_ENABLED).toBool());
+    t->setClosedLoopOutput(
+        static_cast<Tasks::CLOSED_LOOP_OUTPUT>(value(g, SETTING_OUTPUT).toInt()));
+    t->setClosedLoopNPulses(value(g, SETTING_NPULSES).toULongLong());
+    ClosedLoopDetector *det = elWorker->getClosedLoopDetector();
+    det->setDetector(
+        static_cast<ClosedLoopDetector::DETECTOR>(value(g, SETTING_DETECTOR).toInt()));
+    det->setThreshold(value(g, SETTING_THRESHOLD).toDouble());
+    det->setWindow(value(g, SETTING_WINDOW).toDouble());
+    det->setBandLow(value(g, SETTING_BAND_LOW).toDouble());
+    det->setBandHigh(value(g, SETTING_BAND_HIGH).toDouble());
+    det->setRefractoryPeriod(value(g, SETTING_REFRACTORY).toDouble());
+
+    g = SETTINGSGROUP_EDGERECORDER;
+    EdgeRecorder *edges = t->getEdgeRecorder();
+    edges->setEnabled(value(g, SETTING_ENABLED).toBool());
+    const QStringList edgeLines = value(g, SETTING_LINES).toStringList();
+    for (int i = 0; i < EdgeRecorder::N_LINES; ++i) {
+        edges->setLinePhysChan(static_cast<EdgeRecorder::LINE>(i), edgeLines.value(i));
+    }
+
     g = SETTINGSGROUP_TIMING;
     t->setStimulationInitialDelay(value(g, SETTING_INITIALDELAY).toDouble());
     t->setStimulationDuration(value(g, SETTING_STIMDURATION).toDouble());
@@ -225,9 +410,52 @@ void Settings::loadSettings()
     optrode().setSaveBehaviorEnabled(value(g, SETTING_SAVEBEHAVIOR).toBool());
     optrode().setMultiRunEnabled(value(g, SETTING_MULTIRUN_ENABLED).toBool());
     optrode().setNRuns(value(g, SETTING_NRUNS).toInt());
+    optrode().setTrialModeEnabled(value(g, SETTING_TRIAL_MODE).toBool());
+    t->setInterTrialInterval(value(g, SETTING_INTER_TRIAL_INTERVAL).toDouble());
+    t->setTaskReuseEnabled(value(g, SETTING_REUSE_NI_TASKS).toBool());
+    t->setAnalogOutputRate(value(g, SETTING_AO_RATE).toDouble());
 
     g = SETTINGSGROUP_BEHAVCAMROI;
-    optrode().getBehaviorCamera()->setROI(value(g, SETTING_ROI).toRect());
+    for (int i = 0; i < optrode().behaviorCameraCount(); ++i) {
+        QVariant roi = value(g, behavCamROIKey(i));
+        if (!roi.isValid()) {
+            roi = value(g, SETTING_ROI);
+        }
+        optrode().getBehaviorCamera(i)->setROI(roi.toRect());
+    }
+
+    g = SETTINGSGROUP_BEHAVIOR;
+    // all behavior cameras share the encoder settings
+    for (int i = 0; i < optrode().behaviorCameraCount(); ++i) {
+        VideoEncoder *encoder = optrode().getBehavWorker(i)->getEncoder();
+        encoder->setQueueCapacity(value(g, SETTING_ENCODER_QUEUE_SIZE).toInt());
+        encoder->setDropPolicy(static_cast<VideoEncoder::DROP_POLICY>(
+                                   value(g, SETTING_ENCODER_DROP_POLICY).toInt()));
+        encoder->setCodec(
+            static_cast<VideoEncoder::CODEC>(value(g, SETTING_ENCODER_CODEC).toInt()));
+        encoder->setBitrate(value(g, SETTING_ENCODER_BITRATE).toUInt());
+        encoder->setMJPEGQuality(value(g, SETTING_ENCODER_MJPEG_QUALITY).toUInt());
+
+        BehavWorker *worker = optrode().getBehavWorker(i);
+        worker->setRecordingMode(static_cast<BehavWorker::RECORDING_MODE>(
+                                     value(g, SETTING_RECORDING_MODE).toInt()));
+        EventWindowRecorder *ewr = worker->getEventWindowRecorder();
+        ewr->setPreEventTime(value(g, SETTING_PRE_EVENT).toDouble());
+        ewr->setPostEventTime(value(g, SETTING_POST_EVENT).toDouble());
+    }
+    BehavWorker *behavWorker = optrode().getBehavWorker();
+    behavWorker->setMotionEnergyEnabled(value(g, SETTING_MOTION_ENERGY_ENABLED).toBool());
+    QVector<QRect> motionROIs;
+    for (const QVariant &v : value(g, SETTING_MOTION_ENERGY_ROIS).toList()) {
+        motionROIs << v.toRect();
+    }
+    behavWorker->getMotionEnergy()->setROIs(
+        motionROIs, value(g, SETTING_MOTION_ENERGY_ROI_NAMES).toStringList());
+    behavWorker->setPupilTrackingEnabled(value(g, SETTING_PUPIL_ENABLED).toBool());
+    PupilTracker *pt = behavWorker->getPupilTracker();
+    pt->setROI(value(g, SETTING_PUPIL_ROI).toRect());
+    pt->setThreshold(value(g, SETTING_PUPIL_THRESHOLD).toInt());
+    pt->setMinArea(value(g, SETTING_PUPIL_MIN_AREA).toInt());
 
     g = SETTINGSGROUP_ZAXIS;
     PIDevice *dev = optrode().getZAxis();
@@ -252,7 +480,34 @@ void Settings::saveSettings()
     setValue(g, SETTING_TERM, t->getMainTrigTerm());
 
     g = SETTINGSGROUP_BEHAVCAMROI;
-    setValue(g, SETTING_ROI, optrode().getBehaviorCamera()->getROI());
+    for (int i = 0; i < optrode().behaviorCameraCount(); ++i) {
+        setValue(g, behavCamROIKey(i), optrode().getBehaviorCamera(i)->getROI());
+    }
+
+    g = SETTINGSGROUP_BEHAVIOR;
+    VideoEncoder *encoder = optrode().getBehavWorker()->getEncoder();
+    setValue(g, SETTING_ENCODER_QUEUE_SIZE, encoder->getQueueCapacity());
+    setValue(g, SETTING_ENCODER_DROP_POLICY, encoder->getDropPolicy());
+    setValue(g, SETTING_ENCODER_CODEC, encoder->getCodec());
+    setValue(g, SETTING_ENCODER_BITRATE, encoder->getBitrate());
+    setValue(g, SETTING_ENCODER_MJPEG_QUALITY, encoder->getMJPEGQuality());
+    BehavWorker *behavWorker = optrode().getBehavWorker();
+    setValue(g, SETTING_MOTION_ENERGY_ENABLED, behavWorker->isMotionEnergyEnabled());
+    QVariantList motionROIs;
+    for (const QRect &r : behavWorker->getMotionEnergy()->getROIs()) {
+        motionROIs << r;
+    }
+    setValue(g, SETTING_MOTION_ENERGY_ROIS, motionROIs);
+    setValue(g, SETTING_MOTION_ENERGY_ROI_NAMES, behavWorker->getMotionEnergy()->getROINames());
+    setValue(g, SETTING_PUPIL_ENABLED, behavWorker->isPupilTrackingEnabled());
+    PupilTracker *pt = behavWorker->getPupilTracker();
+    setValue(g, SETTING_PUPIL_ROI, pt->getROI());
+    setValue(g, SETTING_PUPIL_THRESHOLD, pt->getThreshold());
+    setValue(g, SETTING_PUPIL_MIN_AREA, pt->getMinArea());
+    setValue(g, SETTING_RECORDING_MODE, behavWorker->getRecordingMode());
+    EventWindowRecorder *ewr = behavWorker->getEventWindowRecorder();
+    setValue(g, SETTING_PRE_EVENT, ewr->getPreEventTime());
+    setValue(g, SETTING_POST_EVENT, ewr->getPostEventTime());
 
     g = SETTINGSGROUP_LED1;
     setValue(g, SETTING_FREQ, t->getLEDFreq());
@@ -267,6 +522,18 @@ void Settings::saveSettings()
     setValue(g, SETTING_PHYSCHAN, t->getElectrodeReadoutPhysChan());
     setValue(g, SETTING_FREQ, t->getElectrodeReadoutRate());
     setValue(g, SETTING_ENABLED, t->getElectrodeReadoutEnabled());
+    ElReadoutWorker *elWorker = optrode().getElReadoutWorker();
+    setValue(g, SETTING_FILTER_ENABLED, elWorker->isFilterEnabled());
+    setValue(g, SETTING_RAW_INT16, elWorker->isRawEnabled());
+    setValue(g, SETTING_SPECTRUM_ENABLED, elWorker->isSpectrumEnabled());
+    SpectrumAnalyzer *sa = elWorker->getSpectrumAnalyzer();
+    setValue(g, SETTING_SPECTRUM_SEGMENT_SIZE, sa->getSegmentSize());
+    setValue(g, SETTING_SPECTRUM_AVERAGES, sa->getAveragedSegments());
+    FilterBank *fb = elWorker->getFilterBank();
+    setValue(g, SETTING_LFP_CUTOFF, fb->getLFPCutoff());
+    setValue(g, SETTING_LFP_RATE, fb->getLFPRate());
+    setValue(g, SETTING_SPIKE_LOWCUT, fb->getSpikeLowCut());
+    setValue(g, SETTING_SPIKE_HIGHCUT, fb->getSpikeHighCut());
 
     g = SETTINGSGROUP_STIMULATION;
     setValue(g, SETTING_LOW_TIME, t->getStimulationLowTime());
@@ -275,6 +542,33 @@ void Settings::saveSettings()
     setValue(g, SETTING_ENABLED, t->getStimulationEnabled());
     setValue(g, SETTING_ALWAYS_ON, t->getContinuousStimulation());
     setValue(g, SETTING_AOD_ENABLED, t->isAODEnabled());
+    setValue(g, SETTING_AOD_SEQUENCE_ENABLED, t->isAODSequenceEnabled());
+    QVariantList targets;
+    for (const AODTarget &target : t->getAODSequence()->getTargets()) {
+        QVariantMap m;
+        m["x"] = target.point.x();
+        m["y"] = target.point.y();
+        m["dwell"] = target.dwell;
+        m["amplitude"] = target.amplitude;
+        targets << m;
+    }
+    setValue(g, SETTING_AOD_TARGETS, targets);
+    setValue(g, SETTING_PROTOCOL_ENABLED, t->isStimulationProtocolEnabled());
+    setValue(g, SETTING_PROTOCOL_FILE, t->getStimulationProtocol()->getFileName());
+
+    for (int i = 0; i < Tasks::N_AO_OUTPUTS; ++i) {
+        g = aoGroups[i];
+        Tasks::AO_OUTPUT o = static_cast<Tasks::AO_OUTPUT>(i);
+        setValue(g, SETTING_ENABLED, t->isAnalogOutputEnabled(o));
+        setValue(g, SETTING_PHYSCHAN, t->getAnalogOutputPhysChan(o));
+        WaveformSynth *w = t->getWaveform(o);
+        setValue(g, SETTING_SHAPE, w->getShape());
+        setValue(g, SETTING_AMPLITUDE, w->getAmplitude());
+        setValue(g, SETTING_OFFSET, w->getOffset());
+        setValue(g, SETTING_FREQ, w->getFrequency());
+        setValue(g, SETTING_DUTY_CYCLE, w->getDutyCycle());
+        setValue(g, SETTING_EDGE_TIME, w->getEdgeTime());
+    }
 
     g = SETTINGSGROUP_AUXSTIMULATION;
     setValue(g, SETTING_ENABLED, t->getAuxStimulationEnabled());
@@ -283,6 +577,27 @@ void Settings::saveSettings()
     setValue(g, SETTING_NPULSES, t->getAuxStimulationNPulses());
     setValue(g, SETTING_INITIALDELAY, t->getAuxStimulationDelay());
 
+    g = SETTINGSGROUP_CLOSEDLOOP;
+    setValue(g, SETTING_ENABLED, t->isClosedLoopEnabled());
+    setValue(g, SETTING_OUTPUT, t->getClosedLoopOutput());
+    setValue(g, SETTING_NPULSES, t->getClosedLoopNPulses());
+    ClosedLoopDetector *det = elWorker->getClosedLoopDetector();
+    setValue(g, SETTING_DETECTOR, det->getDetector());
+    setValue(g, SETTING_THRESHOLD, det->getThreshold());
+    setValue(g, SETTING_WINDOW, det->getWindow());
+    setValue(g, SETTING_BAND_LOW, det->getBandLow());
+    setValue(g, SETTING_BAND_HIGH, det->getBandHigh());
+    setValue(g, SETTING_REFRACTORY, det->getRefractoryPeriod());
+
+    g = SETTINGSGROUP_EDGERECORDER;
+    EdgeRecorder *edges = t->getEdgeRecorder();
+    setValue(g, SETTING_ENABLED, edges->isEnabled());
+    QStringList edgeLines;
+    for (int i = 0; i < EdgeRecorder::N_LINES; ++i) {
+        edgeLines << edges->getLinePhysChan(static_cast<EdgeRecorder::LINE>(i));
+    }
+    setValue(g, SETTING_LINES, edgeLines);
+
     g = SETTINGSGROUP_TIMING;
     setValue(g, SETTING_INITIALDELAY, t->getStimulationInitialDelay());
     setValue(g, SETTING_STIMDURATION, t->stimulationDuration());
@@ -295,6 +610,10 @@ void Settings::saveSettings()
     setValue(g, SETTING_SAVEBEHAVIOR, optrode().isSaveBehaviorEnabled());
     setValue(g, SETTING_MULTIRUN_ENABLED, optrode().isMultiRunEnabled());
     setValue(g, SETTING_NRUNS, optrode().getNRuns());
+    setValue(g, SETTING_TRIAL_MODE, optrode().isTrialModeEnabled());
+    setValue(g, SETTING_INTER_TRIAL_INTERVAL, t->getInterTrialInterval());
+    setValue(g, SETTING_REUSE_NI_TASKS, t->isTaskReuseEnabled());
+    setValue(g, SETTING_AO_RATE, t->getAnalogOutputRate());
 
     g = SETTINGSGROUP_ZAXIS;
     PIDevice *dev = optrode().getZAxis();
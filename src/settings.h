@@ -10,12 +10,17 @@
 #define SETTINGSGROUP_LED1 "LED1"
 #define SETTINGSGROUP_LED2 "LED2"
 #define SETTINGSGROUP_BEHAVCAMROI "BehavCamROI"
+#define SETTINGSGROUP_BEHAVIOR "Behavior"
 #define SETTINGSGROUP_ELREADOUT "ElectrodeReadout"
 #define SETTINGSGROUP_STIMULATION "Stimulation"
 #define SETTINGSGROUP_AUXSTIMULATION "AuxStimulation"
 #define SETTINGSGROUP_TIMING "Timing"
 #define SETTINGSGROUP_ZAXIS "zAxis"
 #define SETTINGSGROUP_DDS "DDS"
+#define SETTINGSGROUP_AO_LED "AnalogOutLED"
+#define SETTINGSGROUP_AO_STIMULATION "AnalogOutStimulation"
+#define SETTINGSGROUP_CLOSEDLOOP "ClosedLoop"
+#define SETTINGSGROUP_EDGERECORDER "EdgeRecorder"
 
 #define SETTING_POS "pos"
 #define SETTING_VELOCITY "velocity"
@@ -39,6 +44,34 @@
 #define SETTING_ENABLED "enabled"
 #define SETTING_ALWAYS_ON "alwaysOn"
 #define SETTING_AOD_ENABLED "aodEnabled"
+#define SETTING_AOD_SEQUENCE_ENABLED "aodSequenceEnabled"
+#define SETTING_AOD_TARGETS "aodTargets"
+#define SETTING_PROTOCOL_ENABLED "protocolEnabled"
+#define SETTING_PROTOCOL_FILE "protocolFile"
+#define SETTING_SHAPE "shape"
+#define SETTING_AMPLITUDE "amplitude"
+#define SETTING_OFFSET "offset"
+#define SETTING_DUTY_CYCLE "dutyCycle"
+#define SETTING_EDGE_TIME "edgeTime"
+#define SETTING_AO_RATE "analogOutRate"
+#define SETTING_OUTPUT "output"
+#define SETTING_DETECTOR "detector"
+#define SETTING_THRESHOLD "threshold"
+#define SETTING_WINDOW "window"
+#define SETTING_BAND_LOW "bandLow"
+#define SETTING_BAND_HIGH "bandHigh"
+#define SETTING_REFRACTORY "refractoryPeriod"
+#define SETTING_LINES "lines"
+
+#define SETTING_FILTER_ENABLED "filterEnabled"
+#define SETTING_LFP_CUTOFF "lfpCutoff"
+#define SETTING_LFP_RATE "lfpRate"
+#define SETTING_SPIKE_LOWCUT "spikeLowCut"
+#define SETTING_SPIKE_HIGHCUT "spikeHighCut"
+#define SETTING_RAW_INT16 "rawInt16"
+#define SETTING_SPECTRUM_ENABLED "spectrumEnabled"
+#define SETTING_SPECTRUM_SEGMENT_SIZE "spectrumSegmentSize"
+#define SETTING_SPECTRUM_AVERAGES "spectrumAverages"
 
 #define SETTING_INITIALDELAY "initialDelay"
 #define SETTING_POSTSTIMULATION "postStimulation"
@@ -49,6 +82,9 @@
 
 #define SETTING_MULTIRUN_ENABLED "multiRunEnabled"
 #define SETTING_NRUNS "nRuns"
+#define SETTING_TRIAL_MODE "trialModeEnabled"
+#define SETTING_INTER_TRIAL_INTERVAL "interTrialInterval"
+#define SETTING_REUSE_NI_TASKS "reuseNITasks"
 
 #define SETTING_OUTPUTPATH "outputPath"
 #define SETTING_RUNNAME "runName"
@@ -57,6 +93,24 @@
 
 #define SETTING_ROI "ROI"
 
+#define SETTING_N_BEHAVIOR_CAMERAS "nCameras"
+#define SETTING_BEHAVIOR_CAMERA_SERIALS "cameraSerials"
+#define SETTING_ENCODER_QUEUE_SIZE "encoderQueueSize"
+#define SETTING_ENCODER_DROP_POLICY "encoderDropPolicy"
+#define SETTING_ENCODER_CODEC "encoderCodec"
+#define SETTING_ENCODER_BITRATE "encoderBitrate"
+#define SETTING_ENCODER_MJPEG_QUALITY "encoderMJPEGQuality"
+#define SETTING_MOTION_ENERGY_ENABLED "motionEnergyEnabled"
+#define SETTING_MOTION_ENERGY_ROIS "motionEnergyROIs"
+#define SETTING_MOTION_ENERGY_ROI_NAMES "motionEnergyROINames"
+#define SETTING_PUPIL_ENABLED "pupilEnabled"
+#define SETTING_PUPIL_ROI "pupilROI"
+#define SETTING_PUPIL_THRESHOLD "pupilThreshold"
+#define SETTING_PUPIL_MIN_AREA "pupilMinArea"
+#define SETTING_RECORDING_MODE "recordingMode"
+#define SETTING_PRE_EVENT "preEvent"
+#define SETTING_POST_EVENT "postEvent"
+
 typedef QMap<QString, QVariant> SettingsMap;
 
 class Settings
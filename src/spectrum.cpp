@@ -0,0 +1,373 @@
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <QtMath>
+
+#include "spectrum.h"
+
+#define MIN_BAND_BINS 2  // fewer bins per band are reported by getUnresolvedBands()
+#define AUTO_SEGMENT_SEC 4  // automatic segment size: at least 0.25 Hz resolution
+
+FFTPlan::FFTPlan()
+{
+}
+
+/**
+ * @brief Precompute bit reversal permutation and twiddle factors.
+ * @param size Must be a power of 2
+ */
+
+void FFTPlan::init(int size)
+{
+    if (size < 2 || (size & (size - 1))) {
+        throw std::runtime_error("FFT size must be a power of 2");
+    }
+    if (size == n) {
+        return;
+    }
+    n = size;
+
+    int bits = 0;
+    while ((1 << bits) < n) {
+        bits++;
+    }
+
+    bitReversed.resize(n);
+    for (int i = 0; i < n; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bitReversed[i] = r;
+    }
+
+    twiddles.resize(n / 2);
+    for (int k = 0; k < n / 2; ++k) {
+        twiddles[k] = std::polar(1., -2 * M_PI * k / n);
+    }
+}
+
+int FFTPlan::size() const
+{
+    return n;
+}
+
+/**
+ * @brief In place forward transform of size() complex samples.
+ */
+
+void FFTPlan::transform(std::complex<double> *data) const
+{
+    for (int i = 0; i < n; ++i) {
+        int j = bitReversed.at(i);
+        if (j > i) {
+            std::swap(data[i], data[j]);
+        }
+    }
+
+    const std::complex<double> *tw = twiddles.constData();
+    for (int len = 2; len <= n; len <<= 1) {
+        const int half = len / 2;
+        const int step = n / len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < half; ++k) {
+                std::complex<double> t = tw[k * step] * data[i + k + half];
+                data[i + k + half] = data[i + k] - t;
+                data[i + k] += t;
+            }
+        }
+    }
+}
+
+
+SpectrumAnalyzer::SpectrumAnalyzer()
+{
+    setBands({{1, 4}, {4, 8}, {8, 13}, {13, 30}, {30, 100}},
+             {"delta", "theta", "alpha", "beta", "gamma"});
+}
+
+/**
+ * @brief Allocate buffers for the given sample rate and reset the estimate.
+ * @param sampleRate Hz
+ *
+ * When the segment size is automatic (0), the next power of 2 of AUTO_SEGMENT_SEC seconds of
+ * samples is used, so that the default bands are resolved at any sample rate.
+ */
+
+void SpectrumAnalyzer::init(double sampleRate)
+{
+    this->sampleRate = sampleRate;
+
+    segmentSize = requestedSegmentSize;
+    if (segmentSize <= 0) {
+        segmentSize = 2;
+        while (segmentSize < AUTO_SEGMENT_SEC * sampleRate) {
+            segmentSize <<= 1;
+        }
+    }
+
+    plan.init(segmentSize);
+
+    hop = qMax(1, qRound(segmentSize * (1 - overlap)));
+    fill = 0;
+    segmentCount = 0;
+
+    window.resize(segmentSize);
+    double sumSq = 0;
+    for (int i = 0; i < segmentSize; ++i) {
+        window[i] = 0.5 * (1 - cos(2 * M_PI * i / segmentSize));
+        sumSq += window[i] * window[i];
+    }
+    psdNorm = 1. / (sampleRate * sumSq);
+
+    segment.resize(segmentSize);
+    fftBuf.resize(segmentSize);
+
+    const int nBins = segmentSize / 2 + 1;
+    psdRing.fill(0, averagedSegments * nBins);
+    psdSum.fill(0, nBins);
+    psd.fill(0, nBins);
+    segmentPSD.fill(0, nBins);
+    ringPos = 0;
+    ringCount = 0;
+
+    // bins of each band; a band narrower than the resolution gets the bin closest to its center
+    const double df = getFrequencyResolution();
+    bandBins.clear();
+    for (const Band &b : bands) {
+        int kMin = qMax(0, qCeil(b.first / df));
+        int kMax = qMin(nBins - 1, qFloor(b.second / df));
+        if (kMin > kMax) {
+            kMin = kMax = qBound(0, qRound((b.first + b.second) / 2 / df), nBins - 1);
+        }
+        bandBins.append({kMin, kMax});
+    }
+
+    bandPowerTimes.clear();
+    bandPowers.clear();
+}
+
+/**
+ * @brief Feed a block of samples.
+ * @param in
+ * @param n
+ * @return Number of segments completed within this block
+ */
+
+int SpectrumAnalyzer::process(const double *in, size_t n)
+{
+    int completed = 0;
+    while (n > 0) {
+        size_t count = qMin<size_t>(n, segmentSize - fill);
+        memcpy(segment.data() + fill, in, count * sizeof(double));
+        fill += count;
+        in += count;
+        n -= count;
+
+        if (fill == segmentSize) {
+            processSegment();
+            completed++;
+
+            // keep the overlapping part for the next segment
+            const int keep = segmentSize - hop;
+            memmove(segment.data(), segment.data() + hop, keep * sizeof(double));
+            fill = keep;
+        }
+    }
+    return completed;
+}
+
+void SpectrumAnalyzer::processSegment()
+{
+    const int nBins = segmentSize / 2 + 1;
+
+    // remove the mean so that DC leakage does not hide low frequency bands
+    double mean = 0;
+    for (int i = 0; i < segmentSize; ++i) {
+        mean += segment.at(i);
+    }
+    mean /= segmentSize;
+
+    std::complex<double> *c = fftBuf.data();
+    for (int i = 0; i < segmentSize; ++i) {
+        c[i] = std::complex<double>((segment.at(i) - mean) * window.at(i), 0);
+    }
+    plan.transform(c);
+
+    double *ringSlot = psdRing.data() + ringPos * nBins;
+    for (int k = 0; k < nBins; ++k) {
+        double p = std::norm(c[k]) * psdNorm;
+        if (k != 0 && k != segmentSize / 2) {
+            p *= 2;  // one-sided
+        }
+        segmentPSD[k] = p;
+        psdSum[k] += p - ringSlot[k];
+        ringSlot[k] = p;
+    }
+
+    ringPos = (ringPos + 1) % averagedSegments;
+    ringCount = qMin(ringCount + 1, averagedSegments);
+    for (int k = 0; k < nBins; ++k) {
+        psd[k] = psdSum.at(k) / ringCount;
+    }
+
+    segmentCount++;
+    if (!bandPowerRecordingEnabled) {
+        return;
+    }
+
+    // band powers of this segment
+    const double df = getFrequencyResolution();
+    for (const QPair<int, int> &bins : bandBins) {
+        double power = 0;
+        for (int k = bins.first; k <= bins.second; ++k) {
+            power += segmentPSD.at(k);
+        }
+        bandPowers.append(power * df);
+    }
+    bandPowerTimes.append(((segmentCount - 1) * hop + segmentSize / 2.) / sampleRate);
+}
+
+/**
+ * @brief Welch estimate (V^2/Hz), one-sided, getSegmentSize() / 2 + 1 bins.
+ */
+
+const QVector<double> &SpectrumAnalyzer::getPSD() const
+{
+    return psd;
+}
+
+/**
+ * @brief PSD of the last completed segment (V^2/Hz).
+ */
+
+const QVector<double> &SpectrumAnalyzer::getSegmentPSD() const
+{
+    return segmentPSD;
+}
+
+double SpectrumAnalyzer::getFrequencyResolution() const
+{
+    return sampleRate / segmentSize;
+}
+
+/**
+ * @brief Time (s, from the first sample) of the center of each segment.
+ */
+
+const QVector<double> &SpectrumAnalyzer::getBandPowerTimes() const
+{
+    return bandPowerTimes;
+}
+
+/**
+ * @brief Band powers (V^2), getBands().size() consecutive values per segment.
+ */
+
+const QVector<double> &SpectrumAnalyzer::getBandPowers() const
+{
+    return bandPowers;
+}
+
+void SpectrumAnalyzer::reserveBandPowers(size_t nSegments)
+{
+    bandPowerTimes.reserve(nSegments);
+    bandPowers.reserve(nSegments * bands.size());
+}
+
+bool SpectrumAnalyzer::isBandPowerRecordingEnabled() const
+{
+    return bandPowerRecordingEnabled;
+}
+
+/**
+ * @brief Whether band powers are appended to the time series (e.g. disable in free run).
+ */
+
+void SpectrumAnalyzer::setBandPowerRecordingEnabled(bool value)
+{
+    bandPowerRecordingEnabled = value;
+}
+
+/**
+ * @brief Requested segment size, 0 for automatic.
+ */
+
+int SpectrumAnalyzer::getSegmentSize() const
+{
+    return requestedSegmentSize;
+}
+
+/**
+ * @brief Set the segment size (a power of 2), or 0 to derive it from the sample rate in init().
+ */
+
+void SpectrumAnalyzer::setSegmentSize(int value)
+{
+    requestedSegmentSize = value;
+}
+
+/**
+ * @brief Segment size in use since the last init().
+ */
+
+int SpectrumAnalyzer::getEffectiveSegmentSize() const
+{
+    return segmentSize;
+}
+
+double SpectrumAnalyzer::getOverlap() const
+{
+    return overlap;
+}
+
+void SpectrumAnalyzer::setOverlap(double value)
+{
+    overlap = qBound(0., value, 0.95);
+}
+
+int SpectrumAnalyzer::getAveragedSegments() const
+{
+    return averagedSegments;
+}
+
+void SpectrumAnalyzer::setAveragedSegments(int value)
+{
+    averagedSegments = qMax(1, value);
+}
+
+QVector<SpectrumAnalyzer::Band> SpectrumAnalyzer::getBands() const
+{
+    return bands;
+}
+
+QStringList SpectrumAnalyzer::getBandNames() const
+{
+    return bandNames;
+}
+
+void SpectrumAnalyzer::setBands(const QVector<SpectrumAnalyzer::Band> &value,
+                                const QStringList &names)
+{
+    bands = value;
+    bandNames = names;
+}
+
+/**
+ * @brief Names of the bands covered by fewer than MIN_BAND_BINS bins at the current resolution.
+ *
+ * Their power is poorly resolved (a single bin is shared with the neighbouring bands): increase
+ * the segment size. Valid after init().
+ */
+
+QStringList SpectrumAnalyzer::getUnresolvedBands() const
+{
+    QStringList ret;
+    for (int i = 0; i < bandBins.size(); ++i) {
+        if (bandBins.at(i).second - bandBins.at(i).first + 1 < MIN_BAND_BINS) {
+            ret << bandNames.value(i);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,117 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <complex>
+
+#include <QPair>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief Radix-2 complex FFT with precomputed twiddle factors and bit reversal table.
+ *
+ * The plan is computed once for a given size and then reused for every transform.
+ */
+
+class FFTPlan
+{
+public:
+    FFTPlan();
+
+    void init(int size);
+    int size() const;
+
+    void transform(std::complex<double> *data) const;
+
+private:
+    int n = 0;
+    QVector<int> bitReversed;
+    QVector<std::complex<double>> twiddles;
+};
+
+
+/**
+ * @brief Incremental Welch power spectral density estimate.
+ *
+ * Incoming samples are split in overlapping Hann windowed segments. The PSD of each segment is
+ * computed as soon as the segment is complete, and the Welch estimate is the running average of
+ * the last N segments. For each segment, the power in a set of frequency bands is also computed
+ * and stored as a time series.
+ *
+ * All working buffers are allocated in init(). The band power time series grows with the
+ * acquisition, use reserveBandPowers() when the total duration is known.
+ */
+
+class SpectrumAnalyzer
+{
+public:
+    typedef QPair<double, double> Band;
+
+    SpectrumAnalyzer();
+
+    void init(double sampleRate);
+    int process(const double *in, size_t n);
+
+    const QVector<double> &getPSD() const;
+    const QVector<double> &getSegmentPSD() const;
+    double getFrequencyResolution() const;
+
+    const QVector<double> &getBandPowerTimes() const;
+    const QVector<double> &getBandPowers() const;
+
+    int getSegmentSize() const;
+    void setSegmentSize(int value);
+    int getEffectiveSegmentSize() const;
+
+    double getOverlap() const;
+    void setOverlap(double value);
+
+    int getAveragedSegments() const;
+    void setAveragedSegments(int value);
+
+    QVector<Band> getBands() const;
+    QStringList getBandNames() const;
+    void setBands(const QVector<Band> &value, const QStringList &names);
+    QStringList getUnresolvedBands() const;
+
+    void reserveBandPowers(size_t nSegments);
+
+    bool isBandPowerRecordingEnabled() const;
+    void setBandPowerRecordingEnabled(bool value);
+
+private:
+    FFTPlan plan;
+    int requestedSegmentSize = 0;
+    int segmentSize = 0;
+    double overlap = 0.5;
+    int averagedSegments = 8;
+    double sampleRate = 0;
+
+    int hop = 0;
+    int fill = 0;
+    qint64 segmentCount = 0;
+    double psdNorm = 0;
+
+    QVector<double> window;
+    QVector<double> segment;
+    QVector<std::complex<double>> fftBuf;
+
+    // ring of the last averagedSegments segment PSDs and their running sum
+    QVector<double> psdRing;
+    QVector<double> psdSum;
+    QVector<double> psd;
+    QVector<double> segmentPSD;
+    int ringPos = 0;
+    int ringCount = 0;
+
+    bool bandPowerRecordingEnabled = true;
+    QVector<Band> bands;
+    QStringList bandNames;
+    QVector<QPair<int, int>> bandBins;  // first and last bin of each band, set by init()
+    QVector<double> bandPowerTimes;
+    QVector<double> bandPowers;  // bands.size() values per segment
+
+    void processSegment();
+};
+
+#endif // SPECTRUM_H
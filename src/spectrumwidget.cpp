@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cmath>
+
+#include <QHBoxLayout>
+#include <QtMath>
+
+#include <qwt_plot.h>
+#include <qwt_plot_curve.h>
+#include <qwt_plot_spectrogram.h>
+#include <qwt_matrix_raster_data.h>
+#include <qwt_color_map.h>
+#include <qwt_scale_engine.h>
+
+#include "spectrumwidget.h"
+
+#define MIN_LOG_PSD -20
+
+
+SpectrumWidget::SpectrumWidget(QWidget *parent) : QWidget(parent)
+{
+    setupUi();
+}
+
+void SpectrumWidget::setupUi()
+{
+    psdPlot = new QwtPlot();
+    psdPlot->setAxisScaleEngine(QwtPlot::yLeft, new QwtLogScaleEngine());
+    psdPlot->setAxisTitle(QwtPlot::xBottom, "Hz");
+    psdPlot->setAxisTitle(QwtPlot::yLeft, "V²/Hz");
+    psdPlot->setAxisScale(QwtPlot::xBottom, 0, maxFrequency);
+
+    psdCurve = new QwtPlotCurve();
+    psdCurve->setPen(Qt::blue);
+    psdCurve->attach(psdPlot);
+
+    spectrogramPlot = new QwtPlot();
+    spectrogramPlot->setAxisTitle(QwtPlot::xBottom, "Hz");
+    spectrogramPlot->enableAxis(QwtPlot::yLeft, false);
+
+    rasterData = new QwtMatrixRasterData();
+    spectrogram = new QwtPlotSpectrogram();
+    spectrogram->setColorMap(new QwtLinearColorMap(Qt::darkBlue, Qt::yellow));
+    spectrogram->setData(rasterData);  // takes ownership
+    spectrogram->attach(spectrogramPlot);
+
+    QHBoxLayout *layout = new QHBoxLayout();
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(psdPlot);
+    layout->addWidget(spectrogramPlot);
+    setLayout(layout);
+}
+
+/**
+ * @brief Update the PSD curve and append a row to the spectrogram.
+ * @param psd Averaged PSD, to be shown as a curve
+ * @param segmentPSD PSD of the last segment, appended to the spectrogram
+ * @param df Frequency resolution (Hz)
+ *
+ * Only bins up to getMaxFrequency() are shown.
+ */
+
+void SpectrumWidget::setSpectrum(const QVector<double> &psd, const QVector<double> &segmentPSD,
+                                 double df)
+{
+    const int n = qMin(psd.size(), qFloor(maxFrequency / df) + 1);
+    if (n <= 0) {
+        return;
+    }
+
+    if (n != nColumns || df != resolution) {
+        clear();
+        nColumns = n;
+        resolution = df;
+        freqs.resize(n);
+        for (int i = 0; i < n; ++i) {
+            freqs[i] = i * df;
+        }
+    }
+
+    psdValues = psd.mid(0, n);
+    psdCurve->setSamples(freqs, psdValues);
+    psdPlot->replot();
+
+    if (matrix.size() >= historyLength * nColumns) {
+        matrix.remove(0, nColumns);
+    }
+    for (int i = 0; i < n; ++i) {
+        matrix.append(qMax<double>(MIN_LOG_PSD, log10(segmentPSD.at(i))));
+    }
+
+    double min = *std::min_element(matrix.constBegin(), matrix.constEnd());
+    double max = *std::max_element(matrix.constBegin(), matrix.constEnd());
+
+    const int nRows = matrix.size() / nColumns;
+    rasterData->setValueMatrix(matrix, nColumns);
+    rasterData->setInterval(Qt::XAxis, QwtInterval(0, n * df));
+    rasterData->setInterval(Qt::YAxis, QwtInterval(0, nRows));
+    rasterData->setInterval(Qt::ZAxis, QwtInterval(min, qMax(max, min + 1e-3)));
+    spectrogramPlot->setAxisScale(QwtPlot::xBottom, 0, n * df);
+    spectrogramPlot->setAxisScale(QwtPlot::yLeft, 0, nRows);
+    spectrogramPlot->replot();
+}
+
+void SpectrumWidget::clear()
+{
+    matrix.clear();
+    psdValues.clear();
+    psdCurve->setSamples(QVector<double>(), QVector<double>());
+    rasterData->setValueMatrix(matrix, qMax(1, nColumns));
+    psdPlot->replot();
+    spectrogramPlot->replot();
+}
+
+double SpectrumWidget::getMaxFrequency() const
+{
+    return maxFrequency;
+}
+
+void SpectrumWidget::setMaxFrequency(double Hz)
+{
+    maxFrequency = Hz;
+    psdPlot->setAxisScale(QwtPlot::xBottom, 0, maxFrequency);
+}
+
+int SpectrumWidget::getHistoryLength() const
+{
+    return historyLength;
+}
+
+/**
+ * @brief Number of segments shown in the spectrogram
+ */
+
+void SpectrumWidget::setHistoryLength(int value)
+{
+    historyLength = qMax(1, value);
+}
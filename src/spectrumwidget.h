@@ -0,0 +1,50 @@
+#ifndef SPECTRUMWIDGET_H
+#define SPECTRUMWIDGET_H
+
+#include <QWidget>
+#include <QVector>
+
+class QwtPlot;
+class QwtPlotCurve;
+class QwtPlotSpectrogram;
+class QwtMatrixRasterData;
+
+/**
+ * @brief Live power spectral density and spectrogram (waterfall) of the electrode signal.
+ */
+
+class SpectrumWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit SpectrumWidget(QWidget *parent = nullptr);
+
+    double getMaxFrequency() const;
+    void setMaxFrequency(double Hz);
+
+    int getHistoryLength() const;
+    void setHistoryLength(int value);
+
+public slots:
+    void setSpectrum(const QVector<double> &psd, const QVector<double> &segmentPSD, double df);
+    void clear();
+
+private:
+    QwtPlot *psdPlot;
+    QwtPlot *spectrogramPlot;
+    QwtPlotCurve *psdCurve;
+    QwtPlotSpectrogram *spectrogram;
+    QwtMatrixRasterData *rasterData;
+
+    QVector<double> freqs;
+    QVector<double> psdValues;
+    QVector<double> matrix;  // one row per segment (most recent last), log10(PSD)
+    int nColumns = 0;
+    double resolution = 0;
+    int historyLength = 100;
+    double maxFrequency = 200;
+
+    void setupUi();
+};
+
+#endif // SPECTRUMWIDGET_H
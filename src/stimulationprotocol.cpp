@@ -0,0 +1,251 @@
+#include <stdexcept>
+
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QStringList>
+
+#include "stimulationprotocol.h"
+
+#define MIN_PULSE_TIME 100e-9  // s, high and low times (10 ticks of the 100 MHz timebase)
+
+
+StimulationProtocol::StimulationProtocol()
+{
+}
+
+/**
+ * @brief Open and validate a protocol file.
+ * @param fileName
+ *
+ * The whole file is parsed once to count the pulses and compute the duration, pulses are not
+ * kept in memory. Throws std::runtime_error on parse errors or inconsistent timings, in which case
+ * the protocol is cleared.
+ */
+
+void StimulationProtocol::load(const QString &fileName)
+{
+    clear();
+
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        throw std::runtime_error(
+                  QString("Cannot open protocol file " + fileName).toStdString());
+    }
+
+    QTextStream s(&f);
+    int line = 0;
+    quint64 n = 0;
+    double onset, width, end = 0, first = 0;
+    while (readPulse(s, &line, &onset, &width)) {
+        if (onset < 0 || width < MIN_PULSE_TIME) {
+            throw std::runtime_error(
+                      QString("%1:%2: invalid pulse").arg(fileName).arg(line).toStdString());
+        }
+        if (n > 0 && onset - end < MIN_PULSE_TIME) {
+            throw std::runtime_error(
+                      QString("%1:%2: pulse overlaps the previous one")
+                      .arg(fileName).arg(line).toStdString());
+        }
+        if (n == 0) {
+            first = onset;
+        }
+        end = onset + width;
+        n++;
+    }
+    if (n == 0) {
+        throw std::runtime_error(
+                  QString("No pulses in protocol file " + fileName).toStdString());
+    }
+
+    this->fileName = fileName;
+    lastModified = QFileInfo(fileName).lastModified();
+    nPulses = n;
+    duration = end;
+    firstOnset = first;
+}
+
+void StimulationProtocol::clear()
+{
+    stream.setDevice(nullptr);
+    file.close();
+    fileName.clear();
+    lastModified = QDateTime();
+    nPulses = 0;
+    duration = 0;
+    firstOnset = 0;
+    readPulses = 0;
+}
+
+bool StimulationProtocol::isLoaded() const
+{
+    return nPulses > 0;
+}
+
+/**
+ * @brief Whether the file has been modified since it was loaded.
+ */
+
+bool StimulationProtocol::isOutdated() const
+{
+    return isLoaded() && QFileInfo(fileName).lastModified() != lastModified;
+}
+
+QString StimulationProtocol::getFileName() const
+{
+    return fileName;
+}
+
+quint64 StimulationProtocol::getNPulses() const
+{
+    return nPulses;
+}
+
+/**
+ * @brief End of the last pulse (s), relative to the start of the stimulation.
+ */
+
+double StimulationProtocol::getDuration() const
+{
+    return duration;
+}
+
+/**
+ * @brief Check that the protocol can be output after the given delay.
+ * @param startDelay Seconds from the start trigger to the start of the stimulation
+ *
+ * The first low time of the counter output (startDelay plus the first onset) must be at least
+ * MIN_PULSE_TIME, which a pulse at onset 0 without delay is not. Throws std::runtime_error
+ * otherwise.
+ */
+
+void StimulationProtocol::checkStartDelay(double startDelay) const
+{
+    if (isLoaded() && startDelay + firstOnset < MIN_PULSE_TIME) {
+        throw std::runtime_error(
+                  QString("%1: the first pulse starts %2 s after the start trigger, at least "
+                          "%3 s are needed: increase the stimulation delay or the first onset")
+                  .arg(fileName).arg(startDelay + firstOnset).arg(MIN_PULSE_TIME)
+                  .toStdString());
+    }
+}
+
+/**
+ * @brief Onsets of all pulses (s), relative to the start of the stimulation.
+ * @param widths If not null, filled with the width of each pulse (s)
+ *
+ * Reads the file again, independently of read().
+ */
+
+QVector<double> StimulationProtocol::onsets(QVector<double> *widths) const
+{
+    QVector<double> ret;
+    if (widths) {
+        widths->clear();
+    }
+    QFile f(fileName);
+    if (!isLoaded() || !f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return ret;
+    }
+    ret.reserve(nPulses);
+    QTextStream s(&f);
+    int line = 0;
+    double onset, width;
+    while (readPulse(s, &line, &onset, &width)) {
+        ret << onset;
+        if (widths) {
+            *widths << width;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Restart sequential reading from the first pulse.
+ * @param startDelay Seconds from the start trigger to the start of the stimulation
+ */
+
+void StimulationProtocol::rewind(double startDelay)
+{
+    stream.setDevice(nullptr);
+    file.close();
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        throw std::runtime_error(
+                  QString("Cannot open protocol file " + fileName).toStdString());
+    }
+    stream.setDevice(&file);
+    lineNumber = 0;
+    readPulses = 0;
+    lastEnd = -startDelay;
+}
+
+/**
+ * @brief Read the next pulses as counter output samples.
+ * @param maxPulses
+ * @param highTime Filled with the pulse widths
+ * @param lowTime Filled with the time from the end of the previous pulse (or from the start
+ * trigger, for the first pulse) to the onset of each pulse
+ * @return Number of pulses read
+ *
+ * On buffered implicit pulse trains low times are output before high times, see
+ * Tasks::createTasks().
+ */
+
+quint64 StimulationProtocol::read(quint64 maxPulses,
+                                  QVector<double> &highTime, QVector<double> &lowTime)
+{
+    const quint64 n = qMin(maxPulses, getRemainingPulses());
+    highTime.resize(n);
+    lowTime.resize(n);
+
+    double onset, width;
+    for (quint64 i = 0; i < n; ++i) {
+        if (!readPulse(stream, &lineNumber, &onset, &width)) {
+            throw std::runtime_error(
+                      QString("Protocol file %1 changed while reading").arg(fileName)
+                      .toStdString());
+        }
+        lowTime[i] = onset - lastEnd;
+        highTime[i] = width;
+        lastEnd = onset + width;
+    }
+    readPulses += n;
+    return n;
+}
+
+quint64 StimulationProtocol::getRemainingPulses() const
+{
+    return nPulses - readPulses;
+}
+
+/**
+ * @brief Parse the next pulse, skipping comments and empty lines.
+ * @return false at the end of the file
+ */
+
+bool StimulationProtocol::readPulse(QTextStream &stream, int *lineNumber,
+                                    double *onset, double *width)
+{
+    static const QRegularExpression sep("[\\s,]+");
+    QString line;
+    while (stream.readLineInto(&line)) {
+        (*lineNumber)++;
+        line = line.trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QStringList fields = line.split(sep, QString::SkipEmptyParts);
+        bool ok1 = false, ok2 = false;
+        if (fields.size() == 2) {
+            *onset = fields.at(0).toDouble(&ok1);
+            *width = fields.at(1).toDouble(&ok2);
+        }
+        if (!ok1 || !ok2) {
+            throw std::runtime_error(
+                      QString("Line %1: expected onset and width").arg(*lineNumber)
+                      .toStdString());
+        }
+        return true;
+    }
+    return false;
+}
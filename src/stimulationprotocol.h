@@ -0,0 +1,59 @@
+#ifndef STIMULATIONPROTOCOL_H
+#define STIMULATIONPROTOCOL_H
+
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+#include <QTextStream>
+#include <QVector>
+
+/**
+ * @brief Arbitrary stimulation pulse train read from a protocol file.
+ *
+ * Text file with one pulse per line: onset and width in seconds, separated by spaces, tabs or a
+ * comma. Onsets are relative to the start of the stimulation and must be increasing, pulses must
+ * not overlap. Empty lines and lines starting with # are ignored.
+ *
+ * The file is validated once by load(), then read sequentially by read() in chunks of counter
+ * output samples (high and low times), so that memory stays bounded however long the protocol.
+ */
+
+class StimulationProtocol
+{
+public:
+    StimulationProtocol();
+
+    void load(const QString &fileName);
+    void clear();
+    bool isLoaded() const;
+    bool isOutdated() const;
+
+    QString getFileName() const;
+    quint64 getNPulses() const;
+    double getDuration() const;
+    void checkStartDelay(double startDelay) const;
+
+    QVector<double> onsets(QVector<double> *widths = nullptr) const;
+
+    void rewind(double startDelay);
+    quint64 read(quint64 maxPulses, QVector<double> &highTime, QVector<double> &lowTime);
+    quint64 getRemainingPulses() const;
+
+private:
+    static bool readPulse(QTextStream &stream, int *lineNumber, double *onset, double *width);
+
+    QString fileName;
+    QDateTime lastModified;
+    quint64 nPulses = 0;
+    double duration = 0;
+    double firstOnset = 0;
+
+    // sequential reading
+    QFile file;
+    QTextStream stream;
+    int lineNumber = 0;
+    quint64 readPulses = 0;
+    double lastEnd = 0;
+};
+
+#endif // STIMULATIONPROTOCOL_H
@@ -0,0 +1,301 @@
+#include <cmath>
+#include <stdexcept>
+
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+
+#include "synctable.h"
+
+
+SyncTable::SyncTable()
+{
+    hostTimer.start();
+}
+
+/**
+ * @brief Clear clock points and events of all streams (stream timing is kept).
+ *
+ * Also restarts the host reference clock, see hostTime().
+ */
+
+void SyncTable::reset()
+{
+    QMutexLocker locker(&mutex);
+    for (Stream &s : streams) {
+        s.n = 0;
+        s.meanX = s.meanY = 0;
+        s.cxx = s.cxy = s.cyy = 0;
+    }
+    for (QVector<double> &e : events) {
+        e.clear();
+    }
+    hostTimer.restart();
+}
+
+/**
+ * @brief Set the mapping of a stream onto the common timebase.
+ * @param stream
+ * @param period Seconds between consecutive samples, in common time
+ * @param offset Common time of the first sample
+ *
+ * Any trial timing of the stream is cleared.
+ */
+
+void SyncTable::setStreamTiming(SyncTable::STREAM stream, double period, double offset)
+{
+    QMutexLocker locker(&mutex);
+    streams[stream].period = period;
+    streams[stream].offset = offset;
+    streams[stream].samplesPerTrial = 0;
+    streams[stream].trialPeriod = 0;
+}
+
+/**
+ * @brief Update the period of a stream, e.g. with the rate actually set by the driver, keeping its
+ * offset and trial timing.
+ */
+
+void SyncTable::setStreamPeriod(SyncTable::STREAM stream, double period)
+{
+    QMutexLocker locker(&mutex);
+    streams[stream].period = period;
+}
+
+/**
+ * @brief Clock the stream reports in addClockPoint(), CLOCK_DEVICE by default.
+ */
+
+void SyncTable::setStreamClock(SyncTable::STREAM stream, SyncTable::CLOCK clock)
+{
+    QMutexLocker locker(&mutex);
+    streams[stream].clock = clock;
+}
+
+SyncTable::CLOCK SyncTable::getStreamClock(SyncTable::STREAM stream) const
+{
+    QMutexLocker locker(&mutex);
+    return streams[stream].clock;
+}
+
+/**
+ * @brief Split a stream into trials.
+ * @param stream
+ * @param samplesPerTrial Number of samples acquired in each trial
+ * @param trialPeriod Seconds between the first samples of consecutive trials, in common time
+ *
+ * To be called after setStreamTiming().
+ */
+
+void SyncTable::setTrialTiming(SyncTable::STREAM stream, qint64 samplesPerTrial,
+                               double trialPeriod)
+{
+    QMutexLocker locker(&mutex);
+    streams[stream].samplesPerTrial = samplesPerTrial;
+    streams[stream].trialPeriod = trialPeriod;
+}
+
+double SyncTable::toCommonTime(SyncTable::STREAM stream, qint64 index) const
+{
+    QMutexLocker locker(&mutex);
+    return _toCommonTime(stream, index);
+}
+
+double SyncTable::_toCommonTime(SyncTable::STREAM stream, qint64 index) const
+{
+    const Stream &s = streams[stream];
+    if (s.samplesPerTrial > 0) {
+        return s.offset + (index / s.samplesPerTrial) * s.trialPeriod
+               + (index % s.samplesPerTrial) * s.period;
+    }
+    return s.offset + index * s.period;
+}
+
+/**
+ * @brief Index of the sample of the given stream that is closest to commonTime.
+ */
+
+qint64 SyncTable::toIndex(SyncTable::STREAM stream, double commonTime) const
+{
+    QMutexLocker locker(&mutex);
+    const Stream &s = streams[stream];
+    if (s.period <= 0) {
+        return 0;
+    }
+    if (s.samplesPerTrial > 0 && s.trialPeriod > 0) {
+        const double t = commonTime - s.offset;
+        const qint64 trial = qMax<qint64>(0, qint64(floor(t / s.trialPeriod)));
+        const qint64 i = qRound64((t - trial * s.trialPeriod) / s.period);
+        return trial * s.samplesPerTrial + qBound<qint64>(0, i, s.samplesPerTrial - 1);
+    }
+    return qRound64((commonTime - s.offset) / s.period);
+}
+
+/**
+ * @brief Report the time of a sample as measured by the stream's own clock.
+ * @param stream
+ * @param index Sample index
+ * @param clockTime Seconds, in the stream's clock (arbitrary origin)
+ *
+ * This is thread safe and cheap: it only updates a running regression. In trial mode, the
+ * regression is against the nominal index that the sample would have if the stream had not been
+ * interrupted between trials.
+ */
+
+void SyncTable::addClockPoint(SyncTable::STREAM stream, qint64 index, double clockTime)
+{
+    QMutexLocker locker(&mutex);
+    Stream &s = streams[stream];
+    double x = index;
+    if (s.samplesPerTrial > 0 && s.period > 0) {
+        x = (_toCommonTime(stream, index) - s.offset) / s.period;
+    }
+    const double y = clockTime;
+
+    s.n++;
+    const double dx = x - s.meanX;
+    const double dy = y - s.meanY;
+    s.meanX += dx / s.n;
+    s.meanY += dy / s.n;
+    s.cxx += dx * (x - s.meanX);
+    s.cxy += dx * (y - s.meanY);
+    s.cyy += dy * (y - s.meanY);
+}
+
+/**
+ * @brief Seconds elapsed since the last reset(), on the host monotonic clock.
+ *
+ * To be used as clock time by streams that have no device timestamps.
+ */
+
+double SyncTable::hostTime() const
+{
+    QMutexLocker locker(&mutex);  // restarted by reset()
+    return hostTimer.nsecsElapsed() * 1e-9;
+}
+
+SyncTable::ClockFit SyncTable::clockFit(SyncTable::STREAM stream) const
+{
+    QMutexLocker locker(&mutex);
+    return _clockFit(stream);
+}
+
+SyncTable::ClockFit SyncTable::_clockFit(SyncTable::STREAM stream) const
+{
+    const Stream &s = streams[stream];
+    ClockFit fit = {s.n, 0, 0, 0, 0};
+    if (s.n < 2 || s.cxx <= 0) {
+        return fit;
+    }
+
+    fit.slope = s.cxy / s.cxx;
+    fit.offset = s.meanY - fit.slope * s.meanX;
+    fit.rmsResidual = sqrt(qMax(0., s.cyy - s.cxy * fit.slope) / s.n);
+    if (s.period > 0 && s.clock == CLOCK_DEVICE) {
+        fit.driftPpm = (fit.slope / s.period - 1) * 1e6;
+    }
+    return fit;
+}
+
+void SyncTable::addEvent(SyncTable::EVENT event, double commonTime)
+{
+    QMutexLocker locker(&mutex);
+    events[event].append(commonTime);
+}
+
+QVector<double> SyncTable::getEvents(SyncTable::EVENT event) const
+{
+    QMutexLocker locker(&mutex);
+    return events[event];
+}
+
+/**
+ * @brief Write the sync table (yaml).
+ * @param fileName
+ *
+ * For each stream: common time of sample i is offset + i * period, or in trial mode
+ * offset + (i / samples_per_trial) * trial_period + (i % samples_per_trial) * period. The clock
+ * fit of each stream reports its own clock as clock_offset + i * clock_slope (with i the nominal
+ * index in trial mode, see addClockPoint()). Host clock streams only report the rms residual,
+ * i.e. the jitter of the host receive time.
+ */
+
+void SyncTable::save(const QString &fileName) const
+{
+    QFile outFile(fileName);
+    if (!outFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fileName).toStdString());
+    }
+
+    QMutexLocker locker(&mutex);
+
+    QTextStream out(&outFile);
+    out.setRealNumberPrecision(15);
+
+    out << "timebase: main_trigger\n";
+    out << "streams:\n";
+    for (int i = 0; i < N_STREAMS; ++i) {
+        const Stream &s = streams[i];
+        ClockFit fit = _clockFit(static_cast<STREAM>(i));
+        out << "  " << streamName(static_cast<STREAM>(i)) << ":\n";
+        out << "    offset: " << s.offset << "\n";
+        out << "    period: " << s.period << "\n";
+        if (s.samplesPerTrial > 0) {
+            out << "    samples_per_trial: " << s.samplesPerTrial << "\n";
+            out << "    trial_period: " << s.trialPeriod << "\n";
+        }
+        out << "    clock: " << (s.clock == CLOCK_HOST ? "host" : "device") << "\n";
+        out << "    clock_points: " << fit.n << "\n";
+        if (fit.n < 2) {
+            continue;
+        }
+        if (s.clock == CLOCK_HOST) {
+            out << "    rms_residual: " << fit.rmsResidual << "\n";
+            continue;
+        }
+        out << "    clock_offset: " << fit.offset << "\n";
+        out << "    clock_slope: " << fit.slope << "\n";
+        out << "    drift_ppm: " << fit.driftPpm << "\n";
+        out << "    rms_residual: " << fit.rmsResidual << "\n";
+    }
+
+    out << "events:\n";
+    for (int i = 0; i < N_EVENTS; ++i) {
+        QStringList l;
+        for (double t : events[i]) {
+            l << QString::number(t, 'g', 15);
+        }
+        out << "  " << eventName(static_cast<EVENT>(i)) << ": [" << l.join(", ") << "]\n";
+    }
+
+    outFile.close();
+}
+
+QString SyncTable::streamName(SyncTable::STREAM stream)
+{
+    switch (stream) {
+    case STREAM_ORCA:
+        return "orca";
+    case STREAM_ELECTRODE:
+        return "electrode";
+    case STREAM_BEHAVIOR:
+        return "behavior";
+    default:
+        return QString();
+    }
+}
+
+QString SyncTable::eventName(SyncTable::EVENT event)
+{
+    switch (event) {
+    case EVENT_STIMULATION:
+        return "stimulation";
+    case EVENT_AUX_STIMULATION:
+        return "aux_stimulation";
+    case EVENT_CLOSED_LOOP:
+        return "closed_loop";
+    default:
+        return QString();
+    }
+}
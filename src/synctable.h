@@ -0,0 +1,121 @@
+#ifndef SYNCTABLE_H
+#define SYNCTABLE_H
+
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+
+/**
+ * @brief The SyncTable class maps all acquired streams onto a common timebase.
+ *
+ * The common timebase is the NI clock, with t = 0 at the first main trigger pulse. Every stream
+ * is hardware locked to it (camera frames and behavior frames are triggered by the main trigger,
+ * electrode samples are clocked by the NI sample clock started on the main trigger): sample i is
+ * produced on an edge of the NI clock, whatever the clock of the device that acquires it, so its
+ * common time is offset + i * period exactly, with the period actually generated by the counter
+ * or sample clock (quantized to its timebase), not the requested one. Device clocks are not used
+ * to move samples: they only timestamp them, with their own drift and jitter.
+ *
+ * While acquiring, each stream also reports the time of its samples as measured by its own clock.
+ * For CLOCK_DEVICE streams (DCAM or Spinnaker timestamps), a running linear regression of those
+ * times against the sample index gives an online estimate of the clock drift of each device with
+ * respect to the NI clock, and the residuals reveal lost or late samples, which must then be
+ * accounted for in the indices (e.g. behavior frames are indexed by hardware frame ID).
+ * CLOCK_HOST streams (host receive time) only report the residuals, i.e. the jitter of the host
+ * polling them: their slope would measure the host, not the device.
+ *
+ * STREAM_BEHAVIOR is the first behavior camera only. Additional cameras share its main trigger,
+ * so their frame i is at the same common time, but their clocks are not tracked: their lost
+ * frames and device timestamps are only in their own frame logs (see FrameLog).
+ *
+ * Stimulation onsets are stored as events, already in common time. Closed-loop stimulation
+ * events are added while acquiring, at the electrode sample that triggered them.
+ *
+ * In trial mode, streams are acquired in trials of a fixed number of samples that start every
+ * trial period (see setTrialTiming()), and sample i belongs to trial i / samplesPerTrial.
+ */
+
+class SyncTable
+{
+public:
+    enum STREAM {
+        STREAM_ORCA,
+        STREAM_ELECTRODE,
+        STREAM_BEHAVIOR,
+
+        N_STREAMS,
+    };
+
+    enum CLOCK {
+        CLOCK_DEVICE,
+        CLOCK_HOST,
+    };
+
+    enum EVENT {
+        EVENT_STIMULATION,
+        EVENT_AUX_STIMULATION,
+        EVENT_CLOSED_LOOP,
+
+        N_EVENTS,
+    };
+
+    struct ClockFit {
+        qint64 n;
+        double offset;  // s, stream clock time at index 0
+        double slope;   // s per sample, in stream clock
+        double driftPpm;
+        double rmsResidual;  // s
+    };
+
+    SyncTable();
+
+    void reset();
+
+    void setStreamTiming(STREAM stream, double period, double offset = 0);
+    void setStreamPeriod(STREAM stream, double period);
+    void setStreamClock(STREAM stream, CLOCK clock);
+    CLOCK getStreamClock(STREAM stream) const;
+    void setTrialTiming(STREAM stream, qint64 samplesPerTrial, double trialPeriod);
+    double toCommonTime(STREAM stream, qint64 index) const;
+    qint64 toIndex(STREAM stream, double commonTime) const;
+
+    void addClockPoint(STREAM stream, qint64 index, double clockTime);
+    double hostTime() const;
+    ClockFit clockFit(STREAM stream) const;
+
+    void addEvent(EVENT event, double commonTime);
+    QVector<double> getEvents(EVENT event) const;
+
+    void save(const QString &fileName) const;
+
+    static QString streamName(STREAM stream);
+    static QString eventName(EVENT event);
+
+private:
+    struct Stream {
+        double period = 0;
+        double offset = 0;
+        qint64 samplesPerTrial = 0;  // 0 if not in trial mode
+        double trialPeriod = 0;
+        CLOCK clock = CLOCK_DEVICE;
+
+        // running regression of clock time vs index (centered sums)
+        qint64 n = 0;
+        double meanX = 0;
+        double meanY = 0;
+        double cxx = 0;
+        double cxy = 0;
+        double cyy = 0;
+    };
+
+    mutable QMutex mutex;
+    QElapsedTimer hostTimer;
+    Stream streams[N_STREAMS];
+    QVector<double> events[N_EVENTS];
+
+    ClockFit _clockFit(STREAM stream) const;
+    double _toCommonTime(STREAM stream, qint64 index) const;
+};
+
+#endif // SYNCTABLE_H
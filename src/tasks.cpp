@@ -1,15 +1,42 @@
+#include <stdexcept>
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QTimer>
+#include <QtMath>
+
 #include <qtlab/core/logmanager.h>
 
 #include "tasks.h"
 #include "optrode.h"
 #include "dds.h"
+#include "edgerecorder.h"
+
+#define STIMULATION_NSAMPLES 2  // pulses output by the plain (counter only) stimulation task
+#define PROTOCOL_BUFFER 4096  // counter output samples (pulses) in the stimulation buffer
+#define PROTOCOL_CHUNK 1024   // pulses per write while streaming
+#define PROTOCOL_INTERVALMSEC 100
+
+#define DDS_SAMP_CLOCK_RATE 100e3  // Hz, DDS writes of the AOD stimulation (without sequence)
 
-#define MHZ_PER_PIXEL 0.151
-#define MHZ_CENTRAL 95.0
-#define MAX_POWER 3546
+#define AO_BUFFER_SEC 2         // DAQ output buffer when streaming waveforms
+#define AO_BLOCK_SEC 0.1        // synthesized at a time
+#define AO_INTERVALMSEC 100
 
 static Logger *logger = logManager().getLogger("Tasks");
 
+/**
+ * @brief Pulses of ddsSampClock at each stimulation edge of the AOD stimulation (without
+ * sequence): half of the samples of the two setOSKI() writes, see Tasks::createTasks().
+ */
+
+static uInt64 ddsSampClockPulses()
+{
+    return DDS::bufferSizeOfWrites(2 * 2) / 2;
+}
+
 
 Tasks::Tasks(QObject *parent) : QObject(parent)
 {
@@ -17,9 +44,21 @@ Tasks::Tasks(QObject *parent) : QObject(parent)
     stimulation = new NITask(this);
     auxStimulation = new NITask(this);
     LED = new NITask(this);
+    LED2 = new NITask(this);
     elReadout = new NITask(this);
     ddsSampClock = new NITask(this);
+    trialGate = new NITask(this);
+    analogOut = new NITask(this);
     dds = new DDS(this);
+    edgeRecorder = new EdgeRecorder(this);
+
+    protocolTimer = new QTimer(this);
+    protocolTimer->setInterval(PROTOCOL_INTERVALMSEC);
+    connect(protocolTimer, &QTimer::timeout, this, &Tasks::streamProtocol);
+
+    analogOutTimer = new QTimer(this);
+    analogOutTimer->setInterval(AO_INTERVALMSEC);
+    connect(analogOutTimer, &QTimer::timeout, this, &Tasks::streamAnalogOutput);
 
     QStringList devList = NI::getSysDevNames();
     QStringListIterator devIt(devList);
@@ -33,13 +72,45 @@ Tasks::Tasks(QObject *parent) : QObject(parent)
 #ifndef DEMO_MODE
     dds->setUdclkPhysicalChannel(coList.at(2)); // same as stimulation
 #else
-    for (int i = 0; i < 4; ++i) {
+    for (int i = 0; i < 8; ++i) {
         coList << "";
     }
 #endif
 }
 
+/**
+ * @brief Set up all tasks for the next acquisition.
+ *
+ * If task reuse is enabled and the configuration is unchanged since the last acquisition, the tasks
+ * of the last acquisition, which were only stopped, are kept as they are. The time spent is
+ * available as getLastSetupTime().
+ */
+
 void Tasks::init()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const QByteArray key = configurationKey();
+    lastSetupReused = isReusable() && key == cachedConfiguration;
+    if (lastSetupReused) {
+        // routes are undone by stopLEDs()
+        if (isLED2Routed()) {
+            NI::connectTerms(LED1Term, LED2Term, DAQmx_Val_InvertPolarity);
+        }
+    } else {
+        createTasks();
+        cachedConfiguration = key;
+    }
+    initialized = true;
+
+    lastSetupTime = timer.nsecsElapsed() * 1e-9;
+    logger->info(QString("NI tasks %1 in %2 ms")
+                 .arg(lastSetupReused ? "reused" : "created")
+                 .arg(lastSetupTime * 1e3, 0, 'f', 1));
+}
+
+void Tasks::createTasks()
 {
     clearTasks();
 
@@ -48,8 +119,70 @@ void Tasks::init()
     NI::tristateOutputTerm(LED1Term);
     NI::tristateOutputTerm(LED2Term);
 
+    if (trialModeEnabled && !freeRunEnabled && aodEnabled) {
+        throw std::runtime_error("Trial mode is not available with AOD stimulation");
+    }
+    if (isAODSequenceActive() && stimulationEnabled && !freeRunEnabled) {
+        for (const AODTarget &target : aodSequence.getTargets()) {
+            if (target.dwell < aodSequence.getMinDwell()) {
+                throw std::runtime_error(
+                          QString("AOD dwell times must be at least %1 us")
+                          .arg(aodSequence.getMinDwell() * 1e6, 0, 'f', 1).toStdString());
+            }
+        }
+    }
+    if (isClosedLoopActive()) {
+        if (!electrodeReadoutEnabled) {
+            throw std::runtime_error("Closed-loop stimulation needs the electrode readout");
+        }
+        if (closedLoopOutput == CLOSED_LOOP_STIMULATION && (aodEnabled || protocolEnabled)) {
+            throw std::runtime_error(
+                      "Closed-loop stimulation is not available with the AOD or a protocol");
+        }
+        if (closedLoopOutput == CLOSED_LOOP_AUX_STIMULATION && !auxStimulationEnabled) {
+            throw std::runtime_error("Closed-loop output on the disabled auxiliary stimulation");
+        }
+    }
+    if (protocolEnabled && stimulationEnabled && !freeRunEnabled) {
+        if (aodEnabled) {
+            throw std::runtime_error("Protocol stimulation is not available with the AOD");
+        }
+        if (!protocol.isLoaded()) {
+            throw std::runtime_error("No stimulation protocol loaded");
+        }
+        if (protocol.isOutdated()) {
+            protocol.load(protocol.getFileName());
+        }
+        protocol.checkStartDelay(stimulationDelay);
+    }
+
     QString co;
 
+    /* In trial mode, trialGate is a finite pulse train with one pulse per trial (high for the
+     * duration of a trial, low for the inter-trial interval). All the other tasks are configured
+     * once as retriggerable on its rising edges, so that trials follow each other on the NI clock
+     * without any software intervention. */
+    QByteArray trialTrig;
+    const bool trials = trialModeEnabled && !freeRunEnabled;
+    if (trials) {
+        if (interTrialInterval <= 0) {
+            throw std::runtime_error("Inter-trial interval must be positive");
+        }
+        co = coList.at(4);
+        trialGate->createTask("trialGate");
+        trialGate->createCOPulseChanTime(co,
+                                         nullptr,
+                                         DAQmx_Val_Seconds,
+                                         NITask::IdleState_Low,
+                                         0,
+                                         interTrialInterval,
+                                         totalDuration);
+        trialGate->cfgImplicitTiming(NITask::SampMode_FiniteSamps, nTrials);
+        trialTrig = trialGate->getCOPulseTerm(nullptr);
+        logger->info(QString("Trial mode: %1 trials, period %2s")
+                     .arg(nTrials).arg(getTrialPeriod()));
+    }
+
     // mainTrigger
     co = coList.at(0);
     mainTrigger->createTask("mainTrigger");
@@ -66,6 +199,10 @@ void Tasks::init()
         mainTrigger->cfgImplicitTiming(NITask::SampMode_FiniteSamps, getMainTrigNPulses());
         logger->info(QString("Total number of trigger pulses: %1").arg(getMainTrigNPulses()));
     }
+    if (trials) {
+        mainTrigger->cfgDigEdgeStartTrig(trialTrig, NITask::Edge_Rising);
+        mainTrigger->setStartTrigRetriggerable(true);
+    }
 
 
     // electrodeReadout
@@ -75,7 +212,11 @@ void Tasks::init()
                                    NITask::TermConf_RSE,
                                    -10., 10.,
                                    NITask::VoltUnits_Volts, nullptr);
-    elReadout->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(), NITask::Edge_Rising);
+    if (trials) {
+        elReadout->cfgDigEdgeStartTrig(trialTrig, NITask::Edge_Rising);
+    } else {
+        elReadout->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(), NITask::Edge_Rising);
+    }
 
     double sBuffer;  // how many seconds of buffering
     NITask::SampleMode sampleMode;
@@ -96,13 +237,20 @@ void Tasks::init()
             sampleMode,
             sBuffer * electrodeReadoutRate);
         elReadout->setReadReadAllAvailSamp(true);
+        if (trials) {
+            // one finite acquisition per trial
+            elReadout->setStartTrigRetriggerable(true);
+        }
     }
 
     if (freeRunEnabled) {
-        initialized = true;
         return;
     }
 
+    if (edgeRecorder->isEnabled()) {
+        edgeRecorder->createTasks(coList.at(5));
+    }
+
 
     // LED1
     double LEDPeriod = 1 / LEDFreq;
@@ -126,16 +274,64 @@ void Tasks::init()
                                initDelay, tempLEDFreq, 0.5);
     LED->resetCOPulseTerm(nullptr);
     QString ledTerm = LED1Term;
-    if (LED1Enabled && LED2Enabled) {
+    if (isLED2Routed()) {
         NI::connectTerms(LED1Term, LED2Term, DAQmx_Val_InvertPolarity); // LED2
-    } else if (LED2Enabled) {
+    } else if (LED2Enabled && !LED1Enabled) {
         ledTerm = LED2Term;
     }
 
     if (!ledTerm.isNull()) {
         LED->setCOPulseTerm(nullptr, ledTerm);
-        LED->cfgImplicitTiming(NITask::SampMode_ContSamps, 1000);
-        LED->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(), NITask::Edge_Rising);
+        if (trials) {
+            // only finite pulse trains can be retriggered
+            LED->cfgImplicitTiming(NITask::SampMode_FiniteSamps,
+                                   qMax<uInt64>(1, qRound64(tempLEDFreq * totalDuration)));
+            LED->cfgDigEdgeStartTrig(trialTrig, NITask::Edge_Rising);
+            LED->setStartTrigRetriggerable(true);
+        } else {
+            LED->cfgImplicitTiming(NITask::SampMode_ContSamps, 1000);
+            LED->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(), NITask::Edge_Rising);
+        }
+    }
+
+    /* The inverted route would keep LED2 on during the inter-trial intervals, while LED1 is idle
+     * low: in trial mode, LED2 is a retriggerable pulse train of its own, in the gaps of LED1. */
+    if (trials && LED1Enabled && LED2Enabled) {
+        co = coList.at(6);
+        LED2->createTask("LED2");
+        LED2->createCOPulseChanFreq(co,
+                                    nullptr,
+                                    NITask::FreqUnits_Hz,
+                                    NITask::IdleState_Low,
+                                    LED2InitialDelay(initDelay), tempLEDFreq, 0.5);
+        LED2->setCOPulseTerm(nullptr, LED2Term);
+        LED2->cfgImplicitTiming(NITask::SampMode_FiniteSamps,
+                                qMax<uInt64>(1, qRound64(tempLEDFreq * totalDuration)));
+        LED2->cfgDigEdgeStartTrig(trialTrig, NITask::Edge_Rising);
+        LED2->setStartTrigRetriggerable(true);
+    }
+
+    // analog outputs
+    if (isAnalogOutputEnabled(AO_LED) || isAnalogOutputEnabled(AO_STIMULATION)) {
+        analogOut->createTask("analogOut");
+        for (int i = 0; i < N_AO_OUTPUTS; ++i) {
+            if (analogOutEnabled[i]) {
+                analogOut->createAOVoltageChan(analogOutPhysChan[i], nullptr, -10., 10.,
+                                               NITask::VoltUnits_Volts, nullptr);
+            }
+        }
+        analogOut->cfgSampClkTiming(nullptr, analogOutRate, NITask::Edge_Rising,
+                                    NITask::SampMode_FiniteSamps,
+                                    totalDuration * analogOutRate);
+        if (trials) {
+            analogOut->cfgDigEdgeStartTrig(trialTrig, NITask::Edge_Rising);
+            analogOut->setStartTrigRetriggerable(true);
+        } else {
+            analogOut->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(),
+                                           NITask::Edge_Rising);
+        }
+        // a retriggered buffer cannot be streamed: in trial mode, write it all at once
+        setupAnalogOutput(!trials);
     }
 
     // stimulation
@@ -146,17 +342,21 @@ void Tasks::init()
         if (aodEnabled) {
             dds->initTask();
             dds->setWriteMode(DDS::WRITE_MODE_TO_NI_TASK);
-            // go to XY point
-            dds->setFrequency1(MHZ_CENTRAL - (point.y() - 256) * MHZ_PER_PIXEL,
-                               MHZ_CENTRAL - (point.x() - 256) * MHZ_PER_PIXEL);
-            dds->setOSKI(0, 0); // turn off
-            dds->udclkPulse();
-            dds->setOSKI(MAX_POWER, MAX_POWER); // turn on (at next UDCLK)
+            if (isAODSequenceActive()) {
+                aodSequence.writeFirstTarget(dds);
+            } else {
+                // go to XY point
+                const QPair<double, double> f = AODSequence::toFrequencies(point);
+                dds->setFrequency1(f.first, f.second);
+                dds->setOSKI(0, 0); // turn off
+                dds->udclkPulse();
+                dds->setOSKI(MAX_POWER, MAX_POWER); // turn on (at next UDCLK)
+            }
         }
 
         QString stimulationCounter = coList.at(2);
         stimulation->createTask("stimulation");
-        if (continuousStimulation) {
+        if (continuousStimulation && !protocolEnabled && !isAODSequenceActive()) {
             stimulation->createCOPulseChanFreq(
                 stimulationCounter,
                 nullptr,
@@ -177,7 +377,13 @@ void Tasks::init()
         }
 
         stimulation->setCOPulseTerm(nullptr, stimulationTerm);
-        stimulation->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(), NITask::Edge_Rising);
+        if (trials) {
+            stimulation->cfgDigEdgeStartTrig(trialTrig, NITask::Edge_Rising);
+            stimulation->setStartTrigRetriggerable(true);
+        } else {
+            stimulation->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(),
+                                             NITask::Edge_Rising);
+        }
 
 
         // auxiliary stimulation
@@ -200,11 +406,29 @@ void Tasks::init()
                 auxStimulationHighTime);
 
             auxStimulation->setCOPulseTerm(nullptr, auxStimulationTerm);
-            auxStimulation->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(), NITask::Edge_Rising);
+            if (trials) {
+                auxStimulation->cfgDigEdgeStartTrig(trialTrig, NITask::Edge_Rising);
+                auxStimulation->setStartTrigRetriggerable(true);
+            } else {
+                auxStimulation->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(),
+                                                    NITask::Edge_Rising);
+            }
             auxStimulation->cfgImplicitTiming(NITask::SampMode_FiniteSamps, auxStimulationNPulses);
         }
 
-        if (aodEnabled && !continuousStimulation) {
+        if (protocolEnabled) {
+            // a retriggered buffer cannot be streamed: in trial mode, write it all at once
+            setupProtocolStimulation(!trials);
+        } else if (isAODSequenceActive()) {
+            // one UDCLK per target, each edge makes the target loaded after the previous one
+            // effective
+            QVector<float64> highTime, lowTime;
+            aodSequence.udclkTimes(aodSequenceCycles(), stimulationDelay, highTime, lowTime);
+            const uInt64 NSamples = highTime.size();
+            stimulation->cfgImplicitTiming(NITask::SampMode_FiniteSamps, NSamples);
+            stimulation->writeCtrTime(NSamples, false, 10, NITask::DataLayout_GroupByChannel,
+                                      highTime.data(), lowTime.data(), nullptr);
+        } else if (aodEnabled && !continuousStimulation) {
             // for each stimulation cycle, we have to generate two short pulses (i.e. two UDCLK)
             const uInt64 NSamples = 2 * stimulationNPulses;
 
@@ -230,11 +454,42 @@ void Tasks::init()
             stimulation->writeCtrTime(NSamples, false, 10, NITask::DataLayout_GroupByChannel,
                                       highTime.data(), lowTime.data(), nullptr);
         } else {
-            stimulation->cfgImplicitTiming(NITask::SampMode_FiniteSamps, 2);
+            stimulation->cfgImplicitTiming(NITask::SampMode_FiniteSamps, STIMULATION_NSAMPLES);
+        }
+
+        if (isClosedLoopActive()) {
+            setupClosedLoopOutput();
         }
     }
 
-    if (aodEnabled) {
+    if (aodEnabled && isAODSequenceActive()) {
+        dds->initTask();
+
+        /* Same scheme as below, but each UDCLK edge makes ddsSampClock load the registers of the
+         * next target, precomputed once for the whole stimulation. */
+        dds->clearBuffer();
+        aodSequence.compile(dds, aodSequenceCycles());
+
+        ddsSampClock->createTask("ddsSampClock");
+        co = coList.at(7);
+        ddsSampClock->createCOPulseChanFreq(co, nullptr, NITask::FreqUnits_Hz,
+                                            NITask::IdleState_Low, 0,
+                                            AOD_SEQUENCE_SAMP_CLOCK_RATE, 0.5);
+        ddsSampClock->cfgImplicitTiming(NITask::SampMode_FiniteSamps,
+                                        aodSequence.samplesPerChunk());
+        ddsSampClock->cfgDigEdgeStartTrig(stimulationTerm.toLatin1(), NITask::Edge_Rising);
+        ddsSampClock->setStartTrigRetriggerable(true);
+        dds->getTask()->cfgSampClkTiming(ddsSampClock->getCOPulseTerm(nullptr),
+                                         AOD_SEQUENCE_SAMP_CLOCK_RATE,
+                                         NITask::Edge_Rising, NITask::SampMode_ContSamps,
+                                         dds->getBufferSize());
+        dds->writeBuffer();  // must come after sample clk timing configuration
+
+        dds->getTask()->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(),
+                                            NITask::Edge_Rising);
+        logger->info(QString("AOD sequence: %1 targets, %2 cycles")
+                     .arg(aodSequence.size()).arg(aodSequenceCycles()));
+    } else if (aodEnabled) {
         dds->initTask();
 
         // write all samples to buffer
@@ -255,14 +510,13 @@ void Tasks::init()
         ddsSampClock->createTask("ddsSampClock");
         co = coList.at(7); // need to use counter from another device
                            // (otherwise it conflicts with LED counter)
-        const int ddsSampClockRate = 100e3;
         ddsSampClock->createCOPulseChanFreq(
-            co, nullptr, NITask::FreqUnits_Hz, NITask::IdleState_Low, 0, ddsSampClockRate, 0.5);
-        ddsSampClock->cfgImplicitTiming(NITask::SampMode_FiniteSamps,
-                                        dds->getBufferSize() / 2);
+            co, nullptr, NITask::FreqUnits_Hz, NITask::IdleState_Low, 0, DDS_SAMP_CLOCK_RATE, 0.5);
+        ddsSampClock->cfgImplicitTiming(NITask::SampMode_FiniteSamps, ddsSampClockPulses());
         ddsSampClock->cfgDigEdgeStartTrig(stimulationTerm.toLatin1(), NITask::Edge_Rising);
         ddsSampClock->setStartTrigRetriggerable(true);
-        dds->getTask()->cfgSampClkTiming(ddsSampClock->getCOPulseTerm(nullptr), ddsSampClockRate,
+        dds->getTask()->cfgSampClkTiming(ddsSampClock->getCOPulseTerm(nullptr),
+                                         DDS_SAMP_CLOCK_RATE,
                                          NITask::Edge_Rising, NITask::SampMode_ContSamps,
                                          dds->getBufferSize());
         dds->writeBuffer();  // must come after sample clk timing configuration
@@ -270,8 +524,6 @@ void Tasks::init()
         dds->getTask()->cfgDigEdgeStartTrig(mainTrigTerm.toStdString().c_str(),
                                             NITask::Edge_Rising);
     }
-
-    initialized = true;
 }
 
 NITask *Tasks::electrodeReadout()
@@ -284,6 +536,21 @@ void Tasks::start()
     if (!initialized) {
         init();
     }
+    try {
+        startTasks();
+    } catch (std::runtime_error) {
+        // do not reuse tasks in an unknown state: the next start sets them up again
+        initialized = false;
+        protocolTimer->stop();
+        analogOutTimer->stop();
+        stopLEDs();  // undo the LED 2 route
+        clearTasks();
+        throw;
+    }
+}
+
+void Tasks::startTasks()
+{
     if (electrodeReadoutEnabled) {
         elReadout->startTask();
         emit elReadoutStarted();
@@ -292,11 +559,24 @@ void Tasks::start()
         if (LED1Enabled || LED2Enabled) {
             LED->startTask();
         }
+        if (LED2->isInitialized()) {
+            LED2->startTask();
+        }
         if (stimulationEnabled) {
-            stimulation->startTask();
-            if (auxStimulationEnabled) {
+            // the closed-loop output is started by fireClosedLoopOutput()
+            const bool closedLoop = isClosedLoopActive();
+            if (!closedLoop || closedLoopOutput != CLOSED_LOOP_STIMULATION) {
+                stimulation->startTask();
+            }
+            if (auxStimulationEnabled
+                && (!closedLoop || closedLoopOutput != CLOSED_LOOP_AUX_STIMULATION)) {
                 auxStimulation->startTask();
             }
+            if (closedLoop) {
+                QMutexLocker locker(&closedLoopMutex);
+                closedLoopFired.invalidate();
+                closedLoopArmed = true;
+            }
             if (aodEnabled) {
                 ddsSampClock->startTask();
                 dds->getTask()->startTask();
@@ -304,15 +584,44 @@ void Tasks::start()
         }
     }
 
+    if (protocolEnabled && protocol.getRemainingPulses() > 0) {
+        protocolTimer->start();
+    }
+    if (analogOut->isInitialized()) {
+        analogOut->startTask();
+        if (analogOutRemaining > 0) {
+            analogOutTimer->start();
+        }
+    }
+
+    if (edgeRecorder->isInitialized()) {
+        edgeRecorder->start();
+    }
+
     // last to be started because it will trigger the other tasks
     mainTrigger->startTask();
+    if (trialGate->isInitialized()) {
+        // in trial mode, mainTrigger itself waits for the trial gate
+        trialGate->startTask();
+    }
 }
 
 void Tasks::stop()
 {
     initialized = false;
+    {
+        QMutexLocker locker(&closedLoopMutex);
+        closedLoopArmed = false;
+    }
+    protocolTimer->stop();
+    analogOutTimer->stop();
     stopLEDs();
-    clearTasks();
+    edgeRecorder->stop();
+    if (isReusable()) {
+        stopTasks();
+    } else {
+        clearTasks();
+    }
 
     if (!freeRunEnabled && aodEnabled && stimulationEnabled) {
         dds->initTask();
@@ -324,15 +633,247 @@ void Tasks::stop()
 
 void Tasks::stopLEDs()
 {
+    if (LED2->isInitialized()) {
+        LED2->stopTask();
+    }
     if (!LED->isInitialized()) {
         return;
     }
     LED->stopTask();
-    if (LED1Enabled && LED2Enabled) {
+    if (isLED2Routed()) {
         NI::disconnectTerms(LED1Term, LED2Term);
     }
 }
 
+/**
+ * @brief Whether LED2 is LED1 inverted, through a route. Not in trial mode (see createTasks()).
+ */
+
+bool Tasks::isLED2Routed() const
+{
+    return !freeRunEnabled && !trialModeEnabled && LED1Enabled && LED2Enabled;
+}
+
+/**
+ * @brief Initial delay of the LED2 pulse train in trial mode: half a period from LED1, as early as
+ * possible.
+ */
+
+double Tasks::LED2InitialDelay(double LED1InitialDelay) const
+{
+    const double halfPeriod = 0.5 / LEDFreq;
+    return LED1InitialDelay >= halfPeriod ? LED1InitialDelay - halfPeriod
+                                          : LED1InitialDelay + halfPeriod;
+}
+
+/**
+ * @brief Nominal onset times of the stimulation pulses
+ * @return seconds since the first main trigger pulse
+ */
+
+QVector<double> Tasks::stimulationOnsets()
+{
+    return stimulationOnsets(totalDuration);
+}
+
+/**
+ * @brief Nominal onset times of the stimulation pulses for an acquisition of the given duration.
+ */
+
+QVector<double> Tasks::stimulationOnsets(double duration)
+{
+    QVector<double> onsets;
+    if (!stimulationEnabled) {
+        return onsets;
+    }
+    if (isClosedLoopActive() && closedLoopOutput == CLOSED_LOOP_STIMULATION) {
+        return onsets;  // not known in advance
+    }
+    if (protocolEnabled) {
+        onsets = protocol.onsets();
+        for (double &t : onsets) {
+            t += stimulationDelay;
+        }
+        return onsets;
+    }
+    if (isAODSequenceActive()) {
+        return aodSequence.onsets(aodSequenceCycles(), stimulationDelay);
+    }
+    if (aodEnabled) {
+        if (continuousStimulation) {
+            onsets << stimulationDelay;  // the second UDCLK turns the light off
+            return onsets;
+        }
+        // one pair of UDCLK pulses per stimulation cycle, the first one turns the light on
+        const double period = 1. / getStimulationFrequency();
+        onsets.reserve(stimulationNPulses);
+        for (uInt64 i = 0; i < stimulationNPulses; ++i) {
+            onsets << stimulationDelay + i * period;
+        }
+        return onsets;
+    }
+
+    // the counter outputs STIMULATION_NSAMPLES pulses, as configured by createTasks()
+    const double period = continuousStimulation ? 2 * stimulationDuration()
+                                                : 1. / getStimulationFrequency();
+    for (int i = 0; i < STIMULATION_NSAMPLES; ++i) {
+        const double t = stimulationDelay + i * period;
+        if (t >= duration) {
+            break;
+        }
+        onsets << t;
+    }
+    return onsets;
+}
+
+/**
+ * @brief Nominal onset times of the auxiliary stimulation pulses
+ * @return seconds since the first main trigger pulse
+ */
+
+QVector<double> Tasks::auxStimulationOnsets()
+{
+    QVector<double> onsets;
+    if (!stimulationEnabled || !auxStimulationEnabled) {
+        return onsets;
+    }
+    if (isClosedLoopActive() && closedLoopOutput == CLOSED_LOOP_AUX_STIMULATION) {
+        return onsets;  // not known in advance
+    }
+    double auxStimulationDuration = stimulationDelay + stimulationDuration() - auxStimulationDelay;
+    const double period = auxStimulationDuration / auxStimulationNPulses;
+    onsets.reserve(auxStimulationNPulses);
+    for (uInt64 i = 0; i < auxStimulationNPulses; ++i) {
+        onsets << auxStimulationDelay + i * period;
+    }
+    return onsets;
+}
+
+/**
+ * @brief Parameters of the output tasks as createTasks() would configure them, to compile a
+ * Timeline.
+ * @param duration Total duration (s), per trial in trial mode, see setTotalDuration()
+ * @param trialMode See setTrialModeEnabled()
+ * @param trials See setNTrials()
+ * @param ledDelay See setLEDdelay()
+ *
+ * The timing of the next acquisition is given explicitly instead of being set beforehand, so that
+ * compiling a timeline leaves the tasks untouched. Must be kept in sync with createTasks(). The
+ * camera exposure is not known here and is left to the caller.
+ */
+
+TimelineParams Tasks::getTimelineParams(double duration, bool trialMode, uInt64 trials,
+                                        double ledDelay)
+{
+    TimelineParams p;
+    p.totalDuration = duration;
+    p.trialMode = trialMode;
+    p.nTrials = p.trialMode ? trials : 1;
+    p.interTrialInterval = interTrialInterval;
+    p.trialGateCounter = coList.value(4);
+
+    p.mainTrigger.enabled = true;
+    p.mainTrigger.counter = coList.value(0);
+    p.mainTrigger.setFrequency(0, 2 * LEDFreq, 0.5, duration * getMainTrigFreq());
+
+    double initDelay, tempLEDFreq;
+    if (LED1Enabled && LED2Enabled) {
+        initDelay = 1 / LEDFreq - ledDelay;
+        tempLEDFreq = LEDFreq;
+    } else {
+        initDelay = 0;
+        tempLEDFreq = 1 / duration / 2; // always on
+    }
+    p.LED1Enabled = LED1Enabled;
+    p.LED2Enabled = LED2Enabled;
+    p.LED.enabled = LED1Enabled || LED2Enabled;
+    p.LED.counter = coList.value(1);
+    // continuous outside of trial mode, cut by the end of the acquisition
+    p.LED.setFrequency(initDelay, tempLEDFreq, 0.5,
+                       p.trialMode ? qMax<uInt64>(1, qRound64(tempLEDFreq * duration))
+                                   : qCeil(tempLEDFreq * duration) + 1);
+    if (p.trialMode && LED1Enabled && LED2Enabled) {
+        p.LED2.enabled = true;
+        p.LED2.counter = coList.value(6);
+        p.LED2.setFrequency(LED2InitialDelay(initDelay), tempLEDFreq, 0.5, p.LED.nPulses);
+    }
+
+    if (!stimulationEnabled) {
+        return p;
+    }
+
+    PulseTrain &s = p.stimulation;
+    s.enabled = true;
+    s.counter = coList.value(2);
+    if (protocolEnabled) {
+        QVector<double> widths;
+        const QVector<double> onsets = protocol.onsets(&widths);
+        double lastEnd = -stimulationDelay;
+        for (int i = 0; i < onsets.size(); ++i) {
+            s.bufferedLow << onsets.at(i) - lastEnd;
+            s.bufferedHigh << widths.at(i);
+            lastEnd = onsets.at(i) + widths.at(i);
+        }
+    } else if (isAODSequenceActive()) {
+        aodSequence.udclkTimes(aodSequenceCycles(), stimulationDelay,
+                               s.bufferedHigh, s.bufferedLow);
+    } else if (aodEnabled && !continuousStimulation) {
+        for (uInt64 i = 0; i < stimulationNPulses; ++i) {
+            s.bufferedLow << 0.9 * stimulationLowTime;
+            s.bufferedHigh << 0.1 * stimulationHighTime;
+            s.bufferedLow << 0.9 * stimulationHighTime;
+            s.bufferedHigh << 0.1 * stimulationLowTime;
+        }
+        if (!s.bufferedLow.isEmpty()) {
+            s.bufferedLow[0] = stimulationDelay;
+        }
+    } else if (continuousStimulation) {
+        s.setFrequency(stimulationDelay,
+                       aodEnabled ? 1 / stimulationDuration() : 1 / stimulationDuration() / 2,
+                       0.5, STIMULATION_NSAMPLES);
+    } else {
+        s.initialDelay = stimulationDelay;
+        s.lowTime = stimulationLowTime;
+        s.highTime = stimulationHighTime;
+        s.nPulses = STIMULATION_NSAMPLES;
+    }
+    p.nominalStimulationOnsets = stimulationOnsets(duration);
+
+    if (auxStimulationEnabled) {
+        PulseTrain &a = p.auxStimulation;
+        double auxStimulationDuration =
+            stimulationDelay + stimulationDuration() - auxStimulationDelay;
+        a.enabled = true;
+        a.counter = coList.value(3);
+        a.initialDelay = auxStimulationDelay;
+        a.highTime = auxStimulationHighTime;
+        a.lowTime = auxStimulationDuration / auxStimulationNPulses - auxStimulationHighTime;
+        a.nPulses = auxStimulationNPulses;
+    }
+
+    if (isClosedLoopActive()) {
+        // pulses are output on detected events only, the counter is still reserved
+        PulseTrain &c = closedLoopOutput == CLOSED_LOOP_STIMULATION ? s : p.auxStimulation;
+        c.nPulses = 0;
+        c.bufferedHigh.clear();
+        c.bufferedLow.clear();
+    }
+
+    if (aodEnabled) {
+        p.aodEnabled = true;
+        p.ddsUdclkCounter = coList.value(2);
+        p.ddsSampClock.enabled = true;
+        p.ddsSampClock.counter = coList.value(7);
+        if (isAODSequenceActive()) {
+            p.ddsSampClock.setFrequency(0, AOD_SEQUENCE_SAMP_CLOCK_RATE, 0.5,
+                                        aodSequence.samplesPerChunk());
+        } else {
+            p.ddsSampClock.setFrequency(0, DDS_SAMP_CLOCK_RATE, 0.5, ddsSampClockPulses());
+        }
+    }
+    return p;
+}
+
 QString Tasks::getAuxStimulationTerm() const
 {
     return auxStimulationTerm;
@@ -383,23 +924,544 @@ void Tasks::setContinuousStimulation(bool value)
     continuousStimulation = value;
 }
 
+bool Tasks::isStimulationProtocolEnabled() const
+{
+    return protocolEnabled;
+}
+
+/**
+ * @brief Play the pulse train of the loaded protocol instead of regular stimulation pulses.
+ *
+ * The stimulation duration is then the duration of the protocol, see loadStimulationProtocol().
+ */
+
+void Tasks::setStimulationProtocolEnabled(bool value)
+{
+    protocolEnabled = value;
+}
+
+/**
+ * @brief Load and validate a stimulation protocol file, see StimulationProtocol.
+ *
+ * Throws std::runtime_error if the file is not valid.
+ */
+
+void Tasks::loadStimulationProtocol(const QString &fileName)
+{
+    protocol.load(fileName);
+    logger->info(QString("Loaded stimulation protocol %1: %2 pulses, %3s")
+                 .arg(fileName).arg(protocol.getNPulses()).arg(protocol.getDuration()));
+}
+
+const StimulationProtocol *Tasks::getStimulationProtocol() const
+{
+    return &protocol;
+}
+
+/**
+ * @brief Configure the stimulation task as a buffered implicit pulse train playing the protocol.
+ * @param stream If true and the protocol does not fit in PROTOCOL_BUFFER samples, only the
+ * first samples are written now, the others are streamed while running (see streamProtocol()).
+ */
+
+void Tasks::setupProtocolStimulation(bool stream)
+{
+    const quint64 n = protocol.getNPulses();
+    stimulation->cfgImplicitTiming(NITask::SampMode_FiniteSamps, n);
+    protocol.rewind(stimulationDelay);
+
+    if (!stream || n <= PROTOCOL_BUFFER) {
+        writeProtocol(n);
+        return;
+    }
+
+    // the buffer is refilled while running, old samples must not be output again
+    stimulation->cfgOutputBuffer(PROTOCOL_BUFFER);
+    stimulation->setWriteRegenMode(DAQmx_Val_DoNotAllowRegen);
+    writeProtocol(PROTOCOL_BUFFER);
+    logger->info(QString("Streaming %1 protocol pulses").arg(n));
+}
+
+void Tasks::writeProtocol(quint64 nPulses)
+{
+    QVector<float64> highTime, lowTime;
+    while (nPulses > 0) {
+        quint64 n = protocol.read(qMin<quint64>(nPulses, PROTOCOL_CHUNK), highTime, lowTime);
+        if (n == 0) {
+            break;
+        }
+        stimulation->writeCtrTime(n, false, 10, NITask::DataLayout_GroupByChannel,
+                                  highTime.data(), lowTime.data(), nullptr);
+        nPulses -= n;
+    }
+}
+
+/**
+ * @brief Top up the stimulation buffer with the next protocol pulses, as space becomes available.
+ */
+
+void Tasks::streamProtocol()
+{
+    try {
+        quint64 space = stimulation->getWriteSpaceAvail();
+        quint64 n = qMin(space, protocol.getRemainingPulses());
+        if (n >= PROTOCOL_CHUNK || n == protocol.getRemainingPulses()) {
+            writeProtocol(n);
+        }
+    } catch (std::runtime_error e) {
+        logger->critical(QString("Protocol streaming stopped: %1").arg(e.what()));
+        protocolTimer->stop();
+        return;
+    }
+    if (protocol.getRemainingPulses() == 0) {
+        protocolTimer->stop();
+    }
+}
+
+bool Tasks::isAnalogOutputEnabled(Tasks::AO_OUTPUT output) const
+{
+    return analogOutEnabled[output];
+}
+
+/**
+ * @brief Play the waveform of the given output (see getWaveform()) on an analog output channel.
+ *
+ * Analog outputs are clocked at getAnalogOutputRate() from the start trigger of the acquisition.
+ * All enabled outputs must be on the same device.
+ */
+
+void Tasks::setAnalogOutputEnabled(Tasks::AO_OUTPUT output, bool value)
+{
+    analogOutEnabled[output] = value;
+}
+
+QString Tasks::getAnalogOutputPhysChan(Tasks::AO_OUTPUT output) const
+{
+    return analogOutPhysChan[output];
+}
+
+void Tasks::setAnalogOutputPhysChan(Tasks::AO_OUTPUT output, const QString &value)
+{
+    analogOutPhysChan[output] = value;
+}
+
+/**
+ * @brief Waveform of the given analog output.
+ *
+ * The stimulation waveform is only output during the stimulation, its window is set when the
+ * tasks are created.
+ */
+
+WaveformSynth *Tasks::getWaveform(Tasks::AO_OUTPUT output)
+{
+    return &waveforms[output];
+}
+
+double Tasks::getAnalogOutputRate() const
+{
+    return analogOutRate;
+}
+
+void Tasks::setAnalogOutputRate(double value)
+{
+    analogOutRate = value;
+}
+
+/**
+ * @brief Reset the waveforms and write the first samples to the analog output task.
+ * @param stream If true and the waveforms do not fit in AO_BUFFER_SEC, the remaining samples
+ * are synthesized and written while running (see streamAnalogOutput()).
+ */
+
+void Tasks::setupAnalogOutput(bool stream)
+{
+    for (int i = 0; i < N_AO_OUTPUTS; ++i) {
+        waveforms[i].reset(analogOutRate);
+    }
+    if (stimulationEnabled) {
+        waveforms[AO_STIMULATION].setWindow(stimulationDelay,
+                                            stimulationDelay + stimulationDuration());
+    } else {
+        waveforms[AO_STIMULATION].setWindow(0, 0);  // always 0 V
+    }
+
+    const quint64 n = totalDuration * analogOutRate;
+    const quint64 bufSize = AO_BUFFER_SEC * analogOutRate;
+    analogOutRemaining = n;
+
+    if (!stream || n <= bufSize) {
+        writeAnalogOutput(n);
+        return;
+    }
+
+    // the buffer is refilled while running, old samples must not be output again
+    analogOut->cfgOutputBuffer(bufSize);
+    analogOut->setWriteRegenMode(DAQmx_Val_DoNotAllowRegen);
+    writeAnalogOutput(bufSize);
+}
+
+/**
+ * @brief Synthesize and write the next samples of all enabled analog outputs.
+ *
+ * The last sample of the acquisition is forced to 0 V, which outputs hold after the task stops.
+ */
+
+void Tasks::writeAnalogOutput(quint64 nSamples)
+{
+    QVector<WaveformSynth *> enabled;
+    for (int i = 0; i < N_AO_OUTPUTS; ++i) {
+        if (analogOutEnabled[i]) {
+            enabled << &waveforms[i];
+        }
+    }
+
+    const quint64 blockSize = qMax<quint64>(1, AO_BLOCK_SEC * analogOutRate);
+    while (nSamples > 0 && analogOutRemaining > 0) {
+        const quint64 n = qMin(qMin(nSamples, blockSize), analogOutRemaining);
+        analogOutBuf.resize(n * enabled.size());
+        for (int c = 0; c < enabled.size(); ++c) {
+            float64 *chan = analogOutBuf.data() + c * n;
+            enabled.at(c)->generate(chan, n);
+            if (n == analogOutRemaining) {
+                chan[n - 1] = 0;
+            }
+        }
+        analogOut->writeAnalogF64(n, false, 10, NITask::DataLayout_GroupByChannel,
+                                  analogOutBuf.data(), nullptr);
+        nSamples -= n;
+        analogOutRemaining -= n;
+    }
+}
+
+/**
+ * @brief Top up the analog output buffer with newly synthesized samples.
+ */
+
+void Tasks::streamAnalogOutput()
+{
+    try {
+        quint64 space = analogOut->getWriteSpaceAvail();
+        quint64 n = qMin(space, analogOutRemaining);
+        if (n >= AO_BLOCK_SEC * analogOutRate || n == analogOutRemaining) {
+            writeAnalogOutput(n);
+        }
+    } catch (std::runtime_error e) {
+        logger->critical(QString("Analog output streaming stopped: %1").arg(e.what()));
+        analogOutTimer->stop();
+        return;
+    }
+    if (analogOutRemaining == 0) {
+        analogOutTimer->stop();
+    }
+}
+
+bool Tasks::isClosedLoopEnabled() const
+{
+    return closedLoopEnabled;
+}
+
+/**
+ * @brief Output stimulation pulses on events detected in the electrode signal.
+ *
+ * The selected output (see setClosedLoopOutput()) is no longer scheduled: on each event detected
+ * by ElReadoutWorker, it outputs getClosedLoopNPulses() pulses with the stimulation high and low
+ * times. Requires the electrode readout, not available with the AOD or a protocol.
+ */
+
+void Tasks::setClosedLoopEnabled(bool value)
+{
+    closedLoopEnabled = value;
+}
+
+/**
+ * @brief Whether closed-loop stimulation applies to the next acquisition.
+ */
+
+bool Tasks::isClosedLoopActive() const
+{
+    return closedLoopEnabled && stimulationEnabled && !freeRunEnabled;
+}
+
+Tasks::CLOSED_LOOP_OUTPUT Tasks::getClosedLoopOutput() const
+{
+    return closedLoopOutput;
+}
+
+void Tasks::setClosedLoopOutput(const CLOSED_LOOP_OUTPUT &value)
+{
+    closedLoopOutput = value;
+}
+
+uInt64 Tasks::getClosedLoopNPulses() const
+{
+    return closedLoopNPulses;
+}
+
+void Tasks::setClosedLoopNPulses(const uInt64 &value)
+{
+    closedLoopNPulses = value;
+}
+
+/**
+ * @brief Duration of the pulse train output on each closed-loop event (s).
+ */
+
+double Tasks::closedLoopTrainDuration() const
+{
+    return closedLoopNPulses * (stimulationHighTime + stimulationLowTime);
+}
+
+/**
+ * @brief Start the pre-armed closed-loop pulse train now.
+ * @return false if not armed or if the previous train is still running
+ *
+ * Thread safe, meant to be called from the electrode readout thread.
+ *
+ * The task is committed in advance, so only stopTask() and startTask() are left: two driver calls
+ * taking typically tens to a few hundreds of microseconds, longer on a loaded machine. They are
+ * made on the readout thread, which does not process the next block until they return, under
+ * closedLoopMutex, which is contended only by start() and stop(). Their duration is measured for
+ * every event (output latency in the closed-loop events file, see
+ * ElReadoutWorker::runClosedLoop()).
+ */
+
+bool Tasks::fireClosedLoopOutput()
+{
+    QMutexLocker locker(&closedLoopMutex);
+    if (!closedLoopArmed) {
+        return false;
+    }
+    if (closedLoopFired.isValid()
+        && closedLoopFired.nsecsElapsed() * 1e-9 < closedLoopTrainDuration()) {
+        return false;
+    }
+    NITask *task = closedLoopTask();
+    try {
+        // back to the committed state, then start: only the start command is left to execute
+        task->stopTask();
+        task->startTask();
+    } catch (std::runtime_error e) {
+        logger->warning(QString("Closed-loop output failed: %1").arg(e.what()));
+        return false;
+    }
+    closedLoopFired.start();
+    return true;
+}
+
+/**
+ * @brief Recorder of the actual edges of the output lines, see EdgeRecorder.
+ *
+ * When enabled, its tasks are created with the others, using the free counter of the second
+ * device, and it is started before the main trigger.
+ */
+
+EdgeRecorder *Tasks::getEdgeRecorder() const
+{
+    return edgeRecorder;
+}
+
+/**
+ * @brief Replace the scheduled output with a pre-armed, software started pulse train.
+ *
+ * The task has no start trigger and is committed here, so that the counter is reserved and
+ * programmed before the acquisition and fireClosedLoopOutput() only has to start it.
+ */
+
+void Tasks::setupClosedLoopOutput()
+{
+    NITask *task = closedLoopTask();
+    const bool stim = closedLoopOutput == CLOSED_LOOP_STIMULATION;
+    task->clearTask();
+    task->createTask(stim ? "stimulation" : "auxStimulation");
+    task->createCOPulseChanTime(coList.at(stim ? 2 : 3),
+                                nullptr,
+                                DAQmx_Val_Seconds,
+                                NITask::IdleState_Low,
+                                0,
+                                stimulationLowTime,
+                                stimulationHighTime);
+    task->setCOPulseTerm(nullptr, stim ? stimulationTerm : auxStimulationTerm);
+    task->cfgImplicitTiming(NITask::SampMode_FiniteSamps, closedLoopNPulses);
+    task->taskControl(DAQmx_Val_Task_Commit);
+    logger->info(QString("Closed-loop output on %1: %2 pulses per event")
+                 .arg(stim ? "stimulation" : "auxiliary stimulation").arg(closedLoopNPulses));
+}
+
+NITask *Tasks::closedLoopTask() const
+{
+    return closedLoopOutput == CLOSED_LOOP_STIMULATION ? stimulation : auxStimulation;
+}
+
 void Tasks::clearTasks()
 {
     QList<NITask *> taskList;
 
     taskList << mainTrigger
              << LED
+             << LED2
              << elReadout
              << stimulation
              << auxStimulation
              << dds->getTask()
-             << ddsSampClock;
+             << ddsSampClock
+             << trialGate
+             << analogOut;
 
     for (NITask *t : taskList) {
         if (t->isInitialized()) {
             t->clearTask();
         }
     }
+    edgeRecorder->clearTasks();
+    cachedConfiguration.clear();
+}
+
+/**
+ * @brief Stop all tasks, keeping their configuration for the next acquisition.
+ */
+
+void Tasks::stopTasks()
+{
+    QList<NITask *> taskList;
+
+    taskList << mainTrigger
+             << LED
+             << LED2
+             << elReadout
+             << stimulation
+             << auxStimulation
+             << trialGate
+             << analogOut;
+
+    for (NITask *t : taskList) {
+        if (t->isInitialized()) {
+            t->stopTask();
+        }
+    }
+}
+
+/**
+ * @brief All the parameters that tasks are created from.
+ */
+
+QByteArray Tasks::configurationKey() const
+{
+    QByteArray key;
+    QDataStream s(&key, QIODevice::WriteOnly);
+    s << freeRunEnabled << mainTrigTerm << LEDFreq << LEDdelay << totalDuration
+      << LED1Enabled << LED2Enabled << LED1Term << LED2Term
+      << electrodeReadoutEnabled << electrodeReadoutPhysChan << electrodeReadoutRate
+      << stimulationEnabled << continuousStimulation << stimulationTerm << stimulationDelay
+      << stimulationLowTime << stimulationHighTime << quint64(stimulationNPulses)
+      << auxStimulationEnabled << auxStimulationTerm << auxStimulationDelay
+      << auxStimulationHighTime << quint64(auxStimulationNPulses)
+      << aodEnabled << point
+      << trialModeEnabled << quint64(nTrials) << interTrialInterval
+      << protocolEnabled << protocol.getFileName()
+      << QFileInfo(protocol.getFileName()).lastModified()
+      << analogOutRate;
+    for (int i = 0; i < N_AO_OUTPUTS; ++i) {
+        const WaveformSynth &w = waveforms[i];
+        s << analogOutEnabled[i] << analogOutPhysChan[i] << int(w.getShape())
+          << w.getAmplitude() << w.getOffset() << w.getFrequency() << w.getDutyCycle()
+          << w.getEdgeTime();
+    }
+    return key;
+}
+
+/**
+ * @brief Whether tasks can be kept across acquisitions, see setTaskReuseEnabled().
+ */
+
+bool Tasks::isReusable() const
+{
+    return taskReuseEnabled && !aodEnabled && !(stimulationEnabled && protocolEnabled)
+           && !isAnalogOutputEnabled(AO_LED) && !isAnalogOutputEnabled(AO_STIMULATION)
+           && !isClosedLoopActive() && !edgeRecorder->isEnabled();
+}
+
+bool Tasks::isTrialModeEnabled() const
+{
+    return trialModeEnabled;
+}
+
+/**
+ * @brief Run getNTrials() acquisitions back to back, retriggered by the NI hardware.
+ *
+ * Each trial lasts the total duration set with setTotalDuration() and is followed by an
+ * inter-trial interval, see getTrialPeriod(). Not available with AOD stimulation.
+ */
+
+void Tasks::setTrialModeEnabled(bool value)
+{
+    trialModeEnabled = value;
+}
+
+uInt64 Tasks::getNTrials() const
+{
+    return nTrials;
+}
+
+void Tasks::setNTrials(const uInt64 &value)
+{
+    nTrials = value;
+}
+
+double Tasks::getInterTrialInterval() const
+{
+    return interTrialInterval;
+}
+
+void Tasks::setInterTrialInterval(double value)
+{
+    interTrialInterval = value;
+}
+
+/**
+ * @brief Time between the first main trigger pulses of two consecutive trials (s).
+ */
+
+double Tasks::getTrialPeriod() const
+{
+    return totalDuration + interTrialInterval;
+}
+
+bool Tasks::isTaskReuseEnabled() const
+{
+    return taskReuseEnabled;
+}
+
+/**
+ * @brief Keep tasks across acquisitions, recreating them only when their configuration changes.
+ *
+ * Not applied when the AOD is enabled, since the DDS is reprogrammed at every stop, nor with
+ * protocol stimulation or analog outputs, whose buffers are consumed while running.
+ */
+
+void Tasks::setTaskReuseEnabled(bool value)
+{
+    taskReuseEnabled = value;
+    if (!value) {
+        cachedConfiguration.clear();
+    }
+}
+
+/**
+ * @brief Time spent in the last init() (s).
+ */
+
+double Tasks::getLastSetupTime() const
+{
+    return lastSetupTime;
+}
+
+/**
+ * @brief Whether the last init() reused the tasks of the previous acquisition.
+ */
+
+bool Tasks::isLastSetupReused() const
+{
+    return lastSetupReused;
 }
 
 QPointF Tasks::getPoint() const
@@ -438,6 +1500,24 @@ void Tasks::setElectrodeReadoutEnabled(bool value)
     electrodeReadoutEnabled = value;
 }
 
+/**
+ * @brief Polynomial coefficients to convert raw ADC codes of the electrode channel to Volts
+ * @return c_0, ..., c_n such that Volts = sum_i c_i * code^i
+ *
+ * \note The electrode readout task must have been created, see init().
+ */
+
+QVector<double> Tasks::getElectrodeScalingCoeffs() const
+{
+    QVector<double> coeffs(4, 0.);
+#ifndef DEMO_MODE
+    elReadout->getAIDevScalingCoeff(electrodeReadoutPhysChan, coeffs.data(), coeffs.size());
+#else
+    coeffs[1] = 10. / 32768;
+#endif
+    return coeffs;
+}
+
 void Tasks::setLEDdelay(double value)
 {
     LEDdelay = value;
@@ -548,6 +1628,9 @@ void Tasks::setStimulationDuration(double s)
 
 double Tasks::stimulationDuration()
 {
+    if (protocolEnabled && protocol.isLoaded()) {
+        return protocol.getDuration();
+    }
     return stimulationNPulses / getStimulationFrequency();
 }
 
@@ -656,3 +1739,39 @@ bool Tasks::isAODEnabled() const
 {
     return aodEnabled;
 }
+
+bool Tasks::isAODSequenceEnabled() const
+{
+    return aodSequenceEnabled;
+}
+
+/**
+ * @brief With the AOD, hop between the targets of getAODSequence() instead of a single point.
+ *
+ * The sequence is repeated for the whole stimulation duration, replacing pulses and continuous
+ * stimulation.
+ */
+
+void Tasks::setAODSequenceEnabled(bool value)
+{
+    aodSequenceEnabled = value;
+}
+
+AODSequence *Tasks::getAODSequence()
+{
+    return &aodSequence;
+}
+
+bool Tasks::isAODSequenceActive() const
+{
+    return aodEnabled && aodSequenceEnabled && !aodSequence.isEmpty();
+}
+
+/**
+ * @brief Whole passes through the AOD sequence that fit in the stimulation duration (at least 1).
+ */
+
+int Tasks::aodSequenceCycles()
+{
+    return qMax(1, qFloor(stimulationDuration() / aodSequence.getPeriod()));
+}
@@ -2,16 +2,39 @@
 #define ELECTRODEREADOUT_H
 
 #include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QPointF>
+#include <QVector>
 
 #include <qtlab/hw/ni/nitask.h>
 
+#include "aodsequence.h"
+#include "stimulationprotocol.h"
+#include "timeline.h"
+#include "waveformsynth.h"
+
 class DDS;
+class EdgeRecorder;
+class QTimer;
 
 class Tasks : public QObject
 {
     Q_OBJECT
 public:
+    enum AO_OUTPUT {
+        AO_LED,
+        AO_STIMULATION,
+
+        N_AO_OUTPUTS,
+    };
+
+    enum CLOSED_LOOP_OUTPUT {
+        CLOSED_LOOP_STIMULATION,
+        CLOSED_LOOP_AUX_STIMULATION,
+    };
+
     explicit Tasks(QObject *parent = nullptr);
     void init();
 
@@ -82,6 +105,8 @@ public:
     bool getElectrodeReadoutEnabled() const;
     void setElectrodeReadoutEnabled(bool value);
 
+    QVector<double> getElectrodeScalingCoeffs() const;
+
     void ddsMasterReset();
 
     DDS *getDDS() const;
@@ -92,17 +117,67 @@ public:
     void setAODEnabled(bool enable);
     bool isAODEnabled() const;
 
+    bool isAODSequenceEnabled() const;
+    void setAODSequenceEnabled(bool value);
+    AODSequence *getAODSequence();
+
     bool getContinuousStimulation() const;
     void setContinuousStimulation(bool value);
 
+    bool isStimulationProtocolEnabled() const;
+    void setStimulationProtocolEnabled(bool value);
+    void loadStimulationProtocol(const QString &fileName);
+    const StimulationProtocol *getStimulationProtocol() const;
+
+    bool isAnalogOutputEnabled(AO_OUTPUT output) const;
+    void setAnalogOutputEnabled(AO_OUTPUT output, bool value);
+    QString getAnalogOutputPhysChan(AO_OUTPUT output) const;
+    void setAnalogOutputPhysChan(AO_OUTPUT output, const QString &value);
+    WaveformSynth *getWaveform(AO_OUTPUT output);
+    double getAnalogOutputRate() const;
+    void setAnalogOutputRate(double value);
+
+    bool isClosedLoopEnabled() const;
+    void setClosedLoopEnabled(bool value);
+    bool isClosedLoopActive() const;
+    CLOSED_LOOP_OUTPUT getClosedLoopOutput() const;
+    void setClosedLoopOutput(const CLOSED_LOOP_OUTPUT &value);
+    uInt64 getClosedLoopNPulses() const;
+    void setClosedLoopNPulses(const uInt64 &value);
+    double closedLoopTrainDuration() const;
+    bool fireClosedLoopOutput();
+
+    EdgeRecorder *getEdgeRecorder() const;
+
     void clearTasks();
 
+    bool isTaskReuseEnabled() const;
+    void setTaskReuseEnabled(bool value);
+    double getLastSetupTime() const;
+    bool isLastSetupReused() const;
+
+    bool isTrialModeEnabled() const;
+    void setTrialModeEnabled(bool value);
+
+    uInt64 getNTrials() const;
+    void setNTrials(const uInt64 &value);
+
+    double getInterTrialInterval() const;
+    void setInterTrialInterval(double value);
+
+    double getTrialPeriod() const;
+
     double getAuxStimulationDelay() const;
     void setAuxStimulationDelay(double value);
 
     uInt64 getAuxStimulationNPulses() const;
     void setAuxStimulationNPulses(const uInt64 &value);
 
+    QVector<double> stimulationOnsets();
+    QVector<double> auxStimulationOnsets();
+    TimelineParams getTimelineParams(double duration, bool trialMode, uInt64 trials,
+                                     double ledDelay);
+
     double getAuxStimulationHighTime() const;
     void setAuxStimulationHighTime(double value);
 
@@ -120,13 +195,36 @@ public slots:
     void stopLEDs();
 
 private:
+    QVector<double> stimulationOnsets(double duration);
+    void createTasks();
+    void startTasks();
+    void stopTasks();
+    bool isReusable() const;
+    QByteArray configurationKey() const;
+    void setupProtocolStimulation(bool stream);
+    void writeProtocol(quint64 nPulses);
+    void streamProtocol();
+    bool isAODSequenceActive() const;
+    int aodSequenceCycles();
+    void setupAnalogOutput(bool stream);
+    void writeAnalogOutput(quint64 nSamples);
+    void streamAnalogOutput();
+    void setupClosedLoopOutput();
+    NITask *closedLoopTask() const;
+    bool isLED2Routed() const;
+    double LED2InitialDelay(double LED1InitialDelay) const;
+
     NITask *mainTrigger;
     NITask *stimulation;
     NITask *auxStimulation;
     NITask *elReadout;
     NITask *LED;
+    NITask *LED2;  // trial mode with both LEDs only
     NITask *ddsSampClock;
+    NITask *trialGate;
+    NITask *analogOut;
     DDS *dds;
+    EdgeRecorder *edgeRecorder;
     QPointF point;
     QStringList coList;
 
@@ -136,6 +234,8 @@ private:
     bool LED1Enabled = true, LED2Enabled = true;
     bool electrodeReadoutEnabled = true;
     bool aodEnabled = false;
+    bool aodSequenceEnabled = false;
+    AODSequence aodSequence;
 
     QString stimulationTerm;
     QString auxStimulationTerm;
@@ -149,6 +249,24 @@ private:
     bool stimulationEnabled = true;
     bool auxStimulationEnabled = false;
     bool continuousStimulation = false;
+    bool protocolEnabled = false;
+    StimulationProtocol protocol;
+    QTimer *protocolTimer;
+
+    bool analogOutEnabled[N_AO_OUTPUTS] = {};
+    QString analogOutPhysChan[N_AO_OUTPUTS];
+    WaveformSynth waveforms[N_AO_OUTPUTS];
+    double analogOutRate = 10000;
+    quint64 analogOutRemaining = 0;
+    QVector<float64> analogOutBuf;
+    QTimer *analogOutTimer;
+
+    bool closedLoopEnabled = false;
+    CLOSED_LOOP_OUTPUT closedLoopOutput = CLOSED_LOOP_STIMULATION;
+    uInt64 closedLoopNPulses = 1;
+    bool closedLoopArmed = false;
+    QElapsedTimer closedLoopFired;
+    QMutex closedLoopMutex;  // fireClosedLoopOutput() is called from the electrode readout thread
 
     QString LED1Term, LED2Term;
 
@@ -157,8 +275,17 @@ private:
 
     double totalDuration = 10;
 
+    bool trialModeEnabled = false;
+    uInt64 nTrials = 2;
+    double interTrialInterval = 1;
+
     bool freeRunEnabled;
     bool initialized = false;
+
+    bool taskReuseEnabled = true;
+    QByteArray cachedConfiguration;
+    double lastSetupTime = 0;
+    bool lastSetupReused = false;
 };
 
 #endif // ELECTRODEREADOUT_H
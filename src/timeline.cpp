@@ -0,0 +1,524 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <QDataStream>
+#include <QFile>
+#include <QTextStream>
+#include <QtMath>
+
+#include "timeline.h"
+
+#define TIMELINE_MAGIC "OLTIMELN"
+#define TIMELINE_VERSION 1
+#define MIN_PULSE_TICKS 2      // shortest high or low time of a counter output
+#define MAX_LISTED_CONFLICTS 20
+
+
+/**
+ * @brief Set the times of a pulse train configured by frequency and duty cycle.
+ */
+
+void PulseTrain::setFrequency(double initialDelay, double freq, double duty, quint64 nPulses)
+{
+    this->initialDelay = initialDelay;
+    highTime = duty / freq;
+    lowTime = (1 - duty) / freq;
+    this->nPulses = nPulses;
+}
+
+
+Timeline::Timeline()
+{
+    std::fill(initialLevel, initialLevel + N_LINES, false);
+}
+
+/**
+ * @brief Compute the edges of all the lines and check them for conflicts.
+ */
+
+void Timeline::compile(const TimelineParams &p)
+{
+    edges.clear();
+    conflicts.clear();
+    std::fill(initialLevel, initialLevel + N_LINES, false);
+
+    trialMode = p.trialMode;
+    nTrials = p.trialMode ? qMax(1, p.nTrials) : 1;
+    trialTicks = toTicks(p.totalDuration);
+    trialPeriodTicks = p.trialMode ? toTicks(p.totalDuration + p.interTrialInterval)
+                                   : trialTicks;
+    endTick = (nTrials - 1) * trialPeriodTicks + trialTicks;
+
+    if (p.trialMode && p.interTrialInterval <= 0) {
+        addConflict(SEVERITY_ERROR, LINE_TRIAL_GATE, 0, "Inter-trial interval must be positive");
+    }
+    checkCounters(p);
+    checkTrain(LINE_MAIN_TRIGGER, p.mainTrigger);
+    checkTrain(p.LED1Enabled ? LINE_LED1 : LINE_LED2, p.LED);
+    checkTrain(LINE_LED2, p.LED2);
+    checkTrain(LINE_STIMULATION, p.stimulation);
+    checkTrain(LINE_AUX_STIMULATION, p.auxStimulation);
+    checkTrain(LINE_DDS_SAMPLES, p.ddsSampClock);
+    if (hasErrors()) {
+        return;  // times may be meaningless
+    }
+
+    const bool bothLEDs = p.LED1Enabled && p.LED2Enabled;
+    initialLevel[LINE_LED2] = bothLEDs && !p.LED2.enabled;
+
+    for (int t = 0; t < nTrials; ++t) {
+        const qint64 start = t * trialPeriodTicks;
+        if (p.trialMode) {
+            addPulse(LINE_TRIAL_GATE, start, start + trialTicks);
+        }
+        addTrain(LINE_MAIN_TRIGGER, p.mainTrigger, start);
+        if (bothLEDs) {
+            addTrain(LINE_LED1, p.LED, start);
+            if (p.LED2.enabled) {
+                addTrain(LINE_LED2, p.LED2, start);
+            } else {
+                addTrain(LINE_LED2, p.LED, start, true);
+            }
+        } else if (p.LED1Enabled || p.LED2Enabled) {
+            addTrain(p.LED1Enabled ? LINE_LED1 : LINE_LED2, p.LED, start);
+        }
+        addTrain(LINE_STIMULATION, p.stimulation, start);
+        if (p.aodEnabled) {
+            // stimulationTerm is the UDCLK of the DDS
+            addTrain(LINE_DDS_UDCLK, p.stimulation, start);
+        }
+        addTrain(LINE_AUX_STIMULATION, p.auxStimulation, start);
+    }
+
+    auto byTime = [](const Edge &a, const Edge &b) {
+        return a.tick < b.tick || (a.tick == b.tick && a.line < b.line);
+    };
+    std::sort(edges.begin(), edges.end(), byTime);
+
+    if (p.ddsSampClock.enabled) {
+        addDDSSampleClock(p);
+        std::sort(edges.begin(), edges.end(), byTime);
+    }
+    checkCameraReadout(p);
+
+    if (p.stimulation.enabled && !p.aodEnabled) {
+        const int n = std::count_if(edges.begin(), edges.end(), [ = ](const Edge &e) {
+            return e.line == LINE_STIMULATION && e.level && e.tick < trialPeriodTicks;
+        });
+        if (n != p.nominalStimulationOnsets.size()) {
+            addConflict(SEVERITY_WARNING, LINE_STIMULATION, 0,
+                        QString("%1 stimulation pulses are output per trial, %2 expected from "
+                                "the stimulation settings")
+                        .arg(n).arg(p.nominalStimulationOnsets.size()));
+        }
+    }
+}
+
+const QVector<Timeline::Edge> &Timeline::getEdges() const
+{
+    return edges;
+}
+
+const QVector<Timeline::Conflict> &Timeline::getConflicts() const
+{
+    return conflicts;
+}
+
+bool Timeline::hasErrors() const
+{
+    for (const Conflict &c : conflicts) {
+        if (c.severity == SEVERITY_ERROR) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Rising edges (s) of the given line.
+ */
+
+QVector<double> Timeline::risingEdges(Timeline::LINE line) const
+{
+    QVector<double> ret;
+    for (const Edge &e : edges) {
+        if (e.line == line && e.level) {
+            ret << e.tick * TIMELINE_TICK;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief End of the last trial (s).
+ */
+
+double Timeline::getDuration() const
+{
+    return endTick * TIMELINE_TICK;
+}
+
+QString Timeline::summary() const
+{
+    int errors = 0;
+    for (const Conflict &c : conflicts) {
+        errors += c.severity == SEVERITY_ERROR;
+    }
+    QStringList lines;
+    lines << QString("%1 edges, %2s, %3 errors, %4 warnings")
+          .arg(edges.size()).arg(getDuration()).arg(errors).arg(conflicts.size() - errors);
+    for (int i = 0; i < qMin(conflicts.size(), MAX_LISTED_CONFLICTS); ++i) {
+        const Conflict &c = conflicts.at(i);
+        QString s = QString("%1 %2 at %3s: %4")
+                    .arg(c.severity == SEVERITY_ERROR ? "Error:" : "Warning:")
+                    .arg(lineName(c.line))
+                    .arg(c.tick * TIMELINE_TICK, 0, 'f', 6)
+                    .arg(c.description);
+        if (c.count > 1) {
+            s += QString(" (%1 times)").arg(c.count);
+        }
+        lines << s;
+    }
+    if (conflicts.size() > MAX_LISTED_CONFLICTS) {
+        lines << QString("... %1 more").arg(conflicts.size() - MAX_LISTED_CONFLICTS);
+    }
+    return lines.join("\n");
+}
+
+void Timeline::saveBinary(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fileName).toStdString());
+    }
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+    stream.writeRawData(TIMELINE_MAGIC, 8);
+    stream << quint32(TIMELINE_VERSION);
+    stream << double(TIMELINE_TICK);
+    stream << quint32(N_LINES);
+    for (int i = 0; i < N_LINES; ++i) {
+        QByteArray name = lineName(static_cast<LINE>(i)).toLatin1();
+        stream << quint8(name.size());
+        stream.writeRawData(name.constData(), name.size());
+        stream << quint8(initialLevel[i]);
+    }
+    stream << quint64(edges.size());
+
+    QByteArray buf;
+    buf.reserve(edges.size() * 3);
+    qint64 last = 0;
+    for (const Edge &e : edges) {
+        quint64 delta = e.tick - last;
+        last = e.tick;
+        do {
+            quint8 b = delta & 0x7f;
+            delta >>= 7;
+            buf.append(char(delta ? b | 0x80 : b));
+        } while (delta);
+        buf.append(char(e.line << 1 | e.level));
+    }
+    stream.writeRawData(buf.constData(), buf.size());
+}
+
+/**
+ * @brief Save as Value Change Dump, to be inspected with a waveform viewer.
+ */
+
+void Timeline::saveVCD(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) {
+        throw std::runtime_error(
+                  QString("Cannot open output file " + fileName).toStdString());
+    }
+
+    QTextStream out(&file);
+    out << "$version OptroLab timeline $end\n";
+    out << "$timescale 10ns $end\n";
+    out << "$scope module optrolab $end\n";
+    for (int i = 0; i < N_LINES; ++i) {
+        out << "$var wire 1 " << char('!' + i) << " " << lineName(static_cast<LINE>(i))
+            << " $end\n";
+    }
+    out << "$upscope $end\n";
+    out << "$enddefinitions $end\n";
+    out << "#0\n$dumpvars\n";
+    for (int i = 0; i < N_LINES; ++i) {
+        out << (initialLevel[i] ? '1' : '0') << char('!' + i) << "\n";
+    }
+    out << "$end\n";
+
+    qint64 last = 0;
+    for (const Edge &e : edges) {
+        if (e.tick != last) {
+            out << "#" << e.tick << "\n";
+            last = e.tick;
+        }
+        out << (e.level ? '1' : '0') << char('!' + e.line) << "\n";
+    }
+}
+
+QString Timeline::lineName(Timeline::LINE line)
+{
+    switch (line) {
+    case LINE_MAIN_TRIGGER:
+        return "main_trigger";
+    case LINE_LED1:
+        return "led1";
+    case LINE_LED2:
+        return "led2";
+    case LINE_STIMULATION:
+        return "stimulation";
+    case LINE_AUX_STIMULATION:
+        return "aux_stimulation";
+    case LINE_DDS_UDCLK:
+        return "dds_udclk";
+    case LINE_DDS_SAMPLES:
+        return "dds_samples";
+    case LINE_TRIAL_GATE:
+        return "trial_gate";
+    default:
+        return "";
+    }
+}
+
+qint64 Timeline::toTicks(double s)
+{
+    return qRound64(s / TIMELINE_TICK);
+}
+
+/**
+ * @brief Add the pulses of a train started at the given tick.
+ *
+ * Pulses beyond the end of the acquisition are cut. Retriggerable tasks (trial mode) that are
+ * still running at the start of the next trial miss its trigger.
+ */
+
+void Timeline::addTrain(Timeline::LINE line, const PulseTrain &train, qint64 start,
+                        bool inverted)
+{
+    if (!train.enabled) {
+        return;
+    }
+
+    const bool continuous = line == LINE_MAIN_TRIGGER || line == LINE_LED1
+                            || line == LINE_LED2;
+    const qint64 limit = trialMode ? start + trialPeriodTicks : endTick;
+    quint64 cut = 0;
+
+    auto add = [&](qint64 rise, qint64 fall) {
+        if (rise >= limit || (trialMode && fall > limit)) {
+            cut++;
+            return;
+        }
+        if (fall > limit) {
+            fall = limit;
+            if (!continuous) {
+                cut++;
+            }
+        }
+        addPulse(line, rise, fall, inverted);
+    };
+
+    if (!train.bufferedHigh.isEmpty()) {
+        qint64 t = start;
+        for (int i = 0; i < train.bufferedHigh.size(); ++i) {
+            t += toTicks(train.bufferedLow.at(i));
+            const qint64 rise = t;
+            t += toTicks(train.bufferedHigh.at(i));
+            add(rise, t);
+        }
+    } else {
+        const qint64 high = toTicks(train.highTime);
+        const qint64 period = high + toTicks(train.lowTime);
+        qint64 rise = start + toTicks(train.initialDelay);
+        quint64 i = 0;
+        for (; i < train.nPulses && rise < limit; ++i, rise += period) {
+            add(rise, rise + high);
+        }
+        cut += train.nPulses - i;
+    }
+
+    if (cut == 0 || (continuous && !trialMode)) {
+        return;
+    }
+    if (trialMode) {
+        addConflict(SEVERITY_ERROR, line, start,
+                    "Still running at the start of the next trial, its trigger is missed");
+    } else {
+        addConflict(SEVERITY_WARNING, line, endTick,
+                    QString("%1 pulses cut by the end of the acquisition").arg(cut));
+    }
+}
+
+void Timeline::addPulse(Timeline::LINE line, qint64 rise, qint64 fall, bool inverted)
+{
+    edges.append({rise, quint8(line), !inverted});
+    edges.append({fall, quint8(line), inverted});
+}
+
+/**
+ * @brief Record a conflict, merging it with previous ones of the same kind.
+ */
+
+void Timeline::addConflict(Timeline::SEVERITY severity, Timeline::LINE line, qint64 tick,
+                           const QString &description)
+{
+    for (Conflict &c : conflicts) {
+        if (c.severity == severity && c.line == line && c.description == description) {
+            c.count++;
+            return;
+        }
+    }
+    conflicts.append({severity, line, tick, 1, description});
+}
+
+void Timeline::checkTrain(Timeline::LINE line, const PulseTrain &train)
+{
+    if (!train.enabled) {
+        return;
+    }
+    if (!train.bufferedHigh.isEmpty()) {
+        if (train.bufferedLow.size() != train.bufferedHigh.size()) {
+            addConflict(SEVERITY_ERROR, line, 0, "Inconsistent buffered pulse train");
+            return;
+        }
+        qint64 t = 0;
+        for (int i = 0; i < train.bufferedHigh.size(); ++i) {
+            const qint64 low = toTicks(train.bufferedLow.at(i));
+            const qint64 high = toTicks(train.bufferedHigh.at(i));
+            if (low < MIN_PULSE_TICKS || high < MIN_PULSE_TICKS) {
+                addConflict(SEVERITY_ERROR, line, t, "Pulse or gap shorter than 2 ticks");
+            }
+            t += low + high;
+        }
+        return;
+    }
+    if (train.initialDelay < 0) {
+        addConflict(SEVERITY_ERROR, line, 0, "Negative initial delay");
+    }
+    if (train.nPulses > 0 && (toTicks(train.highTime) < MIN_PULSE_TICKS
+                              || toTicks(train.lowTime) < MIN_PULSE_TICKS)) {
+        addConflict(SEVERITY_ERROR, line, toTicks(train.initialDelay),
+                    QString("Invalid pulse times (high %1s, low %2s)")
+                    .arg(train.highTime).arg(train.lowTime));
+    }
+}
+
+void Timeline::checkCounters(const TimelineParams &p)
+{
+    struct Use {
+        LINE line;
+        QString counter;
+    };
+    QVector<Use> uses;
+    if (p.trialMode) {
+        uses.append({LINE_TRIAL_GATE, p.trialGateCounter});
+    }
+    const PulseTrain *trains[] = {&p.mainTrigger, &p.LED, &p.LED2, &p.stimulation,
+                                  &p.auxStimulation, &p.ddsSampClock};
+    const LINE lines[] = {LINE_MAIN_TRIGGER, p.LED1Enabled ? LINE_LED1 : LINE_LED2, LINE_LED2,
+                          LINE_STIMULATION, LINE_AUX_STIMULATION, LINE_DDS_SAMPLES};
+    for (int i = 0; i < 6; ++i) {
+        if (trains[i]->enabled) {
+            uses.append({lines[i], trains[i]->counter});
+        }
+    }
+
+    for (int i = 0; i < uses.size(); ++i) {
+        for (int j = 0; j < i; ++j) {
+            if (!uses.at(i).counter.isEmpty() && uses.at(i).counter == uses.at(j).counter) {
+                addConflict(SEVERITY_ERROR, uses.at(i).line, 0,
+                            QString("Counter %1 is also used by %2")
+                            .arg(uses.at(i).counter).arg(lineName(uses.at(j).line)));
+            }
+        }
+    }
+
+    if (!p.aodEnabled || p.ddsUdclkCounter.isEmpty()) {
+        return;
+    }
+    for (const Use &u : uses) {
+        if (u.counter == p.ddsUdclkCounter) {
+            addConflict(SEVERITY_WARNING, LINE_DDS_UDCLK, 0,
+                        QString("Immediate UDCLK pulses use counter %1 of %2: they can only be "
+                                "output while its task is not reserved")
+                        .arg(u.counter).arg(lineName(u.line)));
+        }
+    }
+}
+
+/**
+ * @brief Flag stimulation edges between the end of an exposure and the next camera trigger.
+ */
+
+void Timeline::checkCameraReadout(const TimelineParams &p)
+{
+    if (p.cameraExposure <= 0 || !p.mainTrigger.enabled) {
+        return;
+    }
+
+    QVector<qint64> frames;
+    for (const Edge &e : edges) {
+        if (e.line == LINE_MAIN_TRIGGER && e.level) {
+            frames << e.tick;
+        }
+    }
+    const qint64 exposure = toTicks(p.cameraExposure);
+    const qint64 framePeriod = toTicks(p.mainTrigger.highTime + p.mainTrigger.lowTime);
+    if (exposure >= framePeriod) {
+        addConflict(SEVERITY_ERROR, LINE_MAIN_TRIGGER, 0,
+                    "Camera exposure longer than the frame period, triggers are missed");
+        return;
+    }
+
+    for (const Edge &e : edges) {
+        if (e.line != LINE_STIMULATION && e.line != LINE_AUX_STIMULATION) {
+            continue;
+        }
+        auto it = std::upper_bound(frames.constBegin(), frames.constEnd(), e.tick);
+        if (it == frames.constBegin()) {
+            continue;
+        }
+        const qint64 frame = *(it - 1);
+        const qint64 next = it == frames.constEnd() ? frame + framePeriod : *it;
+        if (e.tick >= frame + exposure && e.tick < qMin(next, frame + framePeriod)) {
+            addConflict(SEVERITY_WARNING, static_cast<LINE>(e.line), e.tick,
+                        "Edge during camera readout");
+        }
+    }
+}
+
+/**
+ * @brief One burst of the DDS sample clock for every rising edge of the UDCLK.
+ *
+ * A retriggerable counter ignores triggers while running: the corresponding DDS samples would be
+ * written one UDCLK late.
+ */
+
+void Timeline::addDDSSampleClock(const TimelineParams &p)
+{
+    const PulseTrain &c = p.ddsSampClock;
+    const qint64 burst = toTicks(c.initialDelay)
+                         + c.nPulses * (toTicks(c.highTime) + toTicks(c.lowTime));
+    qint64 busyUntil = std::numeric_limits<qint64>::min();
+    const int n = edges.size();
+    for (int i = 0; i < n; ++i) {
+        const Edge e = edges.at(i);
+        if (e.line != LINE_DDS_UDCLK || !e.level) {
+            continue;
+        }
+        if (e.tick < busyUntil) {
+            addConflict(SEVERITY_ERROR, LINE_DDS_SAMPLES, e.tick,
+                        "UDCLK while the DDS sample clock is still running");
+            continue;
+        }
+        addPulse(LINE_DDS_SAMPLES, e.tick, e.tick + burst);
+        busyUntil = e.tick + burst;
+    }
+}
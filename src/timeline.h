@@ -0,0 +1,153 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#define TIMELINE_TICK 10e-9  // s, 100 MHz counter timebase
+
+/**
+ * @brief Counter output as configured on the NI board.
+ *
+ * Implicit timing: after initialDelay, nPulses pulses of highTime separated by lowTime. Buffered
+ * implicit timing, when bufferedHigh is not empty: for each sample, lowTime then highTime (so that
+ * the first low time acts as initial delay).
+ */
+
+struct PulseTrain
+{
+    bool enabled = false;
+    QString counter;  // empty if unknown (demo mode): not checked for conflicts
+
+    double initialDelay = 0;
+    double lowTime = 0;
+    double highTime = 0;
+    quint64 nPulses = 0;
+
+    QVector<double> bufferedLow;
+    QVector<double> bufferedHigh;
+
+    void setFrequency(double initialDelay, double freq, double duty, quint64 nPulses);
+};
+
+/**
+ * @brief Acquisition parameters the timeline is compiled from, see Tasks::getTimelineParams().
+ *
+ * All times are in seconds from the first main trigger pulse (of each trial, in trial mode).
+ */
+
+struct TimelineParams
+{
+    double totalDuration = 0;  // per trial
+    int nTrials = 1;
+    bool trialMode = false;
+    double interTrialInterval = 0;
+    QString trialGateCounter;
+
+    PulseTrain mainTrigger;
+    double cameraExposure = 0;  // 0 to skip camera readout checks
+
+    PulseTrain LED;
+    bool LED1Enabled = false;
+    bool LED2Enabled = false;  // if both, LED2 is LED1 inverted...
+    PulseTrain LED2;           // ...unless it has its own train (trial mode)
+
+    PulseTrain stimulation;
+    QVector<double> nominalStimulationOnsets;
+    PulseTrain auxStimulation;
+
+    bool aodEnabled = false;
+    QString ddsUdclkCounter;    // immediate UDCLK pulses, outside of the acquisition
+    PulseTrain ddsSampClock;    // retriggered by every rising edge of the stimulation (UDCLK)
+};
+
+/**
+ * @brief Expected edges of every NI output line of an acquisition, compiled offline.
+ *
+ * The timeline is computed in integer ticks of the counter timebase from the same parameters the
+ * NI tasks are configured with, without any hardware, so that it can run on every parameter change
+ * and headless. Conflicts (shared counters, stimulation edges during camera readout, retriggers
+ * while a task is still running, outputs cut by the end of the acquisition...) are detected while
+ * compiling.
+ *
+ * The DDS sample clock line is compiled as one pulse per burst, high while the sample clock runs.
+ *
+ * Binary layout (little endian): magic "OLTIMELN", version (quint32), tick (double, s), number of
+ * lines (quint32), then for each line its name (quint8 length + Latin-1 characters) and initial
+ * level (quint8), number of edges (quint64), followed by the edges in time order: tick increment
+ * since the previous edge (unsigned LEB128) and line index << 1 | level (quint8).
+ */
+
+class Timeline
+{
+public:
+    enum LINE {
+        LINE_MAIN_TRIGGER,
+        LINE_LED1,
+        LINE_LED2,
+        LINE_STIMULATION,
+        LINE_AUX_STIMULATION,
+        LINE_DDS_UDCLK,
+        LINE_DDS_SAMPLES,
+        LINE_TRIAL_GATE,
+
+        N_LINES,
+    };
+
+    enum SEVERITY {
+        SEVERITY_WARNING,
+        SEVERITY_ERROR,
+    };
+
+    struct Edge {
+        qint64 tick;
+        quint8 line;
+        bool level;
+    };
+
+    struct Conflict {
+        SEVERITY severity;
+        LINE line;
+        qint64 tick;        // first occurrence
+        int count;          // occurrences
+        QString description;
+    };
+
+    Timeline();
+
+    void compile(const TimelineParams &params);
+
+    const QVector<Edge> &getEdges() const;
+    const QVector<Conflict> &getConflicts() const;
+    bool hasErrors() const;
+    QVector<double> risingEdges(LINE line) const;
+    double getDuration() const;
+    QString summary() const;
+
+    void saveBinary(const QString &fileName) const;
+    void saveVCD(const QString &fileName) const;
+
+    static QString lineName(LINE line);
+    static qint64 toTicks(double s);
+
+private:
+    void addTrain(LINE line, const PulseTrain &train, qint64 start, bool inverted = false);
+    void addPulse(LINE line, qint64 rise, qint64 fall, bool inverted = false);
+    void addConflict(SEVERITY severity, LINE line, qint64 tick, const QString &description);
+    void checkTrain(LINE line, const PulseTrain &train);
+    void checkCounters(const TimelineParams &p);
+    void checkCameraReadout(const TimelineParams &p);
+    void addDDSSampleClock(const TimelineParams &p);
+
+    QVector<Edge> edges;
+    QVector<Conflict> conflicts;
+    bool initialLevel[N_LINES];
+    qint64 endTick = 0;
+    qint64 trialTicks = 0;
+    qint64 trialPeriodTicks = 0;
+    int nTrials = 1;
+    bool trialMode = false;
+};
+
+#endif // TIMELINE_H
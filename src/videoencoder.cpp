@@ -0,0 +1,345 @@
+#include <QElapsedTimer>
+
+#include <qtlab/core/logmanager.h>
+
+#include "videoencoder.h"
+
+using namespace Spinnaker;
+
+static Logger *logger = logManager().getLogger("VideoEncoder");
+
+/**
+ * @brief Give a stream image back to the camera. Images created by the application (e.g. copies
+ * kept in a ring buffer) are simply dropped.
+ */
+
+static void release(ImagePtr img)
+{
+    if (img->IsInUse()) {
+        img->Release();
+    }
+}
+
+
+VideoEncoder::VideoEncoder(QObject *parent) : QThread(parent)
+{
+    video.SetMaximumFileSize(0);
+}
+
+VideoEncoder::~VideoEncoder()
+{
+    finish();
+}
+
+/**
+ * @brief Open the output file with the current codec settings, reset counters and start the
+ * encoding thread.
+ */
+
+void VideoEncoder::open(const QString &fileName, int width, int height)
+{
+    finish();
+
+    mutex.lock();
+    finishing = false;
+    encodedFrames = droppedFrames = pushedFrames = 0;
+    encodedFrameIndices.clear();
+    maxQueueDepth = 0;
+    queueDepthSum = 0;
+    encodeNsecs = 0;
+    mutex.unlock();
+
+    const std::string fname = fileName.toStdString();
+    switch (codec) {
+    case CODEC_RAW: {
+        Video::AVIOption option;
+        option.frameRate = static_cast<float>(frameRate);
+        option.width = static_cast<unsigned int>(width);
+        option.height = static_cast<unsigned int>(height);
+        video.Open(fname.c_str(), option);
+        break;
+    }
+    case CODEC_MJPEG: {
+        Video::MJPGOption option;
+        option.frameRate = static_cast<float>(frameRate);
+        option.quality = mjpegQuality;
+        option.width = static_cast<unsigned int>(width);
+        option.height = static_cast<unsigned int>(height);
+        video.Open(fname.c_str(), option);
+        break;
+    }
+    case CODEC_H264:
+    default: {
+        Video::H264Option option;
+        option.frameRate = static_cast<float>(frameRate);
+        option.bitrate = bitrate;
+        option.width = static_cast<unsigned int>(width);
+        option.height = static_cast<unsigned int>(height);
+        video.Open(fname.c_str(), option);
+        break;
+    }
+    }
+    start();
+}
+
+/**
+ * @brief Queue a frame for encoding.
+ * @param img Ownership is taken: stream images are released once encoded or dropped.
+ * @param frameIndex Index of the frame in the camera stream, reported by
+ * getEncodedFrameIndices() once the frame is in the video
+ * @return false if a frame has been dropped
+ */
+
+bool VideoEncoder::push(ImagePtr img, qint64 frameIndex)
+{
+    QMutexLocker locker(&mutex);
+    bool ok = true;
+
+    if (queue.size() >= queueCapacity) {
+        switch (dropPolicy) {
+        case DROP_NEWEST:
+            droppedFrames++;
+            release(img);
+            return false;
+        case DROP_OLDEST:
+            droppedFrames++;
+            release(queue.dequeue().img);
+            ok = false;
+            break;
+        case DROP_NONE:
+            while (queue.size() >= queueCapacity && !finishing) {
+                notFull.wait(&mutex);
+            }
+            break;
+        }
+    }
+
+    if (finishing) {
+        release(img);
+        return false;
+    }
+
+    queue.enqueue({img, frameIndex});
+    pushedFrames++;
+    maxQueueDepth = qMax(maxQueueDepth, queue.size());
+    queueDepthSum += queue.size();
+    notEmpty.wakeOne();
+
+    return ok;
+}
+
+/**
+ * @brief Encode the frames still queued, close the file and wait for the thread to exit.
+ */
+
+void VideoEncoder::finish()
+{
+    if (!isRunning()) {
+        return;
+    }
+
+    mutex.lock();
+    finishing = true;
+    notEmpty.wakeAll();
+    notFull.wakeAll();
+    mutex.unlock();
+
+    wait();
+}
+
+void VideoEncoder::run()
+{
+    while (true) {
+        mutex.lock();
+        while (queue.isEmpty() && !finishing) {
+            notEmpty.wait(&mutex);
+        }
+        if (queue.isEmpty()) {
+            mutex.unlock();
+            break;
+        }
+        QueuedFrame f = queue.dequeue();
+        notFull.wakeOne();
+        mutex.unlock();
+
+        bool ok = true;
+        QElapsedTimer timer;
+        timer.start();
+        try {
+            video.Append(f.img);
+        }
+        catch (Spinnaker::Exception e) {
+            logger->warning(e.what());
+            ok = false;
+        }
+        qint64 elapsed = timer.nsecsElapsed();
+        release(f.img);
+
+        mutex.lock();
+        encodeNsecs += elapsed;
+        if (ok) {
+            encodedFrames++;
+            encodedFrameIndices.append(f.frameIndex);
+        } else {
+            droppedFrames++;
+        }
+        mutex.unlock();
+    }
+
+    try {
+        video.Close();
+    }
+    catch (Spinnaker::Exception e) {
+        logger->warning(e.what());
+        emit error(e.what());
+    }
+}
+
+int VideoEncoder::getQueueCapacity() const
+{
+    return queueCapacity;
+}
+
+/**
+ * @brief Maximum number of frames waiting to be encoded. Has effect at the next open().
+ */
+
+void VideoEncoder::setQueueCapacity(int value)
+{
+    queueCapacity = qMax(1, value);
+}
+
+VideoEncoder::DROP_POLICY VideoEncoder::getDropPolicy() const
+{
+    return dropPolicy;
+}
+
+void VideoEncoder::setDropPolicy(const DROP_POLICY &value)
+{
+    dropPolicy = value;
+}
+
+/**
+ * @brief Number of camera stream buffers needed to keep the queue full without starving the
+ * camera: the queued frames, the frame being encoded and the frame being grabbed, plus some
+ * headroom for bursts.
+ */
+
+int VideoEncoder::requiredStreamBuffers() const
+{
+    return queueCapacity + 2 + 8;
+}
+
+size_t VideoEncoder::getEncodedFrames() const
+{
+    QMutexLocker locker(&mutex);
+    return encodedFrames;
+}
+
+/**
+ * @brief Frame index given to push() of each frame appended to the video, element i being video
+ * frame i.
+ *
+ * Frames dropped because of a full queue or a failed append are not listed, whatever the drop
+ * policy. Complete once finish() has returned.
+ */
+
+QVector<qint64> VideoEncoder::getEncodedFrameIndices() const
+{
+    QMutexLocker locker(&mutex);
+    return encodedFrameIndices;
+}
+
+size_t VideoEncoder::getDroppedFrames() const
+{
+    QMutexLocker locker(&mutex);
+    return droppedFrames;
+}
+
+int VideoEncoder::getMaxQueueDepth() const
+{
+    QMutexLocker locker(&mutex);
+    return maxQueueDepth;
+}
+
+double VideoEncoder::getMeanQueueDepth() const
+{
+    QMutexLocker locker(&mutex);
+    return pushedFrames ? queueDepthSum / pushedFrames : 0;
+}
+
+/**
+ * @brief Frames per second the encoder can sustain, measured on the time actually spent encoding.
+ */
+
+double VideoEncoder::getEncodeThroughput() const
+{
+    QMutexLocker locker(&mutex);
+    return encodeNsecs ? encodedFrames / (encodeNsecs * 1e-9) : 0;
+}
+
+VideoEncoder::CODEC VideoEncoder::getCodec() const
+{
+    return codec;
+}
+
+void VideoEncoder::setCodec(const CODEC &value)
+{
+    codec = value;
+}
+
+QString VideoEncoder::codecName(VideoEncoder::CODEC codec)
+{
+    switch (codec) {
+    case CODEC_H264:
+        return "H.264";
+    case CODEC_MJPEG:
+        return "MJPEG";
+    case CODEC_RAW:
+        return "Raw";
+    default:
+        return QString();
+    }
+}
+
+double VideoEncoder::getFrameRate() const
+{
+    return frameRate;
+}
+
+/**
+ * @brief Container frame rate (Hz), should match the camera trigger rate.
+ */
+
+void VideoEncoder::setFrameRate(double value)
+{
+    frameRate = value;
+}
+
+unsigned int VideoEncoder::getBitrate() const
+{
+    return bitrate;
+}
+
+/**
+ * @brief H.264 bitrate (bit/s).
+ */
+
+void VideoEncoder::setBitrate(unsigned int value)
+{
+    bitrate = value;
+}
+
+unsigned int VideoEncoder::getMJPEGQuality() const
+{
+    return mjpegQuality;
+}
+
+/**
+ * @brief MJPEG quality (0-100).
+ */
+
+void VideoEncoder::setMJPEGQuality(unsigned int value)
+{
+    mjpegQuality = qMin(100u, value);
+}
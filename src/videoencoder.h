@@ -0,0 +1,108 @@
+#ifndef VIDEOENCODER_H
+#define VIDEOENCODER_H
+
+#include <Spinnaker.h>
+#include <SpinVideo.h>
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+
+/**
+ * @brief Encodes behavior frames on its own thread.
+ *
+ * Frames are handed over through a bounded queue, so that a stalling encoder does not hold up the
+ * grab loop. Queued frames still own a camera stream buffer until they are encoded, hence the
+ * number of stream buffers must be at least the queue capacity (see requiredStreamBuffers()).
+ */
+
+class VideoEncoder : public QThread
+{
+    Q_OBJECT
+public:
+    enum DROP_POLICY {
+        DROP_NEWEST,  // discard the incoming frame when the queue is full
+        DROP_OLDEST,  // discard the oldest queued frame to make room
+        DROP_NONE,    // block the grab loop until there is room (camera buffers fill instead)
+    };
+
+    enum CODEC {
+        CODEC_H264,
+        CODEC_MJPEG,
+        CODEC_RAW,
+    };
+
+    explicit VideoEncoder(QObject *parent = nullptr);
+    virtual ~VideoEncoder();
+
+    void open(const QString &fileName, int width, int height);
+    bool push(Spinnaker::ImagePtr img, qint64 frameIndex = -1);
+    void finish();
+
+    int getQueueCapacity() const;
+    void setQueueCapacity(int value);
+
+    DROP_POLICY getDropPolicy() const;
+    void setDropPolicy(const DROP_POLICY &value);
+
+    int requiredStreamBuffers() const;
+
+    CODEC getCodec() const;
+    void setCodec(const CODEC &value);
+    static QString codecName(CODEC codec);
+
+    double getFrameRate() const;
+    void setFrameRate(double value);
+
+    unsigned int getBitrate() const;
+    void setBitrate(unsigned int value);
+
+    unsigned int getMJPEGQuality() const;
+    void setMJPEGQuality(unsigned int value);
+
+    size_t getEncodedFrames() const;
+    QVector<qint64> getEncodedFrameIndices() const;
+    size_t getDroppedFrames() const;
+    int getMaxQueueDepth() const;
+    double getMeanQueueDepth() const;
+    double getEncodeThroughput() const;
+
+signals:
+    void error(QString errMsg);
+
+protected:
+    void run();
+
+private:
+    struct QueuedFrame {
+        Spinnaker::ImagePtr img;
+        qint64 frameIndex;
+    };
+
+    Spinnaker::Video::SpinVideo video;
+
+    mutable QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+    QQueue<QueuedFrame> queue;
+    int queueCapacity = 64;
+    DROP_POLICY dropPolicy = DROP_NEWEST;
+    bool finishing = false;
+
+    CODEC codec = CODEC_H264;
+    double frameRate = 25;
+    unsigned int bitrate = 1000000;
+    unsigned int mjpegQuality = 75;
+
+    size_t encodedFrames = 0;
+    QVector<qint64> encodedFrameIndices;  // of the frames appended to the video, in video order
+    size_t droppedFrames = 0;
+    size_t pushedFrames = 0;
+    int maxQueueDepth = 0;
+    double queueDepthSum = 0;
+    qint64 encodeNsecs = 0;
+};
+
+#endif // VIDEOENCODER_H
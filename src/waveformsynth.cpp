@@ -0,0 +1,312 @@
+#include <cmath>
+
+#include <QtMath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "waveformsynth.h"
+
+#define MIN_EDGE_FRACTION 1e-9  // of the period, edges of SHAPE_PULSES
+
+
+/**
+ * @brief sin(x) for |x| <= pi / 2 (Taylor series up to x^11, error < 1e-7).
+ */
+
+static inline double sinPoly(double x)
+{
+    const double x2 = x * x;
+    return x * (1 + x2 * (-1. / 6 + x2 * (1. / 120 + x2 * (-1. / 5040
+                                    + x2 * (1. / 362880 + x2 * (-1. / 39916800))))));
+}
+
+struct ShapeParams {
+    WaveformSynth::SHAPE shape;
+    double duty;
+    double invEdge;  // 1 / edge time, in periods
+};
+
+/**
+ * @brief Unit shape in [0, 1] at phase u in [0, 1).
+ */
+
+static inline double unitShape(double u, const ShapeParams &p)
+{
+    switch (p.shape) {
+    case WaveformSynth::SHAPE_SINE: {
+        // 0.5 + 0.5 sin(2 pi u) = 0.5 - 0.5 sin(2 pi r), folded onto |2 pi r| <= pi / 2
+        const double r = u - 0.5;
+        double a = fabs(r);
+        a = qMin(a, 0.5 - a);
+        return 0.5 - 0.5 * sinPoly(2 * M_PI * (r < 0 ? -a : a));
+    }
+    case WaveformSynth::SHAPE_RAMP:
+        return u;
+    case WaveformSynth::SHAPE_TRIANGLE:
+        return 1 - fabs(2 * u - 1);
+    case WaveformSynth::SHAPE_PULSES: {
+        // smoothstep edges
+        const double rise = qBound(0., u * p.invEdge, 1.);
+        const double fall = qBound(0., (u - p.duty) * p.invEdge, 1.);
+        const double x = rise - fall;
+        return x * x * (3 - 2 * x);
+    }
+    case WaveformSynth::SHAPE_CONSTANT:
+    default:
+        return 1;
+    }
+}
+
+#ifdef HAVE_SSE2
+static inline __m128d abs_pd(__m128d x)
+{
+    return _mm_andnot_pd(_mm_set1_pd(-0.), x);
+}
+
+static inline __m128d clamp01_pd(__m128d x)
+{
+    return _mm_min_pd(_mm_max_pd(x, _mm_setzero_pd()), _mm_set1_pd(1));
+}
+
+static inline __m128d sinPoly_pd(__m128d x)
+{
+    const __m128d x2 = _mm_mul_pd(x, x);
+    __m128d y = _mm_set1_pd(-1. / 39916800);
+    y = _mm_add_pd(_mm_mul_pd(y, x2), _mm_set1_pd(1. / 362880));
+    y = _mm_add_pd(_mm_mul_pd(y, x2), _mm_set1_pd(-1. / 5040));
+    y = _mm_add_pd(_mm_mul_pd(y, x2), _mm_set1_pd(1. / 120));
+    y = _mm_add_pd(_mm_mul_pd(y, x2), _mm_set1_pd(-1. / 6));
+    y = _mm_add_pd(_mm_mul_pd(y, x2), _mm_set1_pd(1));
+    return _mm_mul_pd(y, x);
+}
+
+/**
+ * @brief Two lane version of unitShape().
+ */
+
+static inline __m128d unitShape_pd(__m128d u, const ShapeParams &p)
+{
+    const __m128d one = _mm_set1_pd(1);
+    const __m128d half = _mm_set1_pd(0.5);
+    switch (p.shape) {
+    case WaveformSynth::SHAPE_SINE: {
+        const __m128d r = _mm_sub_pd(u, half);
+        const __m128d sign = _mm_and_pd(r, _mm_set1_pd(-0.));
+        __m128d a = abs_pd(r);
+        a = _mm_min_pd(a, _mm_sub_pd(half, a));
+        const __m128d x = _mm_mul_pd(_mm_or_pd(a, sign), _mm_set1_pd(2 * M_PI));
+        return _mm_sub_pd(half, _mm_mul_pd(half, sinPoly_pd(x)));
+    }
+    case WaveformSynth::SHAPE_RAMP:
+        return u;
+    case WaveformSynth::SHAPE_TRIANGLE:
+        return _mm_sub_pd(one, abs_pd(_mm_sub_pd(_mm_add_pd(u, u), one)));
+    case WaveformSynth::SHAPE_PULSES: {
+        const __m128d invEdge = _mm_set1_pd(p.invEdge);
+        const __m128d rise = clamp01_pd(_mm_mul_pd(u, invEdge));
+        const __m128d fall = clamp01_pd(
+            _mm_mul_pd(_mm_sub_pd(u, _mm_set1_pd(p.duty)), invEdge));
+        const __m128d x = _mm_sub_pd(rise, fall);
+        const __m128d s = _mm_sub_pd(_mm_set1_pd(3), _mm_add_pd(x, x));
+        return _mm_mul_pd(_mm_mul_pd(x, x), s);
+    }
+    case WaveformSynth::SHAPE_CONSTANT:
+    default:
+        return one;
+    }
+}
+#endif
+
+
+WaveformSynth::WaveformSynth()
+{
+}
+
+/**
+ * @brief Restart the waveform from t = 0.
+ * @param sampleRate Hz
+ */
+
+void WaveformSynth::reset(double sampleRate)
+{
+    this->sampleRate = sampleRate;
+    sampleIndex = 0;
+}
+
+/**
+ * @brief Generate the next n samples (V).
+ *
+ * The phase of periodic shapes is 0 at the start of the window, or at t = 0 if there is no
+ * window.
+ */
+
+void WaveformSynth::generate(double *dest, size_t n)
+{
+    if (sampleRate <= 0) {
+        return;
+    }
+
+    size_t first = 0, last = n;
+    double t0 = 0;
+    if (windowEnd >= windowStart) {
+        const qint64 iStart = qCeil(windowStart * sampleRate) - sampleIndex;
+        const qint64 iEnd = qCeil(windowEnd * sampleRate) - sampleIndex;
+        first = qBound<qint64>(0, iStart, n);
+        last = qBound<qint64>(first, iEnd, n);
+        t0 = windowStart;
+    }
+
+    for (size_t i = 0; i < first; ++i) {
+        dest[i] = 0;
+    }
+    if (last > first) {
+        double phase = frequency * ((sampleIndex + first) / sampleRate - t0);
+        phase -= floor(phase);
+        shapeBlock(dest + first, last - first, phase);
+    }
+    for (size_t i = last; i < n; ++i) {
+        dest[i] = 0;
+    }
+
+    sampleIndex += n;
+}
+
+/**
+ * @brief dest[i] = offset + amplitude * s(phase + i * frequency / sampleRate)
+ * @param phase In [0, 1)
+ */
+
+void WaveformSynth::shapeBlock(double *dest, size_t n, double phase) const
+{
+    const double dphi = frequency / sampleRate;
+    ShapeParams p;
+    p.shape = shape;
+    p.duty = qBound(0., dutyCycle, 1.);
+    p.invEdge = 1. / qMax(edgeTime * frequency, MIN_EDGE_FRACTION);
+
+    size_t i = 0;
+#ifdef HAVE_SSE2
+    // phases stay well below 2^31 within a block: truncation is floor for positive values
+    const __m128d vPhase = _mm_set1_pd(phase);
+    const __m128d vDphi = _mm_set1_pd(dphi);
+    const __m128d vAmplitude = _mm_set1_pd(amplitude);
+    const __m128d vOffset = _mm_set1_pd(offset);
+    for (; i + 2 <= n; i += 2) {
+        const __m128d idx = _mm_set_pd(double(i + 1), double(i));
+        __m128d u = _mm_add_pd(vPhase, _mm_mul_pd(idx, vDphi));
+        u = _mm_sub_pd(u, _mm_cvtepi32_pd(_mm_cvttpd_epi32(u)));
+        const __m128d s = unitShape_pd(u, p);
+        _mm_storeu_pd(dest + i, _mm_add_pd(vOffset, _mm_mul_pd(vAmplitude, s)));
+    }
+#endif
+    for (; i < n; ++i) {
+        double u = phase + i * dphi;
+        u -= floor(u);
+        dest[i] = offset + amplitude * unitShape(u, p);
+    }
+}
+
+WaveformSynth::SHAPE WaveformSynth::getShape() const
+{
+    return shape;
+}
+
+void WaveformSynth::setShape(SHAPE value)
+{
+    shape = value;
+}
+
+double WaveformSynth::getAmplitude() const
+{
+    return amplitude;
+}
+
+/**
+ * @brief Peak to peak modulation (V).
+ */
+
+void WaveformSynth::setAmplitude(double V)
+{
+    amplitude = V;
+}
+
+double WaveformSynth::getOffset() const
+{
+    return offset;
+}
+
+void WaveformSynth::setOffset(double V)
+{
+    offset = V;
+}
+
+double WaveformSynth::getFrequency() const
+{
+    return frequency;
+}
+
+void WaveformSynth::setFrequency(double Hz)
+{
+    frequency = Hz;
+}
+
+double WaveformSynth::getDutyCycle() const
+{
+    return dutyCycle;
+}
+
+/**
+ * @brief Fraction of the period at high level (SHAPE_PULSES), edges included.
+ */
+
+void WaveformSynth::setDutyCycle(double value)
+{
+    dutyCycle = value;
+}
+
+double WaveformSynth::getEdgeTime() const
+{
+    return edgeTime;
+}
+
+/**
+ * @brief Rise and fall time of SHAPE_PULSES (s).
+ */
+
+void WaveformSynth::setEdgeTime(double s)
+{
+    edgeTime = s;
+}
+
+/**
+ * @brief Only output the waveform between start and end (s), 0 V elsewhere.
+ *
+ * No window if end < start.
+ */
+
+void WaveformSynth::setWindow(double start, double end)
+{
+    windowStart = start;
+    windowEnd = end;
+}
+
+QString WaveformSynth::shapeName(WaveformSynth::SHAPE shape)
+{
+    switch (shape) {
+    case SHAPE_CONSTANT:
+        return "constant";
+    case SHAPE_SINE:
+        return "sine";
+    case SHAPE_RAMP:
+        return "ramp";
+    case SHAPE_TRIANGLE:
+        return "triangle";
+    case SHAPE_PULSES:
+        return "pulses";
+    default:
+        return "";
+    }
+}
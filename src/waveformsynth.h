@@ -0,0 +1,75 @@
+#ifndef WAVEFORMSYNTH_H
+#define WAVEFORMSYNTH_H
+
+#include <QString>
+#include <QtGlobal>
+
+/**
+ * @brief Block synthesizer of periodic intensity waveforms for analog outputs.
+ *
+ * Output is offset + amplitude * s(t), with s a unit shape in [0, 1] (so that amplitude is the
+ * peak to peak modulation of an LED or laser driver). Outside of the window set with setWindow()
+ * the output is 0 V.
+ *
+ * Samples are generated in consecutive blocks by generate(), two samples at a time with SSE2. The
+ * phase of each block is computed from the absolute sample index, so that it does not drift
+ * however long the waveform.
+ */
+
+class WaveformSynth
+{
+public:
+    enum SHAPE {
+        SHAPE_CONSTANT,
+        SHAPE_SINE,
+        SHAPE_RAMP,
+        SHAPE_TRIANGLE,
+        SHAPE_PULSES,
+
+        N_SHAPES,
+    };
+
+    WaveformSynth();
+
+    void reset(double sampleRate);
+    void generate(double *dest, size_t n);
+
+    SHAPE getShape() const;
+    void setShape(SHAPE value);
+
+    double getAmplitude() const;
+    void setAmplitude(double V);
+
+    double getOffset() const;
+    void setOffset(double V);
+
+    double getFrequency() const;
+    void setFrequency(double Hz);
+
+    double getDutyCycle() const;
+    void setDutyCycle(double value);
+
+    double getEdgeTime() const;
+    void setEdgeTime(double s);
+
+    void setWindow(double start, double end);
+
+    static QString shapeName(SHAPE shape);
+
+private:
+    SHAPE shape = SHAPE_CONSTANT;
+    double amplitude = 5;
+    double offset = 0;
+    double frequency = 10;
+    double dutyCycle = 0.5;
+    double edgeTime = 1e-3;
+    double windowStart = 0;
+    double windowEnd = -1;  // no window if end < start
+
+    double sampleRate = 0;
+    qint64 sampleIndex = 0;
+
+    void shapeBlock(double *dest, size_t n, double phase) const;
+};
+
+#endif // WAVEFORMSYNTH_H